@@ -0,0 +1,893 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GLIBC__)
+#include <immintrin.h>
+#define BATCH_HAS_LIBMVEC
+#endif
+
+#include "batch_evaluate.h"
+#include "scalar_evaluate.h"
+
+/*
+ * A kernel applies one operator to a block: l = l op r for binary operators
+ * and l = op(l) for unary ones, which get r == l. It returns true if a
+ * domain check failed for any point of the block.
+ */
+template <class T>
+using batch_kernel = bool (*)(T *l, const T *r);
+
+/*
+ * Indexed by CompiledOpcode, the first four opcodes are not operators and
+ * are run by batch_run_block itself, as are the ones after CEQ_EXP.
+ */
+template <class T>
+struct BatchKernels {
+	batch_kernel<T> ops[CEQ_NUM_OPCODES];
+};
+
+enum BatchIsa {
+	BATCH_ISA_SCALAR,
+	BATCH_ISA_AVX2,
+	BATCH_ISA_AVX512,
+};
+
+const size_t BATCH_ALIGNMENT = 64;
+
+struct alignas(64) BatchWorker {
+	struct BatchScratch scratch;
+	enum EquationError err;
+	size_t err_ind;
+};
+
+template <class T>
+struct BatchJob {
+	const struct CompiledEquation *ceq;
+	const T *const *columns;
+	size_t n;
+	T *out;
+	struct BatchWorker *workers;
+};
+
+static enum BatchIsa batch_select_isa();
+template <class T>
+static const struct BatchKernels<T> *batch_kernels(enum BatchIsa isa);
+template <class T>
+static bool batch_run_block(const struct CompiledEquation *ceq,
+							const struct BatchKernels<T> *kernels,
+							const T *const *columns, size_t begin,
+							size_t count, T *scratch);
+template <class T>
+static void batch_parallel_task(void *job_ptr, size_t worker, size_t chunk);
+template <class T>
+static bool batch_powi(T *x, int32_t exp);
+template <class T>
+static void batch_horner(const double *coefs, uint32_t degree, T *x);
+template <class T>
+static void batch_estrin(const double *coefs, uint32_t degree, T *x);
+
+// The scalar kernels are those of ScalarOps<T>
+template <class T, enum MathOp OP>
+static bool batch_scalar_op(T *l, const T *r)
+{
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i++)
+		l[i] = ScalarOps<T>::template eval<OP>(l[i], r[i], &err);
+	return err < 0;
+}
+
+template <class T>
+static bool batch_scalar_exp(T *l, const T */*r*/)
+{
+	for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i++)
+		l[i] = std::exp(l[i]);
+	return false;
+}
+
+template <class T>
+static const struct BatchKernels<T> BATCH_SCALAR_KERNELS = {{
+	NULL, NULL, NULL, NULL,
+	batch_scalar_op<T, MATH_ADD>,    batch_scalar_op<T, MATH_SUB>,
+	batch_scalar_op<T, MATH_MULT>,   batch_scalar_op<T, MATH_DIV>,
+	batch_scalar_op<T, MATH_POW>,    batch_scalar_op<T, MATH_LN>,
+	batch_scalar_op<T, MATH_SQRT>,   batch_scalar_op<T, MATH_COS>,
+	batch_scalar_op<T, MATH_SIN>,    batch_scalar_op<T, MATH_TG>,
+	batch_scalar_op<T, MATH_CTG>,    batch_scalar_op<T, MATH_ARCSIN>,
+	batch_scalar_op<T, MATH_ARCCOS>, batch_scalar_op<T, MATH_ARCTG>,
+	batch_scalar_op<T, MATH_ARCCTG>, batch_scalar_exp<T>,
+	NULL,                            NULL,
+	NULL,
+}};
+
+#ifdef BATCH_HAS_LIBMVEC
+
+/*
+ * Vector variants of libm from glibc's libmvec, named by the x86-64 vector
+ * function ABI: 'd' is AVX2 with 4 lanes of double or 8 of float, 'e' is
+ * AVX-512 with 8 lanes of double or 16 of float.
+ */
+extern "C" {
+__m256d _ZGVdN4v_sin(__m256d x);
+__m256d _ZGVdN4v_cos(__m256d x);
+__m256d _ZGVdN4v_tan(__m256d x);
+__m256d _ZGVdN4v_log(__m256d x);
+__m256d _ZGVdN4v_asin(__m256d x);
+__m256d _ZGVdN4v_acos(__m256d x);
+__m256d _ZGVdN4v_atan(__m256d x);
+__m256d _ZGVdN4v_exp(__m256d x);
+__m256d _ZGVdN4vv_pow(__m256d x, __m256d y);
+
+__m512d _ZGVeN8v_sin(__m512d x);
+__m512d _ZGVeN8v_cos(__m512d x);
+__m512d _ZGVeN8v_tan(__m512d x);
+__m512d _ZGVeN8v_log(__m512d x);
+__m512d _ZGVeN8v_asin(__m512d x);
+__m512d _ZGVeN8v_acos(__m512d x);
+__m512d _ZGVeN8v_atan(__m512d x);
+__m512d _ZGVeN8v_exp(__m512d x);
+__m512d _ZGVeN8vv_pow(__m512d x, __m512d y);
+
+__m256 _ZGVdN8v_sinf(__m256 x);
+__m256 _ZGVdN8v_cosf(__m256 x);
+__m256 _ZGVdN8v_tanf(__m256 x);
+__m256 _ZGVdN8v_logf(__m256 x);
+__m256 _ZGVdN8v_asinf(__m256 x);
+__m256 _ZGVdN8v_acosf(__m256 x);
+__m256 _ZGVdN8v_atanf(__m256 x);
+__m256 _ZGVdN8v_expf(__m256 x);
+__m256 _ZGVdN8vv_powf(__m256 x, __m256 y);
+
+__m512 _ZGVeN16v_sinf(__m512 x);
+__m512 _ZGVeN16v_cosf(__m512 x);
+__m512 _ZGVeN16v_tanf(__m512 x);
+__m512 _ZGVeN16v_logf(__m512 x);
+__m512 _ZGVeN16v_asinf(__m512 x);
+__m512 _ZGVeN16v_acosf(__m512 x);
+__m512 _ZGVeN16v_atanf(__m512 x);
+__m512 _ZGVeN16v_expf(__m512 x);
+__m512 _ZGVeN16vv_powf(__m512 x, __m512 y);
+}
+
+#define BATCH_AVX2 __attribute__((target("avx2,fma")))
+
+BATCH_AVX2 static inline __m256d batch_avx2_abs(__m256d x)
+{
+	return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+}
+
+BATCH_AVX2 static inline __m256d batch_avx2_lt(__m256d x, double c)
+{
+	return _mm256_cmp_pd(x, _mm256_set1_pd(c), _CMP_LT_OQ);
+}
+
+BATCH_AVX2 static inline __m256d batch_avx2_gt(__m256d x, double c)
+{
+	return _mm256_cmp_pd(x, _mm256_set1_pd(c), _CMP_GT_OQ);
+}
+
+#define BATCH_AVX2_KERNEL(name, res, is_bad)							\
+	BATCH_AVX2 static bool batch_avx2_##name(double *l, const double *r)\
+	{																	\
+		__m256d bad = _mm256_setzero_pd();								\
+		for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 4) {			\
+			__m256d a = _mm256_load_pd(l + i);							\
+			__m256d b = _mm256_load_pd(r + i);							\
+			(void) b;													\
+			bad = _mm256_or_pd(bad, (is_bad));							\
+			_mm256_store_pd(l + i, (res));								\
+		}																\
+		return _mm256_movemask_pd(bad) != 0;							\
+	}
+
+#define AVX2_OK _mm256_setzero_pd()
+
+BATCH_AVX2_KERNEL(add,		_mm256_add_pd(a, b),	AVX2_OK)
+BATCH_AVX2_KERNEL(sub,		_mm256_sub_pd(a, b),	AVX2_OK)
+BATCH_AVX2_KERNEL(mult,		_mm256_mul_pd(a, b),	AVX2_OK)
+BATCH_AVX2_KERNEL(div,		_mm256_div_pd(a, b),
+				  batch_avx2_lt(batch_avx2_abs(b), EQ_EPSILON))
+BATCH_AVX2_KERNEL(pow,		_ZGVdN4vv_pow(a, b),	AVX2_OK)
+BATCH_AVX2_KERNEL(ln,		_ZGVdN4v_log(a),
+				  _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_LE_OQ))
+BATCH_AVX2_KERNEL(sqrt,		_mm256_sqrt_pd(a),		AVX2_OK)
+BATCH_AVX2_KERNEL(cos,		_ZGVdN4v_cos(a),		AVX2_OK)
+BATCH_AVX2_KERNEL(sin,		_ZGVdN4v_sin(a),		AVX2_OK)
+BATCH_AVX2_KERNEL(tg,		_ZGVdN4v_tan(a),		AVX2_OK)
+BATCH_AVX2_KERNEL(arcsin,	_ZGVdN4v_asin(a),
+				  batch_avx2_gt(batch_avx2_abs(a), 1))
+BATCH_AVX2_KERNEL(arccos,	_ZGVdN4v_acos(a),
+				  batch_avx2_gt(batch_avx2_abs(a), 1))
+BATCH_AVX2_KERNEL(arctg,	_ZGVdN4v_atan(a),		AVX2_OK)
+BATCH_AVX2_KERNEL(arcctg,	_mm256_sub_pd(_mm256_set1_pd(M_PI_2),
+										  _ZGVdN4v_atan(a)),
+				  AVX2_OK)
+BATCH_AVX2_KERNEL(exp,		_ZGVdN4v_exp(a),		AVX2_OK)
+
+BATCH_AVX2 static bool batch_avx2_ctg(double *l, const double */*r*/)
+{
+	__m256d bad = _mm256_setzero_pd();
+	for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 4) {
+		__m256d tg = _ZGVdN4v_tan(_mm256_load_pd(l + i));
+		bad = _mm256_or_pd(bad, batch_avx2_lt(batch_avx2_abs(tg),
+											  EQ_EPSILON));
+		_mm256_store_pd(l + i, _mm256_div_pd(_mm256_set1_pd(1), tg));
+	}
+	return _mm256_movemask_pd(bad) != 0;
+}
+
+static const struct BatchKernels<double> BATCH_AVX2_KERNELS = {{
+	NULL, NULL, NULL, NULL,
+	batch_avx2_add,    batch_avx2_sub,    batch_avx2_mult,
+	batch_avx2_div,    batch_avx2_pow,    batch_avx2_ln,
+	batch_avx2_sqrt,   batch_avx2_cos,    batch_avx2_sin,
+	batch_avx2_tg,     batch_avx2_ctg,    batch_avx2_arcsin,
+	batch_avx2_arccos, batch_avx2_arctg,  batch_avx2_arcctg,
+	batch_avx2_exp,    NULL,              NULL,
+	NULL,
+}};
+
+BATCH_AVX2 static inline __m256 batch_avx2f_abs(__m256 x)
+{
+	return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+BATCH_AVX2 static inline __m256 batch_avx2f_lt(__m256 x, float c)
+{
+	return _mm256_cmp_ps(x, _mm256_set1_ps(c), _CMP_LT_OQ);
+}
+
+BATCH_AVX2 static inline __m256 batch_avx2f_gt(__m256 x, float c)
+{
+	return _mm256_cmp_ps(x, _mm256_set1_ps(c), _CMP_GT_OQ);
+}
+
+#define BATCH_AVX2F_KERNEL(name, res, is_bad)							\
+	BATCH_AVX2 static bool batch_avx2f_##name(float *l, const float *r)	\
+	{																	\
+		__m256 bad = _mm256_setzero_ps();								\
+		for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 8) {			\
+			__m256 a = _mm256_load_ps(l + i);							\
+			__m256 b = _mm256_load_ps(r + i);							\
+			(void) b;													\
+			bad = _mm256_or_ps(bad, (is_bad));							\
+			_mm256_store_ps(l + i, (res));								\
+		}																\
+		return _mm256_movemask_ps(bad) != 0;							\
+	}
+
+#define AVX2F_OK _mm256_setzero_ps()
+
+BATCH_AVX2F_KERNEL(add,		_mm256_add_ps(a, b),	AVX2F_OK)
+BATCH_AVX2F_KERNEL(sub,		_mm256_sub_ps(a, b),	AVX2F_OK)
+BATCH_AVX2F_KERNEL(mult,	_mm256_mul_ps(a, b),	AVX2F_OK)
+BATCH_AVX2F_KERNEL(div,		_mm256_div_ps(a, b),
+				   batch_avx2f_lt(batch_avx2f_abs(b), (float) EQ_EPSILON))
+BATCH_AVX2F_KERNEL(pow,		_ZGVdN8vv_powf(a, b),	AVX2F_OK)
+BATCH_AVX2F_KERNEL(ln,		_ZGVdN8v_logf(a),
+				   _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LE_OQ))
+BATCH_AVX2F_KERNEL(sqrt,	_mm256_sqrt_ps(a),		AVX2F_OK)
+BATCH_AVX2F_KERNEL(cos,		_ZGVdN8v_cosf(a),		AVX2F_OK)
+BATCH_AVX2F_KERNEL(sin,		_ZGVdN8v_sinf(a),		AVX2F_OK)
+BATCH_AVX2F_KERNEL(tg,		_ZGVdN8v_tanf(a),		AVX2F_OK)
+BATCH_AVX2F_KERNEL(arcsin,	_ZGVdN8v_asinf(a),
+				   batch_avx2f_gt(batch_avx2f_abs(a), 1))
+BATCH_AVX2F_KERNEL(arccos,	_ZGVdN8v_acosf(a),
+				   batch_avx2f_gt(batch_avx2f_abs(a), 1))
+BATCH_AVX2F_KERNEL(arctg,	_ZGVdN8v_atanf(a),		AVX2F_OK)
+BATCH_AVX2F_KERNEL(arcctg,	_mm256_sub_ps(_mm256_set1_ps((float) M_PI_2),
+										  _ZGVdN8v_atanf(a)),
+				   AVX2F_OK)
+BATCH_AVX2F_KERNEL(exp,		_ZGVdN8v_expf(a),		AVX2F_OK)
+
+BATCH_AVX2 static bool batch_avx2f_ctg(float *l, const float */*r*/)
+{
+	__m256 bad = _mm256_setzero_ps();
+	for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 8) {
+		__m256 tg = _ZGVdN8v_tanf(_mm256_load_ps(l + i));
+		bad = _mm256_or_ps(bad, batch_avx2f_lt(batch_avx2f_abs(tg),
+											   (float) EQ_EPSILON));
+		_mm256_store_ps(l + i, _mm256_div_ps(_mm256_set1_ps(1), tg));
+	}
+	return _mm256_movemask_ps(bad) != 0;
+}
+
+static const struct BatchKernels<float> BATCH_AVX2F_KERNELS = {{
+	NULL, NULL, NULL, NULL,
+	batch_avx2f_add,    batch_avx2f_sub,    batch_avx2f_mult,
+	batch_avx2f_div,    batch_avx2f_pow,    batch_avx2f_ln,
+	batch_avx2f_sqrt,   batch_avx2f_cos,    batch_avx2f_sin,
+	batch_avx2f_tg,     batch_avx2f_ctg,    batch_avx2f_arcsin,
+	batch_avx2f_arccos, batch_avx2f_arctg,  batch_avx2f_arcctg,
+	batch_avx2f_exp,    NULL,               NULL,
+	NULL,
+}};
+
+#define BATCH_AVX512 __attribute__((target("avx512f")))
+
+BATCH_AVX512 static inline __mmask8 batch_avx512_abs_lt(__m512d x, double c)
+{
+	return _mm512_cmp_pd_mask(_mm512_abs_pd(x), _mm512_set1_pd(c),
+							  _CMP_LT_OQ);
+}
+
+BATCH_AVX512 static inline __mmask8 batch_avx512_abs_gt(__m512d x, double c)
+{
+	return _mm512_cmp_pd_mask(_mm512_abs_pd(x), _mm512_set1_pd(c),
+							  _CMP_GT_OQ);
+}
+
+#define BATCH_AVX512_KERNEL(name, res, is_bad)							\
+	BATCH_AVX512 static bool batch_avx512_##name(double *l,				\
+												 const double *r)		\
+	{																	\
+		__mmask8 bad = 0;												\
+		for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 8) {			\
+			__m512d a = _mm512_load_pd(l + i);							\
+			__m512d b = _mm512_load_pd(r + i);							\
+			(void) b;													\
+			bad = (__mmask8) (bad | (is_bad));							\
+			_mm512_store_pd(l + i, (res));								\
+		}																\
+		return bad != 0;												\
+	}
+
+BATCH_AVX512_KERNEL(add,	_mm512_add_pd(a, b),	0)
+BATCH_AVX512_KERNEL(sub,	_mm512_sub_pd(a, b),	0)
+BATCH_AVX512_KERNEL(mult,	_mm512_mul_pd(a, b),	0)
+BATCH_AVX512_KERNEL(div,	_mm512_div_pd(a, b),
+					batch_avx512_abs_lt(b, EQ_EPSILON))
+BATCH_AVX512_KERNEL(pow,	_ZGVeN8vv_pow(a, b),	0)
+BATCH_AVX512_KERNEL(ln,		_ZGVeN8v_log(a),
+					_mm512_cmp_pd_mask(a, _mm512_setzero_pd(), _CMP_LE_OQ))
+BATCH_AVX512_KERNEL(sqrt,	_mm512_sqrt_pd(a),		0)
+BATCH_AVX512_KERNEL(cos,	_ZGVeN8v_cos(a),		0)
+BATCH_AVX512_KERNEL(sin,	_ZGVeN8v_sin(a),		0)
+BATCH_AVX512_KERNEL(tg,		_ZGVeN8v_tan(a),		0)
+BATCH_AVX512_KERNEL(arcsin,	_ZGVeN8v_asin(a),		batch_avx512_abs_gt(a, 1))
+BATCH_AVX512_KERNEL(arccos,	_ZGVeN8v_acos(a),		batch_avx512_abs_gt(a, 1))
+BATCH_AVX512_KERNEL(arctg,	_ZGVeN8v_atan(a),		0)
+BATCH_AVX512_KERNEL(arcctg,	_mm512_sub_pd(_mm512_set1_pd(M_PI_2),
+										  _ZGVeN8v_atan(a)),
+					0)
+BATCH_AVX512_KERNEL(exp,	_ZGVeN8v_exp(a),		0)
+
+BATCH_AVX512 static bool batch_avx512_ctg(double *l, const double */*r*/)
+{
+	__mmask8 bad = 0;
+	for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 8) {
+		__m512d tg = _ZGVeN8v_tan(_mm512_load_pd(l + i));
+		bad = (__mmask8) (bad | batch_avx512_abs_lt(tg, EQ_EPSILON));
+		_mm512_store_pd(l + i, _mm512_div_pd(_mm512_set1_pd(1), tg));
+	}
+	return bad != 0;
+}
+
+static const struct BatchKernels<double> BATCH_AVX512_KERNELS = {{
+	NULL, NULL, NULL, NULL,
+	batch_avx512_add,    batch_avx512_sub,    batch_avx512_mult,
+	batch_avx512_div,    batch_avx512_pow,    batch_avx512_ln,
+	batch_avx512_sqrt,   batch_avx512_cos,    batch_avx512_sin,
+	batch_avx512_tg,     batch_avx512_ctg,    batch_avx512_arcsin,
+	batch_avx512_arccos, batch_avx512_arctg,  batch_avx512_arcctg,
+	batch_avx512_exp,    NULL,                NULL,
+	NULL,
+}};
+
+BATCH_AVX512 static inline __mmask16 batch_avx512f_abs_lt(__m512 x, float c)
+{
+	return _mm512_cmp_ps_mask(_mm512_abs_ps(x), _mm512_set1_ps(c),
+							  _CMP_LT_OQ);
+}
+
+BATCH_AVX512 static inline __mmask16 batch_avx512f_abs_gt(__m512 x, float c)
+{
+	return _mm512_cmp_ps_mask(_mm512_abs_ps(x), _mm512_set1_ps(c),
+							  _CMP_GT_OQ);
+}
+
+#define BATCH_AVX512F_KERNEL(name, res, is_bad)							\
+	BATCH_AVX512 static bool batch_avx512f_##name(float *l,				\
+												  const float *r)		\
+	{																	\
+		__mmask16 bad = 0;												\
+		for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 16) {			\
+			__m512 a = _mm512_load_ps(l + i);							\
+			__m512 b = _mm512_load_ps(r + i);							\
+			(void) b;													\
+			bad = (__mmask16) (bad | (is_bad));							\
+			_mm512_store_ps(l + i, (res));								\
+		}																\
+		return bad != 0;												\
+	}
+
+BATCH_AVX512F_KERNEL(add,		_mm512_add_ps(a, b),	0)
+BATCH_AVX512F_KERNEL(sub,		_mm512_sub_ps(a, b),	0)
+BATCH_AVX512F_KERNEL(mult,		_mm512_mul_ps(a, b),	0)
+BATCH_AVX512F_KERNEL(div,		_mm512_div_ps(a, b),
+						batch_avx512f_abs_lt(b, (float) EQ_EPSILON))
+BATCH_AVX512F_KERNEL(pow,		_ZGVeN16vv_powf(a, b),	0)
+BATCH_AVX512F_KERNEL(ln,		_ZGVeN16v_logf(a),
+						_mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_LE_OQ))
+BATCH_AVX512F_KERNEL(sqrt,		_mm512_sqrt_ps(a),		0)
+BATCH_AVX512F_KERNEL(cos,		_ZGVeN16v_cosf(a),		0)
+BATCH_AVX512F_KERNEL(sin,		_ZGVeN16v_sinf(a),		0)
+BATCH_AVX512F_KERNEL(tg,		_ZGVeN16v_tanf(a),		0)
+BATCH_AVX512F_KERNEL(arcsin,	_ZGVeN16v_asinf(a),	batch_avx512f_abs_gt(a, 1))
+BATCH_AVX512F_KERNEL(arccos,	_ZGVeN16v_acosf(a),	batch_avx512f_abs_gt(a, 1))
+BATCH_AVX512F_KERNEL(arctg,		_ZGVeN16v_atanf(a),		0)
+BATCH_AVX512F_KERNEL(arcctg,	_mm512_sub_ps(_mm512_set1_ps((float) M_PI_2),
+											  _ZGVeN16v_atanf(a)),
+						0)
+BATCH_AVX512F_KERNEL(exp,		_ZGVeN16v_expf(a),		0)
+
+BATCH_AVX512 static bool batch_avx512f_ctg(float *l, const float */*r*/)
+{
+	__mmask16 bad = 0;
+	for (size_t i = 0; i < EQ_BATCH_BLOCK_SIZE; i += 16) {
+		__m512 tg = _ZGVeN16v_tanf(_mm512_load_ps(l + i));
+		bad = (__mmask16) (bad | batch_avx512f_abs_lt(tg, (float) EQ_EPSILON));
+		_mm512_store_ps(l + i, _mm512_div_ps(_mm512_set1_ps(1), tg));
+	}
+	return bad != 0;
+}
+
+static const struct BatchKernels<float> BATCH_AVX512F_KERNELS = {{
+	NULL, NULL, NULL, NULL,
+	batch_avx512f_add,    batch_avx512f_sub,    batch_avx512f_mult,
+	batch_avx512f_div,    batch_avx512f_pow,    batch_avx512f_ln,
+	batch_avx512f_sqrt,   batch_avx512f_cos,    batch_avx512f_sin,
+	batch_avx512f_tg,     batch_avx512f_ctg,    batch_avx512f_arcsin,
+	batch_avx512f_arccos, batch_avx512f_arctg,  batch_avx512f_arcctg,
+	batch_avx512f_exp,    NULL,                 NULL,
+	NULL,
+}};
+
+#endif /*BATCH_HAS_LIBMVEC*/
+
+static enum BatchIsa batch_select_isa()
+{
+#ifdef BATCH_HAS_LIBMVEC
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return BATCH_ISA_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return BATCH_ISA_AVX2;
+#endif
+	return BATCH_ISA_SCALAR;
+}
+
+template <>
+const struct BatchKernels<double> *batch_kernels<double>(enum BatchIsa isa)
+{
+	switch (isa) {
+#ifdef BATCH_HAS_LIBMVEC
+		case BATCH_ISA_AVX512:
+			return &BATCH_AVX512_KERNELS;
+		case BATCH_ISA_AVX2:
+			return &BATCH_AVX2_KERNELS;
+#else
+		case BATCH_ISA_AVX512:
+		case BATCH_ISA_AVX2:
+#endif
+		case BATCH_ISA_SCALAR:
+		default:
+			return &BATCH_SCALAR_KERNELS<double>;
+	}
+}
+
+template <>
+const struct BatchKernels<float> *batch_kernels<float>(enum BatchIsa isa)
+{
+	switch (isa) {
+#ifdef BATCH_HAS_LIBMVEC
+		case BATCH_ISA_AVX512:
+			return &BATCH_AVX512F_KERNELS;
+		case BATCH_ISA_AVX2:
+			return &BATCH_AVX2F_KERNELS;
+#else
+		case BATCH_ISA_AVX512:
+		case BATCH_ISA_AVX2:
+#endif
+		case BATCH_ISA_SCALAR:
+		default:
+			return &BATCH_SCALAR_KERNELS<float>;
+	}
+}
+
+template <class T>
+enum EquationError eq_evaluate_batch(struct Equation eq,
+									 const T *const *columns,
+									 size_t n, T *out)
+{
+	struct CompiledEquation ceq = {};
+	enum EquationError err = compiled_eq_ctor(&ceq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_from_equation(&ceq, eq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_evaluate_batch(&ceq, columns, n, out);
+	compiled_eq_dtor(&ceq);
+	return err;
+}
+
+template <class T>
+enum EquationError compiled_eq_evaluate_batch(struct CompiledEquation *ceq,
+											  const T *const *columns,
+											  size_t n, T *out)
+{
+	assert(ceq);
+
+	struct BatchScratch scratch = {};
+	enum EquationError err = batch_scratch_ctor(&scratch, ceq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_evaluate_range(ceq, &scratch, columns, 0, n, out,
+										 NULL);
+	batch_scratch_dtor(&scratch);
+	return err;
+}
+
+enum EquationError batch_scratch_ctor(struct BatchScratch *scratch,
+									  const struct CompiledEquation *ceq)
+{
+	assert(scratch);
+	assert(ceq);
+
+	size_t depth = ceq->max_depth + ceq->num_slots;
+	scratch->blocks = aligned_alloc(BATCH_ALIGNMENT, (depth + 1) *
+									EQ_BATCH_BLOCK_SIZE * sizeof(double));
+	scratch->stack = (double*) calloc(depth + 1, sizeof(double));
+	scratch->vals = (double*) calloc(ceq->num_vars + 1, sizeof(double));
+	if (!scratch->blocks || !scratch->stack || !scratch->vals) {
+		batch_scratch_dtor(scratch);
+		return EQ_NO_MEM_ERR;
+	}
+	return EQ_NO_ERR;
+}
+
+void batch_scratch_dtor(struct BatchScratch *scratch)
+{
+	assert(scratch);
+
+	free(scratch->blocks);
+	free(scratch->stack);
+	free(scratch->vals);
+	scratch->blocks = NULL;
+	scratch->stack = NULL;
+	scratch->vals = NULL;
+}
+
+template <class T>
+enum EquationError compiled_eq_evaluate_range(
+										const struct CompiledEquation *ceq,
+										struct BatchScratch *scratch,
+										const T *const *columns,
+										size_t begin, size_t end, T *out,
+										size_t *err_ind)
+{
+	assert(ceq);
+	assert(scratch);
+	assert(columns || ceq->num_vars == 0);
+	assert(out || begin == end);
+
+	if (ceq->size == 0) {
+		for (size_t i = begin; i < end; i++)
+			out[i] = NAN;
+		return EQ_NO_ERR;
+	}
+
+	static const struct BatchKernels<T> *kernels = batch_kernels<T>(
+														batch_select_isa());
+	T *blocks = (T*) scratch->blocks;
+
+	enum EquationError first_err = EQ_NO_ERR;
+	for (size_t block = begin; block < end; block += EQ_BATCH_BLOCK_SIZE) {
+		size_t count = end - block < EQ_BATCH_BLOCK_SIZE ? end - block :
+														   EQ_BATCH_BLOCK_SIZE;
+		if (!batch_run_block(ceq, kernels, columns, block, count, blocks)) {
+			memcpy(out + block, blocks, count * sizeof(T));
+			continue;
+		}
+
+		for (size_t i = block; i < block + count; i++) {
+			for (size_t var = 0; var < ceq->num_vars; var++)
+				scratch->vals[var] = columns[var][i];
+			double res = NAN;
+			enum EquationError err = compiled_eq_evaluate_stack(ceq,
+												scratch->stack, scratch->vals,
+												&res);
+			out[i] = (T) res;
+			if (err < 0) {
+				out[i] = NAN;
+				if (first_err == EQ_NO_ERR) {
+					first_err = err;
+					if (err_ind)
+						*err_ind = i;
+				}
+			}
+		}
+	}
+
+	return first_err;
+}
+
+template <class T>
+enum EquationError eq_evaluate_parallel(struct Equation eq,
+										const T *const *columns,
+										size_t n, T *out,
+										size_t num_threads)
+{
+	struct ThreadPool pool = {};
+	if (thread_pool_ctor(&pool, num_threads) < 0)
+		return EQ_NO_MEM_ERR;
+
+	struct CompiledEquation ceq = {};
+	enum EquationError err = compiled_eq_ctor(&ceq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_from_equation(&ceq, eq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_evaluate_parallel(&pool, &ceq, columns, n, out);
+	compiled_eq_dtor(&ceq);
+	thread_pool_dtor(&pool);
+	return err;
+}
+
+template <class T>
+enum EquationError compiled_eq_evaluate_parallel(struct ThreadPool *pool,
+											const struct CompiledEquation *ceq,
+											const T *const *columns,
+											size_t n, T *out)
+{
+	assert(pool);
+	assert(ceq);
+
+	size_t num_threads = pool->num_threads;
+	struct BatchWorker *workers = (struct BatchWorker*) aligned_alloc(
+									alignof(struct BatchWorker),
+									num_threads * sizeof(struct BatchWorker));
+	if (!workers)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = EQ_NO_ERR;
+	size_t num_ready = 0;
+	for (; num_ready < num_threads && err == EQ_NO_ERR; num_ready++) {
+		workers[num_ready].err = EQ_NO_ERR;
+		workers[num_ready].err_ind = n;
+		err = batch_scratch_ctor(&workers[num_ready].scratch, ceq);
+	}
+
+	if (err == EQ_NO_ERR) {
+		struct BatchJob<T> job = {ceq, columns, n, out, workers};
+		size_t num_chunks = (n + EQ_PARALLEL_CHUNK_SIZE - 1) /
+							EQ_PARALLEL_CHUNK_SIZE;
+		thread_pool_run(pool, num_chunks, batch_parallel_task<T>, &job);
+
+		size_t err_ind = n;
+		for (size_t i = 0; i < num_threads; i++) {
+			if (workers[i].err < 0 && workers[i].err_ind < err_ind) {
+				err = workers[i].err;
+				err_ind = workers[i].err_ind;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < num_ready; i++)
+		batch_scratch_dtor(&workers[i].scratch);
+	free(workers);
+	return err;
+}
+
+template <class T>
+static void batch_parallel_task(void *job_ptr, size_t worker, size_t chunk)
+{
+	struct BatchJob<T> *job = (struct BatchJob<T>*) job_ptr;
+	struct BatchWorker *self = job->workers + worker;
+
+	size_t begin = chunk * EQ_PARALLEL_CHUNK_SIZE;
+	size_t end = begin + EQ_PARALLEL_CHUNK_SIZE < job->n ?
+				 begin + EQ_PARALLEL_CHUNK_SIZE : job->n;
+	size_t err_ind = end;
+	enum EquationError err = compiled_eq_evaluate_range(job->ceq,
+											&self->scratch, job->columns,
+											begin, end, job->out, &err_ind);
+	if (err < 0 && err_ind < self->err_ind) {
+		self->err = err;
+		self->err_ind = err_ind;
+	}
+}
+
+/*
+ * Runs the bytecode over points [begin, begin + count) with the value stack
+ * made of blocks, the result is left in the first block of scratch. The
+ * columns of a short last block are padded with their last value, so the
+ * padding can't fail a domain check that the real points pass.
+ */
+template <class T>
+static bool batch_run_block(const struct CompiledEquation *ceq,
+							const struct BatchKernels<T> *kernels,
+							const T *const *columns, size_t begin,
+							size_t count, T *scratch)
+{
+	assert(ceq);
+	assert(kernels);
+	assert(scratch);
+	assert(count > 0 && count <= EQ_BATCH_BLOCK_SIZE);
+
+	const size_t BLOCK = EQ_BATCH_BLOCK_SIZE;
+	T *top = scratch;
+	T *slots = scratch + ceq->max_depth * BLOCK;
+	bool bad = false;
+
+	for (size_t i = 0; i < ceq->size; i++) {
+		const struct CompiledInstr *ip = ceq->code + i;
+		const T *col = NULL;
+		switch ((enum CompiledOpcode) ip->opcode) {
+			case CEQ_NUM:
+				for (size_t j = 0; j < BLOCK; j++)
+					top[j] = (T) ip->arg.num;
+				top += BLOCK;
+				break;
+			case CEQ_VAR:
+				col = columns[ip->arg.ind] + begin;
+				memcpy(top, col, count * sizeof(T));
+				for (size_t j = count; j < BLOCK; j++)
+					top[j] = col[count - 1];
+				top += BLOCK;
+				break;
+			case CEQ_LOAD:
+				memcpy(top, slots + ip->arg.ind * BLOCK, BLOCK * sizeof(T));
+				top += BLOCK;
+				break;
+			case CEQ_STORE:
+				memcpy(slots + ip->arg.ind * BLOCK, top - BLOCK,
+					   BLOCK * sizeof(T));
+				break;
+			case CEQ_ADD:
+			case CEQ_SUB:
+			case CEQ_MULT:
+			case CEQ_DIV:
+			case CEQ_POW:
+				top -= BLOCK;
+				bad |= (*kernels->ops[ip->opcode])(top - BLOCK, top);
+				break;
+			case CEQ_LN:
+			case CEQ_SQRT:
+			case CEQ_COS:
+			case CEQ_SIN:
+			case CEQ_TG:
+			case CEQ_CTG:
+			case CEQ_ARCSIN:
+			case CEQ_ARCCOS:
+			case CEQ_ARCTG:
+			case CEQ_ARCCTG:
+			case CEQ_EXP:
+				bad |= (*kernels->ops[ip->opcode])(top - BLOCK, top - BLOCK);
+				break;
+			case CEQ_POWI:
+				bad |= batch_powi(top - BLOCK, ip->arg.exp);
+				break;
+			case CEQ_HORNER:
+				batch_horner(ceq->coefs + ip->arg.poly.coef_ind,
+							 ip->arg.poly.degree, top - BLOCK);
+				break;
+			case CEQ_ESTRIN:
+				batch_estrin(ceq->coefs + ip->arg.poly.coef_ind,
+							 ip->arg.poly.degree, top - BLOCK);
+				break;
+			default:
+				assert(0 && "Unknown opcode");
+				return true;
+		}
+	}
+
+	return bad;
+}
+
+/*
+ * Integer powers and polynomials over a block, with the same order of
+ * operations as compiled_eq_evaluate_stack. The loops over points are left
+ * to the compiler to vectorize.
+ */
+// Like compiled_powi, true if a point raises 0 to a negative power
+template <class T>
+static bool batch_powi(T *x, int32_t exp)
+{
+	assert(x);
+
+	T res[EQ_BATCH_BLOCK_SIZE] = {};
+	for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++)
+		res[j] = 1;
+	uint32_t n = exp < 0 ? 0 - (uint32_t) exp : (uint32_t) exp;
+	for (; n > 0; n >>= 1) {
+		if (n & 1) {
+			for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++)
+				res[j] *= x[j];
+		}
+		for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++)
+			x[j] *= x[j];
+	}
+	if (exp >= 0) {
+		memcpy(x, res, sizeof(res));
+		return false;
+	}
+	bool bad = false;
+	for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++) {
+		bool is_pole = !(std::fabs(res[j]) > 0);
+		bad |= is_pole;
+		x[j] = 1 / (is_pole ? 1 : res[j]);
+	}
+	return bad;
+}
+
+template <class T>
+static void batch_horner(const double *coefs, uint32_t degree, T *x)
+{
+	assert(coefs);
+	assert(x);
+
+	T res[EQ_BATCH_BLOCK_SIZE] = {};
+	for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++)
+		res[j] = (T) coefs[degree];
+	for (uint32_t i = degree; i-- > 0;) {
+		T c = (T) coefs[i];
+		for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++)
+			res[j] = res[j] * x[j] + c;
+	}
+	memcpy(x, res, sizeof(res));
+}
+
+template <class T>
+static void batch_estrin(const double *coefs, uint32_t degree, T *x)
+{
+	assert(coefs);
+	assert(x);
+
+	T x2[EQ_BATCH_BLOCK_SIZE] = {};
+	T x4[EQ_BATCH_BLOCK_SIZE] = {};
+	T res[EQ_BATCH_BLOCK_SIZE] = {};
+	uint32_t block = degree / CEQ_ESTRIN_BLOCK * CEQ_ESTRIN_BLOCK;
+	T c[CEQ_ESTRIN_BLOCK] = {};
+	for (uint32_t i = 0; i < CEQ_ESTRIN_BLOCK; i++)
+		c[i] = (T) coefs[block + i];
+	for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++) {
+		x2[j] = x[j] * x[j];
+		x4[j] = x2[j] * x2[j];
+		res[j] = (c[0] + c[1] * x[j]) + (c[2] + c[3] * x[j]) * x2[j];
+	}
+	while (block > 0) {
+		block -= CEQ_ESTRIN_BLOCK;
+		for (uint32_t i = 0; i < CEQ_ESTRIN_BLOCK; i++)
+			c[i] = (T) coefs[block + i];
+		for (size_t j = 0; j < EQ_BATCH_BLOCK_SIZE; j++)
+			res[j] = res[j] * x4[j] + ((c[0] + c[1] * x[j]) +
+									   (c[2] + c[3] * x[j]) * x2[j]);
+	}
+	memcpy(x, res, sizeof(res));
+}
+
+#define BATCH_INSTANTIATE(T)											\
+	template enum EquationError compiled_eq_evaluate_range<T>(			\
+										const struct CompiledEquation *ceq,	\
+										struct BatchScratch *scratch,	\
+										const T *const *columns,		\
+										size_t begin, size_t end, T *out,	\
+										size_t *err_ind);				\
+	template enum EquationError compiled_eq_evaluate_batch<T>(			\
+										struct CompiledEquation *ceq,	\
+										const T *const *columns,		\
+										size_t n, T *out);				\
+	template enum EquationError eq_evaluate_batch<T>(struct Equation eq,	\
+										const T *const *columns,		\
+										size_t n, T *out);				\
+	template enum EquationError compiled_eq_evaluate_parallel<T>(		\
+										struct ThreadPool *pool,		\
+										const struct CompiledEquation *ceq,	\
+										const T *const *columns,		\
+										size_t n, T *out);				\
+	template enum EquationError eq_evaluate_parallel<T>(struct Equation eq,	\
+										const T *const *columns,		\
+										size_t n, T *out,				\
+										size_t num_threads);
+
+BATCH_INSTANTIATE(double)
+BATCH_INSTANTIATE(float)
@@ -0,0 +1,83 @@
+#ifndef _BATCH_EVALUATE_H
+#define _BATCH_EVALUATE_H
+
+#include "compiled_equation.h"
+#include "equation_utils.h"
+#include "thread_pool.h"
+
+/*
+ * Evaluation of an equation at n points at once. columns[i] points to n
+ * values of the i-th variable and out receives n results.
+ *
+ * The bytecode of CompiledEquation is run over blocks of
+ * EQ_BATCH_BLOCK_SIZE points, every instruction being a SIMD kernel over a
+ * whole block. Kernels are picked once per process by CPU features:
+ * AVX-512 or AVX2 with glibc's libmvec for transcendental functions, and a
+ * scalar libm fallback otherwise. The vector sin/cos/log/... may differ
+ * from libm in the last bits.
+ *
+ * A point that fails a domain check gets NAN in out. The error of the first
+ * such point is returned after all points are evaluated.
+ *
+ * T is double or float. Float blocks fill twice the lanes of a SIMD
+ * register, for plots and screening that need no double precision; the
+ * points of a block that failed are evaluated again in double and rounded.
+ */
+
+const size_t EQ_BATCH_BLOCK_SIZE = 64;
+
+/*
+ * Per-thread memory of batch evaluation: value stack blocks and what the
+ * point by point fallback needs.
+ */
+struct BatchScratch {
+	void *blocks;
+	double *stack;
+	double *vals;
+};
+
+enum EquationError batch_scratch_ctor(struct BatchScratch *scratch,
+									  const struct CompiledEquation *ceq);
+void batch_scratch_dtor(struct BatchScratch *scratch);
+
+/*
+ * Evaluates points [begin, end) into out[begin, end). If a point fails, its
+ * index is stored in *err_ind (may be NULL) along with returning the error.
+ */
+template <class T>
+enum EquationError compiled_eq_evaluate_range(
+										const struct CompiledEquation *ceq,
+										struct BatchScratch *scratch,
+										const T *const *columns,
+										size_t begin, size_t end, T *out,
+										size_t *err_ind);
+
+template <class T>
+enum EquationError compiled_eq_evaluate_batch(struct CompiledEquation *ceq,
+											  const T *const *columns,
+											  size_t n, T *out);
+template <class T>
+enum EquationError eq_evaluate_batch(struct Equation eq,
+									 const T *const *columns,
+									 size_t n, T *out);
+
+/*
+ * Parallel batch evaluation: points are cut into chunks of
+ * EQ_PARALLEL_CHUNK_SIZE that the pool's workers take and steal, every
+ * worker with its own BatchScratch. Results and the returned error are the
+ * same as of compiled_eq_evaluate_batch.
+ */
+const size_t EQ_PARALLEL_CHUNK_SIZE = 16 * EQ_BATCH_BLOCK_SIZE;
+
+template <class T>
+enum EquationError compiled_eq_evaluate_parallel(struct ThreadPool *pool,
+											const struct CompiledEquation *ceq,
+											const T *const *columns,
+											size_t n, T *out);
+template <class T>
+enum EquationError eq_evaluate_parallel(struct Equation eq,
+										const T *const *columns,
+										size_t n, T *out,
+										size_t num_threads);
+
+#endif /*_BATCH_EVALUATE_H*/
@@ -0,0 +1,803 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch_evaluate.h"
+#include "bench.h"
+#include "buffer.h"
+#include "compiled_equation.h"
+#include "equation_io.h"
+#include "equation_utils.h"
+#include "equation_manipulation.h"
+
+// The chains of bench_chain start at this depth and double up to size
+const size_t BENCH_CHAIN_MIN_DEPTH = 1000;
+const char *BENCH_ARENA_FORMULA =
+	"sin(x)*cos(x)*x^3*ln(x+1)*sqrt(x)*arctg(x)*tg(x)*x^2";
+// Functions of x whose derivatives the evaluation benchmarks time
+static const char *BENCH_CORPUS[] = {
+	"x^5-3*x^3+2*x-7",
+	"ln(x^2+1)/sqrt(x+1)",
+	"arctg(sin(x)+x^2)*cos(ln(x+2))",
+	"(x+1)^x",
+	"tg(x)/(1+x^2)-arcsin(x/2)",
+	"sin(x)*cos(x)*x^3*ln(x+1)*sqrt(x)*arctg(x)*tg(x)*x^2",
+};
+// bench_forward averages the time of making the derivative over this many
+const size_t BENCH_FORWARD_BUILD_RUNS = 100;
+/*
+ * Taylor coefficients below EQ_EPSILON are simplified away, so those of
+ * sin(x) + cos(2x) stop at degree 12 and 1/(1 - x) goes on to the end
+ */
+static const char *BENCH_HORNER_FORMULAS[] = {"sin(x)+cos(2*x)", "1/(1-x)"};
+static const size_t BENCH_HORNER_EXTENTS[] = {3, 8, 11, 12, 16, 32, 64};
+// bench_horner repeats every measurement up to this many evaluations
+const size_t BENCH_HORNER_EVALS = 1000000;
+// Evaluation benchmarks take their points evenly from this range
+const double BENCH_POINTS_FROM = 0.1;
+const double BENCH_POINTS_TO = 1.9;
+
+static enum EquationError bench_chain(size_t size);
+static enum EquationError bench_depth(size_t size);
+static enum EquationError bench_arena(size_t size);
+static enum EquationError bench_vm(size_t size);
+static enum EquationError bench_forward(size_t size);
+static enum EquationError bench_cse(size_t size);
+static enum EquationError bench_horner(size_t size);
+static enum EquationError bench_horner_extent(struct Equation eq, size_t extent,
+											  size_t num_points);
+
+static enum EquationError bench_arena_run(struct Equation eq, size_t runs,
+									   bool use_arena, double *secs,
+									   size_t *num_made, size_t *num_slabs);
+static enum EquationError bench_load_chain(const char *op_name, size_t depth,
+										   struct Equation *eq);
+static enum EquationError bench_load_text(char *text, size_t len,
+										  struct Equation *eq);
+static enum EquationError bench_load_formula(const char *formula,
+											 struct Equation *eq);
+static enum EquationError bench_load_derivative(const char *formula,
+												size_t order,
+												struct Equation *diff);
+static enum EquationError bench_time_evaluation(struct Equation eq,
+												size_t num_points,
+												double *tree_secs,
+												double *vm_secs);
+static double bench_point(size_t i, size_t num_points);
+static bool bench_is_close(double a, double b);
+static void bench_stage(const char *name, struct timespec *start);
+static double elapsed_secs(struct timespec start, struct timespec end);
+
+static const struct BenchDef BENCH_DEFS[] = {
+	{"chain", bench_chain, 128000},
+	{"depth", bench_depth, 1000000},
+	{"arena", bench_arena, 1000},
+	{"vm", bench_vm, 1000000},
+	{"forward", bench_forward, 100000},
+	{"cse", bench_cse, 100000},
+	{"horner", bench_horner, 4096},
+};
+
+const struct BenchDef *bench_find(const char *name)
+{
+	assert(name);
+
+	for (size_t i = 0; i < sizeof(BENCH_DEFS) / sizeof(BENCH_DEFS[0]); i++) {
+		if (strcmp(BENCH_DEFS[i].name, name) == 0)
+			return BENCH_DEFS + i;
+	}
+	return NULL;
+}
+
+/*
+ * sin(sin(...(x)...)) of doubling depths is differentiated into a sharing
+ * arena and simplified, as with --dag. The derivative is a product of
+ * cos(sin^k(x)) for every k < depth, terms that share all but their top, so
+ * the time per level of the chain stays flat only if sorting them does not
+ * walk the shared parts.
+ */
+static enum EquationError bench_chain(size_t size)
+{
+	printf("sin(sin(...(x)...)), производная с общими подвыражениями:\n");
+
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t depth = BENCH_CHAIN_MIN_DEPTH; depth <= size && err == EQ_NO_ERR;
+		 depth *= 2) {
+		struct Equation eq = {};
+		struct Equation diff = {};
+		struct timespec start = {};
+		struct timespec mid = {};
+		struct timespec end = {};
+		size_t num_nodes = 0;
+
+		err = eq_ctor(&eq);
+		if (err == EQ_NO_ERR)
+			err = eq_ctor(&diff);
+		if (err == EQ_NO_ERR)
+			err = eq_enable_sharing(&diff);
+		if (err == EQ_NO_ERR)
+			err = bench_load_chain("sin", depth, &eq);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (err == EQ_NO_ERR)
+			err = eq_differentiate(eq, 0, &diff);
+		clock_gettime(CLOCK_MONOTONIC, &mid);
+		if (err == EQ_NO_ERR)
+			err = eq_simplify(&diff);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (err == EQ_NO_ERR)
+			err = eq_count_nodes(diff, &num_nodes);
+
+		if (err == EQ_NO_ERR)
+			printf("глубина %8zu: узлов %9zu, дифференцирование %.3lf с,"
+				   " упрощение %.3lf с, %.1lf нс на звено\n", depth, num_nodes,
+				   elapsed_secs(start, mid), elapsed_secs(mid, end),
+				   elapsed_secs(start, end) / (double) depth * 1e9);
+		eq_dtor(&diff);
+		eq_dtor(&eq);
+	}
+	return err;
+}
+
+/*
+ * Every operation that used to recurse on the depth of the tree, on one
+ * sin(sin(...(x)...)) of depth size. The derivative goes to a sharing
+ * arena: as a tree, the chain rule copies the chain once per level.
+ */
+static enum EquationError bench_depth(size_t size)
+{
+	printf("sin(sin(...(x)...)) глубины %zu:\n", size);
+
+	const double POINT = 0.5;
+	struct Equation eq = {};
+	struct Equation diff = {};
+	struct Node *copy = NULL;
+	struct timespec start = {};
+	double vals[] = {POINT};
+	double res = NAN;
+	FILE *out = tmpfile();
+	enum EquationError eq_err = out ? EQ_NO_ERR : EQ_NO_MEM_ERR;
+	enum EquationError *err = &eq_err;
+
+	if (eq_err == EQ_NO_ERR)
+		eq_err = eq_ctor(&eq);
+	if (eq_err == EQ_NO_ERR)
+		eq_err = eq_ctor(&diff);
+	if (eq_err == EQ_NO_ERR)
+		eq_err = eq_enable_sharing(&diff);
+	if (eq_err < 0)
+		goto finally;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	eq_err = bench_load_chain("sin", size, &eq);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("разбор", &start);
+
+	eq_print(eq, out);
+	bench_stage("печать", &start);
+
+	eq_err = eq_evaluate(eq, vals, &res);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("вычисление", &start);
+	printf("    f(%g) = %.15lg\n", POINT, res);
+
+	copy = eq_copy(eq.arena, eq.tree, err);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("копирование", &start);
+	node_op_delete(eq.arena, copy);
+	bench_stage("удаление копии", &start);
+
+	eq_err = eq_simplify(&eq);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("упрощение", &start);
+
+	eq_err = eq_differentiate(eq, 0, &diff);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("дифференцирование", &start);
+
+	eq_err = eq_simplify(&diff);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("упрощение производной", &start);
+
+	eq_err = eq_evaluate(diff, vals, &res);
+	if (eq_err < 0)
+		goto finally;
+	bench_stage("вычисление производной", &start);
+	printf("    f'(%g) = %.15lg\n", POINT, res);
+
+	finally:
+		eq_dtor(&diff);
+		eq_dtor(&eq);
+		if (eq_err == EQ_NO_ERR)
+			bench_stage("освобождение", &start);
+		if (out)
+			fclose(out);
+		return eq_err;
+}
+
+/*
+ * Differentiates and simplifies BENCH_ARENA_FORMULA size times into an
+ * equation with an arena and into one without it, where every node is
+ * calloc'ed and the dtor frees the tree node by node.
+ */
+static enum EquationError bench_arena(size_t size)
+{
+	printf("%s, дифференцирование и упрощение, %zu прогонов:\n",
+		   BENCH_ARENA_FORMULA, size);
+
+	struct Equation eq = {};
+	double arena_secs = 0;
+	double calloc_secs = 0;
+	size_t num_made = 0;
+	size_t num_slabs = 0;
+
+	enum EquationError err = bench_load_formula(BENCH_ARENA_FORMULA, &eq);
+	if (err == EQ_NO_ERR)
+		err = bench_arena_run(eq, size, true, &arena_secs, &num_made, &num_slabs);
+	if (err == EQ_NO_ERR)
+		err = bench_arena_run(eq, size, false, &calloc_secs, NULL, NULL);
+	eq_dtor(&eq);
+	if (err < 0)
+		return err;
+
+	printf("арена:  %6zu выделений на прогон, %.3lf мс на прогон\n",
+		   num_slabs, arena_secs / (double) size * 1e3);
+	printf("calloc: %6zu выделений на прогон, %.3lf мс на прогон\n",
+		   num_made, calloc_secs / (double) size * 1e3);
+	return EQ_NO_ERR;
+}
+
+/*
+ * Times runs of differentiating eq, simplifying and freeing the derivative.
+ * With the arena, num_made and num_slabs get the nodes it handed out and the
+ * slabs it allocated for them in the last run.
+ */
+static enum EquationError bench_arena_run(struct Equation eq, size_t runs,
+									   bool use_arena, double *secs,
+									   size_t *num_made, size_t *num_slabs)
+{
+	assert(secs);
+
+	enum EquationError err = EQ_NO_ERR;
+	*secs = 0;
+	for (size_t i = 0; i < runs && err == EQ_NO_ERR; i++) {
+		struct Equation diff = {};
+		struct timespec start = {};
+		struct timespec end = {};
+
+		err = eq_ctor(&diff);
+		if (err == EQ_NO_ERR && !use_arena) {
+			node_arena_dtor(diff.arena);
+			free(diff.arena);
+			diff.arena = NULL;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (err == EQ_NO_ERR)
+			err = eq_differentiate(eq, 0, &diff);
+		if (err == EQ_NO_ERR)
+			err = eq_simplify(&diff);
+		if (diff.arena && num_made && num_slabs) {
+			*num_made = diff.arena->num_made;
+			*num_slabs = diff.arena->num_slabs;
+		}
+		eq_dtor(&diff);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		*secs += elapsed_secs(start, end);
+	}
+	return err;
+}
+
+/*
+ * Evaluates the simplified derivatives of BENCH_CORPUS at size points by
+ * the tree walker and by the bytecode VM. Points where the two differ in
+ * the value or in the error are counted.
+ */
+static enum EquationError bench_vm(size_t size)
+{
+	printf("Производные в %zu точках, точек/с:\n", size);
+	printf("      дерево           VM  ускорение  расхождений  функция\n");
+
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t k = 0; k < sizeof(BENCH_CORPUS) / sizeof(BENCH_CORPUS[0]) &&
+					   err == EQ_NO_ERR; k++) {
+		struct Equation diff = {};
+		struct CompiledEquation ceq = {};
+		struct timespec start = {};
+		struct timespec mid = {};
+		struct timespec end = {};
+		size_t num_diffs = 0;
+		volatile double sink = 0;
+
+		err = bench_load_derivative(BENCH_CORPUS[k], 1, &diff);
+		if (err == EQ_NO_ERR)
+			err = compiled_eq_ctor(&ceq);
+		if (err == EQ_NO_ERR)
+			err = compiled_eq_from_equation(&ceq, diff);
+		if (err < 0) {
+			compiled_eq_dtor(&ceq);
+			eq_dtor(&diff);
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < size; i++) {
+			double x = bench_point(i, size);
+			double res = 0;
+			if (eq_evaluate(diff, &x, &res) == EQ_NO_ERR)
+				sink = sink + res;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &mid);
+		for (size_t i = 0; i < size; i++) {
+			double x = bench_point(i, size);
+			double res = 0;
+			if (compiled_eq_evaluate(&ceq, &x, &res) == EQ_NO_ERR)
+				sink = sink + res;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		for (size_t i = 0; i < size; i++) {
+			double x = bench_point(i, size);
+			double tree_res = 0;
+			double vm_res = 0;
+			enum EquationError tree_err = eq_evaluate(diff, &x, &tree_res);
+			enum EquationError vm_err = compiled_eq_evaluate(&ceq, &x, &vm_res);
+			if (tree_err != vm_err ||
+				(tree_err == EQ_NO_ERR && !bench_is_close(tree_res, vm_res)))
+				num_diffs++;
+		}
+
+		double tree_secs = elapsed_secs(start, mid);
+		double vm_secs = elapsed_secs(mid, end);
+		printf("%12.0lf %12.0lf %10.2lf %12zu  %s\n", (double) size / tree_secs,
+			   (double) size / vm_secs, tree_secs / vm_secs, num_diffs,
+			   BENCH_CORPUS[k]);
+		compiled_eq_dtor(&ceq);
+		eq_dtor(&diff);
+	}
+	return err;
+}
+
+/*
+ * Where the forward mode of --forward stops paying off: dual numbers cost
+ * more per point than the simplified symbolic derivative, which has to be
+ * made first. Prints both per point times, the time of making the
+ * derivative and the number of points from which it is cheaper. The two
+ * are also compared at size points, like in bench_vm.
+ */
+static enum EquationError bench_forward(size_t size)
+{
+	printf("Производные в %zu точках: дуальные числа и символьная производная\n",
+		   size);
+	printf("дуальные, нс  символьная, нс  построение, мкс  окупается с  "
+		   "расхождений  функция\n");
+
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t k = 0; k < sizeof(BENCH_CORPUS) / sizeof(BENCH_CORPUS[0]) &&
+					   err == EQ_NO_ERR; k++) {
+		struct Equation eq = {};
+		struct Equation diff = {};
+		struct timespec start = {};
+		struct timespec mid = {};
+		struct timespec end = {};
+		size_t num_diffs = 0;
+		volatile double sink = 0;
+
+		err = bench_load_formula(BENCH_CORPUS[k], &eq);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < BENCH_FORWARD_BUILD_RUNS && err == EQ_NO_ERR;
+			 i++) {
+			eq_dtor(&diff);
+			diff = {};
+			err = eq_ctor(&diff);
+			if (err == EQ_NO_ERR)
+				err = eq_differentiate(eq, 0, &diff);
+			if (err == EQ_NO_ERR)
+				err = eq_simplify(&diff);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (err < 0) {
+			eq_dtor(&diff);
+			eq_dtor(&eq);
+			break;
+		}
+		double build_secs = elapsed_secs(start, end) /
+							(double) BENCH_FORWARD_BUILD_RUNS;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < size; i++) {
+			double x = bench_point(i, size);
+			double val = 0;
+			double res = 0;
+			if (eq_evaluate_dual(eq, 0, &x, &val, &res) == EQ_NO_ERR)
+				sink = sink + res;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &mid);
+		for (size_t i = 0; i < size; i++) {
+			double x = bench_point(i, size);
+			double res = 0;
+			if (eq_evaluate(diff, &x, &res) == EQ_NO_ERR)
+				sink = sink + res;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		for (size_t i = 0; i < size; i++) {
+			double x = bench_point(i, size);
+			double val = 0;
+			double dual_res = 0;
+			double sym_res = 0;
+			enum EquationError dual_err = eq_evaluate_dual(eq, 0, &x, &val,
+														   &dual_res);
+			enum EquationError sym_err = eq_evaluate(diff, &x, &sym_res);
+			if (dual_err != sym_err ||
+				(dual_err == EQ_NO_ERR && !bench_is_close(sym_res, dual_res)))
+				num_diffs++;
+		}
+
+		double dual_secs = elapsed_secs(start, mid) / (double) size;
+		double sym_secs = elapsed_secs(mid, end) / (double) size;
+		printf("%12.1lf  %14.1lf  %15.1lf  ", dual_secs * 1e9, sym_secs * 1e9,
+			   build_secs * 1e6);
+		if (dual_secs > sym_secs)
+			printf("%11.0lf", ceil(build_secs / (dual_secs - sym_secs)));
+		else
+			printf("%11s", "-");
+		printf("  %11zu  %s\n", num_diffs, BENCH_CORPUS[k]);
+		eq_dtor(&diff);
+		eq_dtor(&eq);
+	}
+	return err;
+}
+
+/*
+ * First and second derivatives of BENCH_CORPUS before and after
+ * eq_eliminate_common_subexprs: the node counts and how much faster size
+ * points are evaluated by the tree walker and by the VM after it. Points
+ * where the values or the errors change are counted.
+ */
+static enum EquationError bench_cse(size_t size)
+{
+	printf("Исключение общих подвыражений, %zu точек:\n", size);
+	printf("порядок  узлов до  после  ускорение дерева  ускорение VM  "
+		   "расхождений  функция\n");
+
+	const size_t MAX_ORDER = 2;
+	size_t total_before = 0;
+	size_t total_after = 0;
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t order = 1; order <= MAX_ORDER && err == EQ_NO_ERR; order++) {
+		for (size_t k = 0; k < sizeof(BENCH_CORPUS) / sizeof(BENCH_CORPUS[0]) &&
+						   err == EQ_NO_ERR; k++) {
+			struct Equation tree = {};
+			struct Equation dag = {};
+			size_t num_before = 0;
+			size_t num_after = 0;
+			double tree_secs[2] = {};
+			double vm_secs[2] = {};
+			size_t num_diffs = 0;
+
+			err = bench_load_derivative(BENCH_CORPUS[k], order, &tree);
+			if (err == EQ_NO_ERR)
+				err = bench_load_derivative(BENCH_CORPUS[k], order, &dag);
+			if (err == EQ_NO_ERR)
+				err = eq_count_nodes(tree, &num_before);
+			if (err == EQ_NO_ERR)
+				err = eq_eliminate_common_subexprs(&dag);
+			if (err == EQ_NO_ERR)
+				err = eq_count_nodes(dag, &num_after);
+			if (err == EQ_NO_ERR)
+				err = bench_time_evaluation(tree, size, tree_secs, vm_secs);
+			if (err == EQ_NO_ERR)
+				err = bench_time_evaluation(dag, size, tree_secs + 1,
+											vm_secs + 1);
+
+			for (size_t i = 0; i < size && err == EQ_NO_ERR; i++) {
+				double x = bench_point(i, size);
+				double tree_res = 0;
+				double dag_res = 0;
+				enum EquationError tree_err = eq_evaluate(tree, &x, &tree_res);
+				enum EquationError dag_err = eq_evaluate(dag, &x, &dag_res);
+				if (tree_err != dag_err ||
+					(tree_err == EQ_NO_ERR && !bench_is_close(tree_res, dag_res)))
+					num_diffs++;
+			}
+
+			if (err == EQ_NO_ERR) {
+				total_before += num_before;
+				total_after += num_after;
+				printf("%7zu  %8zu  %5zu  %16.2lf  %12.2lf  %11zu  %s\n", order,
+					   num_before, num_after, tree_secs[0] / tree_secs[1],
+					   vm_secs[0] / vm_secs[1], num_diffs, BENCH_CORPUS[k]);
+			}
+			eq_dtor(&dag);
+			eq_dtor(&tree);
+		}
+	}
+	if (err == EQ_NO_ERR)
+		printf("Всего узлов: %zu до, %zu после\n", total_before, total_after);
+	return err;
+}
+
+/*
+ * Taylor polynomials of BENCH_HORNER_FORMULAS, which the compiler turns
+ * into one CEQ_HORNER or CEQ_ESTRIN instruction, at size points: the
+ * degree, the length of the bytecode and the time per point of the tree
+ * walker, of the VM point by point and of batch evaluation, with the
+ * largest difference of the VM from the tree walker relative to
+ * max(1, |value|).
+ */
+static enum EquationError bench_horner(size_t size)
+{
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t f = 0; f < sizeof(BENCH_HORNER_FORMULAS) /
+						   sizeof(BENCH_HORNER_FORMULAS[0]) &&
+					   err == EQ_NO_ERR; f++) {
+		printf("Формула Тейлора для %s, %zu точек:\n", BENCH_HORNER_FORMULAS[f],
+			   size);
+		printf("порядок  степень  инструкций  дерево, нс  VM, нс  пакет, нс  "
+			   "отклонение\n");
+
+		struct Equation eq = {};
+		err = bench_load_formula(BENCH_HORNER_FORMULAS[f], &eq);
+		for (size_t k = 0; k < sizeof(BENCH_HORNER_EXTENTS) /
+							   sizeof(BENCH_HORNER_EXTENTS[0]) &&
+						   err == EQ_NO_ERR; k++)
+			err = bench_horner_extent(eq, BENCH_HORNER_EXTENTS[k], size);
+		eq_dtor(&eq);
+	}
+	return err;
+}
+
+static enum EquationError bench_horner_extent(struct Equation eq, size_t extent,
+											  size_t num_points)
+{
+	size_t runs = BENCH_HORNER_EVALS / num_points + 1;
+	struct Equation teylor = {};
+	struct CompiledEquation ceq = {};
+	struct timespec start = {};
+	struct timespec end = {};
+	double tree_secs = 0;
+	double vm_secs = 0;
+	double batch_secs = 0;
+	double max_diff = 0;
+	uint32_t degree = 0;
+	volatile double sink = 0;
+
+	double *points = (double*) calloc(num_points, sizeof(double));
+	double *tree_out = (double*) calloc(num_points, sizeof(double));
+	double *vm_out = (double*) calloc(num_points, sizeof(double));
+	enum EquationError err = points && tree_out && vm_out ? EQ_NO_ERR :
+														   EQ_NO_MEM_ERR;
+	const double *columns[] = {points};
+
+	if (err == EQ_NO_ERR)
+		err = eq_ctor(&teylor);
+	if (err == EQ_NO_ERR)
+		err = eq_expand_into_teylor(eq, extent, &teylor);
+	if (err == EQ_NO_ERR)
+		err = eq_simplify(&teylor);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_ctor(&ceq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_from_equation(&ceq, teylor);
+	if (err < 0)
+		goto finally;
+	for (size_t i = 0; i < num_points; i++)
+		points[i] = bench_point(i, num_points);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t r = 0; r < runs && err == EQ_NO_ERR; r++) {
+		for (size_t i = 0; i < num_points && err == EQ_NO_ERR; i++)
+			err = eq_evaluate(teylor, points + i, tree_out + i);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	tree_secs = elapsed_secs(start, end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t r = 0; r < runs && err == EQ_NO_ERR; r++) {
+		for (size_t i = 0; i < num_points && err == EQ_NO_ERR; i++)
+			err = compiled_eq_evaluate(&ceq, points + i, vm_out + i);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	vm_secs = elapsed_secs(start, end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t r = 0; r < runs && err == EQ_NO_ERR; r++) {
+		err = compiled_eq_evaluate_batch(&ceq, columns, num_points, vm_out);
+		sink = sink + vm_out[0];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	batch_secs = elapsed_secs(start, end);
+	if (err < 0)
+		goto finally;
+
+	for (size_t i = 0; i < num_points; i++)
+		max_diff = fmax(max_diff, fabs(vm_out[i] - tree_out[i]) /
+								  fmax(1, fabs(tree_out[i])));
+	for (size_t i = 0; i < ceq.size; i++) {
+		if (ceq.code[i].opcode == CEQ_HORNER || ceq.code[i].opcode == CEQ_ESTRIN)
+			degree = ceq.code[i].arg.poly.degree;
+	}
+	printf("%7zu  %7u  %10zu  %10.1lf  %6.1lf  %9.2lf  %10.2le\n", extent,
+		   degree, ceq.size,
+		   tree_secs / (double) (runs * num_points) * 1e9,
+		   vm_secs / (double) (runs * num_points) * 1e9,
+		   batch_secs / (double) (runs * num_points) * 1e9, max_diff);
+
+	finally:
+		compiled_eq_dtor(&ceq);
+		eq_dtor(&teylor);
+		free(points);
+		free(tree_out);
+		free(vm_out);
+		return err;
+}
+
+// Parses op_name(op_name(...(x)...)) of the given depth into eq
+static enum EquationError bench_load_chain(const char *op_name, size_t depth,
+										   struct Equation *eq)
+{
+	assert(op_name);
+	assert(eq);
+
+	size_t name_len = strlen(op_name);
+	size_t len = depth * (name_len + 2) + 1;
+	char *text = (char*) calloc(len + 1, sizeof(char));
+	if (!text)
+		return EQ_NO_MEM_ERR;
+
+	char *pos = text;
+	for (size_t i = 0; i < depth; i++) {
+		memcpy(pos, op_name, name_len);
+		pos += name_len;
+		*pos++ = '(';
+	}
+	*pos++ = 'x';
+	memset(pos, ')', depth);
+	return bench_load_text(text, len, eq);
+}
+
+// Parses the calloc'ed text of length len into eq and frees it
+static enum EquationError bench_load_text(char *text, size_t len,
+										  struct Equation *eq)
+{
+	assert(text);
+	assert(eq);
+
+	struct Buffer buf = {text, text, len + 1};
+	enum EquationIOError eqio_err = eq_load_from_buf(eq, &buf);
+	buffer_dtor(&buf);
+	if (eqio_err == EQIO_NO_MEM_ERR)
+		return EQ_NO_MEM_ERR;
+	return eqio_err < 0 ? EQ_TREE_ERR : EQ_NO_ERR;
+}
+
+static enum EquationError bench_load_formula(const char *formula,
+											 struct Equation *eq)
+{
+	assert(formula);
+	assert(eq);
+
+	enum EquationError err = eq_ctor(eq);
+	if (err == EQ_NO_ERR) {
+		char *text = strdup(formula);
+		err = text ? bench_load_text(text, strlen(text), eq) : EQ_NO_MEM_ERR;
+	}
+	return err;
+}
+
+/*
+ * Loads formula and puts its derivative by x of the given order into diff,
+ * simplifying every derivative before the next one is taken
+ */
+static enum EquationError bench_load_derivative(const char *formula,
+												size_t order,
+												struct Equation *diff)
+{
+	assert(formula);
+	assert(diff);
+
+	struct Equation eq = {};
+	enum EquationError err = bench_load_formula(formula, &eq);
+	for (size_t i = 0; i < order && err == EQ_NO_ERR; i++) {
+		struct Equation next = {};
+		err = eq_ctor(&next);
+		if (err == EQ_NO_ERR)
+			err = eq_differentiate(eq, 0, &next);
+		if (err == EQ_NO_ERR)
+			err = eq_simplify(&next);
+		eq_dtor(&eq);
+		eq = next;
+	}
+	if (err < 0) {
+		eq_dtor(&eq);
+		return err;
+	}
+	*diff = eq;
+	return EQ_NO_ERR;
+}
+
+// Times eq at num_points points by the tree walker and by the bytecode VM
+static enum EquationError bench_time_evaluation(struct Equation eq,
+												size_t num_points,
+												double *tree_secs,
+												double *vm_secs)
+{
+	assert(tree_secs);
+	assert(vm_secs);
+
+	struct CompiledEquation ceq = {};
+	struct timespec start = {};
+	struct timespec mid = {};
+	struct timespec end = {};
+	volatile double sink = 0;
+
+	enum EquationError err = compiled_eq_ctor(&ceq);
+	if (err == EQ_NO_ERR)
+		err = compiled_eq_from_equation(&ceq, eq);
+	if (err < 0) {
+		compiled_eq_dtor(&ceq);
+		return err;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num_points; i++) {
+		double x = bench_point(i, num_points);
+		double res = 0;
+		if (eq_evaluate(eq, &x, &res) == EQ_NO_ERR)
+			sink = sink + res;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &mid);
+	for (size_t i = 0; i < num_points; i++) {
+		double x = bench_point(i, num_points);
+		double res = 0;
+		if (compiled_eq_evaluate(&ceq, &x, &res) == EQ_NO_ERR)
+			sink = sink + res;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*tree_secs = elapsed_secs(start, mid);
+	*vm_secs = elapsed_secs(mid, end);
+	compiled_eq_dtor(&ceq);
+	return EQ_NO_ERR;
+}
+
+// The i-th of num_points points evenly spaced in the benchmark range
+static double bench_point(size_t i, size_t num_points)
+{
+	return BENCH_POINTS_FROM + (BENCH_POINTS_TO - BENCH_POINTS_FROM) *
+							   (double) i / (double) num_points;
+}
+
+// Equal up to EQ_EPSILON relative to a, or absolute for |a| < 1
+static bool bench_is_close(double a, double b)
+{
+	return fabs(a - b) <= EQ_EPSILON * fmax(1, fabs(a));
+}
+
+// Prints the time since *start and starts the next stage
+static void bench_stage(const char *name, struct timespec *start)
+{
+	assert(name);
+	assert(start);
+
+	struct timespec end = {};
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%8.3lf с  %s\n", elapsed_secs(*start, end), name);
+	*start = end;
+}
+
+static double elapsed_secs(struct timespec start, struct timespec end)
+{
+	return (double) (end.tv_sec - start.tv_sec) +
+		   (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
@@ -0,0 +1,24 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+
+#include "math_funcs.h"
+
+/*
+ * Benchmarks run by --bench NAME instead of the usual processing of the
+ * input. Each one makes its own inputs, prints its table to stdout and
+ * returns only the errors that stop it; size is the --sweep value, or
+ * default_size if it is not given.
+ */
+typedef enum EquationError (*bench_func)(size_t size);
+
+struct BenchDef {
+	const char *name;
+	bench_func func;
+	size_t default_size;
+};
+
+const struct BenchDef *bench_find(const char *name);
+
+#endif /*_BENCH_H*/
@@ -0,0 +1,705 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "compiled_equation.h"
+#include "equation_manipulation.h"
+#include "polynomial.h"
+
+static enum EquationError compiled_eq_reserve(struct CompiledEquation *ceq,
+											  size_t new_cap);
+static enum EquationError compiled_eq_emit(struct CompiledEquation *ceq,
+										   enum CompiledOpcode opcode,
+										   union CompiledArg arg);
+static enum EquationError compiled_eq_count_refs(struct Node *tree,
+												 struct NodeMap *refs);
+static enum EquationError compiled_eq_emit_tree(struct CompiledEquation *ceq,
+												struct Node *tree,
+												struct NodeMap *refs,
+												const struct PolySubtrees *polys);
+static enum EquationError compiled_eq_emit_store(struct CompiledEquation *ceq,
+												 struct Node *node,
+												 struct NodeMap *refs,
+												 struct NodeMap *slots);
+static enum EquationError compiled_eq_emit_poly(struct CompiledEquation *ceq,
+												const struct Polynomial *poly,
+												bool *is_emitted);
+static enum EquationError compiled_eq_emit_op(struct CompiledEquation *ceq,
+											  const struct Node *node,
+											  size_t *depth);
+static bool compiled_is_exp(const struct Node *node);
+static double compiled_powi(double x, int32_t exp, bool *is_pole);
+static bool is_same_num(double a, double b);
+static double compiled_horner(const double *coefs, uint32_t degree, double x);
+static double compiled_estrin(const double *coefs, uint32_t degree, double x);
+static enum CompiledOpcode compiled_opcode(enum MathOp op);
+static enum EquationError compiled_eq_evaluate_checked(
+											const struct CompiledEquation *ceq,
+											double *stack, const double *vals,
+											double *res);
+
+enum EquationError compiled_eq_ctor(struct CompiledEquation *ceq)
+{
+	assert(ceq);
+
+	ceq->code = NULL;
+	ceq->size = 0;
+	ceq->cap = 0;
+	ceq->coefs = NULL;
+	ceq->num_coefs = 0;
+	ceq->cap_coefs = 0;
+	ceq->stack = NULL;
+	ceq->max_depth = 0;
+	ceq->num_slots = 0;
+	ceq->num_vars = 0;
+	return compiled_eq_reserve(ceq, COMPILED_EQ_INIT_CAPACITY);
+}
+
+void compiled_eq_dtor(struct CompiledEquation *ceq)
+{
+	assert(ceq);
+
+	free(ceq->code);
+	free(ceq->coefs);
+	free(ceq->stack);
+	ceq->code = NULL;
+	ceq->coefs = NULL;
+	ceq->stack = NULL;
+	ceq->size = 0;
+	ceq->cap = 0;
+	ceq->num_coefs = 0;
+	ceq->cap_coefs = 0;
+	ceq->max_depth = 0;
+	ceq->num_slots = 0;
+	ceq->num_vars = 0;
+}
+
+static enum EquationError compiled_eq_reserve(struct CompiledEquation *ceq,
+											  size_t new_cap)
+{
+	assert(ceq);
+
+	if (new_cap <= ceq->cap)
+		return EQ_NO_ERR;
+
+	struct CompiledInstr *code = (struct CompiledInstr*) realloc(ceq->code,
+									new_cap * sizeof(struct CompiledInstr));
+	if (!code)
+		return EQ_NO_MEM_ERR;
+	ceq->code = code;
+	ceq->cap = new_cap;
+	return EQ_NO_ERR;
+}
+
+static enum EquationError compiled_eq_emit(struct CompiledEquation *ceq,
+										   enum CompiledOpcode opcode,
+										   union CompiledArg arg)
+{
+	assert(ceq);
+
+	if (ceq->size >= ceq->cap) {
+		enum EquationError err = compiled_eq_reserve(ceq, 2 * ceq->cap +
+													 COMPILED_EQ_INIT_CAPACITY);
+		if (err < 0)
+			return err;
+	}
+	ceq->code[ceq->size].arg = arg;
+	ceq->code[ceq->size].opcode = (uint8_t) opcode;
+	ceq->size++;
+	return EQ_NO_ERR;
+}
+
+enum EquationError compiled_eq_from_equation(struct CompiledEquation *ceq,
+											 struct Equation eq)
+{
+	assert(ceq);
+
+	ceq->size = 0;
+	ceq->num_coefs = 0;
+	ceq->max_depth = 0;
+	ceq->num_slots = 0;
+	ceq->num_vars = 0;
+	if (!eq.tree)
+		return EQ_NO_ERR;
+
+	struct PolySubtrees polys = {};
+	enum EquationError err = poly_subtrees_ctor(&polys);
+	if (err == EQ_NO_ERR)
+		err = eq_find_polynomials(eq, &polys);
+	if (err == EQ_NO_ERR && (!eq.arena || !eq.arena->is_shared)) {
+		err = compiled_eq_emit_tree(ceq, eq.tree, NULL, &polys);
+	} else if (err == EQ_NO_ERR) {
+		struct NodeMap refs = {};
+		if (node_map_ctor(&refs) < 0)
+			err = EQ_NO_MEM_ERR;
+		if (err == EQ_NO_ERR)
+			err = compiled_eq_count_refs(eq.tree, &refs);
+		if (err == EQ_NO_ERR)
+			err = compiled_eq_emit_tree(ceq, eq.tree, &refs, &polys);
+		node_map_dtor(&refs);
+	}
+	poly_subtrees_dtor(&polys);
+	if (err < 0)
+		return err;
+
+	double *stack = (double*) realloc(ceq->stack, (ceq->max_depth +
+									  ceq->num_slots) * sizeof(double));
+	if (!stack)
+		return EQ_NO_MEM_ERR;
+	ceq->stack = stack;
+	return EQ_NO_ERR;
+}
+
+/*
+ * Counts parents of every operator node of a hash-consed tree, the subtree
+ * under a node is walked only on its first visit.
+ */
+static enum EquationError compiled_eq_count_refs(struct Node *tree,
+												 struct NodeMap *refs)
+{
+	assert(refs);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	if (tree_walk_start(&walk, tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+		if (frame.step != NODE_VISIT_PRE || frame.node->data.type != MATH_OP)
+			continue;
+
+		union NodeMapValue *count = node_map_find(refs, frame.node);
+		if (count) {
+			count->ind++;
+			tree_walk_skip(&walk, frame.node);
+			continue;
+		}
+		union NodeMapValue first = {};
+		first.ind = 1;
+		if (node_map_insert(refs, frame.node, first) < 0)
+			err = EQ_NO_MEM_ERR;
+	}
+
+	node_stack_dtor(&walk);
+	return err;
+}
+
+static enum EquationError compiled_eq_emit_tree(struct CompiledEquation *ceq,
+												struct Node *tree,
+												struct NodeMap *refs,
+												const struct PolySubtrees *polys)
+{
+	assert(ceq);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	struct NodeMap slots = {};
+	enum EquationError err = EQ_NO_ERR;
+	size_t depth = 0;
+	const struct Node *skipped = NULL;
+
+	if ((refs && node_map_ctor(&slots) < 0) ||
+		tree_walk_start(&walk, tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		struct Node *node = frame.node;
+		union CompiledArg arg = {};
+		union NodeMapValue *slot = NULL;
+		union NodeMapValue *poly = NULL;
+		bool is_emitted = false;
+		if (frame.step == NODE_VISIT_PRE && node == skipped) {
+			// The base of e^x, the next frame after its parent's one
+			tree_walk_skip(&walk, node);
+			skipped = NULL;
+		} else if (frame.step == NODE_VISIT_PRE && refs &&
+			(slot = node_map_find(&slots, node))) {
+			tree_walk_skip(&walk, node);
+			arg.ind = (uint32_t) slot->ind;
+			err = compiled_eq_emit(ceq, CEQ_LOAD, arg);
+			depth++;
+		} else if (frame.step == NODE_VISIT_PRE && polys &&
+				   (poly = node_map_find(&polys->roots, node)) &&
+				   (err = compiled_eq_emit_poly(ceq, polys->polys + poly->ind,
+												&is_emitted)) == EQ_NO_ERR &&
+				   is_emitted) {
+			tree_walk_skip(&walk, node);
+			err = compiled_eq_emit_store(ceq, node, refs, &slots);
+			depth++;
+		} else if (err < 0 || frame.step != NODE_VISIT_POST) {
+			if (frame.step == NODE_VISIT_PRE && compiled_is_exp(node))
+				skipped = node->left;
+			continue;
+		} else if (node->data.type == MATH_NUM) {
+			arg.num = node->data.value.num;
+			err = compiled_eq_emit(ceq, CEQ_NUM, arg);
+			depth++;
+		} else if (node->data.type == MATH_VAR) {
+			arg.ind = (uint32_t) node->data.value.var_ind;
+			err = compiled_eq_emit(ceq, CEQ_VAR, arg);
+			if (node->data.value.var_ind >= ceq->num_vars)
+				ceq->num_vars = node->data.value.var_ind + 1;
+			depth++;
+		} else if (node->data.type == MATH_OP &&
+				   node->data.value.op < MATH_OP_DEFS_SIZE) {
+			err = compiled_eq_emit_op(ceq, node, &depth);
+			if (err == EQ_NO_ERR)
+				err = compiled_eq_emit_store(ceq, node, refs, &slots);
+		} else {
+			err = EQ_UNKNOWN_OP_ERR;
+		}
+
+		if (depth > ceq->max_depth)
+			ceq->max_depth = depth;
+	}
+
+	node_map_dtor(&slots);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+/*
+ * Emits the operator of node, whose operands are already on the stack. A
+ * constant right operand is the last instruction emitted, so it can be
+ * folded into a cheaper instruction; the base of e^x is not emitted at all.
+ */
+static enum EquationError compiled_eq_emit_op(struct CompiledEquation *ceq,
+											  const struct Node *node,
+											  size_t *depth)
+{
+	assert(ceq);
+	assert(node);
+	assert(depth);
+
+	enum MathOp op = node->data.value.op;
+	union CompiledArg arg = {};
+	arg.ind = (uint32_t) op;
+	if (compiled_is_exp(node))
+		return compiled_eq_emit(ceq, CEQ_EXP, arg);
+	if (node->left)
+		(*depth)--;
+
+	const struct Node *right = node->right;
+	if (!right || right->data.type != MATH_NUM ||
+		(op != MATH_POW && op != MATH_DIV))
+		return compiled_eq_emit(ceq, compiled_opcode(op), arg);
+
+	assert(ceq->size > 0 && ceq->code[ceq->size - 1].opcode == CEQ_NUM);
+	double val = right->data.value.num;
+	if (op == MATH_DIV) {
+		if (fabs(val) < EQ_EPSILON)
+			return compiled_eq_emit(ceq, CEQ_DIV, arg);
+		ceq->code[ceq->size - 1].arg.num = 1 / val;
+		arg.ind = MATH_MULT;
+		return compiled_eq_emit(ceq, CEQ_MULT, arg);
+	}
+
+	if (is_same_num(val, 0.5)) {
+		ceq->size--;
+		arg.ind = MATH_SQRT;
+		return compiled_eq_emit(ceq, CEQ_SQRT, arg);
+	}
+	if (fabs(val) <= CEQ_POWI_MAX_EXP && is_same_num(val, round(val))) {
+		ceq->size--;
+		arg.exp = (int32_t) val;
+		return compiled_eq_emit(ceq, CEQ_POWI, arg);
+	}
+	return compiled_eq_emit(ceq, CEQ_POW, arg);
+}
+
+static bool compiled_is_exp(const struct Node *node)
+{
+	assert(node);
+
+	return node->data.type == MATH_OP && node->data.value.op == MATH_POW &&
+		   node->left && node->left->data.type == MATH_NUM &&
+		   is_same_num(node->left->data.value.num, M_E) && node->right;
+}
+
+// Keeps the value of a node with several parents in a new slot
+static enum EquationError compiled_eq_emit_store(struct CompiledEquation *ceq,
+												 struct Node *node,
+												 struct NodeMap *refs,
+												 struct NodeMap *slots)
+{
+	assert(ceq);
+	assert(node);
+	assert(slots);
+
+	union NodeMapValue *count = NULL;
+	if (refs)
+		count = node_map_find(refs, node);
+	if (!count || count->ind <= 1)
+		return EQ_NO_ERR;
+
+	union NodeMapValue new_slot = {};
+	new_slot.ind = ceq->num_slots++;
+	if (node_map_insert(slots, node, new_slot) < 0)
+		return EQ_NO_MEM_ERR;
+	union CompiledArg arg = {};
+	arg.ind = (uint32_t) new_slot.ind;
+	return compiled_eq_emit(ceq, CEQ_STORE, arg);
+}
+
+/*
+ * Emits CEQ_VAR and CEQ_HORNER or CEQ_ESTRIN for a polynomial in one
+ * variable of degree from 1 to CEQ_POLY_MAX_DEGREE, otherwise *is_emitted
+ * is false and nothing is emitted.
+ */
+static enum EquationError compiled_eq_emit_poly(struct CompiledEquation *ceq,
+												const struct Polynomial *poly,
+												bool *is_emitted)
+{
+	assert(ceq);
+	assert(poly);
+	assert(is_emitted);
+
+	*is_emitted = false;
+	size_t var_ind = poly->num_vars;
+	uint32_t degree = 0;
+	for (size_t i = 0; i < poly->size; i++) {
+		for (size_t k = 0; k < poly->num_vars; k++) {
+			uint32_t exp = poly->exps[i * poly->num_vars + k];
+			if (exp == 0)
+				continue;
+			if (var_ind != poly->num_vars && var_ind != k)
+				return EQ_NO_ERR;
+			var_ind = k;
+			if (exp > degree)
+				degree = exp;
+		}
+	}
+	if (degree == 0 || degree > CEQ_POLY_MAX_DEGREE)
+		return EQ_NO_ERR;
+
+	bool is_estrin = degree >= CEQ_ESTRIN_MIN_DEGREE;
+	size_t num_coefs = degree + 1;
+	if (is_estrin)
+		num_coefs = (num_coefs + CEQ_ESTRIN_BLOCK - 1) / CEQ_ESTRIN_BLOCK *
+					CEQ_ESTRIN_BLOCK;
+	if (ceq->num_coefs + num_coefs > ceq->cap_coefs) {
+		size_t cap = 2 * ceq->cap_coefs + num_coefs;
+		double *coefs = (double*) realloc(ceq->coefs, cap * sizeof(double));
+		if (!coefs)
+			return EQ_NO_MEM_ERR;
+		ceq->coefs = coefs;
+		ceq->cap_coefs = cap;
+	}
+
+	double *coefs = ceq->coefs + ceq->num_coefs;
+	for (size_t i = 0; i < num_coefs; i++)
+		coefs[i] = 0;
+	for (size_t i = 0; i < poly->size; i++)
+		coefs[poly->exps[i * poly->num_vars + var_ind]] += poly->coefs[i];
+
+	union CompiledArg arg = {};
+	arg.ind = (uint32_t) var_ind;
+	enum EquationError err = compiled_eq_emit(ceq, CEQ_VAR, arg);
+	if (err < 0)
+		return err;
+	if (var_ind >= ceq->num_vars)
+		ceq->num_vars = var_ind + 1;
+
+	arg.poly.coef_ind = (uint32_t) ceq->num_coefs;
+	arg.poly.degree = degree;
+	err = compiled_eq_emit(ceq, is_estrin ? CEQ_ESTRIN : CEQ_HORNER, arg);
+	if (err < 0)
+		return err;
+	ceq->num_coefs += num_coefs;
+	*is_emitted = true;
+	return EQ_NO_ERR;
+}
+
+// A negative power of 0 is a division by zero, *is_pole is set instead
+static double compiled_powi(double x, int32_t exp, bool *is_pole)
+{
+	assert(is_pole);
+
+	uint32_t n = exp < 0 ? 0 - (uint32_t) exp : (uint32_t) exp;
+	double res = 1;
+	for (; n > 0; n >>= 1) {
+		if (n & 1)
+			res *= x;
+		x *= x;
+	}
+	*is_pole = exp < 0 && !(fabs(res) > 0);
+	return exp < 0 ? 1 / (*is_pole ? 1 : res) : res;
+}
+
+static double compiled_horner(const double *coefs, uint32_t degree, double x)
+{
+	assert(coefs);
+
+	double res = coefs[degree];
+	for (uint32_t i = degree; i-- > 0;)
+		res = res * x + coefs[i];
+	return res;
+}
+
+/*
+ * Blocks c0 + c1 x + (c2 + c3 x) x^2 are independent of each other and are
+ * summed up by Horner's scheme in x^4.
+ */
+static double compiled_estrin(const double *coefs, uint32_t degree, double x)
+{
+	assert(coefs);
+
+	double x2 = x * x;
+	double x4 = x2 * x2;
+	uint32_t block = degree / CEQ_ESTRIN_BLOCK * CEQ_ESTRIN_BLOCK;
+	const double *c = coefs + block;
+	double res = (c[0] + c[1] * x) + (c[2] + c[3] * x) * x2;
+	while (block > 0) {
+		block -= CEQ_ESTRIN_BLOCK;
+		c = coefs + block;
+		res = res * x4 + ((c[0] + c[1] * x) + (c[2] + c[3] * x) * x2);
+	}
+	return res;
+}
+
+static enum CompiledOpcode compiled_opcode(enum MathOp op)
+{
+	switch (op) {
+		case MATH_ADD:		return CEQ_ADD;
+		case MATH_SUB:		return CEQ_SUB;
+		case MATH_MULT:		return CEQ_MULT;
+		case MATH_DIV:		return CEQ_DIV;
+		case MATH_POW:		return CEQ_POW;
+		case MATH_LN:		return CEQ_LN;
+		case MATH_SQRT:		return CEQ_SQRT;
+		case MATH_COS:		return CEQ_COS;
+		case MATH_SIN:		return CEQ_SIN;
+		case MATH_TG:		return CEQ_TG;
+		case MATH_CTG:		return CEQ_CTG;
+		case MATH_ARCSIN:	return CEQ_ARCSIN;
+		case MATH_ARCCOS:	return CEQ_ARCCOS;
+		case MATH_ARCTG:	return CEQ_ARCTG;
+		case MATH_ARCCTG:	return CEQ_ARCCTG;
+		default:
+			assert(0 && "Unknown operator");
+			return CEQ_ADD;
+	}
+}
+
+enum EquationError compiled_eq_evaluate(struct CompiledEquation *ceq,
+										const double *vals, double *res)
+{
+	assert(ceq);
+
+	return compiled_eq_evaluate_stack(ceq, ceq->stack, vals, res);
+}
+
+enum EquationError compiled_eq_evaluate_stack(
+											const struct CompiledEquation *ceq,
+											double *stack, const double *vals,
+											double *res)
+{
+	assert(ceq);
+	assert(vals);
+	assert(res);
+
+	if (ceq->size == 0) {
+		*res = NAN;
+		return EQ_NO_ERR;
+	}
+
+	double *sp = stack;
+	double *slots = stack + ceq->max_depth;
+	bool domain_err = false;
+	const struct CompiledInstr *end = ceq->code + ceq->size;
+	for (const struct CompiledInstr *ip = ceq->code; ip < end; ip++) {
+		switch ((enum CompiledOpcode) ip->opcode) {
+			case CEQ_NUM:
+				*sp++ = ip->arg.num;
+				break;
+			case CEQ_VAR:
+				*sp++ = vals[ip->arg.ind];
+				break;
+			case CEQ_LOAD:
+				*sp++ = slots[ip->arg.ind];
+				break;
+			case CEQ_STORE:
+				slots[ip->arg.ind] = sp[-1];
+				break;
+			case CEQ_ADD:
+				sp--;
+				sp[-1] += *sp;
+				break;
+			case CEQ_SUB:
+				sp--;
+				sp[-1] -= *sp;
+				break;
+			case CEQ_MULT:
+				sp--;
+				sp[-1] *= *sp;
+				break;
+			case CEQ_DIV: {
+				sp--;
+				// The flag alone records the error, 1 keeps the division defined
+				bool is_zero = fabs(*sp) < EQ_EPSILON;
+				domain_err |= is_zero;
+				sp[-1] /= is_zero ? 1 : *sp;
+				break;
+			}
+			case CEQ_POW:
+				sp--;
+				sp[-1] = pow(sp[-1], *sp);
+				break;
+			case CEQ_LN:
+				domain_err |= sp[-1] <= 0;
+				sp[-1] = log(sp[-1]);
+				break;
+			case CEQ_SQRT:
+				sp[-1] = sqrt(sp[-1]);
+				break;
+			case CEQ_COS:
+				sp[-1] = cos(sp[-1]);
+				break;
+			case CEQ_SIN:
+				sp[-1] = sin(sp[-1]);
+				break;
+			case CEQ_TG:
+				sp[-1] = tan(sp[-1]);
+				break;
+			case CEQ_CTG: {
+				double tg = tan(sp[-1]);
+				bool is_zero = fabs(tg) < EQ_EPSILON;
+				domain_err |= is_zero;
+				sp[-1] = 1 / (is_zero ? 1 : tg);
+				break;
+			}
+			case CEQ_ARCSIN:
+				domain_err |= fabs(sp[-1]) > 1;
+				sp[-1] = asin(sp[-1]);
+				break;
+			case CEQ_ARCCOS:
+				domain_err |= fabs(sp[-1]) > 1;
+				sp[-1] = acos(sp[-1]);
+				break;
+			case CEQ_ARCTG:
+				sp[-1] = atan(sp[-1]);
+				break;
+			case CEQ_ARCCTG:
+				sp[-1] = M_PI_2 - atan(sp[-1]);
+				break;
+			case CEQ_EXP:
+				sp[-1] = exp(sp[-1]);
+				break;
+			case CEQ_POWI: {
+				bool is_pole = false;
+				sp[-1] = compiled_powi(sp[-1], ip->arg.exp, &is_pole);
+				domain_err |= is_pole;
+				break;
+			}
+			case CEQ_HORNER:
+				sp[-1] = compiled_horner(ceq->coefs + ip->arg.poly.coef_ind,
+										 ip->arg.poly.degree, sp[-1]);
+				break;
+			case CEQ_ESTRIN:
+				sp[-1] = compiled_estrin(ceq->coefs + ip->arg.poly.coef_ind,
+										 ip->arg.poly.degree, sp[-1]);
+				break;
+			default:
+				return EQ_UNKNOWN_OP_ERR;
+		}
+	}
+
+	if (domain_err)
+		return compiled_eq_evaluate_checked(ceq, stack, vals, res);
+	*res = sp[-1];
+	return EQ_NO_ERR;
+}
+
+/*
+ * Slow path: evaluates instruction by instruction with MATH_OP_DEFS to find
+ * the error eq_evaluate would return.
+ */
+static enum EquationError compiled_eq_evaluate_checked(
+											const struct CompiledEquation *ceq,
+											double *stack, const double *vals,
+											double *res)
+{
+	assert(ceq);
+
+	double *sp = stack;
+	double *slots = stack + ceq->max_depth;
+	enum EquationError err = EQ_NO_ERR;
+	for (size_t i = 0; i < ceq->size; i++) {
+		const struct CompiledInstr *ip = ceq->code + i;
+		switch ((enum CompiledOpcode) ip->opcode) {
+			case CEQ_NUM:
+				*sp++ = ip->arg.num;
+				break;
+			case CEQ_VAR:
+				*sp++ = vals[ip->arg.ind];
+				break;
+			case CEQ_LOAD:
+				*sp++ = slots[ip->arg.ind];
+				break;
+			case CEQ_STORE:
+				slots[ip->arg.ind] = sp[-1];
+				break;
+			case CEQ_ADD:
+			case CEQ_SUB:
+			case CEQ_MULT:
+			case CEQ_DIV:
+			case CEQ_POW:
+				sp--;
+				sp[-1] = (*MATH_OP_DEFS[ip->arg.ind].eval)(sp[-1], *sp, &err);
+				break;
+			case CEQ_LN:
+			case CEQ_SQRT:
+			case CEQ_COS:
+			case CEQ_SIN:
+			case CEQ_TG:
+			case CEQ_CTG:
+			case CEQ_ARCSIN:
+			case CEQ_ARCCOS:
+			case CEQ_ARCTG:
+			case CEQ_ARCCTG:
+				sp[-1] = (*MATH_OP_DEFS[ip->arg.ind].eval)(NAN, sp[-1],
+														 &err);
+				break;
+			case CEQ_EXP:
+				sp[-1] = exp(sp[-1]);
+				break;
+			case CEQ_POWI: {
+				bool is_pole = false;
+				sp[-1] = compiled_powi(sp[-1], ip->arg.exp, &is_pole);
+				if (is_pole)
+					err = EQ_ZERO_DIV_ERR;
+				break;
+			}
+			case CEQ_HORNER:
+				sp[-1] = compiled_horner(ceq->coefs + ip->arg.poly.coef_ind,
+										 ip->arg.poly.degree, sp[-1]);
+				break;
+			case CEQ_ESTRIN:
+				sp[-1] = compiled_estrin(ceq->coefs + ip->arg.poly.coef_ind,
+										 ip->arg.poly.degree, sp[-1]);
+				break;
+			default:
+				return EQ_UNKNOWN_OP_ERR;
+		}
+		if (err < 0)
+			return err;
+	}
+
+	*res = sp[-1];
+	return EQ_NO_ERR;
+}
+
+// Exact, so that a rewrite changes a value no more than rounding does
+static bool is_same_num(double a, double b)
+{
+	return !(fabs(a - b) > 0);
+}
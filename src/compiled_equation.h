@@ -0,0 +1,129 @@
+#ifndef _COMPILED_EQUATION_H
+#define _COMPILED_EQUATION_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "math_funcs.h"
+#include "equation_utils.h"
+
+/*
+ * Equation compiled to postfix bytecode for evaluating it at many points.
+ * Leaves push a value on a stack and operators replace their operands with
+ * the result; numbers are stored right in the instructions. A subtree that
+ * is shared in a hash-consed equation is computed once, kept in a slot by
+ * CEQ_STORE and pushed again by CEQ_LOAD.
+ *
+ * Domain violations (division by zero, ln of a non-positive number, ...) are
+ * accumulated in a flag that is checked once per evaluation. Only when it is
+ * set the code is rerun through MATH_OP_DEFS evaluators to report the same
+ * error as eq_evaluate.
+ *
+ * Operators are strength-reduced as they are compiled: constant integer
+ * powers become multiplications by squaring (CEQ_POWI), x^0.5 becomes sqrt,
+ * e^x (as math_diff_pow writes it) becomes exp and division by a constant
+ * becomes multiplication by its reciprocal, which may differ from the
+ * division in the last bit.
+ *
+ * A polynomial subtree in one variable that is written out as a sum of
+ * terms is evaluated by a single instruction from its coefficients: by
+ * Horner's scheme, or by Estrin's scheme for high degrees, where pairs and
+ * quadruples of terms are independent and fill the pipeline better.
+ */
+
+enum CompiledOpcode {
+	CEQ_NUM,
+	CEQ_VAR,
+	CEQ_LOAD,
+	CEQ_STORE,
+	CEQ_ADD,
+	CEQ_SUB,
+	CEQ_MULT,
+	CEQ_DIV,
+	CEQ_POW,
+	CEQ_LN,
+	CEQ_SQRT,
+	CEQ_COS,
+	CEQ_SIN,
+	CEQ_TG,
+	CEQ_CTG,
+	CEQ_ARCSIN,
+	CEQ_ARCCOS,
+	CEQ_ARCTG,
+	CEQ_ARCCTG,
+	CEQ_EXP,
+	CEQ_POWI,
+	CEQ_HORNER,
+	CEQ_ESTRIN,
+};
+
+const size_t CEQ_NUM_OPCODES = (size_t) CEQ_ESTRIN + 1;
+
+const int32_t CEQ_POWI_MAX_EXP = 64;
+const uint32_t CEQ_POLY_MAX_DEGREE = 64;
+const uint32_t CEQ_ESTRIN_MIN_DEGREE = 12;
+// Estrin's scheme takes coefficients by blocks of this many
+const uint32_t CEQ_ESTRIN_BLOCK = 4;
+
+struct CompiledPolyArg {
+	uint32_t coef_ind;
+	uint32_t degree;
+};
+
+/*
+ * arg.ind is the variable index for CEQ_VAR, the slot for CEQ_LOAD and
+ * CEQ_STORE and the MathOp of operator instructions. arg.exp is the
+ * exponent of CEQ_POWI. CEQ_HORNER and
+ * CEQ_ESTRIN replace x on the top of the stack with the polynomial of
+ * arg.poly.degree with coefficients from coefs[arg.poly.coef_ind], the
+ * lowest degree first (padded with zeros to whole blocks for CEQ_ESTRIN).
+ */
+union CompiledArg {
+	double num;
+	uint32_t ind;
+	int32_t exp;
+	struct CompiledPolyArg poly;
+};
+
+struct CompiledInstr {
+	union CompiledArg arg;
+	uint8_t opcode;
+};
+
+static_assert(sizeof(struct CompiledInstr) == 16,
+			  "CompiledInstr must stay 16 bytes");
+
+const size_t COMPILED_EQ_INIT_CAPACITY = 64;
+
+struct CompiledEquation {
+	struct CompiledInstr *code;
+	size_t size;
+	size_t cap;
+
+	double *coefs;
+	size_t num_coefs;
+	size_t cap_coefs;
+
+	double *stack;
+	size_t max_depth;
+	size_t num_slots;
+	size_t num_vars;
+};
+
+enum EquationError compiled_eq_ctor(struct CompiledEquation *ceq);
+void compiled_eq_dtor(struct CompiledEquation *ceq);
+
+enum EquationError compiled_eq_from_equation(struct CompiledEquation *ceq,
+											 struct Equation eq);
+enum EquationError compiled_eq_evaluate(struct CompiledEquation *ceq,
+										const double *vals, double *res);
+/*
+ * Same as compiled_eq_evaluate, but on a caller's stack of max_depth +
+ * num_slots values, so several threads can share one CompiledEquation.
+ */
+enum EquationError compiled_eq_evaluate_stack(
+											const struct CompiledEquation *ceq,
+											double *stack, const double *vals,
+											double *res);
+
+#endif /*_COMPILED_EQUATION_H*/
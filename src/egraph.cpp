@@ -0,0 +1,854 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "egraph.h"
+#include "equation_io.h"
+#include "equation_manipulation.h"
+
+struct EGraphMatch {
+	uint32_t rule;
+	uint32_t cls;
+	uint32_t subst[EGRAPH_MAX_PATTERN_VARS];
+};
+
+/*
+ * Backtracking matcher: pending (pattern, class) pairs wait on a small
+ * stack, every complete set of bindings goes to matches.
+ */
+struct EGraphMatcher {
+	struct EGraph *eg;
+	const struct Node *pending_pat[EGRAPH_MAX_PATTERN_SIZE];
+	uint32_t pending_cls[EGRAPH_MAX_PATTERN_SIZE];
+	size_t num_pending;
+	uint32_t subst[EGRAPH_MAX_PATTERN_VARS];
+
+	uint32_t rule;
+	uint32_t root;
+	struct EGraphMatch *matches;
+	size_t num_matches;
+	size_t cap_matches;
+	size_t max_matches;
+	enum EquationError err;
+};
+
+struct EGraphBuildFrame {
+	uint32_t cls;
+	bool is_expanded;
+};
+
+static uint32_t egraph_find(struct EGraph *eg, uint32_t cls);
+static bool egraph_union(struct EGraph *eg, uint32_t a, uint32_t b);
+static enum EquationError egraph_add(struct EGraph *eg, struct MathToken tok,
+									 uint32_t left, uint32_t right,
+									 uint32_t *cls);
+static enum EquationError egraph_new_class(struct EGraph *eg, uint32_t *cls);
+static size_t egraph_hash(const struct ENode *node);
+static bool egraph_node_equal(const struct ENode *a, const struct ENode *b);
+static uint32_t egraph_table_find(const struct EGraph *eg,
+								  const struct ENode *key);
+static void egraph_table_insert(struct EGraph *eg, uint32_t ind);
+static enum EquationError egraph_table_grow(struct EGraph *eg);
+static enum EquationError egraph_rebuild(struct EGraph *eg);
+static enum EquationError egraph_fold(struct EGraph *eg, uint32_t ind,
+									  bool *is_folded);
+static void egraph_match(struct EGraphMatcher *m);
+static enum EquationError egraph_instantiate(struct EGraph *eg,
+											 const struct Node *pat,
+											 const uint32_t *subst,
+											 uint32_t *cls);
+static void egraph_compute_costs(struct EGraph *eg);
+static double seconds_since(const struct timespec *start);
+static bool is_equal(double a, double b);
+
+enum EquationError egraph_ctor(struct EGraph *eg)
+{
+	assert(eg);
+
+	eg->nodes = (struct ENode*) calloc(EGRAPH_INIT_CAPACITY,
+									   sizeof(struct ENode));
+	eg->classes = (struct EClass*) calloc(EGRAPH_INIT_CAPACITY,
+										  sizeof(struct EClass));
+	eg->table = (uint32_t*) malloc(2 * EGRAPH_INIT_CAPACITY *
+								   sizeof(uint32_t));
+	eg->num_nodes = 0;
+	eg->num_classes = 0;
+	eg->cap_nodes = EGRAPH_INIT_CAPACITY;
+	eg->cap_classes = EGRAPH_INIT_CAPACITY;
+	eg->table_cap = 2 * EGRAPH_INIT_CAPACITY;
+	if (!eg->nodes || !eg->classes || !eg->table) {
+		egraph_dtor(eg);
+		return EQ_NO_MEM_ERR;
+	}
+	memset(eg->table, 0xff, eg->table_cap * sizeof(uint32_t));
+	return EQ_NO_ERR;
+}
+
+void egraph_dtor(struct EGraph *eg)
+{
+	assert(eg);
+
+	free(eg->nodes);
+	free(eg->classes);
+	free(eg->table);
+	eg->nodes = NULL;
+	eg->classes = NULL;
+	eg->table = NULL;
+	eg->num_nodes = 0;
+	eg->num_classes = 0;
+	eg->cap_nodes = 0;
+	eg->cap_classes = 0;
+	eg->table_cap = 0;
+}
+
+static uint32_t egraph_find(struct EGraph *eg, uint32_t cls)
+{
+	assert(eg);
+	assert(cls < eg->num_classes);
+
+	while (eg->classes[cls].parent != cls) {
+		eg->classes[cls].parent =
+						eg->classes[eg->classes[cls].parent].parent;
+		cls = eg->classes[cls].parent;
+	}
+	return cls;
+}
+
+static bool egraph_union(struct EGraph *eg, uint32_t a, uint32_t b)
+{
+	assert(eg);
+
+	a = egraph_find(eg, a);
+	b = egraph_find(eg, b);
+	if (a == b)
+		return false;
+
+	struct EClass *big = eg->classes + a;
+	struct EClass *small = eg->classes + b;
+	if (big->size < small->size) {
+		struct EClass *tmp = big;
+		big = small;
+		small = tmp;
+	}
+	small->parent = big->parent;
+	big->size += small->size;
+	eg->nodes[big->tail].next = small->head;
+	big->tail = small->tail;
+	if (!big->is_const && small->is_const) {
+		big->is_const = true;
+		big->value = small->value;
+	}
+	return true;
+}
+
+static enum EquationError egraph_new_class(struct EGraph *eg, uint32_t *cls)
+{
+	assert(eg);
+	assert(cls);
+
+	if (eg->num_classes >= eg->cap_classes) {
+		struct EClass *tmp = (struct EClass*) realloc(eg->classes,
+								2 * eg->cap_classes * sizeof(struct EClass));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		eg->classes = tmp;
+		eg->cap_classes *= 2;
+	}
+
+	*cls = (uint32_t) eg->num_classes++;
+	struct EClass *eclass = eg->classes + *cls;
+	eclass->parent = *cls;
+	eclass->size = 1;
+	eclass->head = EGRAPH_NONE;
+	eclass->tail = EGRAPH_NONE;
+	eclass->value = NAN;
+	eclass->is_const = false;
+	eclass->cost = INFINITY;
+	eclass->best = EGRAPH_NONE;
+	return EQ_NO_ERR;
+}
+
+/*
+ * Returns the class of an e-node with canonical children, adding the node
+ * if the graph has no such one yet. An operator over constant classes makes
+ * a constant class with the computed number in it.
+ */
+static enum EquationError egraph_add(struct EGraph *eg, struct MathToken tok,
+									 uint32_t left, uint32_t right,
+									 uint32_t *cls)
+{
+	assert(eg);
+	assert(cls);
+
+	if (tok.type == MATH_NUM)
+		tok.value.num += 0.0;
+
+	struct ENode key = {};
+	key.tok = tok;
+	key.left = left == EGRAPH_NONE ? EGRAPH_NONE : egraph_find(eg, left);
+	key.right = right == EGRAPH_NONE ? EGRAPH_NONE : egraph_find(eg, right);
+	key.next = EGRAPH_NONE;
+
+	uint32_t found = egraph_table_find(eg, &key);
+	if (found != EGRAPH_NONE) {
+		*cls = egraph_find(eg, eg->nodes[found].cls);
+		return EQ_NO_ERR;
+	}
+
+	if (eg->num_nodes >= EGRAPH_NONE - 1)
+		return EQ_NO_MEM_ERR;
+	if (eg->num_nodes >= eg->cap_nodes) {
+		struct ENode *tmp = (struct ENode*) realloc(eg->nodes,
+								2 * eg->cap_nodes * sizeof(struct ENode));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		eg->nodes = tmp;
+		eg->cap_nodes *= 2;
+	}
+	if (2 * (eg->num_nodes + 1) > eg->table_cap &&
+		egraph_table_grow(eg) < 0)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = egraph_new_class(eg, cls);
+	if (err < 0)
+		return err;
+
+	uint32_t ind = (uint32_t) eg->num_nodes++;
+	key.cls = *cls;
+	eg->nodes[ind] = key;
+	eg->classes[*cls].head = ind;
+	eg->classes[*cls].tail = ind;
+	egraph_table_insert(eg, ind);
+
+	if (tok.type == MATH_NUM) {
+		eg->classes[*cls].is_const = true;
+		eg->classes[*cls].value = tok.value.num;
+	} else if (tok.type == MATH_OP) {
+		bool is_folded = false;
+		err = egraph_fold(eg, ind, &is_folded);
+		if (err < 0)
+			return err;
+		*cls = egraph_find(eg, *cls);
+	}
+	return EQ_NO_ERR;
+}
+
+/*
+ * Merges the class of an operator e-node with the number it evaluates to
+ * when all its operands are constant.
+ */
+static enum EquationError egraph_fold(struct EGraph *eg, uint32_t ind,
+									  bool *is_folded)
+{
+	assert(eg);
+	assert(is_folded);
+
+	*is_folded = false;
+	struct ENode node = eg->nodes[ind];
+	uint32_t cls = egraph_find(eg, node.cls);
+	if (eg->classes[cls].is_const)
+		return EQ_NO_ERR;
+
+	double left = NAN;
+	if (node.left != EGRAPH_NONE) {
+		uint32_t left_cls = egraph_find(eg, node.left);
+		if (!eg->classes[left_cls].is_const)
+			return EQ_NO_ERR;
+		left = eg->classes[left_cls].value;
+	}
+	uint32_t right_cls = egraph_find(eg, node.right);
+	if (!eg->classes[right_cls].is_const)
+		return EQ_NO_ERR;
+
+	enum EquationError eval_err = EQ_NO_ERR;
+	double val = (*MATH_OP_DEFS[node.tok.value.op].eval)(left,
+									eg->classes[right_cls].value, &eval_err);
+	if (eval_err < 0 || !isfinite(val))
+		return EQ_NO_ERR;
+
+	struct MathToken num_tok = {};
+	num_tok.type = MATH_NUM;
+	num_tok.value.num = val;
+	uint32_t num_cls = EGRAPH_NONE;
+	enum EquationError err = egraph_add(eg, num_tok, EGRAPH_NONE, EGRAPH_NONE,
+										&num_cls);
+	if (err < 0)
+		return err;
+	*is_folded = egraph_union(eg, cls, num_cls);
+	return EQ_NO_ERR;
+}
+
+static size_t egraph_hash(const struct ENode *node)
+{
+	assert(node);
+
+	size_t hash = (size_t) node->tok.type * 0x9e3779b97f4a7c15;
+	switch (node->tok.type) {
+		case MATH_NUM: {
+			uint64_t bits = 0;
+			memcpy(&bits, &node->tok.value.num, sizeof(bits));
+			hash ^= bits;
+			break;
+		}
+		case MATH_VAR:
+			hash ^= node->tok.value.var_ind;
+			break;
+		case MATH_OP:
+			hash ^= (size_t) node->tok.value.op;
+			break;
+		default:
+			break;
+	}
+	hash = (hash ^ node->left) * 0xff51afd7ed558ccd;
+	hash = (hash ^ node->right) * 0xc4ceb9fe1a85ec53;
+	return hash ^ (hash >> 29);
+}
+
+static bool egraph_node_equal(const struct ENode *a, const struct ENode *b)
+{
+	assert(a);
+	assert(b);
+
+	if (a->tok.type != b->tok.type || a->left != b->left ||
+		a->right != b->right)
+		return false;
+	switch (a->tok.type) {
+		case MATH_NUM:
+			return memcmp(&a->tok.value.num, &b->tok.value.num,
+						  sizeof(double)) == 0;
+		case MATH_VAR:
+			return a->tok.value.var_ind == b->tok.value.var_ind;
+		case MATH_OP:
+			return a->tok.value.op == b->tok.value.op;
+		default:
+			return false;
+	}
+}
+
+static uint32_t egraph_table_find(const struct EGraph *eg,
+								  const struct ENode *key)
+{
+	assert(eg);
+	assert(key);
+
+	size_t mask = eg->table_cap - 1;
+	for (size_t i = egraph_hash(key) & mask; eg->table[i] != EGRAPH_NONE;
+		 i = (i + 1) & mask) {
+		if (egraph_node_equal(eg->nodes + eg->table[i], key))
+			return eg->table[i];
+	}
+	return EGRAPH_NONE;
+}
+
+static void egraph_table_insert(struct EGraph *eg, uint32_t ind)
+{
+	assert(eg);
+
+	size_t mask = eg->table_cap - 1;
+	size_t i = egraph_hash(eg->nodes + ind) & mask;
+	while (eg->table[i] != EGRAPH_NONE)
+		i = (i + 1) & mask;
+	eg->table[i] = ind;
+}
+
+static enum EquationError egraph_table_grow(struct EGraph *eg)
+{
+	assert(eg);
+
+	uint32_t *table = (uint32_t*) realloc(eg->table,
+									2 * eg->table_cap * sizeof(uint32_t));
+	if (!table)
+		return EQ_NO_MEM_ERR;
+	eg->table = table;
+	eg->table_cap *= 2;
+	memset(eg->table, 0xff, eg->table_cap * sizeof(uint32_t));
+	for (uint32_t i = 0; i < eg->num_nodes; i++)
+		if (!eg->nodes[i].is_dead)
+			egraph_table_insert(eg, i);
+	return EQ_NO_ERR;
+}
+
+/*
+ * Restores the invariants after merges: children of every e-node are made
+ * canonical again, e-nodes that became equal are merged (which may make
+ * more of them equal) and operators over newly constant classes are folded.
+ */
+static enum EquationError egraph_rebuild(struct EGraph *eg)
+{
+	assert(eg);
+
+	bool is_changed = true;
+	while (is_changed) {
+		is_changed = false;
+		memset(eg->table, 0xff, eg->table_cap * sizeof(uint32_t));
+		for (uint32_t i = 0; i < eg->num_nodes; i++) {
+			struct ENode *node = eg->nodes + i;
+			if (node->is_dead)
+				continue;
+			if (node->left != EGRAPH_NONE)
+				node->left = egraph_find(eg, node->left);
+			if (node->right != EGRAPH_NONE)
+				node->right = egraph_find(eg, node->right);
+
+			uint32_t same = egraph_table_find(eg, node);
+			if (same == EGRAPH_NONE) {
+				egraph_table_insert(eg, i);
+				continue;
+			}
+			node->is_dead = true;
+			is_changed |= egraph_union(eg, node->cls, eg->nodes[same].cls);
+		}
+
+		size_t num_nodes = eg->num_nodes;
+		for (uint32_t i = 0; i < num_nodes; i++) {
+			if (eg->nodes[i].is_dead || eg->nodes[i].tok.type != MATH_OP)
+				continue;
+			bool is_folded = false;
+			enum EquationError err = egraph_fold(eg, i, &is_folded);
+			if (err < 0)
+				return err;
+			is_changed |= is_folded;
+		}
+	}
+	return EQ_NO_ERR;
+}
+
+enum EquationError egraph_add_tree(struct EGraph *eg, struct Node *tree,
+								   uint32_t *cls)
+{
+	assert(eg);
+	assert(tree);
+	assert(cls);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	uint32_t *args = NULL;
+	size_t args_size = 0;
+	size_t args_cap = 0;
+
+	if (tree_walk_start(&walk, tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+		if (frame.step != NODE_VISIT_POST)
+			continue;
+
+		uint32_t right = frame.node->right ? args[--args_size] : EGRAPH_NONE;
+		uint32_t left = frame.node->left ? args[--args_size] : EGRAPH_NONE;
+		uint32_t node_cls = EGRAPH_NONE;
+		err = egraph_add(eg, frame.node->data, left, right, &node_cls);
+		if (err < 0)
+			break;
+
+		if (args_size >= args_cap) {
+			size_t new_cap = args_cap ? 2 * args_cap :
+										NODE_STACK_INIT_CAPACITY;
+			uint32_t *tmp = (uint32_t*) realloc(args,
+												new_cap * sizeof(uint32_t));
+			if (!tmp) {
+				err = EQ_NO_MEM_ERR;
+				break;
+			}
+			args = tmp;
+			args_cap = new_cap;
+		}
+		args[args_size++] = node_cls;
+	}
+
+	if (err == EQ_NO_ERR)
+		*cls = args[0];
+	free(args);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+enum EquationError egraph_rules_ctor(struct EGraphRules *rules)
+{
+	assert(rules);
+
+	rules->size = 0;
+	rules->lhs = (struct Node**) calloc(EGRAPH_RULE_DEFS_SIZE,
+										sizeof(struct Node*));
+	rules->rhs = (struct Node**) calloc(EGRAPH_RULE_DEFS_SIZE,
+										sizeof(struct Node*));
+	if (!rules->lhs || !rules->rhs ||
+		eq_ctor(&rules->patterns) < 0) {
+		egraph_rules_dtor(rules);
+		return EQ_NO_MEM_ERR;
+	}
+
+	char text[BUF_INIT_SIZE] = "";
+	struct Buffer buf = {text, text, sizeof(text)};
+	for (size_t i = 0; i < EGRAPH_RULE_DEFS_SIZE; i++) {
+		for (size_t side = 0; side < 2; side++) {
+			const char *pattern = side == 0 ? EGRAPH_RULE_DEFS[i].lhs :
+											  EGRAPH_RULE_DEFS[i].rhs;
+			strncpy(text, pattern, sizeof(text) - 1);
+			rules->patterns.tree = NULL;
+			if (eq_load_from_buf(&rules->patterns, &buf) < 0) {
+				egraph_rules_dtor(rules);
+				return EQ_TREE_ERR;
+			}
+			if (side == 0)
+				rules->lhs[i] = rules->patterns.tree;
+			else
+				rules->rhs[i] = rules->patterns.tree;
+		}
+		rules->size++;
+	}
+	rules->patterns.tree = NULL;
+	assert(rules->patterns.num_vars <= EGRAPH_MAX_PATTERN_VARS);
+
+	return EQ_NO_ERR;
+}
+
+void egraph_rules_dtor(struct EGraphRules *rules)
+{
+	assert(rules);
+
+	if (rules->patterns.var_names)
+		eq_dtor(&rules->patterns);
+	free(rules->lhs);
+	free(rules->rhs);
+	rules->lhs = NULL;
+	rules->rhs = NULL;
+	rules->size = 0;
+}
+
+static void egraph_match(struct EGraphMatcher *m)
+{
+	assert(m);
+
+	if (m->err < 0 || m->num_matches >= m->max_matches)
+		return;
+
+	if (m->num_pending == 0) {
+		if (m->num_matches >= m->cap_matches) {
+			size_t new_cap = m->cap_matches ? 2 * m->cap_matches :
+											  EGRAPH_INIT_CAPACITY;
+			struct EGraphMatch *tmp = (struct EGraphMatch*) realloc(
+						m->matches, new_cap * sizeof(struct EGraphMatch));
+			if (!tmp) {
+				m->err = EQ_NO_MEM_ERR;
+				return;
+			}
+			m->matches = tmp;
+			m->cap_matches = new_cap;
+		}
+		struct EGraphMatch *match = m->matches + m->num_matches++;
+		match->rule = m->rule;
+		match->cls = m->root;
+		memcpy(match->subst, m->subst, sizeof(match->subst));
+		return;
+	}
+
+	struct EGraph *eg = m->eg;
+	size_t top = --m->num_pending;
+	const struct Node *pat = m->pending_pat[top];
+	uint32_t cls = egraph_find(eg, m->pending_cls[top]);
+
+	switch (pat->data.type) {
+		case MATH_VAR: {
+			uint32_t *bound = m->subst + pat->data.value.var_ind;
+			if (*bound == EGRAPH_NONE) {
+				*bound = cls;
+				egraph_match(m);
+				*bound = EGRAPH_NONE;
+			} else if (egraph_find(eg, *bound) == cls) {
+				egraph_match(m);
+			}
+			break;
+		}
+		case MATH_NUM:
+			if (eg->classes[cls].is_const &&
+				is_equal(eg->classes[cls].value, pat->data.value.num))
+				egraph_match(m);
+			break;
+		case MATH_OP:
+			for (uint32_t i = eg->classes[cls].head; i != EGRAPH_NONE;
+				 i = eg->nodes[i].next) {
+				const struct ENode *node = eg->nodes + i;
+				if (node->is_dead || node->tok.type != MATH_OP ||
+					node->tok.value.op != pat->data.value.op)
+					continue;
+
+				size_t saved = m->num_pending;
+				assert(saved + 2 <= EGRAPH_MAX_PATTERN_SIZE);
+				if (pat->left) {
+					m->pending_pat[m->num_pending] = pat->left;
+					m->pending_cls[m->num_pending++] = node->left;
+				}
+				m->pending_pat[m->num_pending] = pat->right;
+				m->pending_cls[m->num_pending++] = node->right;
+				egraph_match(m);
+				m->num_pending = saved;
+			}
+			break;
+		default:
+			break;
+	}
+
+	m->pending_pat[top] = pat;
+	m->pending_cls[top] = cls;
+	m->num_pending = top + 1;
+}
+
+static enum EquationError egraph_instantiate(struct EGraph *eg,
+											 const struct Node *pat,
+											 const uint32_t *subst,
+											 uint32_t *cls)
+{
+	assert(eg);
+	assert(pat);
+	assert(subst);
+	assert(cls);
+
+	if (pat->data.type == MATH_VAR) {
+		*cls = egraph_find(eg, subst[pat->data.value.var_ind]);
+		return EQ_NO_ERR;
+	}
+
+	uint32_t left = EGRAPH_NONE;
+	uint32_t right = EGRAPH_NONE;
+	enum EquationError err = EQ_NO_ERR;
+	if (pat->left)
+		err = egraph_instantiate(eg, pat->left, subst, &left);
+	if (err == EQ_NO_ERR && pat->right)
+		err = egraph_instantiate(eg, pat->right, subst, &right);
+	if (err < 0)
+		return err;
+	return egraph_add(eg, pat->data, left, right, cls);
+}
+
+/*
+ * Every round first collects the matches of all rules and then applies
+ * them, so the order of the rules does not matter.
+ */
+enum EquationError egraph_saturate(struct EGraph *eg,
+								   const struct EGraphRules *rules,
+								   struct EGraphLimits limits)
+{
+	assert(eg);
+	assert(rules);
+
+	struct timespec start = {};
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct EGraphMatcher m = {};
+	m.eg = eg;
+	m.max_matches = limits.max_nodes;
+	enum EquationError err = EQ_NO_ERR;
+	bool is_out_of_budget = false;
+
+	for (size_t iter = 0; iter < limits.max_iters && !is_out_of_budget;
+		 iter++) {
+		m.num_matches = 0;
+		size_t num_classes = eg->num_classes;
+		for (uint32_t rule = 0; rule < rules->size; rule++) {
+			m.rule = rule;
+			for (uint32_t cls = 0; cls < num_classes; cls++) {
+				if (eg->classes[cls].parent != cls)
+					continue;
+				m.root = cls;
+				m.num_pending = 1;
+				m.pending_pat[0] = rules->lhs[rule];
+				m.pending_cls[0] = cls;
+				memset(m.subst, 0xff, sizeof(m.subst));
+				egraph_match(&m);
+			}
+			if (m.err < 0) {
+				err = m.err;
+				goto finally;
+			}
+			if (seconds_since(&start) > limits.max_seconds) {
+				is_out_of_budget = true;
+				break;
+			}
+		}
+
+		bool is_changed = false;
+		for (size_t i = 0; i < m.num_matches; i++) {
+			if (eg->num_nodes >= limits.max_nodes) {
+				is_out_of_budget = true;
+				break;
+			}
+			uint32_t cls = EGRAPH_NONE;
+			err = egraph_instantiate(eg, rules->rhs[m.matches[i].rule],
+									 m.matches[i].subst, &cls);
+			if (err < 0)
+				goto finally;
+			is_changed |= egraph_union(eg, m.matches[i].cls, cls);
+		}
+		err = egraph_rebuild(eg);
+		if (err < 0 || !is_changed)
+			break;
+		if (seconds_since(&start) > limits.max_seconds)
+			is_out_of_budget = true;
+	}
+
+	finally:
+		free(m.matches);
+		return err;
+}
+
+/*
+ * Cheapest e-node of every class, found by relaxing all e-nodes until no
+ * cost goes down. Costs are positive for operators, so the choice has no
+ * cycles.
+ */
+static void egraph_compute_costs(struct EGraph *eg)
+{
+	assert(eg);
+
+	for (size_t i = 0; i < eg->num_classes; i++) {
+		eg->classes[i].cost = INFINITY;
+		eg->classes[i].best = EGRAPH_NONE;
+	}
+
+	bool is_changed = true;
+	while (is_changed) {
+		is_changed = false;
+		for (uint32_t i = 0; i < eg->num_nodes; i++) {
+			const struct ENode *node = eg->nodes + i;
+			if (node->is_dead)
+				continue;
+
+			double cost = 0;
+			if (node->tok.type == MATH_OP) {
+				cost = MATH_OP_DEFS[node->tok.value.op].cost;
+				if (node->left != EGRAPH_NONE)
+					cost += eg->classes[egraph_find(eg, node->left)].cost;
+				cost += eg->classes[egraph_find(eg, node->right)].cost;
+			}
+
+			struct EClass *eclass = eg->classes + egraph_find(eg, node->cls);
+			if (cost < eclass->cost) {
+				eclass->cost = cost;
+				eclass->best = i;
+				is_changed = true;
+			}
+		}
+	}
+}
+
+enum EquationError egraph_extract(struct EGraph *eg, uint32_t root,
+								  struct NodeArena *arena, struct Node **tree)
+{
+	assert(eg);
+	assert(tree);
+
+	egraph_compute_costs(eg);
+
+	struct NodeStack res = {};
+	struct EGraphBuildFrame *frames = NULL;
+	size_t num_frames = 0;
+	size_t cap_frames = 0;
+	enum EquationError eq_err = EQ_NO_ERR;
+	enum EquationError *err = &eq_err;
+
+	struct EGraphBuildFrame first = {egraph_find(eg, root), false};
+	struct EGraphBuildFrame pending[3] = {first};
+	size_t num_pending = 1;
+	while (eq_err == EQ_NO_ERR && (num_pending > 0 || num_frames > 0)) {
+		if (num_frames + num_pending > cap_frames) {
+			size_t new_cap = cap_frames ? 2 * cap_frames :
+										  NODE_STACK_INIT_CAPACITY;
+			struct EGraphBuildFrame *tmp = (struct EGraphBuildFrame*) realloc(
+							frames, new_cap * sizeof(struct EGraphBuildFrame));
+			if (!tmp) {
+				eq_err = EQ_NO_MEM_ERR;
+				break;
+			}
+			frames = tmp;
+			cap_frames = new_cap;
+		}
+		while (num_pending > 0)
+			frames[num_frames++] = pending[--num_pending];
+
+		struct EGraphBuildFrame frame = frames[--num_frames];
+		const struct ENode *node = eg->nodes + eg->classes[frame.cls].best;
+		struct Node *built = NULL;
+		if (node->tok.type == MATH_NUM) {
+			built = new_num(node->tok.value.num);
+		} else if (node->tok.type == MATH_VAR) {
+			built = new_var(node->tok.value.var_ind);
+		} else if (!frame.is_expanded) {
+			if (node->left != EGRAPH_NONE)
+				pending[num_pending++] = {egraph_find(eg, node->left), false};
+			pending[num_pending++] = {egraph_find(eg, node->right), false};
+			pending[num_pending++] = {frame.cls, true};
+			continue;
+		} else {
+			struct Node *right = node_stack_pop(&res);
+			struct Node *left = node->left != EGRAPH_NONE ?
+								node_stack_pop(&res) : NULL;
+			built = new_op(node->tok.value.op, left, right);
+		}
+		if (eq_err == EQ_NO_ERR &&
+			node_stack_push(&res, built, NODE_VISIT_POST) < 0)
+			eq_err = EQ_NO_MEM_ERR;
+	}
+
+	if (eq_err == EQ_NO_ERR)
+		*tree = node_stack_pop(&res);
+	while (res.size > 0)
+		node_op_delete(arena, node_stack_pop(&res));
+	node_stack_dtor(&res);
+	free(frames);
+	return eq_err;
+}
+
+enum EquationError eq_simplify_egraph(struct Equation *eq,
+									  struct EGraphLimits limits)
+{
+	assert(eq);
+
+	if (!eq->tree)
+		return EQ_NO_ERR;
+
+	struct EGraph eg = {};
+	struct EGraphRules rules = {};
+	struct Node *tree = NULL;
+	uint32_t root = EGRAPH_NONE;
+
+	enum EquationError err = egraph_ctor(&eg);
+	if (err == EQ_NO_ERR)
+		err = egraph_rules_ctor(&rules);
+	if (err == EQ_NO_ERR)
+		err = egraph_add_tree(&eg, eq->tree, &root);
+	if (err == EQ_NO_ERR)
+		err = egraph_saturate(&eg, &rules, limits);
+	if (err == EQ_NO_ERR)
+		err = egraph_extract(&eg, root, eq->arena, &tree);
+
+	if (err == EQ_NO_ERR) {
+		if (!eq->arena || !eq->arena->is_shared)
+			node_op_delete(eq->arena, eq->tree);
+		eq->tree = tree;
+	}
+	egraph_rules_dtor(&rules);
+	egraph_dtor(&eg);
+	return err;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	assert(start);
+
+	struct timespec now = {};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - start->tv_sec) +
+		   (double) (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static bool is_equal(double a, double b)
+{
+	return fabs(a - b) < EQ_EPSILON;
+}
@@ -0,0 +1,174 @@
+#ifndef _EGRAPH_H
+#define _EGRAPH_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "math_funcs.h"
+#include "equation_utils.h"
+
+/*
+ * Simplification by equality saturation. An e-graph keeps classes of equal
+ * expressions: an e-node is an operator over classes rather than over nodes,
+ * so one graph holds every form of the equation the rewrite rules reach.
+ * All rules are matched against all classes and their right sides are
+ * merged into the matched classes, round after round, until nothing changes
+ * or a budget runs out. Then the cheapest expression of the root class by
+ * MATH_OP_DEFS costs is extracted.
+ *
+ * Classes whose value is known are folded to numbers as they appear, so the
+ * rules need no arithmetic on constants.
+ */
+
+/*
+ * Rules are parsed with eq_load_from_buf. Variables are pattern variables
+ * (any class, the same one for the same name), numbers match classes with
+ * that value. Both sides must be equal where the left one is defined.
+ */
+struct EGraphRuleDef {
+	const char *lhs;
+	const char *rhs;
+};
+
+const struct EGraphRuleDef EGRAPH_RULE_DEFS[] = {
+	{ "a+0",				"a"					},
+	{ "a-0",				"a"					},
+	{ "0-a",				"-1*a"				},
+	{ "a-a",				"0"					},
+	{ "a*1",				"a"					},
+	{ "a*0",				"0"					},
+	{ "a/1",				"a"					},
+	{ "0/a",				"0"					},
+	{ "a/a",				"1"					},
+	{ "a^1",				"a"					},
+	{ "a^0",				"1"					},
+	{ "1^a",				"1"					},
+
+	{ "a+b",				"b+a"				},
+	{ "a*b",				"b*a"				},
+	{ "(a+b)+c",			"a+(b+c)"			},
+	{ "a+(b+c)",			"(a+b)+c"			},
+	{ "(a*b)*c",			"a*(b*c)"			},
+	{ "a*(b*c)",			"(a*b)*c"			},
+
+	{ "a-b",				"a+-1*b"			},
+	{ "a+-1*b",				"a-b"				},
+	{ "-1*(-1*a)",			"a"					},
+	{ "(-1*a)*b",			"-1*(a*b)"			},
+	{ "a+a",				"2*a"				},
+	{ "a*b+a*c",			"a*(b+c)"			},
+	{ "a*b-a*c",			"a*(b-c)"			},
+	{ "a*b+a",				"a*(b+1)"			},
+
+	{ "a*(b/c)",			"(a*b)/c"			},
+	{ "(a/b)/c",			"a/(b*c)"			},
+	{ "a/(b/c)",			"(a*c)/b"			},
+	{ "(a*b)/a",			"b"					},
+	{ "(a*b)/(a*c)",		"b/c"				},
+	{ "a/b+c/b",			"(a+c)/b"			},
+	{ "a/b-c/b",			"(a-c)/b"			},
+
+	{ "a*a",				"a^2"				},
+	{ "a^b*a",				"a^(b+1)"			},
+	{ "a^b*a^c",			"a^(b+c)"			},
+	{ "a^b/a",				"a^(b-1)"			},
+	{ "a^b/a^c",			"a^(b-c)"			},
+	{ "a^0.5",				"sqrt(a)"			},
+	{ "sqrt(a)*sqrt(a)",	"a"					},
+	{ "sqrt(a)^2",			"a"					},
+
+	{ "2.718281828459045^(ln(a)*b)",	"a^b"	},
+	{ "2.718281828459045^ln(a)",		"a"		},
+	{ "ln(2.718281828459045^a)",		"a"		},
+	{ "ln(a)+ln(b)",		"ln(a*b)"			},
+	{ "ln(a)-ln(b)",		"ln(a/b)"			},
+
+	{ "sin(a)^2+cos(a)^2",	"1"					},
+	{ "sin(a)/cos(a)",		"tg(a)"				},
+	{ "cos(a)/sin(a)",		"ctg(a)"			},
+	{ "tg(a)*cos(a)",		"sin(a)"			},
+	{ "ctg(a)*sin(a)",		"cos(a)"			},
+	{ "sin(a)*cos(a)",		"sin(2*a)/2"		},
+	{ "cos(-1*a)",			"cos(a)"			},
+	{ "sin(-1*a)",			"-1*sin(a)"			},
+};
+const size_t EGRAPH_RULE_DEFS_SIZE = sizeof(EGRAPH_RULE_DEFS) /
+									 sizeof(EGRAPH_RULE_DEFS[0]);
+
+const size_t EGRAPH_MAX_PATTERN_VARS = 4;
+const size_t EGRAPH_MAX_PATTERN_SIZE = 16;
+const uint32_t EGRAPH_NONE = UINT32_MAX;
+
+/*
+ * Saturation stops after max_iters rounds, when the graph grows over
+ * max_nodes e-nodes or after max_seconds, whatever comes first.
+ */
+struct EGraphLimits {
+	size_t max_nodes;
+	size_t max_iters;
+	double max_seconds;
+};
+
+const struct EGraphLimits EGRAPH_DEFAULT_LIMITS = {20000, 16, 0.05};
+
+struct ENode {
+	struct MathToken tok;
+	uint32_t left;
+	uint32_t right;
+	uint32_t cls;
+	uint32_t next;
+	bool is_dead;
+};
+
+struct EClass {
+	uint32_t parent;
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+	double value;
+	bool is_const;
+
+	double cost;
+	uint32_t best;
+};
+
+struct EGraph {
+	struct ENode *nodes;
+	size_t num_nodes;
+	size_t cap_nodes;
+
+	struct EClass *classes;
+	size_t num_classes;
+	size_t cap_classes;
+
+	uint32_t *table;
+	size_t table_cap;
+};
+
+const size_t EGRAPH_INIT_CAPACITY = 256;
+
+struct EGraphRules {
+	struct Equation patterns;
+	struct Node **lhs;
+	struct Node **rhs;
+	size_t size;
+};
+
+enum EquationError egraph_ctor(struct EGraph *eg);
+void egraph_dtor(struct EGraph *eg);
+
+enum EquationError egraph_rules_ctor(struct EGraphRules *rules);
+void egraph_rules_dtor(struct EGraphRules *rules);
+
+enum EquationError egraph_add_tree(struct EGraph *eg, struct Node *tree,
+								   uint32_t *cls);
+enum EquationError egraph_saturate(struct EGraph *eg,
+								   const struct EGraphRules *rules,
+								   struct EGraphLimits limits);
+enum EquationError egraph_extract(struct EGraph *eg, uint32_t root,
+								  struct NodeArena *arena, struct Node **tree);
+
+enum EquationError eq_simplify_egraph(struct Equation *eq,
+									  struct EGraphLimits limits);
+
+#endif /*_EGRAPH_H*/
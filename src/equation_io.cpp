@@ -3,37 +3,149 @@
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
 
 #include "equation_manipulation.h"
 #include "equation_io.h"
 #include "logger.h"
 #include "equation_utils.h"
 #include "gnuplot_i.h"
+#include "graph_sampling.h"
+
+/*
+ * Operator stack of the expression parser. Brackets and function calls stay
+ * on it until the matching ')' is read, binary operators until an operator
+ * with a looser priority (larger MathOpDefinition::priority) arrives.
+ */
+enum ParseOpKind {
+	PARSE_OP_BINARY,
+	PARSE_OP_BRACKET,
+	PARSE_OP_FUNC,
+};
+
+struct ParseOp {
+	enum ParseOpKind kind;
+	enum MathOp op;
+};
+
+struct ParseStack {
+	struct ParseOp *ops;
+	size_t size;
+	size_t cap;
+};
+
+/*
+ * Value numbering of the C emitter: every distinct value (a variable, a
+ * number or an operator over numbered operands) gets a number, and t<number>
+ * is the temporary of an operator. Values are found through an
+ * open-addressing table by the cached subtree hashes, which equal values
+ * share, and are told apart by their tokens and operand numbers. operands
+ * is the stack of numbers of finished subtrees during a walk. may_fail marks
+ * operators with a domain check in their subtree, which have a b<number>
+ * flag next to the temporary.
+ */
+struct CValue {
+	struct MathToken tok;
+	size_t left;
+	size_t right;
+	size_t hash;
+	bool may_fail;
+};
+
+struct CValueTable {
+	struct CValue *vals;
+	size_t size;
+	size_t cap;
+
+	size_t *slots;
+	size_t num_slots;
+
+	size_t *operands;
+	size_t num_operands;
+	size_t cap_operands;
+};
+
+const size_t C_VALUE_TABLE_INIT_CAPACITY = 64;
+const size_t C_NO_VALUE = SIZE_MAX;
+
+/*
+ * How an operator is written in C: prefix left infix right suffix, unary
+ * operators have only the right operand. The domain check of eq_evaluate,
+ * if there is one, is check_prefix right check_suffix.
+ */
+struct COpFormat {
+	const char *prefix;
+	const char *infix;
+	const char *suffix;
+	const char *check_prefix;
+	const char *check_suffix;
+};
+
+static const struct COpFormat C_OP_FORMATS[] = {
+	{"",							" + ",	"",	NULL,			NULL},	// MATH_ADD
+	{"",							" * ",	"",	NULL,			NULL},	// MATH_MULT
+	{"",							" - ",	"",	NULL,			NULL},	// MATH_SUB
+	{"",							" / ",	"",	"fabs(",		") < EQ_EPSILON"},	// MATH_DIV
+	{"pow(",						", ",	")", NULL,			NULL},	// MATH_POW
+	{"log(",						"",		")", "",			" <= 0.0"},	// MATH_LN
+	{"sqrt(",						"",		")", NULL,			NULL},	// MATH_SQRT
+	{"cos(",						"",		")", NULL,			NULL},	// MATH_COS
+	{"sin(",						"",		")", NULL,			NULL},	// MATH_SIN
+	{"tan(",						"",		")", NULL,			NULL},	// MATH_TG
+	{"1.0 / tan(",					"",		")", "fabs(tan(",	")) < EQ_EPSILON"},	// MATH_CTG
+	{"asin(",						"",		")", "fabs(",		") > 1.0"},	// MATH_ARCSIN
+	{"acos(",						"",		")", "fabs(",		") > 1.0"},	// MATH_ARCCOS
+	{"atan(",						"",		")", NULL,			NULL},	// MATH_ARCTG
+	{"1.5707963267948966 - atan(",	"",		")", NULL,			NULL},	// MATH_ARCCTG
+};
 
 static void clear_stdin();
 
 static void get_space(struct Buffer *buf);
-static enum EquationIOError get_add(struct Node **subeq, struct Equation *eq,
-									struct Buffer *buf);
-static enum EquationIOError get_mult(struct Node **subeq, struct Equation *eq,
-									 struct Buffer *buf);
-static enum EquationIOError get_pow(struct Node **subeq, struct Equation *eq,
-									struct Buffer *buf);
-static enum EquationIOError get_prim(struct Node **subeq, struct Equation *eq,
+static enum EquationIOError get_expr(struct Equation *eq, struct Buffer *buf);
+static enum EquationIOError get_operand(struct ParseStack *ops,
+										struct NodeStack *operands,
+										struct Equation *eq,
 										struct Buffer *buf);
-static enum EquationIOError get_func(struct Node **subeq, struct Equation *eq,
-									 struct Buffer *buf);
+static enum EquationIOError get_close_bracket(struct ParseStack *ops,
+											  struct NodeStack *operands,
+											  struct Equation *eq,
+											  struct Buffer *buf);
+static enum EquationIOError parse_reduce(struct ParseStack *ops,
+										 struct NodeStack *operands,
+										 struct NodeArena *arena,
+										 int max_priority);
+static enum EquationIOError parse_push(struct ParseStack *ops,
+									   struct ParseOp op);
 static enum EquationIOError get_num(struct Node **subeq, struct Equation *eq,
 									struct Buffer *buf);
 static enum EquationIOError get_var(struct Node **subeq, struct Equation *eq,
 									  struct Buffer *buf);
 
-static void subeq_print(const struct Node *subeq, struct Equation eq, FILE *out);
+static void subeq_print(struct Node *subeq, struct Equation eq, FILE *out);
 static void subeq_print_latex(const struct Node *subeq, struct Equation eq,
 							  FILE *out, bool put_brackets);
 
-static void eq_to_gnuplot_str(struct Node *subeq, struct Equation eq,
-							  struct Buffer *buf);
+
+static enum EquationIOError subeq_print_c(struct Node *subeq, bool is_shared,
+										  struct CValueTable *table,
+										  struct NodeMap *memo, FILE *out,
+										  size_t *res);
+static enum EquationIOError c_value_add(struct CValueTable *table,
+										const struct Node *node, size_t left,
+										size_t right, FILE *out, size_t *res);
+static size_t c_value_find(const struct CValueTable *table,
+						   const struct CValue *val, size_t *slot);
+static enum EquationIOError c_value_table_grow(struct CValueTable *table);
+static enum EquationIOError c_operand_push(struct CValueTable *table,
+										   size_t ind);
+static void c_value_table_dtor(struct CValueTable *table);
+static void c_print_value(const struct CValueTable *table, size_t ind,
+						  FILE *out);
+static void c_print_num(double num, FILE *out);
+static bool c_token_same(struct MathToken a, struct MathToken b);
 
 enum EquationIOError eq_load_from_buf(struct Equation *eq, struct Buffer *buf)
 {
@@ -42,7 +154,7 @@ enum EquationIOError eq_load_from_buf(struct Equation *eq, struct Buffer *buf)
 
 	buffer_reset(buf);
 	
-	enum EquationIOError eqio_err = get_add(&eq->tree, eq, buf);
+	enum EquationIOError eqio_err = get_expr(eq, buf);
 	if (eqio_err < 0)
 		return eqio_err;
 	if (*buf->pos)
@@ -58,177 +170,208 @@ static void get_space(struct Buffer *buf)
 		buf->pos++;
 }
 
-static enum EquationIOError get_add(struct Node **subeq, struct Equation *eq,
-									struct Buffer *buf)
+static enum EquationIOError get_expr(struct Equation *eq, struct Buffer *buf)
 {
-	assert(subeq);
 	assert(eq);
 	assert(buf);
 
-	enum EquationError eq_err = EQ_NO_ERR;
-	enum EquationError *err = &eq_err;
-	enum EquationIOError eqio_err = get_mult(subeq, eq, buf);
-	if (eqio_err < 0)
-		return eqio_err;
-	get_space(buf);
-	while (*buf->pos == '+' || *buf->pos == '-') {
-		char op = *buf->pos;
-		buf->pos++;
-		get_space(buf);
-		struct Node *subeq1 = NULL;
-		eqio_err = get_mult(&subeq1, eq, buf);
-		if (eqio_err < 0) {
-			node_op_delete(subeq1);
-			return eqio_err;
+	struct ParseStack ops = {};
+	struct NodeStack operands = {};
+	enum EquationIOError eqio_err = EQIO_NO_ERR;
+	bool expect_operand = true;
+
+	while (eqio_err == EQIO_NO_ERR) {
+		if (expect_operand) {
+			eqio_err = get_operand(&ops, &operands, eq, buf);
+			expect_operand = false;
+			continue;
 		}
-		switch (op) {
+
+		struct ParseOp op = {PARSE_OP_BINARY, MATH_ADD};
+		switch (*buf->pos) {
 			case '+':
-				*subeq = new_op(MATH_ADD, *subeq, subeq1);
+				op.op = MATH_ADD;
 				break;
 			case '-':
-				*subeq = new_op(MATH_SUB, *subeq, subeq1);
+				op.op = MATH_SUB;
 				break;
+			case '*':
+				op.op = MATH_MULT;
+				break;
+			case '/':
+				op.op = MATH_DIV;
+				break;
+			case '^':
+				op.op = MATH_POW;
+				break;
+			case ')':
+				eqio_err = get_close_bracket(&ops, &operands, eq, buf);
+				continue;
 			default:
-				return EQIO_UNKNOWN_ERR;
+				goto finish;
 		}
-		if (eq_err < 0)
-			return EQIO_EQUATION_ERR;
+
+		eqio_err = parse_reduce(&ops, &operands, eq->arena,
+								MATH_OP_DEFS[op.op].priority);
+		if (eqio_err == EQIO_NO_ERR)
+			eqio_err = parse_push(&ops, op);
+		buf->pos++;
 		get_space(buf);
+		expect_operand = true;
 	}
-	return EQIO_NO_ERR;
-}
 
-static enum EquationIOError get_mult(struct Node **subeq, struct Equation *eq,
-									 struct Buffer *buf)
+finish:
+	if (eqio_err == EQIO_NO_ERR)
+		eqio_err = parse_reduce(&ops, &operands, eq->arena, INT_MAX);
+	if (eqio_err == EQIO_NO_ERR && ops.size > 0)
+		eqio_err = EQIO_SYNTAX_ERR;
+	if (eqio_err == EQIO_NO_ERR)
+		eq->tree = node_stack_pop(&operands);
+
+	while (operands.size > 0)
+		node_op_delete(eq->arena, node_stack_pop(&operands));
+	node_stack_dtor(&operands);
+	free(ops.ops);
+	return eqio_err;
+}
+/*
+ * Reads one operand: any number of '(' and "func(" openers, which go to the
+ * operator stack, followed by a number or a variable.
+ */
+static enum EquationIOError get_operand(struct ParseStack *ops,
+										struct NodeStack *operands,
+										struct Equation *eq,
+										struct Buffer *buf)
 {
-	assert(subeq);
+	assert(ops);
+	assert(operands);
 	assert(eq);
 	assert(buf);
 
-	enum EquationError eq_err = EQ_NO_ERR;
-	enum EquationError *err = &eq_err;
-	enum EquationIOError eqio_err = get_pow(subeq, eq, buf);
-	if (eqio_err < 0)
-		return eqio_err;
-	get_space(buf);
-	while (*buf->pos == '*' || *buf->pos == '/') {
-		char op = *buf->pos;
-		buf->pos++;
-		get_space(buf);
-		struct Node *subeq1 = NULL;
-		eqio_err = get_pow(&subeq1, eq, buf);
-		if (eqio_err < 0) {
-			node_op_delete(subeq1);
-			return eqio_err;
-		}
-		switch (op) {
-			case '*':
-				*subeq = new_op(MATH_MULT, *subeq, subeq1);
-				break;
-			case '/':
-				*subeq = new_op(MATH_DIV, *subeq, subeq1);
+	enum EquationIOError eqio_err = EQIO_NO_ERR;
+	struct Node *subeq = NULL;
+	while (*buf->pos == '(' || !(isdigit(*buf->pos) || *buf->pos == '-')) {
+		struct ParseOp opener = {PARSE_OP_BRACKET, MATH_ADD};
+		if (*buf->pos == '(') {
+			buf->pos++;
+		} else {
+			size_t i = (size_t) MATH_POW;
+			size_t name_len = 0;
+			for (; i < MATH_OP_DEFS_SIZE; i++) {
+				name_len = strlen(MATH_OP_DEFS[i].name);
+				if (strncmp(buf->pos, MATH_OP_DEFS[i].name, name_len) == 0)
+					break;
+			}
+			if (i == MATH_OP_DEFS_SIZE)
 				break;
-			default:
-				return EQIO_UNKNOWN_ERR;
+			if (*(buf->pos + name_len) != '(')
+				return EQIO_SYNTAX_ERR;
+			buf->pos += name_len + 1;
+			opener = {PARSE_OP_FUNC, (enum MathOp) i};
 		}
-		if (eq_err < 0)
-			return EQIO_EQUATION_ERR;
 		get_space(buf);
+		eqio_err = parse_push(ops, opener);
+		if (eqio_err < 0)
+			return eqio_err;
+	}
+
+	if (isdigit(*buf->pos) || *buf->pos == '-')
+		eqio_err = get_num(&subeq, eq, buf);
+	else
+		eqio_err = get_var(&subeq, eq, buf);
+	if (eqio_err < 0)
+		return eqio_err;
+	if (node_stack_push(operands, subeq, NODE_VISIT_POST) < 0) {
+		node_op_delete(eq->arena, subeq);
+		return EQIO_NO_MEM_ERR;
 	}
+	get_space(buf);
 	return EQIO_NO_ERR;
 }
 
-static enum EquationIOError get_pow(struct Node **subeq, struct Equation *eq,
-									struct Buffer *buf)
+/*
+ * Closes the innermost '(' or "func(" and applies the function, if any.
+ */
+static enum EquationIOError get_close_bracket(struct ParseStack *ops,
+											  struct NodeStack *operands,
+											  struct Equation *eq,
+											  struct Buffer *buf)
 {
-	assert(subeq);
+	assert(ops);
+	assert(operands);
 	assert(eq);
 	assert(buf);
 
-	enum EquationError eq_err = EQ_NO_ERR;
-	enum EquationError *err = &eq_err;
-	enum EquationIOError eqio_err = get_prim(subeq, eq, buf);
+	enum EquationIOError eqio_err = parse_reduce(ops, operands, eq->arena,
+												 INT_MAX);
 	if (eqio_err < 0)
 		return eqio_err;
-	get_space(buf);
-	while (*buf->pos == '^') {
-		buf->pos++;
-		get_space(buf);
-		struct Node *subeq1 = NULL;
-		eqio_err = get_prim(&subeq1, eq, buf);
-		if (eqio_err < 0)
-			return eqio_err;
-		*subeq = new_op(MATH_POW, *subeq, subeq1);
-		if (eq_err < 0)
+	if (ops->size == 0)
+		return EQIO_SYNTAX_ERR;
+
+	struct ParseOp opener = ops->ops[--ops->size];
+	if (opener.kind == PARSE_OP_FUNC) {
+		enum EquationError eq_err = EQ_NO_ERR;
+		enum EquationError *err = &eq_err;
+		struct NodeArena *arena = eq->arena;
+		struct Node *arg = node_stack_pop(operands);
+		struct Node *subeq = new_op(opener.op, NULL, arg);
+		if (eq_err < 0 || node_stack_push(operands, subeq,
+										  NODE_VISIT_POST) < 0) {
+			node_op_delete(arena, subeq);
 			return EQIO_EQUATION_ERR;
-		get_space(buf);
+		}
 	}
+	buf->pos++;
+	get_space(buf);
 	return EQIO_NO_ERR;
 }
 
-static enum EquationIOError get_prim(struct Node **subeq, struct Equation *eq,
-									 struct Buffer *buf)
+/*
+ * Pops binary operators with priority not looser than max_priority and
+ * links their operands, which gives left associativity for equal priorities.
+ */
+static enum EquationIOError parse_reduce(struct ParseStack *ops,
+										 struct NodeStack *operands,
+										 struct NodeArena *arena,
+										 int max_priority)
 {
-	assert(subeq);
-	assert(eq);
-	assert(buf);
+	assert(ops);
+	assert(operands);
 
-	enum EquationIOError eqio_err = EQIO_NO_ERR;
-	if (*buf->pos == '(') {
-		buf->pos++;
-		get_space(buf);
-		eqio_err = get_add(subeq, eq, buf);
-		if (eqio_err < 0)
-			return eqio_err;
-		get_space(buf);
-		if (*buf->pos == ')') {
-			buf->pos++;
-			return EQIO_NO_ERR;
+	enum EquationError eq_err = EQ_NO_ERR;
+	enum EquationError *err = &eq_err;
+	while (ops->size > 0 && ops->ops[ops->size - 1].kind == PARSE_OP_BINARY &&
+		   MATH_OP_DEFS[ops->ops[ops->size - 1].op].priority <= max_priority) {
+		enum MathOp op = ops->ops[--ops->size].op;
+		struct Node *right = node_stack_pop(operands);
+		struct Node *left = node_stack_pop(operands);
+		struct Node *subeq = new_op(op, left, right);
+		if (eq_err < 0 || node_stack_push(operands, subeq,
+										  NODE_VISIT_POST) < 0) {
+			node_op_delete(arena, subeq);
+			return EQIO_EQUATION_ERR;
 		}
-		return EQIO_SYNTAX_ERR;
-	} else if (isdigit(*buf->pos) || *buf->pos == '-') {
-		return get_num(subeq, eq, buf);
 	}
-	eqio_err = get_func(subeq, eq, buf);
-	if (eqio_err == EQIO_UNKNOWN_FUNC_ERR)
-		return get_var(subeq, eq, buf);
-	return eqio_err;
+	return EQIO_NO_ERR;
 }
 
-static enum EquationIOError get_func(struct Node **subeq, struct Equation *eq,
-									 struct Buffer *buf)
+static enum EquationIOError parse_push(struct ParseStack *ops,
+									   struct ParseOp op)
 {
-	assert(subeq);
-	assert(eq);
-	assert(buf);
+	assert(ops);
 
-	enum EquationIOError eqio_err = EQIO_NO_ERR;
-	enum EquationError eq_err = EQ_NO_ERR;
-	enum EquationError *err = &eq_err;
-	for (size_t i = (size_t) MATH_POW; i < MATH_OP_DEFS_SIZE; i++) {
-		size_t name_len = strlen(MATH_OP_DEFS[i].name);
-		if (strncmp(buf->pos, MATH_OP_DEFS[i].name, name_len) == 0) {
-			if (*(buf->pos + name_len) != '(')
-				return EQIO_SYNTAX_ERR;
-			buf->pos += name_len + 1;
-			get_space(buf);
-			struct Node *subeq_arg = NULL;
-			eqio_err = get_add(&subeq_arg, eq, buf);
-			if (eqio_err < 0) {
-				node_op_delete(subeq_arg);
-				return EQIO_EQUATION_ERR;
-			}
-			*subeq = new_op((enum MathOp) i, NULL, subeq_arg);
-			if (eq_err < 0)
-				return EQIO_EQUATION_ERR;
-			get_space(buf);
-			if (*buf->pos != ')')
-				return EQIO_SYNTAX_ERR;
-			buf->pos++;
-			return EQIO_NO_ERR;
-		}
+	if (ops->size >= ops->cap) {
+		size_t new_cap = ops->cap ? 2 * ops->cap : NODE_STACK_INIT_CAPACITY;
+		struct ParseOp *tmp = (struct ParseOp*) realloc(ops->ops, new_cap *
+													   sizeof(struct ParseOp));
+		if (!tmp)
+			return EQIO_NO_MEM_ERR;
+		ops->ops = tmp;
+		ops->cap = new_cap;
 	}
-	return EQIO_UNKNOWN_FUNC_ERR;
+	ops->ops[ops->size++] = op;
+	return EQIO_NO_ERR;
 }
 
 static enum EquationIOError get_num(struct Node **subeq, struct Equation *eq,
@@ -242,6 +385,7 @@ static enum EquationIOError get_num(struct Node **subeq, struct Equation *eq,
 	char *old_pos = buf->pos;
 	enum EquationError eq_err = EQ_NO_ERR;
 	enum EquationError *err = &eq_err;
+	struct NodeArena *arena = eq->arena;
 
 	bool is_neg = false;
 	if (*buf->pos == '-') {
@@ -297,6 +441,7 @@ static enum EquationIOError get_var(struct Node **subeq, struct Equation *eq,
 
 	enum EquationError eq_err = EQ_NO_ERR;
 	enum EquationError *err = &eq_err;
+	struct NodeArena *arena = eq->arena;
 	size_t var_len = buf->pos - old_pos;
 	for (size_t i = 0; i < eq->num_vars; i++) {
 		if (strncmp(eq->var_names[i], old_pos, var_len) == 0 &&
@@ -388,28 +533,42 @@ void eq_print_token(char *buf, struct MathToken tok,
 	}
 }
 
-void subeq_print(const struct Node *subeq, struct Equation eq, FILE *out)
+void subeq_print(struct Node *subeq, struct Equation eq, FILE *out)
 {
 	assert(out);
 
-	if (!subeq)
-		return;
-
 	const size_t PRINT_BUF_SIZE = 512;
 	static char print_buf[PRINT_BUF_SIZE] = "";
-	
-	if (subeq->data.type == MATH_OP)
-		fputs("(", out);
-	subeq_print(subeq->left, eq, out);
-	if (subeq->data.type == MATH_OP && subeq->left)
-		fputs(" ", out);
-	eq_print_token(print_buf, subeq->data, eq, PRINT_BUF_SIZE);
-	fputs(print_buf, out);
-	if (subeq->data.type == MATH_OP && subeq->right)
-		fputs(" ", out);
-	subeq_print(subeq->right, eq, out);
-	if (subeq->data.type == MATH_OP)
-		fputs(")", out);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	if (tree_walk_start(&walk, subeq) < 0)
+		return;
+	while (walk.size > 0 && tree_walk_next(&walk, &frame) == TREE_NO_ERR) {
+		const struct Node *node = frame.node;
+		switch (frame.step) {
+			case NODE_VISIT_PRE:
+				if (node->data.type == MATH_OP)
+					fputs("(", out);
+				break;
+			case NODE_VISIT_IN:
+				if (node->data.type == MATH_OP && node->left)
+					fputs(" ", out);
+				eq_print_token(print_buf, node->data, eq, PRINT_BUF_SIZE);
+				fputs(print_buf, out);
+				if (node->data.type == MATH_OP && node->right)
+					fputs(" ", out);
+				break;
+			case NODE_VISIT_POST:
+				if (node->data.type == MATH_OP)
+					fputs(")", out);
+				break;
+			default:
+				assert(0 && "Unknown visit step");
+				break;
+		}
+	}
+	node_stack_dtor(&walk);
 }
 
 static void subeq_print_latex(const struct Node *subeq, struct Equation eq,
@@ -547,6 +706,413 @@ void eq_print_latex(struct Equation eq, FILE *out)
 	fprintf(out, "\n\\end{equation}\n\n");
 }
 
+enum EquationIOError eq_print_c(const struct Equation *eqs, size_t num_eqs,
+								const char *name, FILE *out)
+{
+	assert(eqs || num_eqs == 0);
+	assert(name);
+	assert(out);
+
+	size_t num_vars = num_eqs > 0 ? eqs[0].num_vars : 0;
+	fprintf(out, "#include <math.h>\n"
+			"#include <stddef.h>\n\n"
+			"#define EQ_EPSILON %.17g\n\n"
+			"void %s(size_t n, const double *const *cols,\n"
+			"\t\tdouble *const *out)\n"
+			"{\n", EQ_EPSILON, name);
+	for (size_t v = 0; v < num_vars; v++)
+		fprintf(out, "\tconst double *restrict c%lu = cols[%lu]; /* %s */\n",
+				v, v, eqs[0].var_names[v]);
+	for (size_t k = 0; k < num_eqs; k++)
+		fprintf(out, "\tdouble *restrict o%lu = out[%lu];\n", k, k);
+	fputs("\n\t#pragma omp simd\n"
+		  "\tfor (size_t i = 0; i < n; i++) {\n", out);
+
+	struct CValueTable table = {};
+	struct NodeMap memo = {};
+	enum EquationIOError err = EQIO_NO_ERR;
+	if (node_map_ctor(&memo) < 0)
+		err = EQIO_NO_MEM_ERR;
+	for (size_t k = 0; k < num_eqs && err == EQIO_NO_ERR; k++) {
+		size_t res = C_NO_VALUE;
+		bool is_shared = eqs[k].arena && eqs[k].arena->is_shared;
+		err = subeq_print_c(eqs[k].tree, is_shared, &table, &memo, out, &res);
+		if (err < 0)
+			break;
+		fprintf(out, "\t\to%lu[i] = ", k);
+		if (res == C_NO_VALUE)
+			fputs("NAN", out);
+		else if (table.vals[res].may_fail)
+			fprintf(out, "b%lu ? NAN : t%lu", res, res);
+		else
+			c_print_value(&table, res, out);
+		fputs(";\n", out);
+	}
+	fputs("\t}\n}\n", out);
+
+	c_value_table_dtor(&table);
+	node_map_dtor(&memo);
+	return err;
+}
+
+/*
+ * Writes the temporaries of the subtree that are not in the table yet, in
+ * post order, and gives the number of its value in *res. In a hash-consed
+ * tree memo maps visited nodes to their numbers, so a shared subtree is
+ * walked once.
+ */
+static enum EquationIOError subeq_print_c(struct Node *subeq, bool is_shared,
+										  struct CValueTable *table,
+										  struct NodeMap *memo, FILE *out,
+										  size_t *res)
+{
+	assert(table);
+	assert(memo);
+	assert(res);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationIOError err = EQIO_NO_ERR;
+	size_t *operands = NULL;
+
+	if (subeq && tree_walk_start(&walk, subeq) < 0)
+		err = EQIO_NO_MEM_ERR;
+	while (err == EQIO_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQIO_NO_MEM_ERR;
+			break;
+		}
+		struct Node *node = frame.node;
+		union NodeMapValue *known = NULL;
+		if (frame.step == NODE_VISIT_PRE && is_shared &&
+			(known = node_map_find(memo, node))) {
+			tree_walk_skip(&walk, node);
+			err = c_operand_push(table, known->ind);
+			continue;
+		}
+		if (frame.step != NODE_VISIT_POST)
+			continue;
+
+		operands = table->operands + table->num_operands;
+		size_t right = node->right ? *--operands : C_NO_VALUE;
+		size_t left = node->left ? *--operands : C_NO_VALUE;
+		table->num_operands = (size_t) (operands - table->operands);
+		size_t ind = C_NO_VALUE;
+		err = c_value_add(table, node, left, right, out, &ind);
+		if (err == EQIO_NO_ERR)
+			err = c_operand_push(table, ind);
+		union NodeMapValue val = {};
+		val.ind = ind;
+		if (err == EQIO_NO_ERR && is_shared &&
+			node_map_insert(memo, node, val) < 0)
+			err = EQIO_NO_MEM_ERR;
+	}
+
+	if (err == EQIO_NO_ERR && table->num_operands > 0)
+		*res = table->operands[--table->num_operands];
+	table->num_operands = 0;
+	node_stack_dtor(&walk);
+	return err;
+}
+
+/*
+ * Finds the value of node over the operand numbers or adds it, writing the
+ * load of a new variable or the temporary of a new operator.
+ */
+static enum EquationIOError c_value_add(struct CValueTable *table,
+										const struct Node *node, size_t left,
+										size_t right, FILE *out, size_t *res)
+{
+	assert(table);
+	assert(node);
+	assert(res);
+
+	if (2 * (table->size + 1) > table->num_slots &&
+		c_value_table_grow(table) < 0)
+		return EQIO_NO_MEM_ERR;
+
+	struct CValue val = {node->data, left, right, node->hash, false};
+	size_t slot = 0;
+	size_t ind = c_value_find(table, &val, &slot);
+	if (ind != C_NO_VALUE) {
+		*res = ind;
+		return EQIO_NO_ERR;
+	}
+
+	ind = table->size++;
+	table->vals[ind] = val;
+	table->slots[slot] = ind + 1;
+	*res = ind;
+
+	switch (val.tok.type) {
+		case MATH_NUM:
+			return EQIO_NO_ERR;
+		case MATH_VAR:
+			fprintf(out, "\t\tconst double v%lu = c%lu[i];\n",
+					val.tok.value.var_ind, val.tok.value.var_ind);
+			return EQIO_NO_ERR;
+		case MATH_OP:
+			break;
+		default:
+			return EQIO_TREE_ERR;
+	}
+	if ((size_t) val.tok.value.op >= sizeof(C_OP_FORMATS) /
+									 sizeof(C_OP_FORMATS[0]) ||
+		right == C_NO_VALUE)
+		return EQIO_UNKNOWN_FUNC_ERR;
+
+	const struct COpFormat *format = C_OP_FORMATS + val.tok.value.op;
+	fprintf(out, "\t\tconst double t%lu = %s", ind, format->prefix);
+	if (left != C_NO_VALUE) {
+		c_print_value(table, left, out);
+		fputs(format->infix, out);
+	}
+	c_print_value(table, right, out);
+	fprintf(out, "%s;\n", format->suffix);
+
+	bool is_left_failing = left != C_NO_VALUE && table->vals[left].may_fail;
+	bool is_right_failing = table->vals[right].may_fail;
+	table->vals[ind].may_fail = format->check_prefix || is_left_failing ||
+								is_right_failing;
+	if (!table->vals[ind].may_fail)
+		return EQIO_NO_ERR;
+
+	const char *sep = "";
+	fprintf(out, "\t\tconst int b%lu = ", ind);
+	if (format->check_prefix) {
+		fprintf(out, "(%s", format->check_prefix);
+		c_print_value(table, right, out);
+		fprintf(out, "%s)", format->check_suffix);
+		sep = " | ";
+	}
+	if (is_left_failing) {
+		fprintf(out, "%sb%lu", sep, left);
+		sep = " | ";
+	}
+	if (is_right_failing)
+		fprintf(out, "%sb%lu", sep, right);
+	fputs(";\n", out);
+	return EQIO_NO_ERR;
+}
+
+// Index of the equal value or C_NO_VALUE and the free slot for it
+static size_t c_value_find(const struct CValueTable *table,
+						   const struct CValue *val, size_t *slot)
+{
+	assert(table);
+	assert(val);
+	assert(slot);
+
+	size_t mask = table->num_slots - 1;
+	for (size_t i = val->hash & mask;; i = (i + 1) & mask) {
+		if (table->slots[i] == 0) {
+			*slot = i;
+			return C_NO_VALUE;
+		}
+		const struct CValue *other = table->vals + table->slots[i] - 1;
+		if (other->hash == val->hash && other->left == val->left &&
+			other->right == val->right && c_token_same(other->tok, val->tok))
+			return table->slots[i] - 1;
+	}
+}
+
+static enum EquationIOError c_value_table_grow(struct CValueTable *table)
+{
+	assert(table);
+
+	size_t new_cap = table->cap ? 2 * table->cap : C_VALUE_TABLE_INIT_CAPACITY;
+	struct CValue *vals = (struct CValue*) realloc(table->vals, new_cap *
+												   sizeof(struct CValue));
+	if (!vals)
+		return EQIO_NO_MEM_ERR;
+	table->vals = vals;
+	table->cap = new_cap;
+
+	size_t *slots = (size_t*) calloc(2 * new_cap, sizeof(size_t));
+	if (!slots)
+		return EQIO_NO_MEM_ERR;
+	free(table->slots);
+	table->slots = slots;
+	table->num_slots = 2 * new_cap;
+	for (size_t i = 0; i < table->size; i++) {
+		size_t slot = 0;
+		c_value_find(table, table->vals + i, &slot);
+		table->slots[slot] = i + 1;
+	}
+	return EQIO_NO_ERR;
+}
+
+static enum EquationIOError c_operand_push(struct CValueTable *table,
+										   size_t ind)
+{
+	assert(table);
+
+	if (table->num_operands >= table->cap_operands) {
+		size_t new_cap = table->cap_operands ? 2 * table->cap_operands :
+											   C_VALUE_TABLE_INIT_CAPACITY;
+		size_t *operands = (size_t*) realloc(table->operands,
+											 new_cap * sizeof(size_t));
+		if (!operands)
+			return EQIO_NO_MEM_ERR;
+		table->operands = operands;
+		table->cap_operands = new_cap;
+	}
+	table->operands[table->num_operands++] = ind;
+	return EQIO_NO_ERR;
+}
+
+static void c_value_table_dtor(struct CValueTable *table)
+{
+	assert(table);
+
+	free(table->vals);
+	free(table->slots);
+	free(table->operands);
+	table->vals = NULL;
+	table->slots = NULL;
+	table->operands = NULL;
+	table->size = 0;
+	table->cap = 0;
+	table->num_slots = 0;
+	table->num_operands = 0;
+	table->cap_operands = 0;
+}
+
+static void c_print_value(const struct CValueTable *table, size_t ind,
+						  FILE *out)
+{
+	assert(table);
+	assert(ind < table->size);
+
+	const struct CValue *val = table->vals + ind;
+	switch (val->tok.type) {
+		case MATH_NUM:
+			c_print_num(val->tok.value.num, out);
+			return;
+		case MATH_VAR:
+			fprintf(out, "v%lu", val->tok.value.var_ind);
+			return;
+		case MATH_OP:
+			fprintf(out, "t%lu", ind);
+			return;
+		default:
+			fputs("NAN", out);
+			return;
+	}
+}
+
+// A double literal, in brackets if it is negative
+static void c_print_num(double num, FILE *out)
+{
+	const size_t NUM_BUF_SIZE = 32;
+	char num_buf[NUM_BUF_SIZE] = "";
+
+	if (isnan(num))
+		snprintf(num_buf, NUM_BUF_SIZE, "NAN");
+	else if (isinf(num))
+		snprintf(num_buf, NUM_BUF_SIZE, "%sINFINITY", num < 0 ? "-" : "");
+	else if (snprintf(num_buf, NUM_BUF_SIZE, "%.17g", num) > 0 &&
+			 !strpbrk(num_buf, ".e"))
+		strncat(num_buf, ".0", NUM_BUF_SIZE - strlen(num_buf) - 1);
+
+	fprintf(out, num_buf[0] == '-' ? "(%s)" : "%s", num_buf);
+}
+
+static bool c_token_same(struct MathToken a, struct MathToken b)
+{
+	if (a.type != b.type)
+		return false;
+
+	switch (a.type) {
+		case MATH_NUM:
+			return !(a.value.num < b.value.num) && !(b.value.num < a.value.num);
+		case MATH_OP:
+			return a.value.op == b.value.op;
+		case MATH_VAR:
+			return a.value.var_ind == b.value.var_ind;
+		default:
+			return false;
+	}
+}
+
+/*
+ * The source goes to a directory made by mkdtemp, which is removed again
+ * once the object is loaded: the mapping outlives the file.
+ */
+enum EquationIOError eq_c_kernel_build(struct EqCKernel *kernel,
+									   const struct Equation *eqs,
+									   size_t num_eqs)
+{
+	assert(kernel);
+
+	const size_t PATH_BUF_SIZE = 64;
+	const size_t CMD_BUF_SIZE = 512;
+	char dir[] = "/tmp/eq_kernel_XXXXXX";
+	char src_path[PATH_BUF_SIZE] = "";
+	char so_path[PATH_BUF_SIZE] = "";
+	char cmd_buf[CMD_BUF_SIZE] = "";
+
+	kernel->handle = NULL;
+	kernel->func = NULL;
+	if (!mkdtemp(dir))
+		return EQIO_COMPILE_ERR;
+	snprintf(src_path, PATH_BUF_SIZE, "%s/kernel.c", dir);
+	snprintf(so_path, PATH_BUF_SIZE, "%s/kernel.so", dir);
+
+	enum EquationIOError err = EQIO_NO_ERR;
+	FILE *src = fopen(src_path, "w");
+	if (!src) {
+		err = EQIO_COMPILE_ERR;
+	} else {
+		err = eq_print_c(eqs, num_eqs, EQ_C_KERNEL_NAME, src);
+		if (fclose(src) != 0 && err == EQIO_NO_ERR)
+			err = EQIO_COMPILE_ERR;
+	}
+
+	const char *cc = getenv("CC");
+	if (err == EQIO_NO_ERR) {
+		int len = snprintf(cmd_buf, CMD_BUF_SIZE, "%s %s -o %s %s -lm",
+						   cc ? cc : "cc", EQ_C_KERNEL_CFLAGS, so_path,
+						   src_path);
+		if (len < 0 || (size_t) len >= CMD_BUF_SIZE) {
+			log_message(ERROR, "The kernel compile command is longer than "
+					"%lu bytes\n", CMD_BUF_SIZE - 1);
+			err = EQIO_COMPILE_ERR;
+		} else if (system(cmd_buf) != 0) {
+			log_message(ERROR, "Unable to compile the kernel: %s\n", cmd_buf);
+			err = EQIO_COMPILE_ERR;
+		}
+	}
+	if (err == EQIO_NO_ERR) {
+		kernel->handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+		void *sym = kernel->handle ? dlsym(kernel->handle, EQ_C_KERNEL_NAME) :
+									 NULL;
+		if (sym) {
+			memcpy(&kernel->func, &sym, sizeof(kernel->func));
+		} else {
+			log_message(ERROR, "Unable to load the kernel: %s\n", dlerror());
+			err = EQIO_COMPILE_ERR;
+		}
+	}
+
+	remove(src_path);
+	remove(so_path);
+	rmdir(dir);
+	if (err < 0)
+		eq_c_kernel_dtor(kernel);
+	return err;
+}
+
+void eq_c_kernel_dtor(struct EqCKernel *kernel)
+{
+	assert(kernel);
+
+	if (kernel->handle)
+		dlclose(kernel->handle);
+	kernel->handle = NULL;
+	kernel->func = NULL;
+}
+
 void eq_start_latex_print(FILE *out)
 {
 	fprintf(out, "\\documentclass[a4paper,12pt]{article}\n"
@@ -574,8 +1140,26 @@ void eq_gen_latex_pdf(const char *filename)
 	system(cmd_buf);
 }
 
+/*
+ * The points of eq_sample_graph go to gnuplot as inline data, a blank line
+ * breaking the line at a NAN.
+ */
 enum EquationIOError eq_graph(struct Equation eq, const char *img_name)
 {
+	const double GRAPH_FROM = -4;
+	const double GRAPH_TO = 4;
+
+	struct GraphSamples samples = {};
+	enum EquationError eq_err = eq_sample_graph(eq, GRAPH_FROM, GRAPH_TO,
+												GRAPH_DEFAULT_LIMITS,
+												&samples);
+	if (eq_err < 0)
+		return eq_err == EQ_NO_MEM_ERR ? EQIO_NO_MEM_ERR : EQIO_EQUATION_ERR;
+	log_message(INFO, "graph: %zu points, %zu point and %zu interval"
+				" evaluations, y in [%lg, %lg]\n", samples.size,
+				samples.num_point_evals, samples.num_interval_evals,
+				samples.y_from, samples.y_to);
+
 	const size_t CMD_BUF_CAP = 1024;
 	char cmd_buf[1024] = "set output \"";
 	size_t cmd_buf_size = CMD_BUF_CAP - strlen(cmd_buf);
@@ -586,70 +1170,27 @@ enum EquationIOError eq_graph(struct Equation eq, const char *img_name)
 	gnuplot_ctrl *handle = gnuplot_init();
 	gnuplot_setterm(handle, "pngcairo", 1024, 768);
 	gnuplot_cmd(handle, cmd_buf);
-	gnuplot_setstyle(handle, "lines");
-
-	struct Buffer eq_buf = {};
-	buffer_ctor(&eq_buf);
-	eq_to_gnuplot_str(eq.tree, eq, &eq_buf);
-	log_message(INFO, "gnuplot str: %s\n", eq_buf.data);
-
-	gnuplot_cmd(handle, "set samples 10000");
-	gnuplot_cmd(handle, "set xrange [-4:4]");
-	gnuplot_cmd(handle, "set yrange [-50:50]");
-	gnuplot_plot_equation(handle, eq_buf.data, "fucking yeah!!!");
-	//gnuplot_cmd(handle, "set parametric");
-	//gnuplot_cmd(handle, "set urange [0:6*pi]");
-	//gnuplot_cmd(handle, "set vrange [0:1]");
-	//gnuplot_cmd(handle, "fx(v) = cos(v)");
-	//gnuplot_cmd(handle, "fy(v) = sin(v)");
-	//gnuplot_cmd(handle, "fz(v) = v");
-	//gnuplot_cmd(handle, "splot fx(v),fy(v),fz(v)");
-	gnuplot_close(handle);
-	buffer_dtor(&eq_buf);
 
-	return EQIO_NO_ERR;
-}
+	FILE *cmd = handle->gnucmd;
+	fprintf(cmd, "set xrange [%.17lg:%.17lg]\n", GRAPH_FROM, GRAPH_TO);
+	fprintf(cmd, "set yrange [%.17lg:%.17lg]\n", samples.y_from,
+			samples.y_to);
+	fprintf(cmd, "plot '-' title \"f(%s)\" with lines\n",
+			eq.num_vars > 0 ? eq.var_names[0] : "");
+	for (size_t i = 0; i < samples.size; i++) {
+		if (isnan(samples.points[i].y))
+			fprintf(cmd, "\n");
+		else
+			fprintf(cmd, "%.17lg %.17lg\n", samples.points[i].x,
+					samples.points[i].y);
+	}
+	fprintf(cmd, "e\n");
+	fflush(cmd);
 
-static void eq_to_gnuplot_str(struct Node *subeq, struct Equation eq,
-							  struct Buffer *buf)
-{
-	if (!subeq)
-		return;
+	gnuplot_close(handle);
+	graph_samples_dtor(&samples);
 
-	snprintf(buf->pos, buf->size - buffer_size(buf), "(");
-	buf->pos++;
-	eq_to_gnuplot_str(subeq->left, eq, buf);
-	if (subeq->data.type == MATH_OP) {
-		switch (subeq->data.value.op) {
-			case MATH_POW:
-				snprintf(buf->pos, buf->size - buffer_size(buf), "**");
-				break;
-			case MATH_TG:
-				snprintf(buf->pos, buf->size - buffer_size(buf), "tan");
-				break;
-			case MATH_CTG:
-				snprintf(buf->pos, buf->size - buffer_size(buf), "(1/tan");
-				break;
-			case MATH_ARCTG:
-				snprintf(buf->pos, buf->size - buffer_size(buf), "atan");
-				break;
-			default:
-				eq_print_token(buf->pos, subeq->data, eq,
-							   buf->size - buffer_size(buf));
-				break;
-		}
-	} else {
-		eq_print_token(buf->pos, subeq->data, eq,
-					   buf->size - buffer_size(buf));
-	}
-	buf->pos += strlen(buf->pos);
-	eq_to_gnuplot_str(subeq->right, eq, buf);
-	if (subeq->data.value.op == MATH_CTG) {
-		snprintf(buf->pos, buf->size - buffer_size(buf), ")");
-		buf->pos++;
-	}
-	snprintf(buf->pos, buf->size - buffer_size(buf), ")");
-	buf->pos++;
+	return EQIO_NO_ERR;
 }
 
 const char *eq_io_err_to_str(enum EquationIOError err)
@@ -663,6 +1204,8 @@ const char *eq_io_err_to_str(enum EquationIOError err)
 			return "No error occured\n";
 		case EQIO_NO_MEM_ERR:
 			return "Not enough memory to store all variables\n";
+		case EQIO_COMPILE_ERR:
+			return "Unable to compile or load the generated code\n";
 		default:
 			return "Unknown error occured\n";
 	}
@@ -5,6 +5,7 @@
 #include "tree.h"
 
 enum EquationIOError {
+	EQIO_COMPILE_ERR      = -7,
 	EQIO_UNKNOWN_FUNC_ERR = -6,
 	EQIO_UNKNOWN_ERR      = -5,
 	EQIO_EQUATION_ERR     = -4,
@@ -21,6 +22,44 @@ void eq_print_token(char *buf, struct MathToken tok,
 					struct Equation eq, size_t n);
 void eq_print(struct Equation eq, FILE *out);
 
+/*
+ * Writes a self-contained C function
+ *   void name(size_t n, const double *const *cols, double *const *out)
+ * that evaluates num_eqs equations over the variables of eqs[0] (say a
+ * function and its partial derivatives) at n points: cols[v][i] is the
+ * v-th variable at the i-th point, out[k][i] receives eqs[k] there. Every
+ * distinct operator over the same operands, within an equation or across
+ * them, is computed once into a temporary. The loop body is straight-line
+ * code of math.h calls, so it vectorizes (with libmvec under -ffast-math).
+ * The domain checks of eq_evaluate are computed along as flags b<number>
+ * of the temporaries that may fail, and out[k][i] is NAN where eqs[k]
+ * fails, as in batch evaluation.
+ */
+enum EquationIOError eq_print_c(const struct Equation *eqs, size_t num_eqs,
+								const char *name, FILE *out);
+
+typedef void (*eq_c_kernel_func)(size_t n, const double *const *cols,
+								 double *const *out);
+
+/*
+ * eq_print_c output built with $CC (cc by default) into a shared object in
+ * a temporary directory and loaded into the process.
+ */
+struct EqCKernel {
+	void *handle;
+	eq_c_kernel_func func;
+};
+
+const char *const EQ_C_KERNEL_NAME = "eq_kernel";
+const char *const EQ_C_KERNEL_CFLAGS = "-O3 -march=native -ffast-math"
+									   " -fno-finite-math-only -fopenmp-simd"
+									   " -shared -fPIC";
+
+enum EquationIOError eq_c_kernel_build(struct EqCKernel *kernel,
+									   const struct Equation *eqs,
+									   size_t num_eqs);
+void eq_c_kernel_dtor(struct EqCKernel *kernel);
+
 void eq_start_latex_print(FILE *out);
 void eq_print_latex(struct Equation eq, FILE *out);
 void eq_end_latex_print(FILE *out);
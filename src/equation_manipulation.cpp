@@ -1,35 +1,77 @@
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 
 #include "equation_manipulation.h"
+#include "equation_utils.h"
 
-struct Node *eq_copy(struct Node *equation, enum EquationError *err)
+static struct Node *eq_drop(struct NodeArena *arena, struct Node *kept,
+							struct Node *dropped);
+static bool is_equal(double a, double b);
+
+struct Node *eq_copy(struct NodeArena *arena, struct Node *equation,
+					 enum EquationError *err)
 {
 	assert(err);
 
 	if (!equation)
 		return NULL;
-	
-	struct MathToken data = equation->data;
+	if (node_is_shared(arena, equation))
+		return equation;
+
+	struct NodeStack local_walk = {};
+	struct NodeStack local_res = {};
+	struct NodeStack *walk = arena ? &arena->copy_walk : &local_walk;
+	struct NodeStack *res = arena ? &arena->copy_res : &local_res;
+	struct NodeFrame frame = {};
 	struct Node *new_node = NULL;
-	enum TreeError tr_err = node_op_new(&new_node, data);
+	enum TreeError tr_err = tree_walk_start(walk, equation);
+	res->size = 0;
 
-	if (tr_err == TREE_NO_MEM_ERR) {
-		*err = EQ_NO_MEM_ERR;
-		return NULL;
-	} else if (tr_err < 0) {
-		*err = EQ_TREE_ERR;
-		return NULL;
+	while (tr_err == TREE_NO_ERR && walk->size > 0) {
+		tr_err = tree_walk_next(walk, &frame);
+		if (tr_err < 0)
+			break;
+
+		if (frame.step == NODE_VISIT_PRE &&
+			node_is_shared(arena, frame.node)) {
+			tree_walk_skip(walk, frame.node);
+			tr_err = node_stack_push(res, frame.node, NODE_VISIT_POST);
+			continue;
+		}
+		if (frame.step != NODE_VISIT_POST)
+			continue;
+
+		struct Node *right = frame.node->right ? node_stack_pop(res) : NULL;
+		struct Node *left = frame.node->left ? node_stack_pop(res) : NULL;
+		tr_err = node_op_make(arena, &new_node, frame.node->data, left, right);
+		if (tr_err < 0) {
+			node_op_delete(arena, left);
+			node_op_delete(arena, right);
+			break;
+		}
+		tr_err = node_stack_push(res, new_node, NODE_VISIT_POST);
+		if (tr_err < 0)
+			node_op_delete(arena, new_node);
 	}
 
-	new_node->left = copy(equation->left);
-	new_node->right = copy(equation->right);
+	new_node = NULL;
+	if (tr_err == TREE_NO_ERR) {
+		new_node = node_stack_pop(res);
+	} else {
+		*err = tr_err == TREE_NO_MEM_ERR ? EQ_NO_MEM_ERR : EQ_TREE_ERR;
+		while (res->size > 0)
+			node_op_delete(arena, node_stack_pop(res));
+	}
 
+	node_stack_dtor(&local_walk);
+	node_stack_dtor(&local_res);
 	return new_node;
 }
 
-struct Node *eq_new_operator(enum MathOp op, struct Node *left,
-							 struct Node *right, enum EquationError *err)
+struct Node *eq_new_operator(struct NodeArena *arena, enum MathOp op,
+							 struct Node *left, struct Node *right,
+							 enum EquationError *err)
 {
 	assert(err);
 
@@ -37,27 +79,71 @@ struct Node *eq_new_operator(enum MathOp op, struct Node *left,
 	data.type = MATH_OP;
 	data.value.op = op;
 	struct Node *new_node = NULL;
-	enum TreeError tr_err = node_op_new(&new_node, data);
+	enum TreeError tr_err = node_op_make(arena, &new_node, data, left, right);
 
 	if (tr_err == TREE_NO_MEM_ERR) {
 		*err = EQ_NO_MEM_ERR;
-		node_op_delete(left);
-		node_op_delete(right);
+		node_op_delete(arena, left);
+		node_op_delete(arena, right);
 		return NULL;
 	} else if (tr_err < 0) {
 		*err = EQ_TREE_ERR;
-		node_op_delete(left);
-		node_op_delete(right);
+		node_op_delete(arena, left);
+		node_op_delete(arena, right);
 		return NULL;
 	}
 
-	new_node->left = left;
-	new_node->right = right;
-
 	return new_node;
 }
 
-struct Node *eq_new_number(double num, enum EquationError *err)
+struct Node *eq_make_operator(struct NodeArena *arena, enum MathOp op,
+							  struct Node *left, struct Node *right,
+							  enum EquationError *err)
+{
+	assert(err);
+
+	if (*err < 0 || !right)
+		return eq_new_operator(arena, op, left, right, err);
+
+	bool is_left_num = left && type(left) == MATH_NUM;
+	bool is_right_num = type(right) == MATH_NUM;
+	if ((!left || is_left_num) && is_right_num) {
+		enum EquationError eval_err = EQ_NO_ERR;
+		double res = (*MATH_OP_DEFS[op].eval)(left ? num(left) : NAN,
+											  num(right), &eval_err);
+		if (eval_err == EQ_NO_ERR) {
+			node_op_delete(arena, left);
+			node_op_delete(arena, right);
+			return eq_new_number(arena, res, err);
+		}
+		return eq_new_operator(arena, op, left, right, err);
+	}
+
+	double l = is_left_num ? num(left) : NAN;
+	double r = is_right_num ? num(right) : NAN;
+	if (op == MATH_ADD && is_equal(l, 0))
+		return eq_drop(arena, right, left);
+	if ((op == MATH_ADD || op == MATH_SUB) && is_equal(r, 0))
+		return eq_drop(arena, left, right);
+	if (op == MATH_MULT && (is_equal(l, 0) || is_equal(r, 1)))
+		return eq_drop(arena, left, right);
+	if (op == MATH_MULT && (is_equal(r, 0) || is_equal(l, 1)))
+		return eq_drop(arena, right, left);
+	if (op == MATH_DIV && (is_equal(l, 0) || is_equal(r, 1)))
+		return eq_drop(arena, left, right);
+	if (op == MATH_POW && (is_equal(r, 1) || is_equal(l, 0) ||
+						   is_equal(l, 1)))
+		return eq_drop(arena, left, right);
+	if (op == MATH_POW && is_equal(r, 0)) {
+		node_op_delete(arena, left);
+		node_op_delete(arena, right);
+		return eq_new_number(arena, 1, err);
+	}
+	return eq_new_operator(arena, op, left, right, err);
+}
+
+struct Node *eq_new_number(struct NodeArena *arena, double num,
+						   enum EquationError *err)
 {
 	assert(err);
 
@@ -65,7 +151,7 @@ struct Node *eq_new_number(double num, enum EquationError *err)
 	data.type = MATH_NUM;
 	data.value.num = num;
 	struct Node *new_node = NULL;
-	enum TreeError tr_err = node_op_new(&new_node, data);
+	enum TreeError tr_err = node_op_make(arena, &new_node, data, NULL, NULL);
 
 	if (tr_err == TREE_NO_MEM_ERR) {
 		*err = EQ_NO_MEM_ERR;
@@ -75,13 +161,11 @@ struct Node *eq_new_number(double num, enum EquationError *err)
 		return NULL;
 	}
 
-	new_node->left = NULL;
-	new_node->right = NULL;
-
 	return new_node;
 }
 
-struct Node *eq_new_variable(size_t var_ind, enum EquationError *err)
+struct Node *eq_new_variable(struct NodeArena *arena, size_t var_ind,
+							 enum EquationError *err)
 {
 	assert(err);
 
@@ -89,7 +173,7 @@ struct Node *eq_new_variable(size_t var_ind, enum EquationError *err)
 	data.type = MATH_VAR;
 	data.value.var_ind = var_ind;
 	struct Node *new_node = NULL;
-	enum TreeError tr_err = node_op_new(&new_node, data);
+	enum TreeError tr_err = node_op_make(arena, &new_node, data, NULL, NULL);
 
 	if (tr_err == TREE_NO_MEM_ERR) {
 		*err = EQ_NO_MEM_ERR;
@@ -99,61 +183,79 @@ struct Node *eq_new_variable(size_t var_ind, enum EquationError *err)
 		return NULL;
 	}
 
-	new_node->left = NULL;
-	new_node->right = NULL;
-
 	return new_node;
 }
 
-void eq_change_to_num(struct Node *equation, double num)
+void eq_change_to_num(struct NodeArena *arena, struct Node *equation,
+					  double num)
 {
 	assert(equation);
 
+	node_op_unshare(arena, equation);
 	type(equation) = MATH_NUM;
 	num(equation) = num;
-	node_op_delete(eq_left);
-	node_op_delete(eq_right);
+	node_op_delete(arena, eq_left);
+	node_op_delete(arena, eq_right);
 	equation->left = NULL;
 	equation->right = NULL;
+	node_rehash(equation);
 }
 
-void eq_change_to_op(struct Node *equation, enum MathOp op,
-							struct Node *left, struct Node *right)
+void eq_change_to_op(struct NodeArena *arena, struct Node *equation,
+					 enum MathOp op, struct Node *left, struct Node *right)
 {
 	assert(equation);
 	assert(left);
 	assert(right);
 	
+	node_op_unshare(arena, equation);
 	type(equation) = MATH_OP;
 	op(equation) = op;
-	node_op_delete(equation->left);
-	node_op_delete(equation->right);
+	node_op_delete(arena, equation->left);
+	node_op_delete(arena, equation->right);
 	equation->left = left;
 	equation->right = right;
+	node_rehash(equation);
 }
 
-void eq_lift_up_left(struct Node *equation)
+void eq_lift_up_left(struct NodeArena *arena, struct Node *equation)
 {
 	assert(equation);
 	assert(equation->left);
 
 	struct Node *left = equation->left;
-	node_op_delete(equation->right);
+	node_op_unshare(arena, equation);
+	node_op_delete(arena, equation->right);
 	equation->data = left->data;
 	equation->right = left->right;
 	equation->left = left->left;
-	free(left);
+	equation->hash = left->hash;
+	node_op_free(arena, left);
 }
 
-void eq_lift_up_right(struct Node *equation)
+void eq_lift_up_right(struct NodeArena *arena, struct Node *equation)
 {
 	assert(equation);
 	assert(equation->right);
 
 	struct Node *right = equation->right;
-	node_op_delete(equation->left);
+	node_op_unshare(arena, equation);
+	node_op_delete(arena, equation->left);
 	equation->data = right->data;
 	equation->right = right->right;
 	equation->left = right->left;
-	free(right);
+	equation->hash = right->hash;
+	node_op_free(arena, right);
+}
+
+static struct Node *eq_drop(struct NodeArena *arena, struct Node *kept,
+							struct Node *dropped)
+{
+	node_op_delete(arena, dropped);
+	return kept;
+}
+
+static bool is_equal(double a, double b)
+{
+	return fabs(a - b) < EQ_EPSILON;
 }
@@ -1,23 +1,39 @@
 #include "math_funcs.h"
 #include "tree.h"
 
-struct Node *eq_new_operator(enum MathOp op, struct Node *left,
-							 struct Node *right, enum EquationError *err);
-struct Node *eq_new_number(double num, enum EquationError *err);
-struct Node *eq_new_variable(size_t var_ind, enum EquationError *err);
-struct Node *eq_copy(struct Node *equation, enum EquationError *err);
-void eq_change_to_num(struct Node *equation, double num);
-void eq_change_to_op(struct Node *equation, enum MathOp op,
-					 struct Node *left, struct Node *right);
-void eq_lift_up_left(struct Node *equation);
-void eq_lift_up_right(struct Node *equation);
+struct Node *eq_new_operator(struct NodeArena *arena, enum MathOp op,
+							 struct Node *left, struct Node *right,
+							 enum EquationError *err);
+/*
+ * Same as eq_new_operator, but folds an operator over constants and drops
+ * identities (u + 0, u - 0, 0 * u, 1 * u, 0 / u, u / 1, u^0, u^1, 0^u, 1^u)
+ * right away, so the rules of differentiation build their results already
+ * simplified. An operator over constants that fails to evaluate is made as
+ * it is, eq_simplify reports the error.
+ */
+struct Node *eq_make_operator(struct NodeArena *arena, enum MathOp op,
+							  struct Node *left, struct Node *right,
+							  enum EquationError *err);
+struct Node *eq_new_number(struct NodeArena *arena, double num,
+						   enum EquationError *err);
+struct Node *eq_new_variable(struct NodeArena *arena, size_t var_ind,
+							 enum EquationError *err);
+struct Node *eq_copy(struct NodeArena *arena, struct Node *equation,
+					 enum EquationError *err);
+void eq_change_to_num(struct NodeArena *arena, struct Node *equation,
+					  double num);
+void eq_change_to_op(struct NodeArena *arena, struct Node *equation,
+					 enum MathOp op, struct Node *left, struct Node *right);
+void eq_lift_up_left(struct NodeArena *arena, struct Node *equation);
+void eq_lift_up_right(struct NodeArena *arena, struct Node *equation);
 
-#define new_op(op, l, r)	eq_new_operator((op), (l), (r), err)
-#define new_num(num)		eq_new_number((num), err)
-#define new_var(var)		eq_new_variable((var), err)
-#define copy(eq) 			eq_copy((eq), err)
-#define to_num(eq, num) 	eq_change_to_num((eq), (num))
-#define to_op(eq, op, l, r) eq_change_to_op((eq), (op), (l), (r))
+#define new_op(op, l, r)	eq_new_operator(arena, (op), (l), (r), err)
+#define make_op(op, l, r)	eq_make_operator(arena, (op), (l), (r), err)
+#define new_num(num)		eq_new_number(arena, (num), err)
+#define new_var(var)		eq_new_variable(arena, (var), err)
+#define copy(eq) 			eq_copy(arena, (eq), err)
+#define to_num(eq, num) 	eq_change_to_num(arena, (eq), (num))
+#define to_op(eq, op, l, r) eq_change_to_op(arena, (eq), (op), (l), (r))
 #define move(dest, src)	 	eq_move((dest), (src))
 #define eq_left	 		 	equation->left
 #define eq_right 		 	equation->right
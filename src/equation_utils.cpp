@@ -8,21 +8,107 @@
 #include "equation_utils.h"
 #include "equation_manipulation.h"
 #include "equation_io.h"
+#include "scalar_evaluate.h"
+#include "polynomial.h"
 #include "logger.h"
 
-static struct Node *subeq_differentiate(const struct Node *equation, 
+// Operands and their operands, which a rewrite may keep or lift up
+const size_t SIMPLIFY_OLD_NODES_SIZE = 6;
+
+/*
+ * An operand of a flattened sum or product: a term with its coefficient
+ * (3 of 3*x) or a base with its exponent (3 of x^3). Subtracted terms and
+ * divisors get negative coefficients.
+ */
+struct CollectedTerm {
+	struct Node *term;
+	double coef;
+};
+
+struct TermCollector {
+	struct CollectedTerm *terms;
+	size_t size;
+	size_t cap;
+
+	struct CollectedTerm *pending;
+	size_t num_pending;
+	size_t cap_pending;
+
+	// Nodes of the chain that are not moved into the collected one
+	struct NodeStack dropped;
+	struct NodeStack cmp;
+};
+
+static struct Node *subeq_differentiate(struct Node *equation, 
 										size_t diff_var_ind,
+										const struct NodeMap *deps,
+										struct NodeArena *arena,
+										struct NodeMap *memo,
 										enum EquationError *err);
-static enum EquationError subeq_simplify(struct Node *equation);
-static enum EquationError subeq_evaluate(struct Node *subeq, double *vals,
-										 double *res);
+static bool subeq_may_be_poly(struct Node *equation,
+							  const struct NodeMap *deps);
+static struct Node *subeq_import(struct Node *equation,
+								 struct NodeArena *arena,
+								 struct NodeMap *memo,
+								 enum EquationError *err);
+static enum EquationError subeq_simplify(struct Node *equation,
+										 struct NodeArena *arena);
+static enum EquationError subeq_simplify_node(struct Node *equation,
+											  struct NodeArena *arena);
+static bool simplify_is_rewritten(const struct Node *node, elem_t old_data,
+								  const struct Node *const *old_nodes);
+static enum EquationError simplify_revisit(struct NodeStack *walk,
+										   struct Node *node,
+										   const struct Node *const *old_nodes);
+static bool is_chain_op(enum MathOp op);
+static bool is_same_chain(const struct Node *node, enum MathOp op);
+static enum EquationError subeq_collect(struct Node *equation,
+										struct NodeArena *arena,
+										struct TermCollector *col);
+static enum EquationError collect_gather(struct Node *equation,
+										 struct TermCollector *col,
+										 double *constant);
+static enum EquationError collect_sort(struct TermCollector *col);
+static int subeq_compare(struct Node *a, struct Node *b,
+						 struct NodeStack *stack, enum EquationError *err);
+static struct Node *collect_balanced(struct Node **nodes, size_t size,
+									 enum MathOp op, struct NodeArena *arena,
+									 enum EquationError *err);
+static enum EquationError collected_push(struct CollectedTerm **arr,
+										 size_t *size, size_t *cap,
+										 struct CollectedTerm val);
+static enum EquationError subeq_series(struct Node *subeq,
+									   struct NodeArena *arena, size_t n,
+									   double *res);
+static enum EquationError series_push(double **blocks, size_t *size,
+									  size_t *cap, const double *val, size_t n);
 
 static bool is_equal(double a, double b);
-
-#define diff(eq)			subeq_differentiate((eq), var, err)
+static bool is_same_operands(struct Node *equation);
+static void series_mult(const double *a, const double *b, double *c,
+						size_t n);
+static void series_div(const double *a, const double *b, double *c,
+					   size_t n);
+static void series_integrate_ratio(const double *u, const double *q,
+								   double *c, size_t n);
+static void series_exp(const double *u, double *e, size_t n);
+static void series_sqrt(const double *u, double *c, size_t n);
+static void series_sin_cos(const double *u, double *s, double *c, size_t n);
+static void series_arcsin_tail(const double *u, double *c, size_t n,
+							   double *tmp);
+static void series_arctg_tail(const double *u, double *c, size_t n,
+							  double *tmp);
 
 enum EquationError eq_ctor(struct Equation *eq)
 {
+	eq->arena = (struct NodeArena*) calloc(1, sizeof(struct NodeArena));
+	if (!eq->arena)
+		return EQ_NO_MEM_ERR;
+	if (node_arena_ctor(eq->arena) < 0) {
+		free(eq->arena);
+		eq->arena = NULL;
+		return EQ_NO_MEM_ERR;
+	}
 	eq->var_names = (char**) calloc(EQ_INIT_VARS_CAPACITY, sizeof(char*));
 	if (!eq->var_names)
 		return EQ_NO_MEM_ERR;
@@ -32,9 +118,26 @@ enum EquationError eq_ctor(struct Equation *eq)
 	return EQ_NO_ERR;
 }
 
+enum EquationError eq_enable_sharing(struct Equation *eq)
+{
+	assert(eq);
+	assert(eq->arena);
+	assert(!eq->tree);
+
+	if (node_arena_enable_sharing(eq->arena) < 0)
+		return EQ_NO_MEM_ERR;
+	return EQ_NO_ERR;
+}
+
 void eq_dtor(struct Equation *eq)
 {
-	node_op_delete(eq->tree);
+	if (eq->arena) {
+		node_arena_dtor(eq->arena);
+		free(eq->arena);
+		eq->arena = NULL;
+	} else {
+		node_op_delete(NULL, eq->tree);
+	}
 	eq->tree = NULL;
 	for (size_t i = 0; i < eq->num_vars; i++)
 		free(eq->var_names[i]);
@@ -58,57 +161,869 @@ enum EquationError eq_differentiate(struct Equation eq, size_t diff_var_ind,
 	diff->num_vars = eq.num_vars;
 	diff->cap_vars = eq.cap_vars;
 
+	struct NodeMap deps = {};
+	if (node_map_ctor(&deps) < 0)
+		return EQ_NO_MEM_ERR;
+	enum EquationError err = eq_find_dependencies(eq, &deps);
+
+	bool is_poly = false;
+	if (err == EQ_NO_ERR && subeq_may_be_poly(eq.tree, &deps))
+		err = eq_differentiate_polynomial(eq, diff_var_ind, diff, &is_poly);
+
+	struct Equation src = eq;
+	struct NodeMap memo = {};
+	bool is_shared = diff->arena && diff->arena->is_shared;
+	if (err == EQ_NO_ERR && !is_poly && is_shared) {
+		if (node_map_ctor(&memo) < 0)
+			err = EQ_NO_MEM_ERR;
+		if (err == EQ_NO_ERR)
+			src.tree = subeq_import(eq.tree, diff->arena, &memo, &err);
+		node_map_clear(&memo);
+		node_map_clear(&deps);
+		if (err == EQ_NO_ERR)
+			err = eq_find_dependencies(src, &deps);
+	}
+	if (err == EQ_NO_ERR && !is_poly)
+		diff->tree = subeq_differentiate(src.tree, diff_var_ind, &deps,
+										 diff->arena, is_shared ? &memo : NULL,
+										 &err);
+	node_map_dtor(&memo);
+	node_map_dtor(&deps);
+	return err;
+}
+
+/*
+ * Cheap test before eq_differentiate_polynomial: in a polynomial, subtrees
+ * that depend on variables are made only by +, -, * and by / and ^ with
+ * constant right operands.
+ */
+static bool subeq_may_be_poly(struct Node *equation,
+							  const struct NodeMap *deps)
+{
+	assert(deps);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	bool may_be_poly = true;
+
+	if (tree_walk_start(&walk, equation) < 0)
+		return true;
+	while (may_be_poly && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0)
+			break;
+
+		struct Node *node = frame.node;
+		if (frame.step != NODE_VISIT_PRE || type(node) != MATH_OP)
+			continue;
+		if (!node_map_find(deps, node)->ind) {
+			tree_walk_skip(&walk, node);
+			continue;
+		}
+
+		if (op(node) == MATH_DIV || op(node) == MATH_POW)
+			may_be_poly = !node_map_find(deps, node->right)->ind;
+		else
+			may_be_poly = op(node) == MATH_ADD || op(node) == MATH_SUB ||
+						  op(node) == MATH_MULT;
+	}
+
+	node_stack_dtor(&walk);
+	return may_be_poly;
+}
+
+var_set_t eq_var_set(size_t var_ind)
+{
+	if (var_ind >= EQ_VAR_SET_BITS)
+		var_ind = EQ_VAR_SET_BITS - 1;
+	return (var_set_t) 1 << var_ind;
+}
+
+/*
+ * The sets of the operands are already in deps when an operator is visited
+ * in post order, a node shared in a DAG is walked once.
+ */
+enum EquationError eq_find_dependencies(struct Equation eq,
+										struct NodeMap *deps)
+{
+	assert(deps);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
 	enum EquationError err = EQ_NO_ERR;
-	diff->tree = subeq_differentiate(eq.tree, diff_var_ind, &err);
 
+	if (tree_walk_start(&walk, eq.tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		struct Node *node = frame.node;
+		if (frame.step == NODE_VISIT_PRE && node_map_find(deps, node)) {
+			tree_walk_skip(&walk, node);
+			continue;
+		}
+		if (frame.step != NODE_VISIT_POST)
+			continue;
+
+		union NodeMapValue vars = {};
+		if (type(node) == MATH_VAR)
+			vars.ind = eq_var_set(var(node));
+		if (node->left)
+			vars.ind |= node_map_find(deps, node->left)->ind;
+		if (node->right)
+			vars.ind |= node_map_find(deps, node->right)->ind;
+		if (node_map_insert(deps, node, vars) < 0)
+			err = EQ_NO_MEM_ERR;
+	}
+
+	node_stack_dtor(&walk);
 	return err;
 }
 
-static struct Node *subeq_differentiate(const struct Node *equation, 
+// memo maps the nodes already imported to their copies in arena
+static struct Node *subeq_import(struct Node *equation,
+								 struct NodeArena *arena,
+								 struct NodeMap *memo,
+								 enum EquationError *err)
+{
+	assert(arena);
+	assert(memo);
+	assert(err);
+
+	struct NodeStack walk = {};
+	struct NodeStack res = {};
+	struct NodeFrame frame = {};
+	union NodeMapValue imported = {};
+
+	if (tree_walk_start(&walk, equation) < 0)
+		*err = EQ_NO_MEM_ERR;
+	while (*err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			*err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		if (frame.step == NODE_VISIT_PRE) {
+			union NodeMapValue *known = node_map_find(memo, frame.node);
+			if (known) {
+				tree_walk_skip(&walk, frame.node);
+				if (node_stack_push(&res, known->node, NODE_VISIT_POST) < 0)
+					*err = EQ_NO_MEM_ERR;
+			}
+			continue;
+		}
+		if (frame.step != NODE_VISIT_POST)
+			continue;
+
+		struct Node *right = frame.node->right ? node_stack_pop(&res) : NULL;
+		struct Node *left = frame.node->left ? node_stack_pop(&res) : NULL;
+		if (node_op_make(arena, &imported.node, frame.node->data, left,
+						 right) < 0 ||
+			node_map_insert(memo, frame.node, imported) < 0 ||
+			node_stack_push(&res, imported.node, NODE_VISIT_POST) < 0)
+			*err = EQ_NO_MEM_ERR;
+	}
+
+	imported.node = *err == EQ_NO_ERR && res.size ? node_stack_pop(&res) : NULL;
+	node_stack_dtor(&walk);
+	node_stack_dtor(&res);
+	return imported.node;
+}
+
+/*
+ * In a sharing arena memo (NULL otherwise) maps the nodes already
+ * differentiated to their derivatives.
+ */
+static struct Node *subeq_differentiate(struct Node *equation, 
 										size_t diff_var_ind,
+										const struct NodeMap *deps,
+										struct NodeArena *arena,
+										struct NodeMap *memo,
 										enum EquationError *err)
 {
-	switch (type(equation)) {
+	assert(deps);
+	assert(err);
+
+	struct NodeStack walk = {};
+	struct NodeStack res = {};
+	struct NodeFrame frame = {};
+	union NodeMapValue diff = {};
+
+	if (tree_walk_start(&walk, equation) < 0)
+		*err = EQ_NO_MEM_ERR;
+	while (*err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			*err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		bool is_const = false;
+		if (frame.step == NODE_VISIT_PRE) {
+			union NodeMapValue *known = NULL;
+			if (memo && (known = node_map_find(memo, frame.node))) {
+				tree_walk_skip(&walk, frame.node);
+				if (node_stack_push(&res, known->node, NODE_VISIT_POST) < 0)
+					*err = EQ_NO_MEM_ERR;
+				continue;
+			}
+			union NodeMapValue *vars = node_map_find(deps, frame.node);
+			is_const = vars && !(vars->ind & eq_var_set(diff_var_ind));
+			if (!is_const)
+				continue;
+			tree_walk_skip(&walk, frame.node);
+		} else if (frame.step != NODE_VISIT_POST) {
+			continue;
+		}
+
+		struct Node *diff_right = NULL;
+		struct Node *diff_left = NULL;
+		switch (is_const ? MATH_NUM : type(frame.node)) {
+			case MATH_NUM:
+				diff.node = new_num(0);
+				break;
+			case MATH_VAR:
+				if (var(frame.node) == diff_var_ind)
+					diff.node = new_num(1);
+				else
+					diff.node = new_num(0);
+				break;
+			case MATH_OP:
+				diff_right = frame.node->right ? node_stack_pop(&res) : NULL;
+				diff_left = frame.node->left ? node_stack_pop(&res) : NULL;
+				diff.node = (*MATH_OP_DEFS[op(frame.node)].diff)(frame.node,
+																 diff_left,
+																 diff_right,
+																 arena, err);
+				break;
+			default:
+				*err = EQ_UNKNOWN_OP_ERR;
+				diff.node = NULL;
+				break;
+		}
+		if (*err < 0) {
+			node_op_delete(arena, diff.node);
+			break;
+		}
+
+		if ((memo && node_map_insert(memo, frame.node, diff) < 0) ||
+			node_stack_push(&res, diff.node, NODE_VISIT_POST) < 0) {
+			node_op_delete(arena, diff.node);
+			*err = EQ_NO_MEM_ERR;
+		}
+	}
+
+	diff.node = NULL;
+	if (*err == EQ_NO_ERR && res.size)
+		diff.node = node_stack_pop(&res);
+	while (res.size > 0)
+		node_op_delete(arena, node_stack_pop(&res));
+	node_stack_dtor(&walk);
+	node_stack_dtor(&res);
+	return diff.node;
+}
+
+enum EquationError eq_eliminate_common_subexprs(struct Equation *eq)
+{
+	assert(eq);
+
+	struct NodeArena *shared = (struct NodeArena*) calloc(1,
+													sizeof(struct NodeArena));
+	if (!shared)
+		return EQ_NO_MEM_ERR;
+	if (node_arena_ctor(shared) < 0) {
+		free(shared);
+		return EQ_NO_MEM_ERR;
+	}
+
+	enum EquationError err = EQ_NO_ERR;
+	struct Node *tree = NULL;
+	struct NodeMap memo = {};
+	if (node_arena_enable_sharing(shared) < 0 || node_map_ctor(&memo) < 0)
+		err = EQ_NO_MEM_ERR;
+	else if (eq->tree)
+		tree = subeq_import(eq->tree, shared, &memo, &err);
+	node_map_dtor(&memo);
+	if (err < 0) {
+		node_arena_dtor(shared);
+		free(shared);
+		return err;
+	}
+
+	if (eq->arena) {
+		node_arena_dtor(eq->arena);
+		free(eq->arena);
+	} else {
+		node_op_delete(NULL, eq->tree);
+	}
+	eq->arena = shared;
+	eq->tree = tree;
+	return EQ_NO_ERR;
+}
+
+/*
+ * Counts distinct nodes, so a subtree shared in a hash-consed equation is
+ * counted once.
+ */
+enum EquationError eq_count_nodes(struct Equation eq, size_t *count)
+{
+	assert(count);
+
+	bool is_shared = eq.arena && eq.arena->is_shared;
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	struct NodeMap seen = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	*count = 0;
+	if ((is_shared && node_map_ctor(&seen) < 0) ||
+		tree_walk_start(&walk, eq.tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+		if (frame.step != NODE_VISIT_PRE)
+			continue;
+
+		if (is_shared) {
+			if (node_map_find(&seen, frame.node)) {
+				tree_walk_skip(&walk, frame.node);
+				continue;
+			}
+			if (node_map_insert(&seen, frame.node, {}) < 0)
+				err = EQ_NO_MEM_ERR;
+		}
+		(*count)++;
+	}
+
+	node_map_dtor(&seen);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+enum EquationError eq_simplify(struct Equation *eq)
+{
+	enum EquationError err = eq_simplify_polynomials(eq);
+	if (err < 0)
+		return err;
+	return subeq_simplify(eq->tree, eq->arena);
+}
+
+static enum EquationError subeq_simplify(struct Node *equation,
+										 struct NodeArena *arena)
+{
+	bool is_shared = arena && arena->is_shared;
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	struct TermCollector col = {};
+	struct NodeMap seen = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	if ((is_shared && node_map_ctor(&seen) < 0) ||
+		tree_walk_start(&walk, equation) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		// Operands may have been rewritten in place since it was hashed
+		if (frame.step == NODE_VISIT_POST && type(frame.node) == MATH_OP)
+			node_rehash(frame.node);
+
+		if (frame.step == NODE_VISIT_PRE && is_shared &&
+			type(frame.node) == MATH_OP) {
+			if (node_map_find(&seen, frame.node))
+				tree_walk_skip(&walk, frame.node);
+			else if (node_map_insert(&seen, frame.node, {}) < 0)
+				err = EQ_NO_MEM_ERR;
+		} else if (frame.step == NODE_VISIT_POST &&
+				   type(frame.node) == MATH_OP &&
+				   is_chain_op(op(frame.node))) {
+			// The frame below belongs to the parent, which collects the
+			// whole chain if it is in the chain too
+			if (walk.size == 0 ||
+				!is_same_chain(walk.frames[walk.size - 1].node,
+							   op(frame.node)))
+				err = subeq_collect(frame.node, arena, &col);
+		} else if (frame.step == NODE_VISIT_POST &&
+				   type(frame.node) == MATH_OP) {
+			struct Node *node = frame.node;
+			elem_t old_data = node->data;
+			const struct Node *old_nodes[SIMPLIFY_OLD_NODES_SIZE] = {
+				node->left, node->right,
+				node->left ? node->left->left : NULL,
+				node->left ? node->left->right : NULL,
+				node->right ? node->right->left : NULL,
+				node->right ? node->right->right : NULL,
+			};
+			err = subeq_simplify_node(node, arena);
+			if (err == EQ_NO_ERR &&
+				simplify_is_rewritten(node, old_data, old_nodes))
+				err = simplify_revisit(&walk, node, old_nodes);
+		}
+	}
+
+	free(col.terms);
+	free(col.pending);
+	node_stack_dtor(&col.dropped);
+	node_stack_dtor(&col.cmp);
+	node_map_dtor(&seen);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+static bool simplify_is_rewritten(const struct Node *node, elem_t old_data,
+								  const struct Node *const *old_nodes)
+{
+	assert(node);
+	assert(old_nodes);
+
+	if (node->left != old_nodes[0] || node->right != old_nodes[1] ||
+		type(node) != old_data.type)
+		return true;
+	switch (type(node)) {
 		case MATH_NUM:
-			return new_num(0);
-		case MATH_VAR:
-			if (var(equation) == diff_var_ind)
-				return new_num(1);
-			else
-				return new_num(0);
+			return memcmp(&num(node), &old_data.value.num,
+						  sizeof(double)) != 0;
 		case MATH_OP:
-			return (*MATH_OP_DEFS[op(equation)].diff)(equation, diff_var_ind,
-													  err);
+			return op(node) != old_data.value.op;
+		case MATH_VAR:
+			return var(node) != old_data.value.var_ind;
 		default:
-			*err = EQ_UNKNOWN_OP_ERR;
-			return NULL;
+			return true;
 	}
 }
 
-enum EquationError eq_simplify(struct Equation *eq)
+/*
+ * Rules look only at a node and its operands, so after a rewrite only the
+ * node itself and the operators the rule has made can simplify further: the
+ * operands it lifted up or kept are done already. They go back on the walk,
+ * the new operands above the node, while the ancestors still wait for their
+ * POST visits. So one pass reaches the fixed point and the extra work is
+ * bounded by what the rewrites have built.
+ */
+static enum EquationError simplify_revisit(struct NodeStack *walk,
+										   struct Node *node,
+										   const struct Node *const *old_nodes)
 {
-	return subeq_simplify(eq->tree);
+	assert(walk);
+	assert(node);
+	assert(old_nodes);
+
+	if (type(node) != MATH_OP)
+		return EQ_NO_ERR;
+	if (node_stack_push(walk, node, NODE_VISIT_POST) < 0)
+		return EQ_NO_MEM_ERR;
+
+	struct Node *operands[] = {node->left, node->right};
+	for (size_t i = 0; i < sizeof(operands) / sizeof(operands[0]); i++) {
+		if (!operands[i] || type(operands[i]) != MATH_OP)
+			continue;
+
+		bool is_old = false;
+		for (size_t j = 0; j < SIMPLIFY_OLD_NODES_SIZE; j++)
+			is_old |= operands[i] == old_nodes[j];
+		if (!is_old && node_stack_push(walk, operands[i], NODE_VISIT_PRE) < 0)
+			return EQ_NO_MEM_ERR;
+	}
+	return EQ_NO_ERR;
 }
 
-static enum EquationError subeq_simplify(struct Node *equation)
+static bool is_chain_op(enum MathOp op)
 {
-	if (!equation)
-		return EQ_NO_ERR;
+	return op == MATH_ADD || op == MATH_SUB || op == MATH_MULT ||
+		   op == MATH_DIV;
+}
 
-	if (type(equation) == MATH_NUM || type(equation) == MATH_VAR)
-		return EQ_NO_ERR;
+static bool is_same_chain(const struct Node *node, enum MathOp op)
+{
+	assert(node);
+
+	if (type(node) != MATH_OP || !is_chain_op(op(node)))
+		return false;
+	return (op(node) == MATH_ADD || op(node) == MATH_SUB) ==
+		   (op == MATH_ADD || op == MATH_SUB);
+}
+
+/*
+ * A sum (product) is simplified as a whole: the chain of ADD and SUB (MULT
+ * and DIV) nodes is flattened into a list of operands, the operands are
+ * sorted so that equal terms meet, numbers are folded into one constant and
+ * equal terms (bases) are merged adding up their coefficients (exponents).
+ * So x + 2*x - y + 1 + 3 becomes 3*x - y + 4 and x*y*x/3 becomes
+ * 0.333333 * (x^2 * y). The sum is built back as balanced trees of additions
+ * and subtractions, so long sums are evaluated in short dependency chains.
+ */
+static enum EquationError subeq_collect(struct Node *equation,
+										struct NodeArena *arena,
+										struct TermCollector *col)
+{
+	assert(equation);
+	assert(type(equation) == MATH_OP);
+	assert(col);
+
+	bool is_sum = op(equation) == MATH_ADD || op(equation) == MATH_SUB;
+	double constant = is_sum ? 0 : 1;
+	enum EquationError eq_err = collect_gather(equation, col, &constant);
+	enum EquationError *err = &eq_err;
+	if (eq_err == EQ_NO_ERR)
+		eq_err = collect_sort(col);
+
+	// Equal terms go to pending, their coefficients to the first one
+	size_t size = 0;
+	col->num_pending = 0;
+	for (size_t i = 0; eq_err == EQ_NO_ERR && i < col->size; i++) {
+		if (size > 0 && tree_is_same(col->terms[size - 1].term,
+									 col->terms[i].term, &col->cmp)) {
+			col->terms[size - 1].coef += col->terms[i].coef;
+			col->pending[col->num_pending++] = col->terms[i];
+		} else {
+			col->terms[size++] = col->terms[i];
+		}
+	}
+	if (eq_err < 0)
+		return eq_err;
+	col->size = size;
+
+	struct Node **nodes = (struct Node**) calloc(2 * size + 2,
+												 sizeof(struct Node*));
+	if (!nodes)
+		return EQ_NO_MEM_ERR;
+	struct Node **pos = nodes;
+	struct Node **neg = nodes + size + 1;
+	size_t num_pos = 0;
+	size_t num_neg = 0;
+	struct Node *res = NULL;
+
+	for (size_t i = 0; i < col->num_pending; i++)
+		node_op_delete(arena, col->pending[i].term);
+
+	if (is_sum) {
+		bool has_pos = constant > EQ_EPSILON;
+		for (size_t i = 0; i < size; i++)
+			has_pos |= col->terms[i].coef > EQ_EPSILON;
+
+		for (size_t i = 0; i <= size; i++) {
+			double coef = i < size ? col->terms[i].coef : constant;
+			if (is_equal(coef, 0)) {
+				if (i < size)
+					node_op_delete(arena, col->terms[i].term);
+				continue;
+			}
+
+			// Until there is a positive term the first one keeps its sign
+			bool is_neg = coef < 0 && has_pos;
+			double factor = is_neg ? -coef : coef;
+			struct Node *node = NULL;
+			if (i == size)
+				node = new_num(factor);
+			else if (is_equal(factor, 1))
+				node = col->terms[i].term;
+			else
+				node = new_op(MATH_MULT, new_num(factor), col->terms[i].term);
+
+			if (is_neg) {
+				neg[num_neg++] = node;
+			} else {
+				pos[num_pos++] = node;
+				has_pos = true;
+			}
+		}
+
+		if (num_pos == 0)
+			res = new_num(0);
+		else if (num_neg == 0)
+			res = collect_balanced(pos, num_pos, MATH_ADD, arena, err);
+		else
+			res = new_op(MATH_SUB,
+						 collect_balanced(pos, num_pos, MATH_ADD, arena, err),
+						 collect_balanced(neg, num_neg, MATH_ADD, arena, err));
+	} else {
+		for (size_t i = 0; i < size; i++) {
+			double exp = col->terms[i].coef;
+			if (is_equal(constant, 0) || is_equal(exp, 0)) {
+				node_op_delete(arena, col->terms[i].term);
+				continue;
+			}
+
+			struct Node *node = col->terms[i].term;
+			if (!is_equal(fabs(exp), 1))
+				node = new_op(MATH_POW, node, new_num(fabs(exp)));
+			if (exp < 0)
+				neg[num_neg++] = node;
+			else
+				pos[num_pos++] = node;
+		}
+
+		struct Node *denom = num_neg == 0 ? NULL :
+							 collect_balanced(neg, num_neg, MATH_MULT,
+											  arena, err);
+		if (is_equal(constant, 0)) {
+			res = new_num(0);
+		} else if (num_pos == 0) {
+			res = denom ? new_op(MATH_DIV, new_num(constant), denom) :
+						  new_num(constant);
+		} else {
+			res = collect_balanced(pos, num_pos, MATH_MULT, arena, err);
+			if (denom)
+				res = new_op(MATH_DIV, res, denom);
+			if (!is_equal(constant, 1))
+				res = new_op(MATH_MULT, new_num(constant), res);
+		}
+	}
+	free(nodes);
+	if (eq_err < 0)
+		return eq_err;
+
+	node_op_unshare(arena, equation);
+	equation->data = res->data;
+	equation->left = res->left;
+	equation->right = res->right;
+	equation->hash = res->hash;
+	node_op_free(arena, res);
+	while (col->dropped.size > 0)
+		node_op_free(arena, node_stack_pop(&col->dropped));
+
+	return EQ_NO_ERR;
+}
+
+static enum EquationError collect_gather(struct Node *equation,
+										 struct TermCollector *col,
+										 double *constant)
+{
+	assert(equation);
+	assert(col);
+	assert(constant);
+
+	bool is_sum = op(equation) == MATH_ADD || op(equation) == MATH_SUB;
+	col->size = 0;
+	col->num_pending = 0;
+	col->dropped.size = 0;
+
+	enum EquationError err = collected_push(&col->pending, &col->num_pending,
+											&col->cap_pending, {equation, 1});
+	while (err == EQ_NO_ERR && col->num_pending > 0) {
+		struct CollectedTerm item = col->pending[--col->num_pending];
+		struct Node *node = item.term;
+
+		if (is_same_chain(node, op(equation))) {
+			double right_coef = op(node) == MATH_SUB ||
+								op(node) == MATH_DIV ? -item.coef : item.coef;
+			if (node != equation &&
+				node_stack_push(&col->dropped, node, NODE_VISIT_POST) < 0)
+				return EQ_NO_MEM_ERR;
+			err = collected_push(&col->pending, &col->num_pending,
+								 &col->cap_pending, {node->right, right_coef});
+			if (err == EQ_NO_ERR)
+				err = collected_push(&col->pending, &col->num_pending,
+									 &col->cap_pending, {node->left, item.coef});
+			continue;
+		}
+
+		struct Node *shell_num = NULL;
+		if (type(node) == MATH_NUM) {
+			if (is_sum) {
+				*constant += item.coef * num(node);
+			} else if (item.coef > 0) {
+				*constant *= num(node);
+			} else {
+				if (is_equal(num(node), 0))
+					return EQ_ZERO_DIV_ERR;
+				*constant /= num(node);
+			}
+			if (node_stack_push(&col->dropped, node, NODE_VISIT_POST) < 0)
+				return EQ_NO_MEM_ERR;
+			continue;
+		} else if (is_sum && type(node) == MATH_OP &&
+				   op(node) == MATH_MULT && type(node->left) == MATH_NUM) {
+			shell_num = node->left;
+			item.term = node->right;
+			item.coef *= num(shell_num);
+		} else if (!is_sum && type(node) == MATH_OP &&
+				   op(node) == MATH_POW && type(node->right) == MATH_NUM) {
+			shell_num = node->right;
+			item.term = node->left;
+			item.coef *= num(shell_num);
+		}
+		if (shell_num &&
+			(node_stack_push(&col->dropped, node, NODE_VISIT_POST) < 0 ||
+			 node_stack_push(&col->dropped, shell_num, NODE_VISIT_POST) < 0))
+			return EQ_NO_MEM_ERR;
+		err = collected_push(&col->terms, &col->size, &col->cap, item);
+	}
+	return err;
+}
+
+// Stable bottom-up merge sort by subeq_compare, pending is the buffer
+static enum EquationError collect_sort(struct TermCollector *col)
+{
+	assert(col);
+
+	size_t size = col->size;
+	if (col->cap_pending < size) {
+		struct CollectedTerm *tmp = (struct CollectedTerm*) realloc(
+						col->pending, size * sizeof(struct CollectedTerm));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		col->pending = tmp;
+		col->cap_pending = size;
+	}
 
 	enum EquationError err = EQ_NO_ERR;
+	struct CollectedTerm *src = col->terms;
+	struct CollectedTerm *dst = col->pending;
+	for (size_t width = 1; width < size; width *= 2) {
+		for (size_t lo = 0; lo < size; lo += 2 * width) {
+			size_t mid = lo + width < size ? lo + width : size;
+			size_t hi = lo + 2 * width < size ? lo + 2 * width : size;
+			size_t i = lo;
+			size_t j = mid;
+			size_t k = lo;
+			while (i < mid && j < hi) {
+				if (subeq_compare(src[j].term, src[i].term, &col->cmp,
+								  &err) < 0)
+					dst[k++] = src[j++];
+				else
+					dst[k++] = src[i++];
+			}
+			while (i < mid)
+				dst[k++] = src[i++];
+			while (j < hi)
+				dst[k++] = src[j++];
+		}
+		struct CollectedTerm *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src != col->terms)
+		memcpy(col->terms, src, size * sizeof(struct CollectedTerm));
+	return err;
+}
 
-	err = subeq_simplify(equation->left);
-	if (err < 0)
-		return err;
-	err = subeq_simplify(equation->right);
-	if (err < 0)
-		return err;
+/*
+ * A total order of equations: numbers go first, then variables, then
+ * operators, which are compared by the operator and then by the hash. Only
+ * operators with the same hash, equal ones but for collisions, are compared
+ * by the operands, so terms sharing long subtrees are ordered in O(1).
+ * Equal equations compare as 0.
+ */
+static int subeq_compare(struct Node *a, struct Node *b,
+						 struct NodeStack *stack, enum EquationError *err)
+{
+	assert(a);
+	assert(b);
+	assert(stack);
+	assert(err);
+
+	const int TYPE_RANKS[] = {
+		[MATH_NUM] = 0,
+		[MATH_OP]  = 2,
+		[MATH_VAR] = 1,
+	};
+
+	stack->size = 0;
+	if (node_stack_push(stack, a, NODE_VISIT_PRE) < 0 ||
+		node_stack_push(stack, b, NODE_VISIT_PRE) < 0) {
+		*err = EQ_NO_MEM_ERR;
+		return 1;
+	}
+	while (stack->size > 0) {
+		b = node_stack_pop(stack);
+		a = node_stack_pop(stack);
+		if (a == b)
+			continue;
+
+		if (type(a) != type(b))
+			return TYPE_RANKS[type(a)] < TYPE_RANKS[type(b)] ? -1 : 1;
+		switch (type(a)) {
+			case MATH_NUM:
+				if (num(a) < num(b))
+					return -1;
+				if (num(b) < num(a))
+					return 1;
+				break;
+			case MATH_VAR:
+				if (var(a) != var(b))
+					return var(a) < var(b) ? -1 : 1;
+				break;
+			case MATH_OP:
+				if (op(a) != op(b))
+					return op(a) < op(b) ? -1 : 1;
+				if (a->hash != b->hash)
+					return a->hash < b->hash ? -1 : 1;
+				if ((a->right &&
+					 (node_stack_push(stack, a->right, NODE_VISIT_PRE) < 0 ||
+					  node_stack_push(stack, b->right, NODE_VISIT_PRE) < 0)) ||
+					(a->left &&
+					 (node_stack_push(stack, a->left, NODE_VISIT_PRE) < 0 ||
+					  node_stack_push(stack, b->left, NODE_VISIT_PRE) < 0))) {
+					*err = EQ_NO_MEM_ERR;
+					return 1;
+				}
+				break;
+			default:
+				*err = EQ_TREE_ERR;
+				return 1;
+		}
+	}
+	return 0;
+}
+
+// Pairs up neighbours until one node is left, nodes are used as the buffer
+static struct Node *collect_balanced(struct Node **nodes, size_t size,
+									 enum MathOp op, struct NodeArena *arena,
+									 enum EquationError *err)
+{
+	assert(nodes);
+	assert(size > 0);
+	assert(err);
 
-	if (type(equation) == MATH_OP && !eq_left &&
-		type(eq_right) == MATH_NUM) {
+	while (size > 1) {
+		size_t k = 0;
+		for (size_t i = 0; i + 1 < size; i += 2)
+			nodes[k++] = new_op(op, nodes[i], nodes[i + 1]);
+		if (size % 2 == 1)
+			nodes[k++] = nodes[size - 1];
+		size = k;
+	}
+	return nodes[0];
+}
+
+static enum EquationError collected_push(struct CollectedTerm **arr,
+										 size_t *size, size_t *cap,
+										 struct CollectedTerm val)
+{
+	assert(arr);
+	assert(size);
+	assert(cap);
+
+	if (*size >= *cap) {
+		size_t new_cap = *cap ? 2 * *cap : NODE_STACK_INIT_CAPACITY;
+		struct CollectedTerm *tmp = (struct CollectedTerm*) realloc(*arr,
+									new_cap * sizeof(struct CollectedTerm));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		*arr = tmp;
+		*cap = new_cap;
+	}
+	(*arr)[(*size)++] = val;
+	return EQ_NO_ERR;
+}
+
+static enum EquationError subeq_simplify_node(struct Node *equation,
+											  struct NodeArena *arena)
+{
+	assert(equation);
+	assert(type(equation) == MATH_OP);
+
+	enum EquationError err = EQ_NO_ERR;
+
+	if (!eq_left && type(eq_right) == MATH_NUM) {
 		double eval_res = (*MATH_OP_DEFS[op(equation)].eval)(NAN,
 															 num(eq_right),
 															 &err);
@@ -117,8 +1032,7 @@ static enum EquationError subeq_simplify(struct Node *equation)
 		to_num(equation, eval_res);
 		return EQ_NO_ERR;
 	}
-	if (type(equation) == MATH_OP && !eq_right &&
-		type(eq_left) == MATH_NUM) {
+	if (!eq_right && type(eq_left) == MATH_NUM) {
 		double eval_res = (*MATH_OP_DEFS[op(equation)].eval)(num(eq_left),
 															 NAN,
 															 &err);
@@ -127,7 +1041,7 @@ static enum EquationError subeq_simplify(struct Node *equation)
 		to_num(equation, eval_res);
 		return EQ_NO_ERR;
 	}
-	if (eq_left && eq_right && type(equation) == MATH_OP &&
+	if (eq_left && eq_right &&
 		type(eq_left) == MATH_NUM && type(eq_right) == MATH_NUM) {
 		double eval_res = (*MATH_OP_DEFS[op(equation)].eval)(num(eq_left),
 															 num(eq_right),
@@ -137,52 +1051,41 @@ static enum EquationError subeq_simplify(struct Node *equation)
 		to_num(equation, eval_res);
 		return EQ_NO_ERR;
 	}
-	if (type(equation) == MATH_OP) {
-		return (*MATH_OP_DEFS[op(equation)].simplify)(equation);
-	}
 
-	return EQ_NO_ERR;
+	return (*MATH_OP_DEFS[op(equation)].simplify)(equation, arena);
 }
 
 enum EquationError eq_evaluate(struct Equation equation, double *vals,
 							   double *res)
 {
-	return subeq_evaluate(equation.tree, vals, res);
+	return eq_evaluate_as<double>(equation, vals, res);
 }
 
-static enum EquationError subeq_evaluate(struct Node *subeq, double *vals,
-										 double *res)
+enum EquationError eq_evaluate_dual(struct Equation equation,
+									size_t diff_var_ind, double *vals,
+									double *res, double *diff_res)
 {
 	assert(vals);
 	assert(res);
+	assert(diff_res);
 
-	if (!subeq) {
-		*res = NAN;
-		return EQ_NO_ERR;
-	}
-
-	if (type(subeq) == MATH_NUM) {
-		*res = num(subeq);
-		return EQ_NO_ERR;
-	}
-	if (type(subeq) == MATH_VAR) {
-		*res = vals[var(subeq)];
-		return EQ_NO_ERR;
+	size_t num_vars = equation.num_vars > 0 ? equation.num_vars : 1;
+	struct DualValue *duals = (struct DualValue*) calloc(num_vars,
+												sizeof(struct DualValue));
+	if (!duals)
+		return EQ_NO_MEM_ERR;
+	for (size_t i = 0; i < equation.num_vars; i++) {
+		bool is_diff_var = i == diff_var_ind;
+		duals[i] = {vals[i], is_diff_var ? 1.0 : 0.0, is_diff_var};
 	}
 
-	double left = NAN;
-	double right = NAN;
-	enum EquationError err = EQ_NO_ERR;
-
-	err = subeq_evaluate(subeq->left, vals, &left);
-	if (err < 0)
-		return err;
-	err = subeq_evaluate(subeq->right, vals, &right);
-	if (err < 0)
-		return err;
-	*res = (*MATH_OP_DEFS[op(subeq)].eval)(left, right, &err);
+	struct DualValue dual = {};
+	enum EquationError err = eq_evaluate_as<DualValue>(equation, duals, &dual);
+	free(duals);
 	if (err < 0)
 		return err;
+	*res = dual.val;
+	*diff_res = dual.diff;
 	return EQ_NO_ERR;
 }
 
@@ -205,81 +1108,298 @@ enum EquationError eq_expand_into_teylor(struct Equation eq,
 
 	enum EquationError eq_err = EQ_NO_ERR;
 	enum EquationError *err = &eq_err;
+	struct NodeArena *arena = teylor->arena;
 
-	double vals[] = { 0.0 };
-	double coeff = NAN;
-	double n_fact = 1;
-
-	struct Equation n_diff = {};
-	struct Equation eq_tmp = {};
-
-	eq_err = eq_ctor(&n_diff);
-	if (eq_err < 0)
-		goto finally;
-	eq_err = eq_differentiate(eq, 0, &n_diff);
-	if (eq_err < 0)
-		goto finally;
-	eq_err = eq_simplify(&n_diff);
-	if (eq_err < 0)
-		goto finally;
-	eq_err = eq_evaluate(eq, vals, &coeff);
-	if (eq_err < 0)
-		goto finally;
-	teylor->tree = new_num(coeff);
+	double *coeffs = (double*) calloc(extent + 1, sizeof(double));
+	if (!coeffs)
+		return EQ_NO_MEM_ERR;
+	eq_err = subeq_series(eq.tree, eq.arena, extent + 1, coeffs);
 	if (eq_err < 0)
 		goto finally;
 
-	for (size_t n = 1; n <= extent; n++) {
-		n_fact *= (double) n;
-		eq_err = eq_evaluate(n_diff, vals, &coeff);
-		if (eq_err < 0)
-			goto finally;
+	teylor->tree = new_num(coeffs[0]);
+	for (size_t n = 1; n <= extent && eq_err == EQ_NO_ERR; n++) {
 		teylor->tree =
 			new_op(MATH_ADD, teylor->tree,
-				   new_op(MATH_MULT, new_op(MATH_DIV, new_num(coeff),
-				   							new_num(n_fact)),
+				   new_op(MATH_MULT, new_num(coeffs[n]),
 				   		  new_op(MATH_POW, new_var(0), new_num((double) n))));
-		if (eq_err < 0)
-			goto finally;
-		eq_err = eq_differentiate(n_diff, 0, &eq_tmp);
-		if (eq_err < 0)
-			goto finally;
-		eq_dtor(&n_diff);
-		n_diff = eq_tmp;
-		eq_tmp.tree = NULL;
-		eq_tmp.var_names = NULL;
-		eq_err = eq_simplify(&n_diff);
-		if (eq_err < 0)
-			goto finally;
 	}
 
 	finally:
-		eq_dtor(&n_diff);
+		free(coeffs);
 		return eq_err;
 }
 
+/*
+ * Taylor mode: instead of n derivative trees, truncated power series of
+ * every node at x = 0 are carried through the tree with MATH_OP_DEFS
+ * recurrences, O(n^2) per node. res receives the coefficients
+ * f^(k)(0) / k!, k < n. Series wait on a stack of n-value blocks; in a
+ * sharing arena a memo keeps indices of computed blocks in cache.
+ */
+static enum EquationError subeq_series(struct Node *subeq,
+									   struct NodeArena *arena, size_t n,
+									   double *res)
+{
+	assert(res);
+	assert(n > 0);
+
+	if (!subeq) {
+		for (size_t k = 0; k < n; k++)
+			res[k] = NAN;
+		return EQ_NO_ERR;
+	}
+
+	bool is_shared = arena && arena->is_shared;
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	struct NodeMap memo = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	double *stack = NULL;
+	size_t stack_size = 0;
+	size_t stack_cap = 0;
+	double *cache = NULL;
+	size_t cache_size = 0;
+	size_t cache_cap = 0;
+	double *scratch = (double*) calloc(3 * n, sizeof(double));
+	double *val = scratch;
+	double *tmp = scratch + n;
+
+	if (!scratch || (is_shared && node_map_ctor(&memo) < 0) ||
+		tree_walk_start(&walk, subeq) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		union NodeMapValue *known = NULL;
+		if (frame.step == NODE_VISIT_PRE && is_shared &&
+			type(frame.node) == MATH_OP &&
+			(known = node_map_find(&memo, frame.node))) {
+			tree_walk_skip(&walk, frame.node);
+			memcpy(val, cache + known->ind * n, n * sizeof(double));
+		} else if (frame.step != NODE_VISIT_POST) {
+			continue;
+		} else if (type(frame.node) == MATH_NUM) {
+			memset(val, 0, n * sizeof(double));
+			val[0] = num(frame.node);
+		} else if (type(frame.node) == MATH_VAR) {
+			memset(val, 0, n * sizeof(double));
+			if (n > 1)
+				val[1] = 1;
+		} else {
+			const double *right = NULL;
+			const double *left = NULL;
+			if (frame.node->right)
+				right = stack + --stack_size * n;
+			if (frame.node->left)
+				left = stack + --stack_size * n;
+
+			(*MATH_OP_DEFS[op(frame.node)].series)(left, right, val, n, tmp,
+												   &err);
+			if (err < 0)
+				break;
+
+			if (is_shared) {
+				union NodeMapValue ind = {};
+				ind.ind = cache_size;
+				err = series_push(&cache, &cache_size, &cache_cap, val, n);
+				if (err == EQ_NO_ERR &&
+					node_map_insert(&memo, frame.node, ind) < 0)
+					err = EQ_NO_MEM_ERR;
+				if (err < 0)
+					break;
+			}
+		}
+
+		err = series_push(&stack, &stack_size, &stack_cap, val, n);
+	}
+
+	if (err == EQ_NO_ERR)
+		memcpy(res, stack, n * sizeof(double));
+	free(stack);
+	free(cache);
+	free(scratch);
+	node_map_dtor(&memo);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+static enum EquationError series_push(double **blocks, size_t *size,
+									  size_t *cap, const double *val, size_t n)
+{
+	assert(blocks);
+	assert(size);
+	assert(cap);
+	assert(val);
+
+	if (*size >= *cap) {
+		size_t new_cap = *cap ? 2 * *cap : NODE_STACK_INIT_CAPACITY;
+		double *tmp = (double*) realloc(*blocks,
+										new_cap * n * sizeof(double));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		*blocks = tmp;
+		*cap = new_cap;
+	}
+	memcpy(*blocks + (*size)++ * n, val, n * sizeof(double));
+	return EQ_NO_ERR;
+}
+
+/*
+ * Truncated power series: arrays of n Taylor coefficients. Every function
+ * below takes O(n^2) and its result must not alias its arguments.
+ */
+static void series_mult(const double *a, const double *b, double *c,
+						size_t n)
+{
+	for (size_t k = 0; k < n; k++) {
+		double sum = 0;
+		for (size_t j = 0; j <= k; j++)
+			sum += a[j] * b[k - j];
+		c[k] = sum;
+	}
+}
+
+static void series_div(const double *a, const double *b, double *c,
+					   size_t n)
+{
+	for (size_t k = 0; k < n; k++) {
+		double sum = a[k];
+		for (size_t j = 1; j <= k; j++)
+			sum -= b[j] * c[k - j];
+		c[k] = sum / b[0];
+	}
+}
+
+/*
+ * Coefficients from the first one on of c with c' = u' / q, c[0] is given.
+ */
+static void series_integrate_ratio(const double *u, const double *q,
+								   double *c, size_t n)
+{
+	for (size_t k = 1; k < n; k++) {
+		double sum = (double) k * u[k];
+		for (size_t j = 1; j < k; j++)
+			sum -= (double) j * c[j] * q[k - j];
+		c[k] = sum / ((double) k * q[0]);
+	}
+}
+
+static void series_exp(const double *u, double *e, size_t n)
+{
+	e[0] = exp(u[0]);
+	for (size_t k = 1; k < n; k++) {
+		double sum = 0;
+		for (size_t j = 1; j <= k; j++)
+			sum += (double) j * u[j] * e[k - j];
+		e[k] = sum / (double) k;
+	}
+}
+
+static void series_sqrt(const double *u, double *c, size_t n)
+{
+	c[0] = sqrt(u[0]);
+	for (size_t k = 1; k < n; k++) {
+		double sum = u[k];
+		for (size_t j = 1; j < k; j++)
+			sum -= c[j] * c[k - j];
+		c[k] = sum / (2 * c[0]);
+	}
+}
+
+static void series_sin_cos(const double *u, double *s, double *c, size_t n)
+{
+	s[0] = sin(u[0]);
+	c[0] = cos(u[0]);
+	for (size_t k = 1; k < n; k++) {
+		double sum_s = 0;
+		double sum_c = 0;
+		for (size_t j = 1; j <= k; j++) {
+			sum_s += (double) j * u[j] * c[k - j];
+			sum_c += (double) j * u[j] * s[k - j];
+		}
+		s[k] = sum_s / (double) k;
+		c[k] = -sum_c / (double) k;
+	}
+}
+
+// arcsin' = u' / sqrt(1 - u^2), tmp holds 2n values
+static void series_arcsin_tail(const double *u, double *c, size_t n,
+							   double *tmp)
+{
+	series_mult(u, u, tmp, n);
+	for (size_t k = 0; k < n; k++)
+		tmp[k] = -tmp[k];
+	tmp[0] += 1;
+	series_sqrt(tmp, tmp + n, n);
+	series_integrate_ratio(u, tmp + n, c, n);
+}
+
+// arctg' = u' / (1 + u^2), tmp holds n values
+static void series_arctg_tail(const double *u, double *c, size_t n,
+							  double *tmp)
+{
+	series_mult(u, u, tmp, n);
+	tmp[0] += 1;
+	series_integrate_ratio(u, tmp, c, n);
+}
+
 static bool is_equal(double a, double b)
 {
 	return abs(a - b) < EQ_EPSILON;
 }
 
-struct Node *math_diff_add(const struct Node *equation, size_t var,
-						   enum EquationError *err)
+// u + u, u - u, u / u for any subtree u
+static bool is_same_operands(struct Node *equation)
+{
+	assert(equation);
+
+	struct NodeStack stack = {};
+	bool is_same = tree_is_same(eq_left, eq_right, &stack);
+	node_stack_dtor(&stack);
+	return is_same;
+}
+
+struct Node *math_diff_add(const struct Node *equation,
+						   struct Node *diff_left, struct Node *diff_right,
+						   struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_ADD);
 	
-	return new_op(MATH_ADD, diff(eq_left), diff(eq_right));
+	return make_op(MATH_ADD, diff_left, diff_right);
 }
 									 	
-double math_eval_add(double l, double r, enum EquationError */*err*/)
+double math_eval_add(double l, double r, enum EquationError *err)
+{
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_ADD>(l, r, err);
+}
+
+void math_partial_add(double /*l*/, double /*r*/, double /*res*/,
+					  double *d_left, double *d_right,
+					  enum EquationError */*err*/)
+{
+	*d_left = 1;
+	*d_right = 1;
+}
+
+void math_series_add(const double *l, const double *r, double *res,
+					 size_t n, double */*tmp*/, enum EquationError */*err*/)
 {
-	return l + r;
+	for (size_t k = 0; k < n; k++)
+		res[k] = l[k] + r[k];
 }
 
-enum EquationError math_simplify_add(struct Node *equation)
+enum EquationError math_simplify_add(struct Node *equation,
+									 struct NodeArena *arena)
 {
 	assert(equation);
 	assert(type(equation) == MATH_OP);
@@ -289,34 +1409,52 @@ enum EquationError math_simplify_add(struct Node *equation)
 	enum EquationError *err = &eq_err;
 	if (type(eq_left) == MATH_NUM) {
 		if (is_equal(num(eq_left), 0))
-			eq_lift_up_right(equation);
+			eq_lift_up_right(arena, equation);
 	} else if (type(eq_right) == MATH_NUM) {
 		if (is_equal(num(eq_right), 0))
-			eq_lift_up_left(equation);
-	} else if (type(eq_right) == MATH_VAR && type(eq_left) == MATH_VAR &&
-			   var(eq_right) == var(eq_left)) {
+			eq_lift_up_left(arena, equation);
+	} else if (is_same_operands(equation)) {
 		to_op(equation, MATH_MULT, new_num(2), copy(eq_left));
 	}
 	return eq_err;
 }
 
-struct Node *math_diff_sub(const struct Node *equation, size_t var,
-						   enum EquationError *err)
+struct Node *math_diff_sub(const struct Node *equation,
+						   struct Node *diff_left, struct Node *diff_right,
+						   struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_SUB);
 
-	return new_op(MATH_SUB, diff(eq_left), diff(eq_right));
+	return make_op(MATH_SUB, diff_left, diff_right);
+}
+
+double math_eval_sub(double l, double r, enum EquationError *err)
+{
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_SUB>(l, r, err);
 }
 
-double math_eval_sub(double l, double r, enum EquationError */*err*/)
+void math_partial_sub(double /*l*/, double /*r*/, double /*res*/,
+					  double *d_left, double *d_right,
+					  enum EquationError */*err*/)
 {
-	return l - r;
+	*d_left = 1;
+	*d_right = -1;
 }
 
-enum EquationError math_simplify_sub(struct Node *equation)
+void math_series_sub(const double *l, const double *r, double *res,
+					 size_t n, double */*tmp*/, enum EquationError */*err*/)
+{
+	for (size_t k = 0; k < n; k++)
+		res[k] = l[k] - r[k];
+}
+
+enum EquationError math_simplify_sub(struct Node *equation,
+									 struct NodeArena *arena)
 {
 	assert(equation);
 
@@ -327,33 +1465,50 @@ enum EquationError math_simplify_sub(struct Node *equation)
 			to_op(equation, MATH_MULT, new_num(-1), copy(eq_right));
 	} else if (type(eq_right) == MATH_NUM) {
 		if (is_equal(num(eq_right), 0))
-			eq_lift_up_left(equation);
-	} else if (type(eq_right) == MATH_VAR && type(eq_left) == MATH_VAR &&
-			   var(eq_right) == var(eq_left)) {
+			eq_lift_up_left(arena, equation);
+	} else if (is_same_operands(equation)) {
 		to_num(equation, 0);
 	}
 	return eq_err;
 }
 
-struct Node *math_diff_mult(const struct Node *equation, size_t var,
-							enum EquationError *err)
+struct Node *math_diff_mult(const struct Node *equation,
+							struct Node *diff_left, struct Node *diff_right,
+							struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_MULT);
 
-	return new_op(MATH_ADD,
-				  new_op(MATH_MULT, diff(eq_left), copy(eq_right)),
-				  new_op(MATH_MULT, copy(eq_left), diff(eq_right)));
+	return make_op(MATH_ADD,
+				   make_op(MATH_MULT, diff_left, copy(eq_right)),
+				   make_op(MATH_MULT, copy(eq_left), diff_right));
+}
+
+double math_eval_mult(double l, double r, enum EquationError *err)
+{
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_MULT>(l, r, err);
+}
+
+void math_partial_mult(double l, double r, double /*res*/,
+					   double *d_left, double *d_right,
+					   enum EquationError */*err*/)
+{
+	*d_left = r;
+	*d_right = l;
 }
 
-double math_eval_mult(double l, double r, enum EquationError */*err*/)
+void math_series_mult(const double *l, const double *r, double *res,
+					  size_t n, double */*tmp*/, enum EquationError */*err*/)
 {
-	return l * r;
+	series_mult(l, r, res, n);
 }
 
-enum EquationError math_simplify_mult(struct Node *equation)
+enum EquationError math_simplify_mult(struct Node *equation,
+									  struct NodeArena *arena)
 {
 	assert(equation);
 
@@ -361,45 +1516,59 @@ enum EquationError math_simplify_mult(struct Node *equation)
 		if (is_equal(num(eq_left), 0))
 			to_num(equation, 0);
 		else if (is_equal(num(eq_left), 1))
-			eq_lift_up_right(equation);
+			eq_lift_up_right(arena, equation);
 	} else if (type(eq_right) == MATH_NUM) {
 		if (is_equal(num(eq_right), 0))
 			to_num(equation, 0);
 		else if (is_equal(num(eq_right), 1))
-			eq_lift_up_left(equation);
+			eq_lift_up_left(arena, equation);
 	}
 
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_div(const struct Node *equation, size_t var,
-						   enum EquationError *err)
+struct Node *math_diff_div(const struct Node *equation,
+						   struct Node *diff_left, struct Node *diff_right,
+						   struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_DIV);
 
-	return new_op(MATH_DIV,
-				  new_op(MATH_SUB,
-				  		 new_op(MATH_MULT, diff(eq_left), copy(eq_right)),
-				  		 new_op(MATH_MULT, copy(eq_left), diff(eq_right))),
-				  new_op(MATH_POW, copy(eq_right), new_num(2)));
+	return make_op(MATH_DIV,
+				   make_op(MATH_SUB,
+				  		  make_op(MATH_MULT, diff_left, copy(eq_right)),
+				  		  make_op(MATH_MULT, copy(eq_left), diff_right)),
+				   make_op(MATH_POW, copy(eq_right), new_num(2)));
 }
 
 double math_eval_div(double l, double r, enum EquationError *err)
 {
 	assert(err);
 
-	if (is_equal(r, 0)) {
-		*err = EQ_ZERO_DIV_ERR;
-		return NAN;
-	}
+	return ScalarOps<double>::eval<MATH_DIV>(l, r, err);
+}
+
+void math_partial_div(double /*l*/, double r, double res,
+					  double *d_left, double *d_right,
+					  enum EquationError */*err*/)
+{
+	*d_left = 1 / r;
+	*d_right = -res / r;
+}
 
-	return l / r;
+void math_series_div(const double *l, const double *r, double *res,
+					 size_t n, double */*tmp*/, enum EquationError *err)
+{
+	res[0] = math_eval_div(l[0], r[0], err);
+	if (*err < 0)
+		return;
+	series_div(l, r, res, n);
 }
 
-enum EquationError math_simplify_div(struct Node *equation)
+enum EquationError math_simplify_div(struct Node *equation,
+									 struct NodeArena *arena)
 {
 	assert(equation);
 
@@ -410,16 +1579,16 @@ enum EquationError math_simplify_div(struct Node *equation)
 		if (is_equal(num(eq_right), 0))
 			return EQ_ZERO_DIV_ERR;
 		else if (is_equal(num(eq_right), 1))
-			eq_lift_up_left(equation);
-	} else if (type(eq_right) == MATH_VAR && type(eq_left) == MATH_VAR &&
-			   var(eq_left) == var(eq_right)) {
+			eq_lift_up_left(arena, equation);
+	} else if (is_same_operands(equation)) {
 		to_num(equation, 1);
 	}
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_pow(const struct Node *equation, size_t var,
-						   enum EquationError *err)
+struct Node *math_diff_pow(const struct Node *equation,
+						   struct Node *diff_left, struct Node *diff_right,
+						   struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
@@ -427,43 +1596,114 @@ struct Node *math_diff_pow(const struct Node *equation, size_t var,
 	assert(op(equation) == MATH_POW);
 
 	if (type(eq_right) == MATH_NUM) {
-		return new_op(MATH_MULT, new_op(MATH_MULT, copy(eq_right),
-					  new_op(MATH_POW, copy(eq_left),
-					  		 new_op(MATH_SUB, copy(eq_right), new_num(1)))),
-					  diff(eq_left));
+		node_op_delete(arena, diff_right);
+		return make_op(MATH_MULT, make_op(MATH_MULT, copy(eq_right),
+					   make_op(MATH_POW, copy(eq_left),
+					  		  make_op(MATH_SUB, copy(eq_right), new_num(1)))),
+					   diff_left);
 	}
 	//TODO: copy(equation) instead of copy(eq_left) ^ copy(eq_right)
 	if (type(eq_left) == MATH_NUM) {
-		return new_op(MATH_MULT, new_op(MATH_MULT,
-					  new_op(MATH_POW, copy(eq_left), copy(eq_right)),
-					  new_num(log(num(eq_left)))),
-					  diff(eq_right));
+		node_op_delete(arena, diff_left);
+		return make_op(MATH_MULT, make_op(MATH_MULT,
+					   make_op(MATH_POW, copy(eq_left), copy(eq_right)),
+					   new_num(log(num(eq_left)))),
+					   diff_right);
 	}
 
 
-	return new_op(MATH_MULT, new_op(MATH_POW, new_num(M_E),
-				  new_op(MATH_MULT,
-					     new_op(MATH_LN, NULL, copy(eq_left)),
-					     copy(eq_right))),
-				  new_op(MATH_ADD, new_op(MATH_DIV,
-				  		 new_op(MATH_MULT, diff(eq_left), copy(eq_right)), 
-				  		 copy(eq_left)),
-				  		 new_op(MATH_MULT, new_op(MATH_LN, NULL, copy(eq_left)), diff(eq_right))));
+	return make_op(MATH_MULT, make_op(MATH_POW, new_num(M_E),
+				   make_op(MATH_MULT,
+					      make_op(MATH_LN, NULL, copy(eq_left)),
+					      copy(eq_right))),
+				   make_op(MATH_ADD, make_op(MATH_DIV,
+				  		  make_op(MATH_MULT, diff_left, copy(eq_right)), 
+				  		  copy(eq_left)),
+				  		  make_op(MATH_MULT, make_op(MATH_LN, NULL, copy(eq_left)), diff_right)));
+}
+
+double math_eval_pow(double l, double r, enum EquationError *err)
+{
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_POW>(l, r, err);
+}
+
+void math_partial_pow(double l, double r, double res,
+					  double *d_left, double *d_right,
+					  enum EquationError */*err*/)
+{
+	*d_left = r * pow(l, r - 1);
+	*d_right = res * log(l);
 }
 
-double math_eval_pow(double l, double r, enum EquationError */*err*/)
+void math_series_pow(const double *l, const double *r, double *res,
+					 size_t n, double *tmp, enum EquationError *err)
 {
-	return pow(l, r);
+	bool is_const_exp = true;
+	for (size_t k = 1; k < n; k++)
+		is_const_exp = is_const_exp && is_equal(r[k], 0);
+
+	if (!is_const_exp) {
+		if (l[0] <= 0) {
+			math_eval_ln(NAN, l[0], err);
+			return;
+		}
+		tmp[0] = log(l[0]);
+		series_integrate_ratio(l, l, tmp, n);
+		series_mult(tmp, r, tmp + n, n);
+		series_exp(tmp + n, res, n);
+		return;
+	}
+
+	double p = r[0];
+	if (!is_equal(l[0], 0) || p < 0 || !is_equal(p, round(p))) {
+		// The recurrence divides by l[0], a negative or fractional power of
+		// a base starting with 0 has no Taylor series
+		if (n > 1 && is_equal(l[0], 0)) {
+			*err = EQ_ZERO_DIV_ERR;
+			return;
+		}
+		res[0] = math_eval_pow(l[0], p, err);
+		if (*err < 0)
+			return;
+		for (size_t k = 1; k < n; k++) {
+			double sum = 0;
+			for (size_t j = 1; j <= k; j++)
+				sum += ((p + 1) * (double) j - (double) k) * l[j] * res[k - j];
+			res[k] = sum / ((double) k * l[0]);
+		}
+		return;
+	}
+
+	// The base starts with 0, so integer powers are multiplied out
+	double *base = tmp;
+	double *prod = tmp + n;
+	memcpy(base, l, n * sizeof(double));
+	res[0] = 1;
+	for (size_t k = 1; k < n; k++)
+		res[k] = 0;
+	for (size_t m = (size_t) llround(p); m > 0; m >>= 1) {
+		if (m & 1) {
+			series_mult(res, base, prod, n);
+			memcpy(res, prod, n * sizeof(double));
+		}
+		if (m > 1) {
+			series_mult(base, base, prod, n);
+			memcpy(base, prod, n * sizeof(double));
+		}
+	}
 }
 
-enum EquationError math_simplify_pow(struct Node *equation)
+enum EquationError math_simplify_pow(struct Node *equation,
+									 struct NodeArena *arena)
 {
 	assert(equation);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_POW);
 
 	if (type(eq_right) == MATH_NUM && is_equal(num(eq_right), 1)) {
-		eq_lift_up_left(equation);
+		eq_lift_up_left(arena, equation);
 	} else if (type(eq_left) == MATH_NUM && (is_equal(num(eq_left), 1) ||
 			 is_equal(num(eq_left), 0))) {
 		to_num(equation, num(eq_left));
@@ -472,17 +1712,18 @@ enum EquationError math_simplify_pow(struct Node *equation)
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_ln(const struct Node *equation, size_t var,
-						  enum EquationError *err)
+struct Node *math_diff_ln(const struct Node *equation,
+						  struct Node */*diff_left*/, struct Node *diff_right,
+						  struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_LN);
 
-	return new_op(MATH_MULT,
-				  new_op(MATH_DIV, new_num(1), copy(eq_right)),
-				  diff(eq_right));
+	return make_op(MATH_MULT,
+				   make_op(MATH_DIV, new_num(1), copy(eq_right)),
+				   diff_right);
 }
 
 double math_eval_ln(double l, double r, enum EquationError *err)
@@ -490,256 +1731,453 @@ double math_eval_ln(double l, double r, enum EquationError *err)
 	assert(isnan(l));
 	assert(err);
 
-	if (r <= 0) {
-		*err = EQ_LN_NEGATIVE_ARG_ERR;
-		return NAN;
-	}
+	return ScalarOps<double>::eval<MATH_LN>(l, r, err);
+}
 
-	return 0;
+void math_partial_ln(double l, double r, double /*res*/,
+					 double */*d_left*/, double *d_right,
+					 enum EquationError *err)
+{
+	assert(isnan(l));
+
+	*d_right = math_eval_div(1, r, err);
+}
+
+void math_series_ln(const double */*l*/, const double *r, double *res,
+					size_t n, double */*tmp*/, enum EquationError *err)
+{
+	res[0] = math_eval_ln(NAN, r[0], err);
+	if (*err < 0)
+		return;
+	series_integrate_ratio(r, r, res, n);
 }
 
-enum EquationError math_simplify_ln (struct Node */*equation*/)
+enum EquationError math_simplify_ln(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_cos(const struct Node *equation, size_t var,
-						   enum EquationError *err)
+struct Node *math_diff_cos(const struct Node *equation,
+						   struct Node */*diff_left*/, struct Node *diff_right,
+						   struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_COS);
 
-	return new_op(MATH_MULT, new_op(MATH_MULT, new_num(-1), 
-				  new_op(MATH_SIN, NULL, copy(eq_right))),
-				  diff(eq_right));
+	return make_op(MATH_MULT, make_op(MATH_MULT, new_num(-1), 
+				   make_op(MATH_SIN, NULL, copy(eq_right))),
+				   diff_right);
 }
 
-double math_eval_cos(double l, double r, enum EquationError */*err*/)
+double math_eval_cos(double l, double r, enum EquationError *err)
 {
 	assert(isnan(l));
+	assert(err);
 
-	return cos(r);
+	return ScalarOps<double>::eval<MATH_COS>(l, r, err);
 }
 	
-enum EquationError math_simplify_cos(struct Node */*equation*/)
+void math_partial_cos(double l, double r, double /*res*/,
+					  double */*d_left*/, double *d_right,
+					  enum EquationError */*err*/)
+{
+	assert(isnan(l));
+
+	*d_right = -sin(r);
+}
+
+void math_series_cos(const double */*l*/, const double *r, double *res,
+					 size_t n, double *tmp, enum EquationError */*err*/)
+{
+	series_sin_cos(r, tmp, res, n);
+}
+
+enum EquationError math_simplify_cos(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_sin(const struct Node *equation, size_t var,
-						   enum EquationError *err)
+struct Node *math_diff_sin(const struct Node *equation,
+						   struct Node */*diff_left*/, struct Node *diff_right,
+						   struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_SIN);
 
-	return new_op(MATH_MULT, new_op(MATH_COS, NULL, copy(eq_right)),
-				  diff(eq_right));
+	return make_op(MATH_MULT, make_op(MATH_COS, NULL, copy(eq_right)),
+				   diff_right);
+}
+
+double math_eval_sin(double l, double r, enum EquationError *err)
+{
+	assert(isnan(l));
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_SIN>(l, r, err);
 }
 
-double math_eval_sin(double l, double r, enum EquationError */*err*/)
+void math_partial_sin(double l, double r, double /*res*/,
+					  double */*d_left*/, double *d_right,
+					  enum EquationError */*err*/)
 {
 	assert(isnan(l));
 
-	return sin(r);
+	*d_right = cos(r);
+}
+
+void math_series_sin(const double */*l*/, const double *r, double *res,
+					 size_t n, double *tmp, enum EquationError */*err*/)
+{
+	series_sin_cos(r, res, tmp, n);
 }
 
-enum EquationError math_simplify_sin(struct Node */*equation*/)
+enum EquationError math_simplify_sin(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_sqrt(const struct Node *equation, size_t var,
-						    enum EquationError *err)
+struct Node *math_diff_sqrt(const struct Node *equation,
+						    struct Node */*diff_left*/, struct Node *diff_right,
+						    struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_SQRT);
 
-	return new_op(MATH_DIV, diff(eq_right),
-				  new_op(MATH_MULT, new_num(2), 
-				  		 new_op(MATH_SQRT, NULL, copy(eq_right))));
+	return make_op(MATH_DIV, diff_right,
+				   make_op(MATH_MULT, new_num(2), 
+				  		  make_op(MATH_SQRT, NULL, copy(eq_right))));
+}
+
+double math_eval_sqrt(double l, double r, enum EquationError *err)
+{
+	assert(isnan(l));
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_SQRT>(l, r, err);
 }
 
-double math_eval_sqrt(double l, double r, enum EquationError */*err*/)
+void math_partial_sqrt(double l, double /*r*/, double res,
+					   double */*d_left*/, double *d_right,
+					   enum EquationError *err)
 {
 	assert(isnan(l));
 
-	return sqrt(r);
+	*d_right = math_eval_div(1, 2 * res, err);
+}
+
+void math_series_sqrt(const double */*l*/, const double *r, double *res,
+					  size_t n, double */*tmp*/, enum EquationError *err)
+{
+	// sqrt' = u' / (2 * sqrt(u)) is a division by zero there
+	if (n > 1 && is_equal(r[0], 0)) {
+		*err = EQ_ZERO_DIV_ERR;
+		return;
+	}
+	series_sqrt(r, res, n);
 }
 
-enum EquationError math_simplify_sqrt(struct Node */*equation*/)
+enum EquationError math_simplify_sqrt(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_tg(const struct Node *equation, size_t var,
-						    enum EquationError *err)
+struct Node *math_diff_tg(const struct Node *equation,
+						    struct Node */*diff_left*/, struct Node *diff_right,
+						    struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_TG);
 
-	return new_op(MATH_DIV, diff(eq_right),
-				  new_op(MATH_POW,
-				  		 new_op(MATH_COS, NULL, copy(eq_right)), 
-				  		 new_num(2)));
+	return make_op(MATH_DIV, diff_right,
+				   make_op(MATH_POW,
+				  		  make_op(MATH_COS, NULL, copy(eq_right)), 
+				  		  new_num(2)));
+}
+
+double math_eval_tg(double l, double r, enum EquationError *err)
+{
+	assert(isnan(l));
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_TG>(l, r, err);
 }
 
-double math_eval_tg(double l, double r, enum EquationError */*err*/)
+void math_partial_tg(double l, double r, double /*res*/,
+					 double */*d_left*/, double *d_right,
+					 enum EquationError *err)
 {
 	assert(isnan(l));
 
-	return tan(r);
+	*d_right = math_eval_div(1, cos(r) * cos(r), err);
+}
+
+void math_series_tg(const double */*l*/, const double *r, double *res,
+					size_t n, double *tmp, enum EquationError */*err*/)
+{
+	res[0] = tan(r[0]);
+
+	// tg' = (1 + tg^2) * u', tmp is 1 + tg^2
+	tmp[0] = 1 + res[0] * res[0];
+	for (size_t k = 1; k < n; k++) {
+		double sum = 0;
+		for (size_t j = 1; j <= k; j++)
+			sum += (double) j * r[j] * tmp[k - j];
+		res[k] = sum / (double) k;
+
+		tmp[k] = 0;
+		for (size_t j = 0; j <= k; j++)
+			tmp[k] += res[j] * res[k - j];
+	}
 }
 
-enum EquationError math_simplify_tg(struct Node */*equation*/)
+enum EquationError math_simplify_tg(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_ctg(const struct Node *equation, size_t var,
-						    enum EquationError *err)
+struct Node *math_diff_ctg(const struct Node *equation,
+						    struct Node */*diff_left*/, struct Node *diff_right,
+						    struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_CTG);
 
-	return new_op(MATH_MULT, new_num(-1), 
-				  new_op(MATH_DIV, diff(eq_right), new_op(MATH_POW,
-				  		 new_op(MATH_SIN, NULL, copy(eq_right)), 
-				  		 new_num(2))));
+	return make_op(MATH_MULT, new_num(-1), 
+				   make_op(MATH_DIV, diff_right, make_op(MATH_POW,
+				  		  make_op(MATH_SIN, NULL, copy(eq_right)), 
+				  		  new_num(2))));
 }
 
 double math_eval_ctg(double l, double r, enum EquationError *err)
 {
 	assert(isnan(l));
+	assert(err);
 
-	if (is_equal(tan(r), 0)) {
-		*err = EQ_WRONG_CTG_ARG_ERR;
-		return NAN;
-	}
-	return 1 / tan(r);
+	return ScalarOps<double>::eval<MATH_CTG>(l, r, err);
 }
 
-enum EquationError math_simplify_ctg(struct Node */*equation*/)
+void math_partial_ctg(double l, double r, double /*res*/,
+					  double */*d_left*/, double *d_right,
+					  enum EquationError *err)
+{
+	assert(isnan(l));
+
+	*d_right = -math_eval_div(1, sin(r) * sin(r), err);
+}
+
+void math_series_ctg(const double */*l*/, const double *r, double *res,
+					 size_t n, double *tmp, enum EquationError *err)
+{
+	math_eval_ctg(NAN, r[0], err);
+	if (*err < 0)
+		return;
+	series_sin_cos(r, tmp, tmp + n, n);
+	series_div(tmp + n, tmp, res, n);
+}
+
+enum EquationError math_simplify_ctg(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_arcsin(const struct Node *equation, size_t var,
-							  enum EquationError *err)
+struct Node *math_diff_arcsin(const struct Node *equation,
+							  struct Node */*diff_left*/, struct Node *diff_right,
+							  struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_ARCSIN);
 
-	return new_op(MATH_DIV, diff(eq_right), new_op(MATH_SQRT, NULL,
-				  new_op(MATH_SUB, new_num(1), new_op(MATH_POW,
-				  		 copy(eq_right), new_num(2)))));
+	return make_op(MATH_DIV, diff_right, make_op(MATH_SQRT, NULL,
+				   make_op(MATH_SUB, new_num(1), make_op(MATH_POW,
+				  		  copy(eq_right), new_num(2)))));
 }
 
 double math_eval_arcsin(double l, double r, enum EquationError *err)
+{
+	assert(isnan(l));
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_ARCSIN>(l, r, err);
+}
+
+void math_partial_arcsin(double l, double r, double /*res*/,
+						 double */*d_left*/, double *d_right,
+						 enum EquationError *err)
 {
 	assert(isnan(l));
 
-	if (abs(r) > 1) {
-		*err = EQ_WRONG_ARCSIN_ARG_ERR;
-		return NAN;
-	}
+	*d_right = math_eval_div(1, sqrt(1 - r * r), err);
+}
 
-	return asin(r);
+void math_series_arcsin(const double */*l*/, const double *r, double *res,
+						size_t n, double *tmp, enum EquationError *err)
+{
+	res[0] = math_eval_arcsin(NAN, r[0], err);
+	if (*err < 0)
+		return;
+	series_arcsin_tail(r, res, n, tmp);
 }
 
-enum EquationError math_simplify_arcsin(struct Node */*equation*/)
+enum EquationError math_simplify_arcsin(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
-struct Node *math_diff_arccos(const struct Node *equation, size_t var,
-						    enum EquationError *err)
+struct Node *math_diff_arccos(const struct Node *equation,
+						    struct Node */*diff_left*/, struct Node *diff_right,
+						    struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_ARCCOS);
 
-	return new_op(MATH_MULT, new_num(-1),
-				  new_op(MATH_DIV, diff(eq_right), new_op(MATH_SQRT, NULL,
-				  new_op(MATH_SUB, new_num(1), new_op(MATH_POW,
-				  		 copy(eq_right), new_num(2))))));
+	return make_op(MATH_MULT, new_num(-1),
+				   make_op(MATH_DIV, diff_right, make_op(MATH_SQRT, NULL,
+				   make_op(MATH_SUB, new_num(1), make_op(MATH_POW,
+				  		  copy(eq_right), new_num(2))))));
 }
 
 double math_eval_arccos(double l, double r, enum EquationError *err)
 {
 	assert(isnan(l));
-	
-	if (abs(r) > 1) {
-		*err = EQ_WRONG_ARCCOS_ARG_ERR;
-		return NAN;
-	}
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_ARCCOS>(l, r, err);
+}
+
+void math_partial_arccos(double l, double r, double /*res*/,
+						 double */*d_left*/, double *d_right,
+						 enum EquationError *err)
+{
+	assert(isnan(l));
 
-	return acos(r);
+	*d_right = -math_eval_div(1, sqrt(1 - r * r), err);
 }
 
-enum EquationError math_simplify_arccos(struct Node */*equation*/)
+void math_series_arccos(const double */*l*/, const double *r, double *res,
+						size_t n, double *tmp, enum EquationError *err)
+{
+	res[0] = math_eval_arccos(NAN, r[0], err);
+	if (*err < 0)
+		return;
+	series_arcsin_tail(r, res, n, tmp);
+	for (size_t k = 1; k < n; k++)
+		res[k] = -res[k];
+}
+
+enum EquationError math_simplify_arccos(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
 
-struct Node *math_diff_arctg(const struct Node *equation, size_t var,
-						    enum EquationError *err)
+struct Node *math_diff_arctg(const struct Node *equation,
+						    struct Node */*diff_left*/, struct Node *diff_right,
+						    struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_ARCTG);
 
-	return new_op(MATH_DIV, diff(eq_right), new_op(MATH_ADD, new_num(1), 
-				  new_op(MATH_POW, copy(eq_right), new_num(2))));
+	return make_op(MATH_DIV, diff_right, make_op(MATH_ADD, new_num(1), 
+				   make_op(MATH_POW, copy(eq_right), new_num(2))));
 }
 
-double math_eval_arctg(double l, double r, enum EquationError */*err*/)
+double math_eval_arctg(double l, double r, enum EquationError *err)
 {
 	assert(isnan(l));
-	
-	return atan(r);
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_ARCTG>(l, r, err);
+}
+
+void math_partial_arctg(double l, double r, double /*res*/,
+					   double */*d_left*/, double *d_right,
+					   enum EquationError */*err*/)
+{
+	assert(isnan(l));
+
+	*d_right = 1 / (1 + r * r);
+}
+
+void math_series_arctg(const double */*l*/, const double *r, double *res,
+					   size_t n, double *tmp, enum EquationError */*err*/)
+{
+	res[0] = atan(r[0]);
+	series_arctg_tail(r, res, n, tmp);
 }
 
-enum EquationError math_simplify_arctg(struct Node */*equation*/)
+enum EquationError math_simplify_arctg(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
 
 
-struct Node *math_diff_arcctg(const struct Node *equation, size_t var,
-						    enum EquationError *err)
+struct Node *math_diff_arcctg(const struct Node *equation,
+						    struct Node */*diff_left*/, struct Node *diff_right,
+						    struct NodeArena *arena, enum EquationError *err)
 {
 	assert(equation);
 	assert(err);
 	assert(type(equation) == MATH_OP);
 	assert(op(equation) == MATH_ARCCTG);
 
-	return new_op(MATH_DIV, diff(eq_right), new_op(MATH_ADD, new_num(1), 
-				  new_op(MATH_POW, copy(eq_right), new_num(2))));
+	return make_op(MATH_MULT, new_num(-1),
+				   make_op(MATH_DIV, diff_right, make_op(MATH_ADD, new_num(1), 
+				   make_op(MATH_POW, copy(eq_right), new_num(2)))));
 }
 
-double math_eval_arcctg(double l, double r, enum EquationError */*err*/)
+double math_eval_arcctg(double l, double r, enum EquationError *err)
 {
 	assert(isnan(l));
-	
-	return atan(r);
+	assert(err);
+
+	return ScalarOps<double>::eval<MATH_ARCCTG>(l, r, err);
+}
+
+void math_partial_arcctg(double l, double r, double /*res*/,
+						 double */*d_left*/, double *d_right,
+						 enum EquationError */*err*/)
+{
+	assert(isnan(l));
+
+	*d_right = -1 / (1 + r * r);
+}
+
+void math_series_arcctg(const double */*l*/, const double *r, double *res,
+						size_t n, double *tmp, enum EquationError */*err*/)
+{
+	res[0] = M_PI_2 - atan(r[0]);
+	series_arctg_tail(r, res, n, tmp);
+	for (size_t k = 1; k < n; k++)
+		res[k] = -res[k];
 }
 
-enum EquationError math_simplify_arcctg(struct Node */*equation*/)
+enum EquationError math_simplify_arcctg(struct Node */*equation*/,
+									 struct NodeArena */*arena*/)
 {
 	return EQ_NO_ERR;
 }
@@ -1,11 +1,14 @@
 #ifndef _EQUATION_UTILS_H
 #define _EQUATION_UTILS_H
 
+#include <stdint.h>
+
 #include "tree.h"
 #include "math_funcs.h"
 
 struct Equation {
 	struct Node *tree;
+	struct NodeArena *arena;
 	char **var_names;
 	size_t num_vars;
 	size_t cap_vars;
@@ -15,14 +18,52 @@ const double EQ_EPSILON = 1e-6;
 const size_t EQ_INIT_VARS_CAPACITY = 1;
 const size_t EQ_DELTA_VARS_CAPACITY = 1;
 
+/*
+ * Set of variables, bit i for the i-th one. Variables from
+ * EQ_VAR_SET_BITS - 1 on share the last bit, so a set may hold extra
+ * variables but never misses one.
+ */
+typedef uint64_t var_set_t;
+const size_t EQ_VAR_SET_BITS = 64;
+
 enum EquationError eq_ctor(struct Equation *eq);
+enum EquationError eq_enable_sharing(struct Equation *eq);
 void eq_dtor(struct Equation *eq);
 
+/*
+ * Subtrees that do not depend on diff_var_ind are not walked, their
+ * derivatives are 0 right away.
+ */
 enum EquationError eq_differentiate(struct Equation eq, size_t diff_var_ind,
 									struct Equation *diff);
+var_set_t eq_var_set(size_t var_ind);
+/*
+ * Fills deps (already constructed) with the set of variables every node of
+ * the tree depends on, in the ind field of the values.
+ */
+enum EquationError eq_find_dependencies(struct Equation eq,
+										struct NodeMap *deps);
+/*
+ * Applies MATH_OP_DEFS simplify rules until none of them matches anywhere in
+ * the equation; nodes are revisited only when a rule has changed them.
+ */
 enum EquationError eq_simplify(struct Equation *eq);
+/*
+ * Common subexpression elimination: moves the equation into a new sharing
+ * arena, so every distinct subexpression is stored and evaluated once.
+ */
+enum EquationError eq_eliminate_common_subexprs(struct Equation *eq);
+enum EquationError eq_count_nodes(struct Equation eq, size_t *count);
 enum EquationError eq_evaluate(struct Equation equation, double *vals,
 							   double *res);
+/*
+ * Forward mode: the value and the derivative by diff_var_ind at a point in
+ * one pass over the tree, carrying dual numbers through MATH_OP_DEFS. Fails
+ * where evaluating the symbolic derivative would, at the poles of partials.
+ */
+enum EquationError eq_evaluate_dual(struct Equation equation,
+									size_t diff_var_ind, double *vals,
+									double *res, double *diff_res);
 enum EquationError eq_expand_into_teylor(struct Equation eq,
 										 size_t extent,
 										 struct Equation *teylor);
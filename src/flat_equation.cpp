@@ -0,0 +1,278 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "flat_equation.h"
+#include "equation_manipulation.h"
+
+static enum EquationError flat_eq_reserve(struct FlatEquation *flat,
+										  size_t new_cap);
+static enum EquationError flat_append_subeq(struct FlatEquation *flat,
+											struct Node *subeq,
+											struct NodeMap *shared,
+											uint32_t *ind);
+
+enum EquationError flat_eq_ctor(struct FlatEquation *flat)
+{
+	assert(flat);
+
+	flat->nodes = NULL;
+	flat->vals = NULL;
+	flat->size = 0;
+	flat->cap = 0;
+	flat->root = FLAT_NO_CHILD;
+	return flat_eq_reserve(flat, FLAT_EQ_INIT_CAPACITY);
+}
+
+void flat_eq_dtor(struct FlatEquation *flat)
+{
+	assert(flat);
+
+	free(flat->nodes);
+	free(flat->vals);
+	flat->nodes = NULL;
+	flat->vals = NULL;
+	flat->size = 0;
+	flat->cap = 0;
+	flat->root = FLAT_NO_CHILD;
+}
+
+static enum EquationError flat_eq_reserve(struct FlatEquation *flat,
+										  size_t new_cap)
+{
+	assert(flat);
+
+	if (new_cap <= flat->cap)
+		return EQ_NO_ERR;
+	if (new_cap >= FLAT_NO_CHILD)
+		return EQ_NO_MEM_ERR;
+
+	struct FlatNode *nodes = (struct FlatNode*) realloc(flat->nodes,
+										new_cap * sizeof(struct FlatNode));
+	if (!nodes)
+		return EQ_NO_MEM_ERR;
+	flat->nodes = nodes;
+
+	double *vals = (double*) realloc(flat->vals, new_cap * sizeof(double));
+	if (!vals)
+		return EQ_NO_MEM_ERR;
+	flat->vals = vals;
+
+	flat->cap = new_cap;
+	return EQ_NO_ERR;
+}
+
+enum EquationError flat_eq_from_equation(struct FlatEquation *flat,
+										 struct Equation eq)
+{
+	assert(flat);
+
+	flat->size = 0;
+	flat->root = FLAT_NO_CHILD;
+	if (!eq.tree)
+		return EQ_NO_ERR;
+
+	if (!eq.arena || !eq.arena->is_shared)
+		return flat_append_subeq(flat, eq.tree, NULL, &flat->root);
+
+	struct NodeMap shared = {};
+	if (node_map_ctor(&shared) < 0)
+		return EQ_NO_MEM_ERR;
+	enum EquationError err = flat_append_subeq(flat, eq.tree, &shared,
+											   &flat->root);
+	node_map_dtor(&shared);
+	return err;
+}
+
+static enum EquationError flat_append_subeq(struct FlatEquation *flat,
+											struct Node *subeq,
+											struct NodeMap *shared,
+											uint32_t *ind)
+{
+	assert(flat);
+	assert(ind);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	uint32_t *res = NULL;
+	size_t res_size = 0;
+	size_t res_cap = 0;
+
+	*ind = FLAT_NO_CHILD;
+	if (tree_walk_start(&walk, subeq) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		union NodeMapValue val = {};
+		union NodeMapValue *memo = NULL;
+		if (frame.step == NODE_VISIT_PRE && shared &&
+			(memo = node_map_find(shared, frame.node))) {
+			tree_walk_skip(&walk, frame.node);
+			val = *memo;
+		} else if (frame.step != NODE_VISIT_POST) {
+			continue;
+		} else {
+			const struct Node *cur = frame.node;
+			struct FlatNode node = {};
+			node.type = (uint8_t) cur->data.type;
+			switch (cur->data.type) {
+				case MATH_NUM:
+					node.value.num = cur->data.value.num;
+					break;
+				case MATH_VAR:
+					assert(cur->data.value.var_ind < FLAT_NO_CHILD);
+					node.value.var_ind = (uint32_t) cur->data.value.var_ind;
+					break;
+				case MATH_OP:
+					node.op = (uint8_t) cur->data.value.op;
+					node.value.child[1] = cur->right ? res[--res_size] :
+													   FLAT_NO_CHILD;
+					node.value.child[0] = cur->left ? res[--res_size] :
+													  FLAT_NO_CHILD;
+					node.arity = cur->left ? 2 : 1;
+					break;
+				default:
+					err = EQ_UNKNOWN_OP_ERR;
+					break;
+			}
+			if (err < 0)
+				break;
+
+			if (flat->size >= flat->cap) {
+				err = flat_eq_reserve(flat, 2 * flat->cap);
+				if (err < 0)
+					break;
+			}
+			val.ind = flat->size;
+			flat->nodes[flat->size++] = node;
+			if (shared && node_map_insert(shared, cur, val) < 0) {
+				err = EQ_NO_MEM_ERR;
+				break;
+			}
+		}
+
+		if (res_size >= res_cap) {
+			size_t new_cap = res_cap ? 2 * res_cap : NODE_STACK_INIT_CAPACITY;
+			uint32_t *tmp = (uint32_t*) realloc(res, new_cap *
+														 sizeof(uint32_t));
+			if (!tmp) {
+				err = EQ_NO_MEM_ERR;
+				break;
+			}
+			res = tmp;
+			res_cap = new_cap;
+		}
+		res[res_size++] = (uint32_t) val.ind;
+	}
+
+	if (err == EQ_NO_ERR && res_size > 0)
+		*ind = res[0];
+	free(res);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+enum EquationError flat_eq_to_equation(struct FlatEquation flat,
+									   struct Equation *eq)
+{
+	assert(eq);
+	assert(!eq->tree);
+
+	if (flat.root == FLAT_NO_CHILD)
+		return EQ_NO_ERR;
+
+	enum EquationError eq_err = EQ_NO_ERR;
+	enum EquationError *err = &eq_err;
+	struct NodeArena *arena = eq->arena;
+	bool is_shared = arena && arena->is_shared;
+
+	struct Node **built = (struct Node**) calloc(flat.root + 1,
+												 sizeof(struct Node*));
+	bool *used = (bool*) calloc(flat.root + 1, sizeof(bool));
+	if (!built || !used) {
+		free(built);
+		free(used);
+		return EQ_NO_MEM_ERR;
+	}
+
+	for (size_t i = 0; i <= flat.root && eq_err == EQ_NO_ERR; i++) {
+		struct FlatNode node = flat.nodes[i];
+		struct Node *kids[2] = {};
+		switch (node.type) {
+			case MATH_NUM:
+				built[i] = new_num(node.value.num);
+				break;
+			case MATH_VAR:
+				built[i] = new_var(node.value.var_ind);
+				break;
+			case MATH_OP:
+				for (size_t k = 2 - node.arity; k < 2; k++) {
+					uint32_t child = node.value.child[k];
+					assert(child < i);
+					if (used[child] && !is_shared)
+						kids[k] = copy(built[child]);
+					else
+						kids[k] = built[child];
+					used[child] = true;
+				}
+				built[i] = new_op((enum MathOp) node.op, kids[0], kids[1]);
+				break;
+			default:
+				eq_err = EQ_UNKNOWN_OP_ERR;
+				break;
+		}
+	}
+
+	if (eq_err == EQ_NO_ERR)
+		eq->tree = built[flat.root];
+
+	free(built);
+	free(used);
+	return eq_err;
+}
+
+enum EquationError flat_eq_evaluate(struct FlatEquation *flat, double *vals,
+									double *res)
+{
+	assert(flat);
+	assert(vals);
+	assert(res);
+
+	if (flat->root == FLAT_NO_CHILD) {
+		*res = NAN;
+		return EQ_NO_ERR;
+	}
+
+	enum EquationError err = EQ_NO_ERR;
+	const struct FlatNode *nodes = flat->nodes;
+	double *res_vals = flat->vals;
+	for (size_t i = 0; i <= flat->root; i++) {
+		switch (nodes[i].type) {
+			case MATH_NUM:
+				res_vals[i] = nodes[i].value.num;
+				break;
+			case MATH_VAR:
+				res_vals[i] = vals[nodes[i].value.var_ind];
+				break;
+			case MATH_OP:
+				res_vals[i] = (*MATH_OP_DEFS[nodes[i].op].eval)(
+								nodes[i].arity == 2 ?
+									res_vals[nodes[i].value.child[0]] : NAN,
+								res_vals[nodes[i].value.child[1]], &err);
+				if (err < 0)
+					return err;
+				break;
+			default:
+				return EQ_UNKNOWN_OP_ERR;
+		}
+	}
+
+	*res = res_vals[flat->root];
+	return EQ_NO_ERR;
+}
@@ -0,0 +1,55 @@
+#ifndef _FLAT_EQUATION_H
+#define _FLAT_EQUATION_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "math_funcs.h"
+#include "equation_utils.h"
+
+/*
+ * Compact representation of an equation: 16-byte records with 32-bit child
+ * indices stored in one contiguous array. Children always precede their
+ * parents, so a tree converted from struct Node is laid out in post-order
+ * and a whole-tree walk is a single linear pass over the array. A record
+ * may be referenced by several parents, which is how shared subtrees of a
+ * hash-consed equation are stored.
+ */
+
+union FlatNodeValue {
+	double num;
+	uint32_t var_ind;
+	uint32_t child[2];
+};
+
+struct FlatNode {
+	union FlatNodeValue value;
+	uint8_t type;
+	uint8_t op;
+	uint8_t arity;
+};
+
+static_assert(sizeof(struct FlatNode) == 16, "FlatNode must stay 16 bytes");
+
+const uint32_t FLAT_NO_CHILD = UINT32_MAX;
+const size_t FLAT_EQ_INIT_CAPACITY = 64;
+
+struct FlatEquation {
+	struct FlatNode *nodes;
+	double *vals;
+	size_t size;
+	size_t cap;
+	uint32_t root;
+};
+
+enum EquationError flat_eq_ctor(struct FlatEquation *flat);
+void flat_eq_dtor(struct FlatEquation *flat);
+
+enum EquationError flat_eq_from_equation(struct FlatEquation *flat,
+										 struct Equation eq);
+enum EquationError flat_eq_to_equation(struct FlatEquation flat,
+									   struct Equation *eq);
+enum EquationError flat_eq_evaluate(struct FlatEquation *flat, double *vals,
+									double *res);
+
+#endif /*_FLAT_EQUATION_H*/
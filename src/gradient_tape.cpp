@@ -0,0 +1,320 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gradient_tape.h"
+
+static enum EquationError gradient_tape_reserve(struct GradientTape *tape,
+												size_t new_cap);
+static enum EquationError gradient_tape_append(struct GradientTape *tape,
+											   const struct Node *node,
+											   uint32_t left, uint32_t right);
+static enum EquationError gradient_tape_record_tree(struct GradientTape *tape,
+													struct Node *tree,
+													struct NodeMap *memo);
+
+enum EquationError gradient_tape_ctor(struct GradientTape *tape)
+{
+	assert(tape);
+
+	tape->entries = NULL;
+	tape->size = 0;
+	tape->cap = 0;
+	tape->values = NULL;
+	tape->adjoints = NULL;
+	tape->num_vars = 0;
+	tape->used_vars = 0;
+	return gradient_tape_reserve(tape, GRADIENT_TAPE_INIT_CAPACITY);
+}
+
+void gradient_tape_dtor(struct GradientTape *tape)
+{
+	assert(tape);
+
+	free(tape->entries);
+	free(tape->values);
+	free(tape->adjoints);
+	tape->entries = NULL;
+	tape->values = NULL;
+	tape->adjoints = NULL;
+	tape->size = 0;
+	tape->cap = 0;
+	tape->num_vars = 0;
+	tape->used_vars = 0;
+}
+
+static enum EquationError gradient_tape_reserve(struct GradientTape *tape,
+												size_t new_cap)
+{
+	assert(tape);
+
+	if (new_cap <= tape->cap)
+		return EQ_NO_ERR;
+
+	struct GradientEntry *entries = (struct GradientEntry*) realloc(
+						tape->entries, new_cap * sizeof(struct GradientEntry));
+	if (!entries)
+		return EQ_NO_MEM_ERR;
+	tape->entries = entries;
+
+	double *values = (double*) realloc(tape->values, new_cap * sizeof(double));
+	if (!values)
+		return EQ_NO_MEM_ERR;
+	tape->values = values;
+
+	double *adjoints = (double*) realloc(tape->adjoints,
+										 new_cap * sizeof(double));
+	if (!adjoints)
+		return EQ_NO_MEM_ERR;
+	tape->adjoints = adjoints;
+
+	tape->cap = new_cap;
+	return EQ_NO_ERR;
+}
+
+static enum EquationError gradient_tape_append(struct GradientTape *tape,
+											   const struct Node *node,
+											   uint32_t left, uint32_t right)
+{
+	assert(tape);
+	assert(node);
+
+	if (tape->size >= tape->cap) {
+		enum EquationError err = gradient_tape_reserve(tape, 2 * tape->cap +
+												GRADIENT_TAPE_INIT_CAPACITY);
+		if (err < 0)
+			return err;
+	}
+
+	struct GradientEntry *entry = tape->entries + tape->size;
+	entry->num = NAN;
+	entry->left = left;
+	entry->right = right;
+	entry->ind = 0;
+	entry->type = (uint8_t) node->data.type;
+	entry->deps = 0;
+	switch (node->data.type) {
+		case MATH_NUM:
+			entry->num = node->data.value.num;
+			break;
+		case MATH_VAR:
+			entry->ind = (uint32_t) node->data.value.var_ind;
+			entry->deps = eq_var_set(node->data.value.var_ind);
+			break;
+		case MATH_OP:
+			if (node->data.value.op >= MATH_OP_DEFS_SIZE)
+				return EQ_UNKNOWN_OP_ERR;
+			entry->ind = (uint32_t) node->data.value.op;
+			if (left != GRADIENT_NO_ARG)
+				entry->deps |= tape->entries[left].deps;
+			if (right != GRADIENT_NO_ARG)
+				entry->deps |= tape->entries[right].deps;
+			break;
+		default:
+			return EQ_TREE_ERR;
+	}
+	tape->size++;
+	return EQ_NO_ERR;
+}
+
+enum EquationError gradient_tape_record(struct GradientTape *tape,
+										struct Equation eq)
+{
+	assert(tape);
+
+	tape->size = 0;
+	tape->num_vars = eq.num_vars;
+	tape->used_vars = 0;
+	if (!eq.tree)
+		return EQ_NO_ERR;
+
+	enum EquationError err = EQ_NO_ERR;
+	if (!eq.arena || !eq.arena->is_shared) {
+		err = gradient_tape_record_tree(tape, eq.tree, NULL);
+	} else {
+		struct NodeMap memo = {};
+		if (node_map_ctor(&memo) < 0)
+			return EQ_NO_MEM_ERR;
+		err = gradient_tape_record_tree(tape, eq.tree, &memo);
+		node_map_dtor(&memo);
+	}
+	if (err == EQ_NO_ERR && tape->size > 0)
+		tape->used_vars = tape->entries[tape->size - 1].deps;
+	return err;
+}
+
+/*
+ * Appends nodes in post order. Indices of the recorded operands wait on a
+ * stack like values do in subeq_evaluate; with memo a node that is already
+ * on the tape is pushed by its index and its subtree is skipped.
+ */
+static enum EquationError gradient_tape_record_tree(struct GradientTape *tape,
+													struct Node *tree,
+													struct NodeMap *memo)
+{
+	assert(tape);
+	assert(tree);
+
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	uint32_t *args = NULL;
+	size_t args_size = 0;
+	size_t args_cap = 0;
+
+	if (tree_walk_start(&walk, tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		uint32_t ind = 0;
+		union NodeMapValue *recorded = NULL;
+		if (frame.step == NODE_VISIT_PRE && memo &&
+			(recorded = node_map_find(memo, frame.node))) {
+			tree_walk_skip(&walk, frame.node);
+			ind = (uint32_t) recorded->ind;
+		} else if (frame.step != NODE_VISIT_POST) {
+			continue;
+		} else {
+			if (tape->size >= GRADIENT_NO_ARG) {
+				err = EQ_NO_MEM_ERR;
+				break;
+			}
+			uint32_t right = frame.node->right ? args[--args_size] :
+												 GRADIENT_NO_ARG;
+			uint32_t left = frame.node->left ? args[--args_size] :
+											   GRADIENT_NO_ARG;
+			ind = (uint32_t) tape->size;
+			err = gradient_tape_append(tape, frame.node, left, right);
+			if (err < 0)
+				break;
+
+			union NodeMapValue val = {};
+			val.ind = ind;
+			if (memo && node_map_insert(memo, frame.node, val) < 0) {
+				err = EQ_NO_MEM_ERR;
+				break;
+			}
+		}
+
+		if (args_size >= args_cap) {
+			size_t new_cap = args_cap ? 2 * args_cap :
+										NODE_STACK_INIT_CAPACITY;
+			uint32_t *tmp = (uint32_t*) realloc(args,
+												new_cap * sizeof(uint32_t));
+			if (!tmp) {
+				err = EQ_NO_MEM_ERR;
+				break;
+			}
+			args = tmp;
+			args_cap = new_cap;
+		}
+		args[args_size++] = ind;
+	}
+
+	free(args);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+enum EquationError gradient_tape_evaluate(struct GradientTape *tape,
+										  const double *vals, double *res,
+										  double *grad)
+{
+	assert(tape);
+	assert(res);
+	assert(grad);
+
+	for (size_t i = 0; i < tape->num_vars; i++)
+		grad[i] = 0;
+	if (tape->size == 0) {
+		*res = NAN;
+		return EQ_NO_ERR;
+	}
+	assert(vals);
+
+	const struct GradientEntry *entries = tape->entries;
+	double *values = tape->values;
+	double *adjoints = tape->adjoints;
+	enum EquationError err = EQ_NO_ERR;
+
+	for (size_t i = 0; i < tape->size; i++) {
+		const struct GradientEntry *entry = entries + i;
+		switch ((enum MathTokenType) entry->type) {
+			case MATH_NUM:
+				values[i] = entry->num;
+				break;
+			case MATH_VAR:
+				values[i] = vals[entry->ind];
+				break;
+			case MATH_OP:
+				values[i] = (*MATH_OP_DEFS[entry->ind].eval)(
+								entry->left != GRADIENT_NO_ARG ?
+								values[entry->left] : NAN,
+								values[entry->right], &err);
+				if (err < 0)
+					return err;
+				break;
+			default:
+				return EQ_TREE_ERR;
+		}
+	}
+	*res = values[tape->size - 1];
+	if (!tape->used_vars)
+		return EQ_NO_ERR;
+
+	memset(adjoints, 0, tape->size * sizeof(double));
+	adjoints[tape->size - 1] = 1;
+	for (size_t i = tape->size; i-- > 0;) {
+		const struct GradientEntry *entry = entries + i;
+		double adjoint = adjoints[i];
+		if (!entry->deps)
+			continue;
+
+		if (entry->type == MATH_VAR) {
+			grad[entry->ind] += adjoint;
+			continue;
+		}
+		if (entry->type != MATH_OP)
+			continue;
+
+		double left = entry->left != GRADIENT_NO_ARG ? values[entry->left] :
+													   NAN;
+		double d_left = 0;
+		double d_right = 0;
+		(*MATH_OP_DEFS[entry->ind].partial)(left, values[entry->right],
+											values[i], &d_left, &d_right,
+											&err);
+		if (err < 0)
+			return err;
+		if (entry->left != GRADIENT_NO_ARG && entries[entry->left].deps)
+			adjoints[entry->left] += adjoint * d_left;
+		if (entries[entry->right].deps)
+			adjoints[entry->right] += adjoint * d_right;
+	}
+
+	return EQ_NO_ERR;
+}
+
+enum EquationError eq_gradient_at(struct Equation eq, const double *vals,
+								  double *grad, double *res)
+{
+	struct GradientTape tape = {};
+	double value = NAN;
+
+	enum EquationError err = gradient_tape_ctor(&tape);
+	if (err == EQ_NO_ERR)
+		err = gradient_tape_record(&tape, eq);
+	if (err == EQ_NO_ERR)
+		err = gradient_tape_evaluate(&tape, vals, &value, grad);
+	if (err == EQ_NO_ERR && res)
+		*res = value;
+
+	gradient_tape_dtor(&tape);
+	return err;
+}
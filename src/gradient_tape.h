@@ -0,0 +1,70 @@
+#ifndef _GRADIENT_TAPE_H
+#define _GRADIENT_TAPE_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "math_funcs.h"
+#include "equation_utils.h"
+
+/*
+ * Reverse-mode automatic differentiation. An equation is recorded once into
+ * a tape of nodes in post order, every entry referring to its operands by
+ * index; a subtree shared in a hash-consed equation gets one entry. At a
+ * point the tape is run forward with MATH_OP_DEFS evaluators, keeping every
+ * value, and then backward, spreading the adjoint of every entry over its
+ * operands with MATH_OP_DEFS partial derivatives. So the value and all the
+ * partial derivatives are found in two passes whatever the number of
+ * variables is.
+ *
+ * Every entry keeps the set of variables it depends on. Entries that depend
+ * on no variable are inactive and get no adjoints, so constant parts like
+ * the exponent of x^2 never meet ln of a negative base. The set of the last
+ * entry, used_vars, is the sparsity pattern of the gradient: partial
+ * derivatives by other variables are 0 whatever the point is.
+ */
+
+const uint32_t GRADIENT_NO_ARG = UINT32_MAX;
+const size_t GRADIENT_TAPE_INIT_CAPACITY = 64;
+
+struct GradientEntry {
+	double num;
+	var_set_t deps;
+	uint32_t left;
+	uint32_t right;
+	uint32_t ind;
+	uint8_t type;
+};
+
+struct GradientTape {
+	struct GradientEntry *entries;
+	size_t size;
+	size_t cap;
+
+	double *values;
+	double *adjoints;
+	size_t num_vars;
+	var_set_t used_vars;
+};
+
+enum EquationError gradient_tape_ctor(struct GradientTape *tape);
+void gradient_tape_dtor(struct GradientTape *tape);
+
+enum EquationError gradient_tape_record(struct GradientTape *tape,
+										struct Equation eq);
+/*
+ * grad receives num_vars partial derivatives. The errors are the same as of
+ * eq_evaluate, of the equation or of its derivatives.
+ */
+enum EquationError gradient_tape_evaluate(struct GradientTape *tape,
+										  const double *vals, double *res,
+										  double *grad);
+
+/*
+ * Records a tape and runs it once: the value goes to *res (may be NULL) and
+ * eq.num_vars partial derivatives to grad.
+ */
+enum EquationError eq_gradient_at(struct Equation eq, const double *vals,
+								  double *grad, double *res);
+
+#endif /*_GRADIENT_TAPE_H*/
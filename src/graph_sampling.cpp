@@ -0,0 +1,303 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "graph_sampling.h"
+#include "scalar_evaluate.h"
+
+// Share of the y-range added on both sides of the percentiles
+const double GRAPH_Y_MARGIN = 0.05;
+const double GRAPH_Y_LOW_PERCENTILE = 0.02;
+const double GRAPH_Y_HIGH_PERCENTILE = 0.98;
+
+// A segment waiting to be checked, with the values at its ends
+struct GraphSegment {
+	double x_from;
+	double x_to;
+	double y_from;
+	double y_to;
+	size_t depth;
+};
+
+struct GraphSampler {
+	struct Equation eq;
+	struct Equation diff;
+	double *vals;
+	struct Interval *boxes;
+	struct GraphSamples *samples;
+};
+
+static double graph_eval_point(struct GraphSampler *sampler, double x,
+							   enum EquationError *err);
+static enum EquationError graph_eval_segment(struct GraphSampler *sampler,
+											 struct Equation eq,
+											 double x_from, double x_to,
+											 struct Interval *res);
+static bool graph_is_straight(struct GraphSampler *sampler,
+							  struct GraphSegment seg, double tolerance,
+							  enum EquationError *err);
+static void graph_find_y_range(double *ys, size_t n, double *y_from,
+							   double *y_to);
+static int graph_compare(const void *a, const void *b);
+static int graph_point_compare(const void *a, const void *b);
+static enum EquationError graph_push(struct GraphSamples *samples,
+									 double x, double y);
+static enum EquationError segment_push(struct GraphSegment **arr,
+									   size_t *size, size_t *cap,
+									   struct GraphSegment val);
+
+void graph_samples_dtor(struct GraphSamples *samples)
+{
+	assert(samples);
+
+	free(samples->points);
+	*samples = {};
+}
+
+enum EquationError eq_sample_graph(struct Equation eq, double x_from,
+								   double x_to,
+								   struct GraphSamplingLimits limits,
+								   struct GraphSamples *samples)
+{
+	assert(samples);
+	assert(x_from < x_to);
+	assert(limits.num_coarse > 0);
+
+	*samples = {};
+	size_t num_vars = eq.num_vars > 0 ? eq.num_vars : 1;
+	size_t n = limits.num_coarse;
+	struct GraphSampler sampler = {eq, {}, NULL, NULL, samples};
+	enum EquationError err = eq_ctor(&sampler.diff);
+	if (err == EQ_NO_ERR && eq.num_vars > 0)
+		err = eq_differentiate(eq, 0, &sampler.diff);
+	if (err == EQ_NO_ERR)
+		err = eq_simplify(&sampler.diff);
+	sampler.vals = (double*) calloc(num_vars, sizeof(double));
+	sampler.boxes = (struct Interval*) calloc(num_vars,
+											  sizeof(struct Interval));
+	double *ys = (double*) calloc(n + 1, sizeof(double));
+	double *sorted = (double*) calloc(n + 1, sizeof(double));
+	struct GraphSegment *queue = NULL;
+	size_t queue_head = 0;
+	size_t queue_size = 0;
+	size_t queue_cap = 0;
+
+	if (err == EQ_NO_ERR &&
+		(!sampler.vals || !sampler.boxes || !ys || !sorted))
+		err = EQ_NO_MEM_ERR;
+
+	for (size_t i = 0; i <= n && err == EQ_NO_ERR; i++) {
+		ys[i] = graph_eval_point(&sampler,
+								 x_from + (x_to - x_from) * (double) i /
+										  (double) n, &err);
+		sorted[i] = ys[i];
+	}
+	if (err == EQ_NO_ERR)
+		graph_find_y_range(sorted, n + 1, &samples->y_from, &samples->y_to);
+	double tolerance = (samples->y_to - samples->y_from) * limits.y_tolerance;
+
+	for (size_t i = 0; i < n && err == EQ_NO_ERR; i++) {
+		double seg_from = x_from + (x_to - x_from) * (double) i / (double) n;
+		double seg_to = x_from + (x_to - x_from) * (double) (i + 1) /
+								 (double) n;
+		err = segment_push(&queue, &queue_size, &queue_cap,
+						   {seg_from, seg_to, ys[i], ys[i + 1], 0});
+	}
+
+	// Breadth first, so running out of evals leaves even refinement
+	while (err == EQ_NO_ERR && queue_head < queue_size) {
+		struct GraphSegment seg = queue[queue_head++];
+		size_t num_evals = samples->num_point_evals +
+						   samples->num_interval_evals;
+		struct Interval range = {};
+		enum EquationError seg_err = graph_eval_segment(&sampler, eq,
+														seg.x_from, seg.x_to,
+														&range);
+		if (seg_err == EQ_NO_MEM_ERR) {
+			err = seg_err;
+			break;
+		}
+
+		bool is_bounded = seg_err == EQ_NO_ERR && isfinite(range.lo) &&
+						  isfinite(range.hi);
+		bool is_flat = (seg_err == EQ_NO_ERR && isnan(range.lo)) ||
+					   (is_bounded && (range.hi - range.lo <= tolerance ||
+									   range.lo > samples->y_to ||
+									   range.hi < samples->y_from));
+		if (!is_flat && is_bounded)
+			is_flat = graph_is_straight(&sampler, seg, tolerance, &err);
+		if (err < 0)
+			break;
+		bool is_gap = !is_bounded && isnan(seg.y_from) && isnan(seg.y_to);
+		bool is_leaf = seg.depth >= limits.max_depth ||
+					   num_evals >= limits.max_evals ||
+					   (is_gap && seg.depth >= limits.gap_depth);
+
+		if (is_flat || is_leaf) {
+			err = graph_push(samples, seg.x_from, seg.y_from);
+			// A pole or a domain error between two defined ends
+			if (err == EQ_NO_ERR && !is_flat && !is_bounded && !is_gap)
+				err = graph_push(samples, (seg.x_from + seg.x_to) / 2, NAN);
+			continue;
+		}
+
+		double x_mid = (seg.x_from + seg.x_to) / 2;
+		double y_mid = graph_eval_point(&sampler, x_mid, &err);
+		if (err == EQ_NO_ERR)
+			err = segment_push(&queue, &queue_size, &queue_cap,
+							   {seg.x_from, x_mid, seg.y_from, y_mid,
+								seg.depth + 1});
+		if (err == EQ_NO_ERR)
+			err = segment_push(&queue, &queue_size, &queue_cap,
+							   {x_mid, seg.x_to, y_mid, seg.y_to,
+								seg.depth + 1});
+	}
+	if (err == EQ_NO_ERR)
+		err = graph_push(samples, x_to, ys[n]);
+	if (err == EQ_NO_ERR)
+		qsort(samples->points, samples->size, sizeof(struct GraphPoint),
+			  graph_point_compare);
+
+	eq_dtor(&sampler.diff);
+	free(sampler.vals);
+	free(sampler.boxes);
+	free(ys);
+	free(sorted);
+	free(queue);
+	if (err < 0)
+		graph_samples_dtor(samples);
+	return err;
+}
+
+// Only running out of memory is an error, a point out of the domain is NAN
+static double graph_eval_point(struct GraphSampler *sampler, double x,
+							   enum EquationError *err)
+{
+	assert(sampler);
+	assert(err);
+
+	sampler->samples->num_point_evals++;
+	sampler->vals[0] = x;
+	double y = NAN;
+	enum EquationError eval_err = eq_evaluate(sampler->eq, sampler->vals, &y);
+	if (eval_err == EQ_NO_MEM_ERR)
+		*err = eval_err;
+	return eval_err == EQ_NO_ERR && isfinite(y) ? y : NAN;
+}
+
+static enum EquationError graph_eval_segment(struct GraphSampler *sampler,
+											 struct Equation eq,
+											 double x_from, double x_to,
+											 struct Interval *res)
+{
+	assert(sampler);
+	assert(res);
+
+	sampler->samples->num_interval_evals++;
+	sampler->boxes[0] = {x_from, x_to};
+	return eq_evaluate_as<Interval>(eq, sampler->boxes, res);
+}
+
+/*
+ * f minus its chord is 0 at both ends and its slope lies in f'(segment)
+ * minus the chord's one, so it stays within width(f') * length / 4.
+ */
+static bool graph_is_straight(struct GraphSampler *sampler,
+							  struct GraphSegment seg, double tolerance,
+							  enum EquationError *err)
+{
+	assert(sampler);
+	assert(err);
+
+	struct Interval slope = {};
+	enum EquationError slope_err = graph_eval_segment(sampler, sampler->diff,
+													  seg.x_from, seg.x_to,
+													  &slope);
+	if (slope_err == EQ_NO_MEM_ERR)
+		*err = slope_err;
+	return slope_err == EQ_NO_ERR && isfinite(slope.hi - slope.lo) &&
+		   (slope.hi - slope.lo) * (seg.x_to - seg.x_from) / 4 <= tolerance;
+}
+
+static void graph_find_y_range(double *ys, size_t n, double *y_from,
+							   double *y_to)
+{
+	assert(ys);
+	assert(y_from);
+	assert(y_to);
+
+	size_t num_finite = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (!isnan(ys[i]))
+			ys[num_finite++] = ys[i];
+	}
+	if (num_finite == 0) {
+		*y_from = -1;
+		*y_to = 1;
+		return;
+	}
+
+	qsort(ys, num_finite, sizeof(double), graph_compare);
+	double low = ys[(size_t) (GRAPH_Y_LOW_PERCENTILE *
+							  (double) (num_finite - 1))];
+	double high = ys[(size_t) (GRAPH_Y_HIGH_PERCENTILE *
+							   (double) (num_finite - 1))];
+	double margin = (high - low) * GRAPH_Y_MARGIN;
+	if (!(margin > 0))
+		margin = fabs(low) * GRAPH_Y_MARGIN + 1;
+	*y_from = low - margin;
+	*y_to = high + margin;
+}
+
+static int graph_compare(const void *a, const void *b)
+{
+	double l = *(const double*) a;
+	double r = *(const double*) b;
+	return (l > r) - (l < r);
+}
+
+static int graph_point_compare(const void *a, const void *b)
+{
+	return graph_compare(&((const struct GraphPoint*) a)->x,
+						 &((const struct GraphPoint*) b)->x);
+}
+
+static enum EquationError graph_push(struct GraphSamples *samples,
+									 double x, double y)
+{
+	assert(samples);
+
+	if (samples->size >= samples->cap) {
+		size_t new_cap = samples->cap ? 2 * samples->cap :
+										NODE_STACK_INIT_CAPACITY;
+		struct GraphPoint *tmp = (struct GraphPoint*) realloc(samples->points,
+										new_cap * sizeof(struct GraphPoint));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		samples->points = tmp;
+		samples->cap = new_cap;
+	}
+	samples->points[samples->size++] = {x, y};
+	return EQ_NO_ERR;
+}
+
+static enum EquationError segment_push(struct GraphSegment **arr,
+									   size_t *size, size_t *cap,
+									   struct GraphSegment val)
+{
+	assert(arr);
+	assert(size);
+	assert(cap);
+
+	if (*size >= *cap) {
+		size_t new_cap = *cap ? 2 * *cap : NODE_STACK_INIT_CAPACITY;
+		struct GraphSegment *tmp = (struct GraphSegment*) realloc(*arr,
+									new_cap * sizeof(struct GraphSegment));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		*arr = tmp;
+		*cap = new_cap;
+	}
+	(*arr)[(*size)++] = val;
+	return EQ_NO_ERR;
+}
@@ -0,0 +1,56 @@
+#ifndef _GRAPH_SAMPLING_H
+#define _GRAPH_SAMPLING_H
+
+#include <stddef.h>
+
+#include "equation_utils.h"
+
+/*
+ * Adaptive sampling of an equation over [x_from, x_to] for plotting, by its
+ * first variable (the others are 0). A uniform pass of num_coarse segments
+ * gives the y-range: the 2nd to 98th percentile of its values with a margin,
+ * so poles don't squash the plot. Then every segment is enclosed with
+ * eq_evaluate_as<Interval> and halved until the enclosure is narrower than
+ * y_tolerance of the y-range or lies out of it. Flat stretches take a few
+ * evaluations, steep ones and domain edges are refined down to max_depth
+ * halvings. Segments undefined at both ends are given up after gap_depth
+ * halvings. A bounded enclosure of f' on a segment bounds how far f strays
+ * from the chord, so a slope costs no more than a constant. Segments are
+ * halved breadth first: when max_evals evaluations of f and f' are spent,
+ * the refinement is even over x instead of stuck at one spot.
+ */
+struct GraphSamplingLimits {
+	size_t num_coarse;
+	double y_tolerance;
+	size_t max_depth;
+	size_t gap_depth;
+	size_t max_evals;
+};
+
+const struct GraphSamplingLimits GRAPH_DEFAULT_LIMITS = {64, 1.0 / 512, 20,
+														 2, 50000};
+
+// A point with y == NAN breaks the line (a pole or a domain error)
+struct GraphPoint {
+	double x;
+	double y;
+};
+
+struct GraphSamples {
+	struct GraphPoint *points;
+	size_t size;
+	size_t cap;
+	double y_from;
+	double y_to;
+	size_t num_point_evals;
+	size_t num_interval_evals;
+};
+
+void graph_samples_dtor(struct GraphSamples *samples);
+
+enum EquationError eq_sample_graph(struct Equation eq, double x_from,
+								   double x_to,
+								   struct GraphSamplingLimits limits,
+								   struct GraphSamples *samples);
+
+#endif /*_GRAPH_SAMPLING_H*/
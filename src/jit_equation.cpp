@@ -0,0 +1,1177 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_IS_SUPPORTED
+#endif
+
+#if defined(JIT_IS_SUPPORTED) && defined(__GLIBC__)
+#include <immintrin.h>
+#define JIT_HAS_LIBMVEC
+#endif
+
+#include "jit_equation.h"
+#include "batch_evaluate.h"
+
+/*
+ * Register roles: the stack value number k < JIT_NUM_REGS is in xmm<k> (ymm
+ * for batch_func), a spilled one is loaded into JIT_DST_REG or JIT_SRC_REG
+ * to be worked on, JIT_TMP_REG and JIT_TMP2_REG hold temporaries of one
+ * instruction. rbx points to vals, r13 to res of batch_func, and r12
+ * accumulates failed domain checks; all of them survive calls.
+ */
+const uint8_t JIT_DST_REG = 12;
+const uint8_t JIT_SRC_REG = 13;
+const uint8_t JIT_TMP_REG = 14;
+const uint8_t JIT_TMP2_REG = 15;
+
+const uint8_t JIT_RSP = 4;
+const uint8_t JIT_RBX = 3;
+const uint8_t JIT_R13 = 13;
+
+const size_t JIT_PAGE_SIZE = 4096;
+const size_t JIT_POOL_ALIGNMENT = 32;
+const size_t JIT_IMAGE_ALIGNMENT = 64;
+
+// Predicates of cmpsd and vcmppd
+const int JIT_CMP_LT = 1;
+const int JIT_CMP_LE = 2;
+
+enum JitOp {
+	JIT_LOAD,
+	JIT_STORE,
+	JIT_MOVE,
+	JIT_ADD,
+	JIT_MULT,
+	JIT_SUB,
+	JIT_DIV,
+	JIT_SQRT,
+	JIT_AND,
+	JIT_CMP,
+};
+
+/*
+ * SSE2 encoding is prefix 0F opcode (movsd, addsd, ..., andpd), the AVX one
+ * is VEX.256.66.0F opcode (vmovupd, vaddpd, ...). Operators take the
+ * destination as their first source (vvvv) in AVX.
+ */
+struct JitOpcode {
+	uint8_t prefix;
+	uint8_t opcode;
+	bool is_nds;
+};
+
+static const struct JitOpcode JIT_OPCODES[] = {
+	{0xF2, 0x10, false},	// JIT_LOAD
+	{0xF2, 0x11, false},	// JIT_STORE
+	{0x66, 0x28, false},	// JIT_MOVE
+	{0xF2, 0x58, true},		// JIT_ADD
+	{0xF2, 0x59, true},		// JIT_MULT
+	{0xF2, 0x5C, true},		// JIT_SUB
+	{0xF2, 0x5E, true},		// JIT_DIV
+	{0xF2, 0x51, false},	// JIT_SQRT
+	{0x66, 0x54, true},		// JIT_AND
+	{0xF2, 0xC2, true},		// JIT_CMP
+};
+
+enum JitOperandKind {
+	JIT_OPERAND_REG,
+	JIT_OPERAND_MEM,
+	JIT_OPERAND_CONST,
+};
+
+// A register, [reg + disp] or an entry of the constant pool
+struct JitOperand {
+	enum JitOperandKind kind;
+	uint8_t reg;
+	int32_t disp;
+	size_t const_ind;
+};
+
+// Constants every function may need, they open the pool in this order
+enum JitConst {
+	JIT_CONST_ABS_MASK,
+	JIT_CONST_EPSILON,
+	JIT_CONST_ZERO,
+	JIT_CONST_ONE,
+	JIT_CONST_PI_2,
+	JIT_CONST_NAN,
+};
+
+// disp32 at disp_pos is relative to end_pos, the end of its instruction
+struct JitFixup {
+	size_t disp_pos;
+	size_t end_pos;
+	size_t const_ind;
+};
+
+/*
+ * Where the value of a register is while the code is made. Registers are
+ * saved to their cells before a call and loaded back only when their
+ * values are used, a value that is in both needs no saving again.
+ */
+enum JitRegState {
+	JIT_IN_REG,
+	JIT_IN_CELL,
+	JIT_IN_BOTH,
+};
+
+/*
+ * Machine code of one function and its constants, which are stored as bit
+ * patterns and repeated to the width of a register in the pool. Emitters
+ * do nothing after an error, it is checked once the code is made.
+ */
+struct JitWriter {
+	uint8_t *code;
+	size_t size;
+	size_t cap;
+
+	uint64_t *consts;
+	size_t num_consts;
+	size_t cap_consts;
+
+	struct JitFixup *fixups;
+	size_t num_fixups;
+	size_t cap_fixups;
+
+	bool is_vector;
+	// Bytes of a value: of a stack frame cell and of a variable in vals
+	size_t cell_size;
+	size_t frame_size;
+	enum JitRegState reg_states[JIT_NUM_REGS];
+	enum EquationError err;
+};
+
+struct JitCallees {
+	uintptr_t pow;
+	uintptr_t log;
+	uintptr_t cos;
+	uintptr_t sin;
+	uintptr_t tan;
+	uintptr_t asin;
+	uintptr_t acos;
+	uintptr_t atan;
+	uintptr_t exp;
+};
+
+#ifdef JIT_HAS_LIBMVEC
+extern "C" {
+__m256d _ZGVdN4v_sin(__m256d x);
+__m256d _ZGVdN4v_cos(__m256d x);
+__m256d _ZGVdN4v_tan(__m256d x);
+__m256d _ZGVdN4v_log(__m256d x);
+__m256d _ZGVdN4v_asin(__m256d x);
+__m256d _ZGVdN4v_acos(__m256d x);
+__m256d _ZGVdN4v_atan(__m256d x);
+__m256d _ZGVdN4v_exp(__m256d x);
+__m256d _ZGVdN4vv_pow(__m256d x, __m256d y);
+}
+#endif
+
+static void jit_eq_unmap(struct JitEquation *jit);
+static size_t jit_find_used_vars(const struct CompiledEquation *ceq,
+								 size_t *used);
+static bool jit_has_avx2();
+static enum EquationError jit_compile(struct JitWriter *w,
+									  const struct CompiledEquation *ceq,
+									  bool is_vector);
+static enum EquationError jit_map(struct JitEquation *jit,
+								  const struct JitWriter *scalar,
+								  const struct JitWriter *vector);
+static size_t jit_image_size(const struct JitWriter *w);
+static void jit_link(const struct JitWriter *w, uint8_t *image);
+static struct JitCallees jit_callees(bool is_vector);
+static void jit_writer_dtor(struct JitWriter *w);
+static bool jit_reserve(struct JitWriter *w, void **arr, size_t *cap,
+						size_t size, size_t elem_size);
+
+static void jit_emit_prologue(struct JitWriter *w);
+static void jit_emit_epilogue(struct JitWriter *w);
+static void jit_emit_instr(struct JitWriter *w,
+						   const struct CompiledEquation *ceq,
+						   const struct JitCallees *callees,
+						   const struct CompiledInstr *ip, size_t *depth);
+static void jit_emit_binary(struct JitWriter *w, enum JitOp op, size_t k);
+static void jit_emit_unary_call(struct JitWriter *w, size_t k,
+								uintptr_t callee);
+static void jit_emit_call_begin(struct JitWriter *w, size_t k,
+								size_t num_args, uintptr_t callee);
+static void jit_emit_call_end(struct JitWriter *w, size_t k);
+static void jit_emit_powi(struct JitWriter *w, size_t k, int32_t exp);
+static void jit_emit_horner(struct JitWriter *w, size_t k,
+							const double *coefs, uint32_t degree);
+static void jit_emit_estrin(struct JitWriter *w, size_t k,
+							const double *coefs, uint32_t degree,
+							size_t tmp_cell);
+static void jit_emit_estrin_block(struct JitWriter *w, const double *c,
+								  uint8_t x, struct JitOperand x2);
+static void jit_emit_check_small(struct JitWriter *w, uint8_t reg);
+static void jit_emit_check_zero(struct JitWriter *w, uint8_t reg);
+static void jit_emit_check_nonpositive(struct JitWriter *w, uint8_t reg);
+static void jit_emit_check_above_one(struct JitWriter *w, uint8_t reg);
+static void jit_emit_mask(struct JitWriter *w, uint8_t reg);
+
+static uint8_t jit_fetch(struct JitWriter *w, size_t k, uint8_t scratch);
+static uint8_t jit_target(size_t k);
+static void jit_commit(struct JitWriter *w, size_t k, uint8_t reg);
+static struct JitOperand jit_reg(uint8_t reg);
+static struct JitOperand jit_mem(uint8_t reg, size_t disp);
+static struct JitOperand jit_cell(const struct JitWriter *w, size_t cell);
+static struct JitOperand jit_const(size_t const_ind);
+static struct JitOperand jit_num(struct JitWriter *w, double num);
+static size_t jit_add_const(struct JitWriter *w, uint64_t bits);
+
+static void jit_emit_op(struct JitWriter *w, enum JitOp op, uint8_t reg,
+						struct JitOperand rm, int imm8);
+static void jit_emit_modrm(struct JitWriter *w, uint8_t reg,
+						   struct JitOperand rm, int imm8);
+static void jit_emit_call(struct JitWriter *w, uintptr_t callee);
+static void jit_emit_bytes(struct JitWriter *w, const uint8_t *bytes,
+						   size_t n);
+static void jit_emit_byte(struct JitWriter *w, uint8_t byte);
+static void jit_emit_u32(struct JitWriter *w, uint32_t val);
+
+enum EquationError jit_eq_ctor(struct JitEquation *jit)
+{
+	assert(jit);
+
+	jit->func = NULL;
+	jit->batch_func = NULL;
+	jit->code = NULL;
+	jit->code_size = 0;
+	return compiled_eq_ctor(&jit->ceq);
+}
+
+void jit_eq_dtor(struct JitEquation *jit)
+{
+	assert(jit);
+
+	jit_eq_unmap(jit);
+	compiled_eq_dtor(&jit->ceq);
+}
+
+static void jit_eq_unmap(struct JitEquation *jit)
+{
+	assert(jit);
+
+#ifdef JIT_IS_SUPPORTED
+	if (jit->code)
+		munmap(jit->code, jit->code_size);
+#endif
+	jit->func = NULL;
+	jit->batch_func = NULL;
+	jit->code = NULL;
+	jit->code_size = 0;
+}
+
+enum EquationError jit_eq_from_equation(struct JitEquation *jit,
+										struct Equation eq)
+{
+	assert(jit);
+
+	jit_eq_unmap(jit);
+	enum EquationError err = compiled_eq_from_equation(&jit->ceq, eq);
+	if (err < 0 || jit->ceq.size == 0 || jit->ceq.size > JIT_MAX_SIZE)
+		return err;
+
+#ifdef JIT_IS_SUPPORTED
+	struct JitWriter scalar = {};
+	struct JitWriter vector = {};
+	bool has_vector = jit_has_avx2();
+	err = jit_compile(&scalar, &jit->ceq, false);
+	if (err == EQ_NO_ERR && has_vector)
+		err = jit_compile(&vector, &jit->ceq, true);
+	if (err == EQ_NO_ERR)
+		err = jit_map(jit, &scalar, has_vector ? &vector : NULL);
+	jit_writer_dtor(&scalar);
+	jit_writer_dtor(&vector);
+#endif
+	return err;
+}
+
+enum EquationError jit_eq_evaluate(struct JitEquation *jit,
+								   const double *vals, double *res)
+{
+	assert(jit);
+	assert(vals);
+	assert(res);
+
+	if (!jit->func)
+		return compiled_eq_evaluate(&jit->ceq, vals, res);
+
+	double val = (*jit->func)(vals);
+	if (isnan(val))
+		return compiled_eq_evaluate(&jit->ceq, vals, res);
+	*res = val;
+	return EQ_NO_ERR;
+}
+
+/*
+ * Points go to batch_func by JIT_BATCH_WIDTH, the last short group is padded
+ * with its last point. Only the variables the code reads are interleaved.
+ * Points that batch_func reports are rerun one by one.
+ */
+enum EquationError jit_eq_evaluate_batch(struct JitEquation *jit,
+										 const double *const *columns,
+										 size_t n, double *out)
+{
+	assert(jit);
+	assert(out);
+
+	if (!jit->batch_func)
+		return compiled_eq_evaluate_batch(&jit->ceq, columns, n, out);
+
+	const size_t WIDTH = JIT_BATCH_WIDTH;
+	size_t num_vars = jit->ceq.num_vars;
+	double *vals = (double*) calloc(num_vars * (WIDTH + 1) + 1,
+									sizeof(double));
+	size_t *used = (size_t*) calloc(num_vars + 1, sizeof(size_t));
+	if (!vals || !used) {
+		free(vals);
+		free(used);
+		return EQ_NO_MEM_ERR;
+	}
+	double *point = vals + num_vars * WIDTH;
+	size_t num_used = jit_find_used_vars(&jit->ceq, used);
+
+	enum EquationError first_err = EQ_NO_ERR;
+	for (size_t i = 0; i < n; i += WIDTH) {
+		size_t count = n - i < WIDTH ? n - i : WIDTH;
+		for (size_t u = 0; u < num_used; u++) {
+			const double *column = columns[used[u]] + i;
+			double *dst = vals + used[u] * WIDTH;
+			for (size_t j = 0; j < WIDTH; j++)
+				dst[j] = column[j < count ? j : count - 1];
+		}
+
+		double res[JIT_BATCH_WIDTH] = {};
+		uint32_t bad = (*jit->batch_func)(vals, res);
+		for (size_t j = 0; j < count; j++) {
+			out[i + j] = res[j];
+			if (!(bad >> j & 1))
+				continue;
+
+			for (size_t v = 0; v < num_vars; v++)
+				point[v] = columns[v][i + j];
+			enum EquationError err = compiled_eq_evaluate(&jit->ceq, point,
+														  out + i + j);
+			if (err < 0) {
+				out[i + j] = NAN;
+				if (first_err == EQ_NO_ERR)
+					first_err = err;
+			}
+		}
+	}
+
+	free(vals);
+	free(used);
+	return first_err;
+}
+
+// Indices of the variables ceq reads, in ascending order
+static size_t jit_find_used_vars(const struct CompiledEquation *ceq,
+								 size_t *used)
+{
+	assert(ceq);
+	assert(used);
+
+	for (size_t i = 0; i < ceq->size; i++) {
+		if (ceq->code[i].opcode == CEQ_VAR)
+			used[ceq->code[i].arg.ind] = 1;
+	}
+
+	size_t num_used = 0;
+	for (size_t v = 0; v < ceq->num_vars; v++) {
+		if (used[v])
+			used[num_used++] = v;
+	}
+	return num_used;
+}
+
+static bool jit_has_avx2()
+{
+#ifdef JIT_HAS_LIBMVEC
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+static enum EquationError jit_compile(struct JitWriter *w,
+									  const struct CompiledEquation *ceq,
+									  bool is_vector)
+{
+	assert(w);
+	assert(ceq);
+
+	w->is_vector = is_vector;
+	w->cell_size = is_vector ? JIT_BATCH_WIDTH * sizeof(double) :
+							   sizeof(double);
+	// Stack values, slots and the two powers of x of Estrin's scheme
+	size_t num_cells = ceq->max_depth + ceq->num_slots + 2;
+	w->frame_size = (num_cells * w->cell_size + 15) / 16 * 16;
+	w->err = EQ_NO_ERR;
+
+	const uint64_t SPECIAL_BITS[] = {
+		[JIT_CONST_ABS_MASK] = UINT64_MAX >> 1,
+		[JIT_CONST_EPSILON]  = 0,
+		[JIT_CONST_ZERO]	 = 0,
+		[JIT_CONST_ONE]		 = 0,
+		[JIT_CONST_PI_2]	 = 0,
+		[JIT_CONST_NAN]		 = 0,
+	};
+	const double SPECIAL_NUMS[] = {
+		[JIT_CONST_ABS_MASK] = 0,
+		[JIT_CONST_EPSILON]  = EQ_EPSILON,
+		[JIT_CONST_ZERO]	 = 0,
+		[JIT_CONST_ONE]		 = 1,
+		[JIT_CONST_PI_2]	 = M_PI_2,
+		[JIT_CONST_NAN]		 = NAN,
+	};
+	jit_add_const(w, SPECIAL_BITS[JIT_CONST_ABS_MASK]);
+	for (size_t i = JIT_CONST_EPSILON; i <= JIT_CONST_NAN; i++)
+		jit_num(w, SPECIAL_NUMS[i]);
+
+	struct JitCallees callees = jit_callees(is_vector);
+	size_t depth = 0;
+	jit_emit_prologue(w);
+	for (size_t i = 0; i < ceq->size && w->err == EQ_NO_ERR; i++)
+		jit_emit_instr(w, ceq, &callees, ceq->code + i, &depth);
+	assert(w->err < 0 || depth == 1);
+	jit_emit_epilogue(w);
+	return w->err;
+}
+
+/*
+ * Both functions go to one mapping, each followed by its constant pool,
+ * which the code addresses relative to rip.
+ */
+static enum EquationError jit_map(struct JitEquation *jit,
+								  const struct JitWriter *scalar,
+								  const struct JitWriter *vector)
+{
+	assert(jit);
+	assert(scalar);
+
+#ifdef JIT_IS_SUPPORTED
+	size_t vector_pos = (jit_image_size(scalar) + JIT_IMAGE_ALIGNMENT - 1) /
+						JIT_IMAGE_ALIGNMENT * JIT_IMAGE_ALIGNMENT;
+	size_t size = vector_pos + (vector ? jit_image_size(vector) : 0);
+	size = (size + JIT_PAGE_SIZE - 1) / JIT_PAGE_SIZE * JIT_PAGE_SIZE;
+
+	void *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED)
+		return EQ_NO_ERR;
+	jit_link(scalar, (uint8_t*) code);
+	if (vector)
+		jit_link(vector, (uint8_t*) code + vector_pos);
+	if (mprotect(code, size, PROT_READ | PROT_EXEC) < 0) {
+		munmap(code, size);
+		return EQ_NO_ERR;
+	}
+
+	jit->code = code;
+	jit->code_size = size;
+	memcpy(&jit->func, &code, sizeof(jit->func));
+	if (vector) {
+		void *batch_code = (uint8_t*) code + vector_pos;
+		memcpy(&jit->batch_func, &batch_code, sizeof(jit->batch_func));
+	}
+#else
+	(void) jit;
+	(void) vector;
+#endif
+	return EQ_NO_ERR;
+}
+
+static size_t jit_image_size(const struct JitWriter *w)
+{
+	assert(w);
+
+	size_t pool_pos = (w->size + JIT_POOL_ALIGNMENT - 1) /
+					  JIT_POOL_ALIGNMENT * JIT_POOL_ALIGNMENT;
+	return pool_pos + w->num_consts * JIT_POOL_ALIGNMENT;
+}
+
+// Copies the code and the pool to image and points the code to the pool
+static void jit_link(const struct JitWriter *w, uint8_t *image)
+{
+	assert(w);
+	assert(image);
+
+	size_t pool_pos = (w->size + JIT_POOL_ALIGNMENT - 1) /
+					  JIT_POOL_ALIGNMENT * JIT_POOL_ALIGNMENT;
+	size_t entry_size = w->is_vector ? JIT_POOL_ALIGNMENT :
+									   JIT_POOL_ALIGNMENT / 2;
+	memcpy(image, w->code, w->size);
+	for (size_t i = 0; i < w->num_consts; i++) {
+		for (size_t j = 0; j < entry_size; j += sizeof(uint64_t))
+			memcpy(image + pool_pos + i * entry_size + j, w->consts + i,
+				   sizeof(uint64_t));
+	}
+	for (size_t i = 0; i < w->num_fixups; i++) {
+		const struct JitFixup *fix = w->fixups + i;
+		int32_t disp = (int32_t) (pool_pos + fix->const_ind * entry_size) -
+					   (int32_t) fix->end_pos;
+		memcpy(image + fix->disp_pos, &disp, sizeof(disp));
+	}
+}
+
+static struct JitCallees jit_callees(bool is_vector)
+{
+	typedef double (*unary_func)(double);
+	typedef double (*binary_func)(double, double);
+
+	struct JitCallees callees = {
+		(uintptr_t) (binary_func) pow,
+		(uintptr_t) (unary_func) log,
+		(uintptr_t) (unary_func) cos,
+		(uintptr_t) (unary_func) sin,
+		(uintptr_t) (unary_func) tan,
+		(uintptr_t) (unary_func) asin,
+		(uintptr_t) (unary_func) acos,
+		(uintptr_t) (unary_func) atan,
+		(uintptr_t) (unary_func) exp,
+	};
+#ifdef JIT_HAS_LIBMVEC
+	if (is_vector) {
+		callees = {
+			(uintptr_t) _ZGVdN4vv_pow,
+			(uintptr_t) _ZGVdN4v_log,
+			(uintptr_t) _ZGVdN4v_cos,
+			(uintptr_t) _ZGVdN4v_sin,
+			(uintptr_t) _ZGVdN4v_tan,
+			(uintptr_t) _ZGVdN4v_asin,
+			(uintptr_t) _ZGVdN4v_acos,
+			(uintptr_t) _ZGVdN4v_atan,
+			(uintptr_t) _ZGVdN4v_exp,
+		};
+	}
+#else
+	assert(!is_vector);
+#endif
+	return callees;
+}
+
+static void jit_writer_dtor(struct JitWriter *w)
+{
+	assert(w);
+
+	free(w->code);
+	free(w->consts);
+	free(w->fixups);
+	w->code = NULL;
+	w->consts = NULL;
+	w->fixups = NULL;
+	w->size = 0;
+	w->cap = 0;
+	w->num_consts = 0;
+	w->cap_consts = 0;
+	w->num_fixups = 0;
+	w->cap_fixups = 0;
+}
+
+// Makes room for one more element, sets w->err if it can't
+static bool jit_reserve(struct JitWriter *w, void **arr, size_t *cap,
+						size_t size, size_t elem_size)
+{
+	assert(w);
+	assert(arr);
+	assert(cap);
+
+	if (w->err < 0)
+		return false;
+	if (size < *cap)
+		return true;
+
+	size_t new_cap = 2 * *cap + JIT_INIT_CODE_CAPACITY;
+	void *tmp = realloc(*arr, new_cap * elem_size);
+	if (!tmp) {
+		w->err = EQ_NO_MEM_ERR;
+		return false;
+	}
+	*arr = tmp;
+	*cap = new_cap;
+	return true;
+}
+
+/*
+ * push rbx, r12, r13; rbx = vals, r13 = res, r12 = 0. The frame is touched
+ * page by page on the way down, so a large one can't jump over a guard page.
+ */
+static void jit_emit_prologue(struct JitWriter *w)
+{
+	assert(w);
+
+	static const uint8_t PUSHES[] = {0x53, 0x41, 0x54, 0x41, 0x55};
+	static const uint8_t SUB_RSP[] = {0x48, 0x81, 0xEC};
+	static const uint8_t PROBE_RSP[] = {0x48, 0x83, 0x0C, 0x24, 0x00};
+	static const uint8_t SETUP[] = {0x48, 0x89, 0xFB, 0x49, 0x89, 0xF5,
+							 0x45, 0x31, 0xE4};
+
+	jit_emit_bytes(w, PUSHES, sizeof(PUSHES));
+	size_t left = w->frame_size;
+	while (left > JIT_PAGE_SIZE) {
+		jit_emit_bytes(w, SUB_RSP, sizeof(SUB_RSP));
+		jit_emit_u32(w, (uint32_t) JIT_PAGE_SIZE);
+		jit_emit_bytes(w, PROBE_RSP, sizeof(PROBE_RSP));
+		left -= JIT_PAGE_SIZE;
+	}
+	jit_emit_bytes(w, SUB_RSP, sizeof(SUB_RSP));
+	jit_emit_u32(w, (uint32_t) left);
+	jit_emit_bytes(w, SETUP, sizeof(SETUP));
+}
+
+/*
+ * The result is in xmm0. The scalar function replaces it with NAN if r12 is
+ * set, the vector one stores it to res and returns the lanes of r12.
+ */
+static void jit_emit_epilogue(struct JitWriter *w)
+{
+	assert(w);
+
+	static const uint8_t TEST_R12[] = {0x4D, 0x85, 0xE4, 0x74, 0x00};
+	static const uint8_t MOV_EAX_R12D[] = {0x44, 0x89, 0xE0};
+	static const uint8_t VZEROUPPER[] = {0xC5, 0xF8, 0x77};
+	static const uint8_t ADD_RSP[] = {0x48, 0x81, 0xC4};
+	static const uint8_t POPS_RET[] = {0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3};
+
+	jit_fetch(w, 0, JIT_DST_REG);
+	if (w->is_vector) {
+		jit_emit_op(w, JIT_STORE, 0, jit_mem(JIT_R13, 0), -1);
+		jit_emit_bytes(w, MOV_EAX_R12D, sizeof(MOV_EAX_R12D));
+		jit_emit_bytes(w, VZEROUPPER, sizeof(VZEROUPPER));
+	} else {
+		jit_emit_bytes(w, TEST_R12, sizeof(TEST_R12));
+		size_t jump_end = w->size;
+		jit_emit_op(w, JIT_LOAD, 0, jit_const(JIT_CONST_NAN), -1);
+		if (w->err == EQ_NO_ERR)
+			w->code[jump_end - 1] = (uint8_t) (w->size - jump_end);
+	}
+	jit_emit_bytes(w, ADD_RSP, sizeof(ADD_RSP));
+	jit_emit_u32(w, (uint32_t) w->frame_size);
+	jit_emit_bytes(w, POPS_RET, sizeof(POPS_RET));
+}
+
+// Lowers one instruction, the stack holds *depth values before it
+static void jit_emit_instr(struct JitWriter *w,
+						   const struct CompiledEquation *ceq,
+						   const struct JitCallees *callees,
+						   const struct CompiledInstr *ip, size_t *depth)
+{
+	assert(w);
+	assert(ceq);
+	assert(callees);
+	assert(ip);
+	assert(depth);
+
+	size_t top = *depth - 1;
+	size_t tmp_cell = ceq->max_depth + ceq->num_slots;
+	uint8_t reg = 0;
+	switch ((enum CompiledOpcode) ip->opcode) {
+		case CEQ_NUM:
+			reg = jit_target(*depth);
+			jit_emit_op(w, JIT_LOAD, reg, jit_num(w, ip->arg.num), -1);
+			jit_commit(w, (*depth)++, reg);
+			break;
+		case CEQ_VAR:
+			reg = jit_target(*depth);
+			jit_emit_op(w, JIT_LOAD, reg,
+						jit_mem(JIT_RBX, ip->arg.ind * w->cell_size), -1);
+			jit_commit(w, (*depth)++, reg);
+			break;
+		case CEQ_LOAD:
+			reg = jit_target(*depth);
+			jit_emit_op(w, JIT_LOAD, reg,
+						jit_cell(w, ceq->max_depth + ip->arg.ind), -1);
+			jit_commit(w, (*depth)++, reg);
+			break;
+		case CEQ_STORE:
+			reg = jit_fetch(w, top, JIT_DST_REG);
+			jit_emit_op(w, JIT_STORE, reg,
+						jit_cell(w, ceq->max_depth + ip->arg.ind), -1);
+			break;
+		case CEQ_ADD:
+			jit_emit_binary(w, JIT_ADD, --(*depth) - 1);
+			break;
+		case CEQ_SUB:
+			jit_emit_binary(w, JIT_SUB, --(*depth) - 1);
+			break;
+		case CEQ_MULT:
+			jit_emit_binary(w, JIT_MULT, --(*depth) - 1);
+			break;
+		case CEQ_DIV:
+			jit_emit_binary(w, JIT_DIV, --(*depth) - 1);
+			break;
+		case CEQ_POW:
+			jit_emit_call_begin(w, top - 1, 2, callees->pow);
+			jit_emit_call_end(w, top - 1);
+			(*depth)--;
+			break;
+		case CEQ_LN:
+			jit_emit_check_nonpositive(w, jit_fetch(w, top, JIT_DST_REG));
+			jit_emit_unary_call(w, top, callees->log);
+			break;
+		case CEQ_SQRT:
+			reg = jit_fetch(w, top, JIT_DST_REG);
+			jit_emit_op(w, JIT_SQRT, reg, jit_reg(reg), -1);
+			jit_commit(w, top, reg);
+			break;
+		case CEQ_COS:
+			jit_emit_unary_call(w, top, callees->cos);
+			break;
+		case CEQ_SIN:
+			jit_emit_unary_call(w, top, callees->sin);
+			break;
+		case CEQ_TG:
+			jit_emit_unary_call(w, top, callees->tan);
+			break;
+		case CEQ_CTG:
+			jit_emit_call_begin(w, top, 1, callees->tan);
+			jit_emit_check_small(w, 0);
+			jit_emit_op(w, JIT_LOAD, JIT_TMP_REG, jit_const(JIT_CONST_ONE),
+						-1);
+			jit_emit_op(w, JIT_DIV, JIT_TMP_REG, jit_reg(0), -1);
+			jit_emit_op(w, JIT_MOVE, 0, jit_reg(JIT_TMP_REG), -1);
+			jit_emit_call_end(w, top);
+			break;
+		case CEQ_ARCSIN:
+			jit_emit_check_above_one(w, jit_fetch(w, top, JIT_DST_REG));
+			jit_emit_unary_call(w, top, callees->asin);
+			break;
+		case CEQ_ARCCOS:
+			jit_emit_check_above_one(w, jit_fetch(w, top, JIT_DST_REG));
+			jit_emit_unary_call(w, top, callees->acos);
+			break;
+		case CEQ_ARCTG:
+			jit_emit_unary_call(w, top, callees->atan);
+			break;
+		case CEQ_ARCCTG:
+			jit_emit_call_begin(w, top, 1, callees->atan);
+			jit_emit_op(w, JIT_LOAD, JIT_TMP_REG, jit_const(JIT_CONST_PI_2),
+						-1);
+			jit_emit_op(w, JIT_SUB, JIT_TMP_REG, jit_reg(0), -1);
+			jit_emit_op(w, JIT_MOVE, 0, jit_reg(JIT_TMP_REG), -1);
+			jit_emit_call_end(w, top);
+			break;
+		case CEQ_EXP:
+			jit_emit_unary_call(w, top, callees->exp);
+			break;
+		case CEQ_POWI:
+			jit_emit_powi(w, top, ip->arg.exp);
+			break;
+		case CEQ_HORNER:
+			jit_emit_horner(w, top, ceq->coefs + ip->arg.poly.coef_ind,
+							ip->arg.poly.degree);
+			break;
+		case CEQ_ESTRIN:
+			jit_emit_estrin(w, top, ceq->coefs + ip->arg.poly.coef_ind,
+							ip->arg.poly.degree, tmp_cell);
+			break;
+		default:
+			w->err = EQ_UNKNOWN_OP_ERR;
+			break;
+	}
+}
+
+// The k-th value op= the (k + 1)-th one
+static void jit_emit_binary(struct JitWriter *w, enum JitOp op, size_t k)
+{
+	assert(w);
+
+	uint8_t src = jit_fetch(w, k + 1, JIT_SRC_REG);
+	uint8_t dst = jit_fetch(w, k, JIT_DST_REG);
+	if (op == JIT_DIV)
+		jit_emit_check_small(w, src);
+	jit_emit_op(w, op, dst, jit_reg(src), -1);
+	jit_commit(w, k, dst);
+}
+
+static void jit_emit_unary_call(struct JitWriter *w, size_t k,
+								uintptr_t callee)
+{
+	jit_emit_call_begin(w, k, 1, callee);
+	jit_emit_call_end(w, k);
+}
+
+/*
+ * Calls callee on the values from the k-th on, the result is left in xmm0
+ * until jit_emit_call_end puts it in place of the k-th value. Every
+ * register is clobbered by the call, so the ones below k are kept in their
+ * cells meanwhile.
+ */
+static void jit_emit_call_begin(struct JitWriter *w, size_t k,
+								size_t num_args, uintptr_t callee)
+{
+	assert(w);
+
+	size_t num_live = k < JIT_NUM_REGS ? k : JIT_NUM_REGS;
+	for (size_t i = 0; i < num_live; i++) {
+		if (w->reg_states[i] == JIT_IN_REG)
+			jit_emit_op(w, JIT_STORE, (uint8_t) i, jit_cell(w, i), -1);
+		w->reg_states[i] = JIT_IN_CELL;
+	}
+	for (size_t i = 0; i < num_args; i++) {
+		if (k + i >= JIT_NUM_REGS || w->reg_states[k + i] == JIT_IN_CELL)
+			jit_emit_op(w, JIT_LOAD, (uint8_t) i, jit_cell(w, k + i), -1);
+		else if (k != 0)
+			jit_emit_op(w, JIT_MOVE, (uint8_t) i, jit_reg((uint8_t) (k + i)),
+						-1);
+	}
+	jit_emit_call(w, callee);
+}
+
+static void jit_emit_call_end(struct JitWriter *w, size_t k)
+{
+	assert(w);
+
+	if (k != 0 && k < JIT_NUM_REGS)
+		jit_emit_op(w, JIT_MOVE, (uint8_t) k, jit_reg(0), -1);
+	jit_commit(w, k, 0);
+}
+
+// Unrolled squaring, the same multiplications as compiled_powi makes
+static void jit_emit_powi(struct JitWriter *w, size_t k, int32_t exp)
+{
+	assert(w);
+
+	uint8_t x = jit_fetch(w, k, JIT_DST_REG);
+	uint32_t n = exp < 0 ? 0 - (uint32_t) exp : (uint32_t) exp;
+	if (n == 0) {
+		jit_emit_op(w, JIT_LOAD, x, jit_const(JIT_CONST_ONE), -1);
+		jit_commit(w, k, x);
+		return;
+	}
+
+	bool has_res = false;
+	jit_emit_op(w, JIT_MOVE, JIT_TMP2_REG, jit_reg(x), -1);
+	for (; n > 0; n >>= 1) {
+		if (n & 1)
+			jit_emit_op(w, has_res ? JIT_MULT : JIT_MOVE, JIT_TMP_REG,
+						jit_reg(JIT_TMP2_REG), -1);
+		has_res |= n & 1;
+		if (n > 1)
+			jit_emit_op(w, JIT_MULT, JIT_TMP2_REG, jit_reg(JIT_TMP2_REG), -1);
+	}
+	if (exp < 0) {
+		jit_emit_check_zero(w, JIT_TMP_REG);
+		jit_emit_op(w, JIT_LOAD, x, jit_const(JIT_CONST_ONE), -1);
+		jit_emit_op(w, JIT_DIV, x, jit_reg(JIT_TMP_REG), -1);
+	} else {
+		jit_emit_op(w, JIT_MOVE, x, jit_reg(JIT_TMP_REG), -1);
+	}
+	jit_commit(w, k, x);
+}
+
+static void jit_emit_horner(struct JitWriter *w, size_t k,
+							const double *coefs, uint32_t degree)
+{
+	assert(w);
+	assert(coefs);
+
+	uint8_t x = jit_fetch(w, k, JIT_DST_REG);
+	jit_emit_op(w, JIT_LOAD, JIT_TMP2_REG, jit_num(w, coefs[degree]), -1);
+	for (uint32_t i = degree; i-- > 0;) {
+		jit_emit_op(w, JIT_MULT, JIT_TMP2_REG, jit_reg(x), -1);
+		jit_emit_op(w, JIT_ADD, JIT_TMP2_REG, jit_num(w, coefs[i]), -1);
+	}
+	jit_emit_op(w, JIT_MOVE, x, jit_reg(JIT_TMP2_REG), -1);
+	jit_commit(w, k, x);
+}
+
+/*
+ * Same order of operations as compiled_estrin. x^2 and x^4 are kept in the
+ * cells from tmp_cell on, the sum in JIT_SRC_REG, which no operand of a
+ * unary instruction takes.
+ */
+static void jit_emit_estrin(struct JitWriter *w, size_t k,
+							const double *coefs, uint32_t degree,
+							size_t tmp_cell)
+{
+	assert(w);
+	assert(coefs);
+
+	struct JitOperand x2 = jit_cell(w, tmp_cell);
+	struct JitOperand x4 = jit_cell(w, tmp_cell + 1);
+	uint8_t x = jit_fetch(w, k, JIT_DST_REG);
+	jit_emit_op(w, JIT_MOVE, JIT_TMP_REG, jit_reg(x), -1);
+	jit_emit_op(w, JIT_MULT, JIT_TMP_REG, jit_reg(x), -1);
+	jit_emit_op(w, JIT_STORE, JIT_TMP_REG, x2, -1);
+	jit_emit_op(w, JIT_MULT, JIT_TMP_REG, jit_reg(JIT_TMP_REG), -1);
+	jit_emit_op(w, JIT_STORE, JIT_TMP_REG, x4, -1);
+
+	uint32_t block = degree / CEQ_ESTRIN_BLOCK * CEQ_ESTRIN_BLOCK;
+	jit_emit_estrin_block(w, coefs + block, x, x2);
+	jit_emit_op(w, JIT_MOVE, JIT_SRC_REG, jit_reg(JIT_TMP_REG), -1);
+	while (block > 0) {
+		block -= CEQ_ESTRIN_BLOCK;
+		jit_emit_estrin_block(w, coefs + block, x, x2);
+		jit_emit_op(w, JIT_MULT, JIT_SRC_REG, x4, -1);
+		jit_emit_op(w, JIT_ADD, JIT_SRC_REG, jit_reg(JIT_TMP_REG), -1);
+	}
+	jit_emit_op(w, JIT_MOVE, x, jit_reg(JIT_SRC_REG), -1);
+	jit_commit(w, k, x);
+}
+
+// JIT_TMP_REG = (c0 + c1 x) + (c2 + c3 x) x^2
+static void jit_emit_estrin_block(struct JitWriter *w, const double *c,
+								  uint8_t x, struct JitOperand x2)
+{
+	assert(w);
+	assert(c);
+
+	jit_emit_op(w, JIT_LOAD, JIT_TMP_REG, jit_num(w, c[1]), -1);
+	jit_emit_op(w, JIT_MULT, JIT_TMP_REG, jit_reg(x), -1);
+	jit_emit_op(w, JIT_ADD, JIT_TMP_REG, jit_num(w, c[0]), -1);
+	jit_emit_op(w, JIT_LOAD, JIT_TMP2_REG, jit_num(w, c[3]), -1);
+	jit_emit_op(w, JIT_MULT, JIT_TMP2_REG, jit_reg(x), -1);
+	jit_emit_op(w, JIT_ADD, JIT_TMP2_REG, jit_num(w, c[2]), -1);
+	jit_emit_op(w, JIT_MULT, JIT_TMP2_REG, x2, -1);
+	jit_emit_op(w, JIT_ADD, JIT_TMP_REG, jit_reg(JIT_TMP2_REG), -1);
+}
+
+// Domain checks of compiled_eq_evaluate_stack, they keep reg as it is
+static void jit_emit_check_small(struct JitWriter *w, uint8_t reg)
+{
+	jit_emit_op(w, JIT_MOVE, JIT_TMP2_REG, jit_reg(reg), -1);
+	jit_emit_op(w, JIT_AND, JIT_TMP2_REG, jit_const(JIT_CONST_ABS_MASK), -1);
+	jit_emit_op(w, JIT_CMP, JIT_TMP2_REG, jit_const(JIT_CONST_EPSILON),
+				JIT_CMP_LT);
+	jit_emit_mask(w, JIT_TMP2_REG);
+}
+
+// Exactly 0, the pole of a negative power in compiled_powi
+static void jit_emit_check_zero(struct JitWriter *w, uint8_t reg)
+{
+	jit_emit_op(w, JIT_MOVE, JIT_TMP2_REG, jit_reg(reg), -1);
+	jit_emit_op(w, JIT_AND, JIT_TMP2_REG, jit_const(JIT_CONST_ABS_MASK), -1);
+	jit_emit_op(w, JIT_CMP, JIT_TMP2_REG, jit_const(JIT_CONST_ZERO),
+				JIT_CMP_LE);
+	jit_emit_mask(w, JIT_TMP2_REG);
+}
+
+static void jit_emit_check_nonpositive(struct JitWriter *w, uint8_t reg)
+{
+	jit_emit_op(w, JIT_MOVE, JIT_TMP2_REG, jit_reg(reg), -1);
+	jit_emit_op(w, JIT_CMP, JIT_TMP2_REG, jit_const(JIT_CONST_ZERO),
+				JIT_CMP_LE);
+	jit_emit_mask(w, JIT_TMP2_REG);
+}
+
+static void jit_emit_check_above_one(struct JitWriter *w, uint8_t reg)
+{
+	jit_emit_op(w, JIT_MOVE, JIT_TMP_REG, jit_reg(reg), -1);
+	jit_emit_op(w, JIT_AND, JIT_TMP_REG, jit_const(JIT_CONST_ABS_MASK), -1);
+	jit_emit_op(w, JIT_LOAD, JIT_TMP2_REG, jit_const(JIT_CONST_ONE), -1);
+	jit_emit_op(w, JIT_CMP, JIT_TMP2_REG, jit_reg(JIT_TMP_REG), JIT_CMP_LT);
+	jit_emit_mask(w, JIT_TMP2_REG);
+}
+
+/*
+ * r12 |= lanes of a comparison result: movq rax, xmm for a scalar (all
+ * bits of the lane), vmovmskpd eax, ymm for a vector.
+ */
+static void jit_emit_mask(struct JitWriter *w, uint8_t reg)
+{
+	assert(w);
+
+	static const uint8_t OR_R12_RAX[] = {0x49, 0x09, 0xC4};
+	uint8_t ext = (uint8_t) (reg >> 3);
+	if (w->is_vector) {
+		jit_emit_byte(w, 0xC4);
+		jit_emit_byte(w, (uint8_t) (0xC1 | (ext ^ 1) << 5));
+		jit_emit_byte(w, 0x7D);
+		jit_emit_byte(w, 0x50);
+		jit_emit_byte(w, (uint8_t) (0xC0 | (reg & 7)));
+	} else {
+		jit_emit_byte(w, 0x66);
+		jit_emit_byte(w, (uint8_t) (0x48 | ext << 2));
+		jit_emit_byte(w, 0x0F);
+		jit_emit_byte(w, 0x7E);
+		jit_emit_byte(w, (uint8_t) (0xC0 | (reg & 7) << 3));
+	}
+	jit_emit_bytes(w, OR_R12_RAX, sizeof(OR_R12_RAX));
+}
+
+// Register with the k-th stack value, loaded into scratch if it is spilled
+static uint8_t jit_fetch(struct JitWriter *w, size_t k, uint8_t scratch)
+{
+	assert(w);
+
+	if (k >= JIT_NUM_REGS) {
+		jit_emit_op(w, JIT_LOAD, scratch, jit_cell(w, k), -1);
+		return scratch;
+	}
+	if (w->reg_states[k] == JIT_IN_CELL) {
+		jit_emit_op(w, JIT_LOAD, (uint8_t) k, jit_cell(w, k), -1);
+		w->reg_states[k] = JIT_IN_BOTH;
+	}
+	return (uint8_t) k;
+}
+
+// Register to make the k-th stack value in
+static uint8_t jit_target(size_t k)
+{
+	return k < JIT_NUM_REGS ? (uint8_t) k : JIT_DST_REG;
+}
+
+// Puts the k-th stack value made in reg to its place
+static void jit_commit(struct JitWriter *w, size_t k, uint8_t reg)
+{
+	if (k >= JIT_NUM_REGS)
+		jit_emit_op(w, JIT_STORE, reg, jit_cell(w, k), -1);
+	else
+		w->reg_states[k] = JIT_IN_REG;
+}
+
+static struct JitOperand jit_reg(uint8_t reg)
+{
+	struct JitOperand operand = {};
+	operand.kind = JIT_OPERAND_REG;
+	operand.reg = reg;
+	return operand;
+}
+
+static struct JitOperand jit_mem(uint8_t reg, size_t disp)
+{
+	struct JitOperand operand = {};
+	operand.kind = JIT_OPERAND_MEM;
+	operand.reg = reg;
+	operand.disp = (int32_t) disp;
+	return operand;
+}
+
+static struct JitOperand jit_cell(const struct JitWriter *w, size_t cell)
+{
+	assert(w);
+
+	return jit_mem(JIT_RSP, cell * w->cell_size);
+}
+
+static struct JitOperand jit_const(size_t const_ind)
+{
+	struct JitOperand operand = {};
+	operand.kind = JIT_OPERAND_CONST;
+	operand.const_ind = const_ind;
+	return operand;
+}
+
+static struct JitOperand jit_num(struct JitWriter *w, double num)
+{
+	uint64_t bits = 0;
+	memcpy(&bits, &num, sizeof(bits));
+	return jit_const(jit_add_const(w, bits));
+}
+
+static size_t jit_add_const(struct JitWriter *w, uint64_t bits)
+{
+	assert(w);
+
+	if (!jit_reserve(w, (void**) &w->consts, &w->cap_consts, w->num_consts,
+					 sizeof(uint64_t)))
+		return 0;
+	w->consts[w->num_consts] = bits;
+	return w->num_consts++;
+}
+
+/*
+ * op reg, rm: the SSE2 form with an optional REX prefix, or the 3-byte VEX
+ * form with L = 256 and pp = 66 (R, X, B and vvvv inverted).
+ */
+static void jit_emit_op(struct JitWriter *w, enum JitOp op, uint8_t reg,
+						struct JitOperand rm, int imm8)
+{
+	assert(w);
+	assert((size_t) op < sizeof(JIT_OPCODES) / sizeof(JIT_OPCODES[0]));
+
+	const struct JitOpcode *code = JIT_OPCODES + op;
+	uint8_t ext_reg = (uint8_t) (reg >> 3);
+	uint8_t ext_rm = rm.kind == JIT_OPERAND_CONST ? 0 :
+					 (uint8_t) (rm.reg >> 3);
+	if (w->is_vector) {
+		uint8_t vvvv = code->is_nds ? reg : 0;
+		jit_emit_byte(w, 0xC4);
+		jit_emit_byte(w, (uint8_t) ((ext_reg ^ 1) << 7 | 1 << 6 |
+									(ext_rm ^ 1) << 5 | 1));
+		jit_emit_byte(w, (uint8_t) ((~vvvv & 0xF) << 3 | 1 << 2 | 1));
+	} else {
+		jit_emit_byte(w, code->prefix);
+		if (ext_reg || ext_rm)
+			jit_emit_byte(w, (uint8_t) (0x40 | ext_reg << 2 | ext_rm));
+		jit_emit_byte(w, 0x0F);
+	}
+	jit_emit_byte(w, code->opcode);
+	jit_emit_modrm(w, reg, rm, imm8);
+}
+
+// ModRM (with SIB for rsp) and disp32, rip-relative for a constant
+static void jit_emit_modrm(struct JitWriter *w, uint8_t reg,
+						   struct JitOperand rm, int imm8)
+{
+	assert(w);
+
+	size_t disp_pos = 0;
+	switch (rm.kind) {
+		case JIT_OPERAND_REG:
+			jit_emit_byte(w, (uint8_t) (0xC0 | (reg & 7) << 3 | (rm.reg & 7)));
+			break;
+		case JIT_OPERAND_MEM:
+			jit_emit_byte(w, (uint8_t) (0x80 | (reg & 7) << 3 | (rm.reg & 7)));
+			if ((rm.reg & 7) == JIT_RSP)
+				jit_emit_byte(w, 0x24);
+			jit_emit_u32(w, (uint32_t) rm.disp);
+			break;
+		case JIT_OPERAND_CONST:
+			jit_emit_byte(w, (uint8_t) ((reg & 7) << 3 | 5));
+			disp_pos = w->size;
+			jit_emit_u32(w, 0);
+			break;
+		default:
+			assert(0 && "Unknown operand");
+			break;
+	}
+	if (imm8 >= 0)
+		jit_emit_byte(w, (uint8_t) imm8);
+
+	if (rm.kind == JIT_OPERAND_CONST &&
+		jit_reserve(w, (void**) &w->fixups, &w->cap_fixups, w->num_fixups,
+					sizeof(struct JitFixup)))
+		w->fixups[w->num_fixups++] = {disp_pos, w->size, rm.const_ind};
+}
+
+// mov rax, callee; call rax
+static void jit_emit_call(struct JitWriter *w, uintptr_t callee)
+{
+	static const uint8_t MOV_RAX[] = {0x48, 0xB8};
+	static const uint8_t CALL_RAX[] = {0xFF, 0xD0};
+
+	uint64_t addr = callee;
+	jit_emit_bytes(w, MOV_RAX, sizeof(MOV_RAX));
+	jit_emit_bytes(w, (const uint8_t*) &addr, sizeof(addr));
+	jit_emit_bytes(w, CALL_RAX, sizeof(CALL_RAX));
+}
+
+static void jit_emit_bytes(struct JitWriter *w, const uint8_t *bytes,
+						   size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		jit_emit_byte(w, bytes[i]);
+}
+
+static void jit_emit_byte(struct JitWriter *w, uint8_t byte)
+{
+	assert(w);
+
+	if (jit_reserve(w, (void**) &w->code, &w->cap, w->size, sizeof(uint8_t)))
+		w->code[w->size++] = byte;
+}
+
+static void jit_emit_u32(struct JitWriter *w, uint32_t val)
+{
+	jit_emit_bytes(w, (const uint8_t*) &val, sizeof(val));
+}
@@ -0,0 +1,67 @@
+#ifndef _JIT_EQUATION_H
+#define _JIT_EQUATION_H
+
+#include <stdint.h>
+
+#include "compiled_equation.h"
+#include "equation_utils.h"
+
+/*
+ * Equation compiled to x86-64 machine code. The bytecode of
+ * CompiledEquation is lowered instruction by instruction: the value stack
+ * lives in registers xmm0..xmm(JIT_NUM_REGS - 1) and in stack frame cells
+ * past them, slots of shared subtrees live in the frame, numbers and
+ * polynomial coefficients are read from a constant pool after the code.
+ * Integer powers and polynomials are unrolled, transcendental operators
+ * are calls to libm, around which the live registers are spilled.
+ *
+ * func evaluates at one point with SSE2. batch_func evaluates at
+ * JIT_BATCH_WIDTH points at once with AVX, calling libmvec: vals holds
+ * JIT_BATCH_WIDTH values of every variable one after another and res
+ * receives as many results. The code is made in a page mapped writable and
+ * then turned executable.
+ *
+ * Domain checks are the same as of compiled_eq_evaluate_stack: func returns
+ * NAN at a point that fails one, batch_func returns the mask of such
+ * points. The jit_eq_evaluate functions then rerun those points through the
+ * bytecode to report the error. If machine code can't be made (not an
+ * x86-64 Linux, the mapping is refused, no AVX2 for batch_func), the
+ * function is NULL and they run the bytecode instead. So is it for
+ * bytecode longer than JIT_MAX_SIZE: straight-line code that large streams
+ * through the instruction cache at every point and loses to the loop of
+ * compiled_eq_evaluate.
+ */
+
+typedef double (*jit_func)(const double *vals);
+typedef uint32_t (*jit_batch_func)(const double *vals, double *res);
+
+const size_t JIT_NUM_REGS = 12;
+const size_t JIT_BATCH_WIDTH = 4;
+const size_t JIT_INIT_CODE_CAPACITY = 256;
+const size_t JIT_MAX_SIZE = 8192;
+
+struct JitEquation {
+	struct CompiledEquation ceq;
+
+	jit_func func;
+	jit_batch_func batch_func;
+	void *code;
+	size_t code_size;
+};
+
+enum EquationError jit_eq_ctor(struct JitEquation *jit);
+void jit_eq_dtor(struct JitEquation *jit);
+
+enum EquationError jit_eq_from_equation(struct JitEquation *jit,
+										struct Equation eq);
+enum EquationError jit_eq_evaluate(struct JitEquation *jit,
+								   const double *vals, double *res);
+/*
+ * Same contract as compiled_eq_evaluate_batch: points that fail get NAN in
+ * out and the error of the first of them is returned.
+ */
+enum EquationError jit_eq_evaluate_batch(struct JitEquation *jit,
+										 const double *const *columns,
+										 size_t n, double *out);
+
+#endif /*_JIT_EQUATION_H*/
@@ -1,12 +1,20 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <time.h>
 
 #include "logger.h"
 #include "tree.h"
 #include "tree_debug.h"
 #include "equation_io.h"
 #include "equation_utils.h"
+#include "batch_evaluate.h"
+#include "jit_equation.h"
+#include "gradient_tape.h"
+#include "egraph.h"
+#include "static_check.h"
+#include "bench.h"
 #include "buffer.h"
 #include "../lib-cmd-args/src/cmd_args.h"
 
@@ -18,6 +26,23 @@ enum ArgError handle_latex_filename(const char *arg_str, void *processed_args);
 enum ArgError handle_graph_filename(const char *arg_str, void *processed_args);
 enum ArgError handle_eval_mode(const char *arg_str, void *processed_args);
 enum ArgError handle_teylor_extent(const char *arg_str, void *processed_args);
+enum ArgError handle_dag_mode(const char *arg_str, void *processed_args);
+enum ArgError handle_num_threads(const char *arg_str, void *processed_args);
+enum ArgError handle_sweep_points(const char *arg_str, void *processed_args);
+enum ArgError handle_gradient_mode(const char *arg_str, void *processed_args);
+enum ArgError handle_forward_mode(const char *arg_str, void *processed_args);
+enum ArgError handle_egraph_mode(const char *arg_str, void *processed_args);
+enum ArgError handle_ckernel_filename(const char *arg_str,
+									  void *processed_args);
+enum ArgError handle_static_check(const char *arg_str, void *processed_args);
+enum ArgError handle_bench_name(const char *arg_str, void *processed_args);
+
+enum EquationError sweep_derivative(struct Equation diff, size_t num_points,
+									size_t max_threads);
+enum EquationIOError write_c_kernel(struct Equation eq, const char *filename,
+									size_t num_points);
+enum EquationIOError bench_c_kernel(const struct Equation *eqs,
+									size_t num_eqs, size_t num_points);
 
 struct CmdArgs {
 	const char *input_file;
@@ -26,6 +51,15 @@ struct CmdArgs {
 	const char *graph_file;
 	bool eval_mode;
 	size_t teylor_extent;
+	bool dag_mode;
+	size_t num_threads;
+	size_t sweep_points;
+	bool gradient_mode;
+	bool forward_mode;
+	bool egraph_mode;
+	const char *ckernel_file;
+	bool static_check;
+	const struct BenchDef *bench;
 };
 
 const ArgDef arg_defs[] = {
@@ -41,6 +75,29 @@ const ArgDef arg_defs[] = {
 	 " Teylor's series (3 by default)", true, false, handle_teylor_extent},
 	{"graph", '\0', "WIP",
 	 true, false, handle_graph_filename},
+	{"dag",   '\0', "Store derivatives as DAGs with shared subexpressions",
+	 true, true,  handle_dag_mode},
+	{"threads", '\0', "Number of threads for batch evaluation (1 by default)",
+	 true, false, handle_num_threads},
+	{"sweep", '\0', "Evaluate the derivative at this many points of [-4, 4]"
+	 " and report throughput on 1..threads threads, of the JIT and of float",
+	 true, false, handle_sweep_points},
+	{"gradient", '\0', "Evaluate the function and all its partial derivatives"
+	 " at a certain point", true, true, handle_gradient_mode},
+	{"forward", '\0', "Evaluate the derivative with dual numbers right on the"
+	 " formula instead of the symbolic derivative (with --eval), which is"
+	 " then built only for --sweep",
+	 true, true, handle_forward_mode},
+	{"egraph", '\0', "Look for a cheaper form of the derivative with equality"
+	 " saturation after the simplification", true, true, handle_egraph_mode},
+	{"ckernel", '\0', "Name of the C file the function and its gradient will"
+	 " be written to (compared with eq_evaluate at --sweep points)",
+	 true, false, handle_ckernel_filename},
+	{"static-check", '\0', "Compare the compile-time derivatives of the"
+	 " built-in formulas with eq_differentiate at --sweep points and exit",
+	 true, true, handle_static_check},
+	{"bench", '\0', "Run a benchmark sized by --sweep and exit: chain, depth,"
+	 " arena, vm, forward, cse, horner", true, false, handle_bench_name},
 };
 const size_t ARG_DEFS_SIZE = sizeof(arg_defs) / sizeof(arg_defs[0]);
 
@@ -56,13 +113,15 @@ int main(int argc, const char *argv[])
 	enum EquationIOError eqio_err = EQIO_NO_ERR;
 	enum EquationError eq_err = EQ_NO_ERR;
 
-	struct CmdArgs args = {NULL, NULL, NULL, NULL, false, 3};
+	struct CmdArgs args = {NULL, NULL, NULL, NULL, false, 3, false, 1, 0,
+							false, false, false, NULL, false, NULL};
 	struct Buffer buf = {};
 	struct Equation eq = {};
 	struct Equation diff = {};
 	struct Equation teylor = {};
 
 	double *vals = NULL;
+	double *grad = NULL;
 	double res = NAN;
 
 	FILE *dump = NULL;
@@ -77,6 +136,31 @@ int main(int argc, const char *argv[])
 		return 0;
 	}
 
+	if (args.static_check) {
+		bool is_conformant = false;
+		eq_err = static_eq_check(args.sweep_points ? args.sweep_points :
+								 STATIC_CHECK_DEFAULT_POINTS, &is_conformant);
+		if (eq_err < 0) {
+			log_message(ERROR, "An equation error happened\n");
+			goto error;
+		}
+		if (!is_conformant) {
+			log_message(ERROR, "Compile-time derivatives differ from"
+						" eq_differentiate\n");
+			goto error;
+		}
+		goto finally;
+	}
+	if (args.bench) {
+		eq_err = (*args.bench->func)(args.sweep_points ? args.sweep_points :
+									 args.bench->default_size);
+		if (eq_err < 0) {
+			log_message(ERROR, "An error happened while benchmarking\n");
+			goto error;
+		}
+		goto finally;
+	}
+
 	if (args.dump_file) {
 		dump = tree_start_html_dump(args.dump_file);
 		if (!dump) {
@@ -107,6 +191,13 @@ int main(int argc, const char *argv[])
 		log_message(ERROR, "An equation error happened\n");
 		goto error;
 	}
+	if (args.dag_mode) {
+		eq_err = eq_enable_sharing(&diff);
+		if (eq_err < 0) {
+			log_message(ERROR, "An equation error happened\n");
+			goto error;
+		}
+	}
 
 	eqio_err = eq_load_from_buf(&eq, &buf);
 	if (eqio_err < 0) {
@@ -131,6 +222,8 @@ int main(int argc, const char *argv[])
 		eq_print_latex(eq, latex);
 	}
 
+	if (args.forward_mode && args.eval_mode && !args.sweep_points)
+		goto skip_diff;
 	eq_err = eq_differentiate(eq, 0, &diff);
 	if (eq_err < 0) {
 		log_message(ERROR, "An error happened while differentiating\n");
@@ -148,6 +241,28 @@ int main(int argc, const char *argv[])
 		log_message(ERROR, "An error happened while simplifying\n");
 		goto error;
 	}
+	if (args.egraph_mode) {
+		eq_err = eq_simplify_egraph(&diff, EGRAPH_DEFAULT_LIMITS);
+		if (eq_err < 0) {
+			log_message(ERROR, "An error happened while simplifying\n");
+			goto error;
+		}
+	}
+	if (args.dag_mode) {
+		size_t tree_size = 0;
+		size_t dag_size = 0;
+		eq_err = eq_count_nodes(diff, &tree_size);
+		if (eq_err == EQ_NO_ERR)
+			eq_err = eq_eliminate_common_subexprs(&diff);
+		if (eq_err == EQ_NO_ERR)
+			eq_err = eq_count_nodes(diff, &dag_size);
+		if (eq_err < 0) {
+			log_message(ERROR, "An error happened while simplifying\n");
+			goto error;
+		}
+		printf("Узлов в производной: %lu, различных подвыражений: %lu\n",
+			   tree_size, dag_size);
+	}
 	eq_print(diff, stdout);
 	if (dump)
 		TREE_DUMP_GUI(diff, eq_print_token, dump);
@@ -155,10 +270,17 @@ int main(int argc, const char *argv[])
 		fprintf(latex, "Производная (упрощенная):\n");
 		eq_print_latex(diff, latex);
 	}
+	skip_diff:
 
 	if (args.eval_mode) {
-		eq_read_var_values_cli(diff, &vals);
-		eq_err = eq_evaluate(diff, vals, &res);
+		if (args.forward_mode) {
+			double value = NAN;
+			eq_read_var_values_cli(eq, &vals);
+			eq_err = eq_evaluate_dual(eq, 0, vals, &value, &res);
+		} else {
+			eq_read_var_values_cli(diff, &vals);
+			eq_err = eq_evaluate(diff, vals, &res);
+		}
 		if (eq_err < 0) {
 			log_message(ERROR, "An error happened while evaluating\n");
 			goto error;
@@ -166,11 +288,56 @@ int main(int argc, const char *argv[])
 		printf("Значение производной:\n%lf\n", res);
 	}
 
+	if (args.gradient_mode) {
+		if (!vals)
+			eq_read_var_values_cli(eq, &vals);
+		grad = (double*) calloc(eq.num_vars, sizeof(double));
+		if (!grad || !vals) {
+			log_message(ERROR, "An error happened while evaluating\n");
+			goto error;
+		}
+		eq_err = eq_gradient_at(eq, vals, grad, &res);
+		if (eq_err < 0) {
+			log_message(ERROR, "An error happened while evaluating\n");
+			goto error;
+		}
+		printf("Значение функции:\n%lf\nГрадиент:\n", res);
+		for (size_t i = 0; i < eq.num_vars; i++)
+			printf("d/d%s = %lf\n", eq.var_names[i], grad[i]);
+	}
+
+	if (args.sweep_points) {
+		eq_err = sweep_derivative(diff, args.sweep_points, args.num_threads);
+		if (eq_err < 0) {
+			log_message(ERROR, "An error happened while sweeping\n");
+			goto error;
+		}
+	}
+
+	if (args.ckernel_file) {
+		eqio_err = write_c_kernel(eq, args.ckernel_file, args.sweep_points);
+		if (eqio_err < 0) {
+			log_message(ERROR, eq_io_err_to_str(eqio_err));
+			goto error;
+		}
+	}
+
+	if (eq.num_vars > 1) {
+		printf("Формула Тейлора строится только для функций одной переменной\n");
+		goto skip_teylor;
+	}
 	eq_err = eq_ctor(&teylor);
 	if (eq_err < 0) {
 		log_message(ERROR, "An error happened while teyloring\n");
 		goto error;
 	}
+	if (args.dag_mode) {
+		eq_err = eq_enable_sharing(&teylor);
+		if (eq_err < 0) {
+			log_message(ERROR, "An error happened while teyloring\n");
+			goto error;
+		}
+	}
 
 	eq_err = eq_expand_into_teylor(eq, args.teylor_extent, &teylor);
 	if (eq_err < 0) {
@@ -188,6 +355,7 @@ int main(int argc, const char *argv[])
 		fprintf(latex, "Формула Тейлора:\n");
 		eq_print_latex(teylor, latex);
 	}
+	skip_teylor:
 
 	if (args.graph_file) {
 		eq_graph(eq, args.graph_file);
@@ -210,6 +378,7 @@ int main(int argc, const char *argv[])
 		if (dump)
 			tree_end_html_dump(dump);
 		free(vals);
+		free(grad);
 		eq_dtor(&eq);
 		eq_dtor(&diff);
 		eq_dtor(&teylor);
@@ -258,9 +427,345 @@ enum ArgError handle_teylor_extent(const char *arg_str, void *processed_args)
 	return ARG_NO_ERR;
 }
 
+enum ArgError handle_dag_mode(const char */*arg_str*/, void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->dag_mode = true;
+	return ARG_NO_ERR;
+}
+
 enum ArgError handle_graph_filename(const char *arg_str, void *processed_args)
 {
 	struct CmdArgs *args = (struct CmdArgs*) processed_args;
 	args->graph_file = arg_str;
 	return ARG_NO_ERR;
 }
+
+enum ArgError handle_num_threads(const char *arg_str, void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	int read = sscanf(arg_str, "%lu", &args->num_threads);
+	if (read != 1 || args->num_threads == 0)
+		return ARG_WRONG_ARGS_ERR;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_sweep_points(const char *arg_str, void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	int read = sscanf(arg_str, "%lu", &args->sweep_points);
+	if (read != 1)
+		return ARG_WRONG_ARGS_ERR;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_gradient_mode(const char */*arg_str*/,
+								   void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->gradient_mode = true;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_forward_mode(const char */*arg_str*/,
+								  void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->forward_mode = true;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_egraph_mode(const char */*arg_str*/,
+								 void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->egraph_mode = true;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_ckernel_filename(const char *arg_str,
+									  void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->ckernel_file = arg_str;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_static_check(const char */*arg_str*/,
+								  void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->static_check = true;
+	return ARG_NO_ERR;
+}
+
+enum ArgError handle_bench_name(const char *arg_str, void *processed_args)
+{
+	struct CmdArgs *args = (struct CmdArgs*) processed_args;
+	args->bench = bench_find(arg_str);
+	if (!args->bench)
+		return ARG_WRONG_ARGS_ERR;
+	return ARG_NO_ERR;
+}
+
+enum EquationError sweep_derivative(struct Equation diff, size_t num_points,
+									size_t max_threads)
+{
+	const double SWEEP_FROM = -4;
+	const double SWEEP_TO = 4;
+
+	struct CompiledEquation ceq = {};
+	struct JitEquation jit = {};
+	double *points = (double*) calloc(num_points, sizeof(double));
+	double *out = (double*) calloc(num_points, sizeof(double));
+	const double **columns = (const double**) calloc(diff.num_vars + 1,
+													 sizeof(double*));
+	float *points_f = (float*) calloc(num_points, sizeof(float));
+	float *out_f = (float*) calloc(num_points, sizeof(float));
+	const float **columns_f = (const float**) calloc(diff.num_vars + 1,
+													 sizeof(float*));
+	enum EquationError eq_err = EQ_NO_ERR;
+	if (!points || !out || !columns || !points_f || !out_f || !columns_f) {
+		eq_err = EQ_NO_MEM_ERR;
+		goto finally;
+	}
+	for (size_t i = 0; i < num_points; i++)
+		points[i] = SWEEP_FROM + (SWEEP_TO - SWEEP_FROM) * (double) i /
+								 (double) num_points;
+	for (size_t i = 0; i < num_points; i++)
+		points_f[i] = (float) points[i];
+	for (size_t i = 0; i < diff.num_vars; i++) {
+		columns[i] = points;
+		columns_f[i] = points_f;
+	}
+
+	eq_err = compiled_eq_ctor(&ceq);
+	if (eq_err < 0)
+		goto finally;
+	eq_err = compiled_eq_from_equation(&ceq, diff);
+	if (eq_err < 0)
+		goto finally;
+
+	printf("Производная в %lu точках:\n", num_points);
+	for (size_t num_threads = 1; num_threads <= max_threads; num_threads++) {
+		struct ThreadPool pool = {};
+		if (thread_pool_ctor(&pool, num_threads) < 0) {
+			eq_err = EQ_NO_MEM_ERR;
+			goto finally;
+		}
+
+		struct timespec start = {};
+		struct timespec end = {};
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		enum EquationError sweep_err = compiled_eq_evaluate_parallel(&pool,
+												&ceq, columns, num_points, out);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		thread_pool_dtor(&pool);
+		if (sweep_err == EQ_NO_MEM_ERR) {
+			eq_err = sweep_err;
+			goto finally;
+		}
+
+		double secs = (double) (end.tv_sec - start.tv_sec) +
+					  (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+		printf("%lu потоков: %.3lf с, %.3le точек/с%s\n", num_threads, secs,
+			   (double) num_points / secs,
+			   sweep_err < 0 ? " (есть точки вне области определения)" : "");
+	}
+
+	eq_err = jit_eq_ctor(&jit);
+	if (eq_err < 0)
+		goto finally;
+	eq_err = jit_eq_from_equation(&jit, diff);
+	if (eq_err < 0)
+		goto finally;
+	{
+		struct timespec start = {};
+		struct timespec end = {};
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		enum EquationError sweep_err = jit_eq_evaluate_batch(&jit, columns,
+														num_points, out);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (sweep_err == EQ_NO_MEM_ERR) {
+			eq_err = sweep_err;
+			goto finally;
+		}
+
+		double secs = (double) (end.tv_sec - start.tv_sec) +
+					  (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+		printf("JIT%s, 1 поток: %.3lf с, %.3le точек/с%s\n",
+			   jit.batch_func ? "" : " (недоступен, байт-код)", secs,
+			   (double) num_points / secs,
+			   sweep_err < 0 ? " (есть точки вне области определения)" : "");
+	}
+	{
+		struct timespec start = {};
+		struct timespec end = {};
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		enum EquationError sweep_err = compiled_eq_evaluate_batch(&ceq,
+												columns_f, num_points, out_f);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (sweep_err == EQ_NO_MEM_ERR) {
+			eq_err = sweep_err;
+			goto finally;
+		}
+
+		// Deviation from double at the same (rounded to float) points
+		double max_diff = 0;
+		for (size_t i = 0; i < num_points; i++) {
+			if (isfinite(out[i]) && isfinite(out_f[i]))
+				max_diff = fmax(max_diff, fabs(out[i] - (double) out_f[i]) /
+										  (1 + fabs(out[i])));
+		}
+		double secs = (double) (end.tv_sec - start.tv_sec) +
+					  (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+		printf("float, 1 поток: %.3lf с, %.3le точек/с, отклонение от double"
+			   " %.3le%s\n", secs, (double) num_points / secs, max_diff,
+			   sweep_err < 0 ? " (есть точки вне области определения)" : "");
+	}
+
+	finally:
+		jit_eq_dtor(&jit);
+		compiled_eq_dtor(&ceq);
+		free(points);
+		free(out);
+		free(columns);
+		free(points_f);
+		free(out_f);
+		free(columns_f);
+		return eq_err;
+}
+
+enum EquationIOError write_c_kernel(struct Equation eq, const char *filename,
+									size_t num_points)
+{
+	size_t num_eqs = eq.num_vars + 1;
+	struct Equation *eqs = (struct Equation*) calloc(num_eqs,
+													 sizeof(struct Equation));
+	if (!eqs)
+		return EQIO_NO_MEM_ERR;
+	eqs[0] = eq;
+
+	enum EquationError eq_err = EQ_NO_ERR;
+	enum EquationIOError eqio_err = EQIO_NO_ERR;
+	FILE *out = NULL;
+	size_t num_made = 1;
+	for (; num_made < num_eqs && eq_err == EQ_NO_ERR; num_made++) {
+		eq_err = eq_ctor(eqs + num_made);
+		if (eq_err == EQ_NO_ERR)
+			eq_err = eq_differentiate(eq, num_made - 1, eqs + num_made);
+		if (eq_err == EQ_NO_ERR)
+			eq_err = eq_simplify(eqs + num_made);
+	}
+	if (eq_err < 0) {
+		eqio_err = EQIO_EQUATION_ERR;
+		goto finally;
+	}
+
+	out = fopen(filename, "w");
+	if (!out) {
+		log_message(ERROR, "Unable to open file %s\n", filename);
+		eqio_err = EQIO_UNKNOWN_ERR;
+		goto finally;
+	}
+	eqio_err = eq_print_c(eqs, num_eqs, EQ_C_KERNEL_NAME, out);
+	fclose(out);
+	if (eqio_err == EQIO_NO_ERR && num_points)
+		eqio_err = bench_c_kernel(eqs, num_eqs, num_points);
+
+	finally:
+		for (size_t i = 1; i < num_made; i++)
+			eq_dtor(eqs + i);
+		free(eqs);
+		return eqio_err;
+}
+
+enum EquationIOError bench_c_kernel(const struct Equation *eqs,
+									size_t num_eqs, size_t num_points)
+{
+	const double SWEEP_FROM = -4;
+	const double SWEEP_TO = 4;
+
+	size_t num_vars = eqs[0].num_vars;
+	struct EqCKernel kernel = {};
+	double *points = (double*) calloc(num_points, sizeof(double));
+	double *vals = (double*) calloc(num_vars + 1, sizeof(double));
+	double *expected = (double*) calloc(num_eqs * num_points, sizeof(double));
+	double *got = (double*) calloc(num_eqs * num_points, sizeof(double));
+	const double **columns = (const double**) calloc(num_vars + 1,
+													 sizeof(double*));
+	double **outs = (double**) calloc(num_eqs, sizeof(double*));
+	enum EquationIOError eqio_err = EQIO_NO_ERR;
+	struct timespec start = {};
+	struct timespec end = {};
+	double eval_secs = 0;
+	double build_secs = 0;
+	double kernel_secs = 0;
+	double max_diff = 0;
+	size_t num_domain_diffs = 0;
+	if (!points || !vals || !expected || !got || !columns || !outs) {
+		eqio_err = EQIO_NO_MEM_ERR;
+		goto finally;
+	}
+	for (size_t i = 0; i < num_points; i++)
+		points[i] = SWEEP_FROM + (SWEEP_TO - SWEEP_FROM) * (double) i /
+								 (double) num_points;
+	for (size_t v = 0; v < num_vars; v++)
+		columns[v] = points;
+	for (size_t k = 0; k < num_eqs; k++)
+		outs[k] = got + k * num_points;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num_points; i++) {
+		for (size_t v = 0; v < num_vars; v++)
+			vals[v] = points[i];
+		for (size_t k = 0; k < num_eqs; k++) {
+			double *res = expected + k * num_points + i;
+			if (eq_evaluate(eqs[k], vals, res) < 0)
+				*res = NAN;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	eval_secs = (double) (end.tv_sec - start.tv_sec) +
+				(double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	eqio_err = eq_c_kernel_build(&kernel, eqs, num_eqs);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (eqio_err < 0)
+		goto finally;
+	build_secs = (double) (end.tv_sec - start.tv_sec) +
+				 (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	(*kernel.func)(num_points, columns, outs);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	kernel_secs = (double) (end.tv_sec - start.tv_sec) +
+				  (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+	for (size_t i = 0; i < num_eqs * num_points; i++) {
+		if (isnan(expected[i]) != isnan(got[i]))
+			num_domain_diffs++;
+		if (isfinite(expected[i]) && isfinite(got[i]))
+			max_diff = fmax(max_diff, fabs(expected[i] - got[i]) /
+									  (1 + fabs(expected[i])));
+	}
+
+	printf("Функция и градиент в %lu точках:\n", num_points);
+	printf("eq_evaluate: %.3lf с, %.3le точек/с\n", eval_secs,
+		   (double) num_points / eval_secs);
+	printf("Сгенерированный C (сборка %.3lf с): %.3lf с, %.3le точек/с,"
+		   " относительное отклонение до %.3le, несовпадений области"
+		   " определения %lu\n", build_secs, kernel_secs,
+		   (double) num_points / kernel_secs, max_diff, num_domain_diffs);
+
+	finally:
+		eq_c_kernel_dtor(&kernel);
+		free(points);
+		free(vals);
+		free(expected);
+		free(got);
+		free(columns);
+		free(outs);
+		return eqio_err;
+}
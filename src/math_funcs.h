@@ -17,125 +17,266 @@ enum EquationError {
 };
 
 typedef struct Node 	  *(*op_diff)	   (const struct Node *equation,
-											size_t var, enum EquationError *err);
+											struct Node *diff_left,
+											struct Node *diff_right,
+											struct NodeArena *arena,
+											enum EquationError *err);
 typedef double 			   (*op_eval)	   (double l, double r,
 											enum EquationError *err);
-typedef enum EquationError (*op_simplify)  (struct Node *equation);
+/*
+ * Partials divide where the derivative made by op_diff divides, and fail
+ * there with the error its evaluation gives.
+ */
+typedef void			   (*op_partial)   (double l, double r, double res,
+											double *d_left, double *d_right,
+											enum EquationError *err);
+typedef void			   (*op_series)	   (const double *l, const double *r,
+											double *res, size_t n, double *tmp,
+											enum EquationError *err);
+typedef enum EquationError (*op_simplify)  (struct Node *equation,
+											struct NodeArena *arena);
 
-struct Node		 *math_diff_add	   (const struct Node *equation, size_t var,
-							 		enum EquationError *err);
+struct Node		 *math_diff_add	   (const struct Node *equation,
+							 		struct Node *diff_left, struct Node *diff_right,
+							 		struct NodeArena *arena, enum EquationError *err);
 double 		 	  math_eval_add	   (double l, double r,
 									enum EquationError *err);
-enum EquationError math_simplify_add(struct Node *equation);
+void			  math_partial_add (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			  math_series_add   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_add(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node 	 *math_diff_sub	   (const struct Node *equation, size_t var,
-							 		enum EquationError *err);
+struct Node 	 *math_diff_sub	   (const struct Node *equation,
+							 		struct Node *diff_left, struct Node *diff_right,
+							 		struct NodeArena *arena, enum EquationError *err);
 double		 	  math_eval_sub	   (double l, double r,
 									enum EquationError *errr);
-enum EquationError math_simplify_sub(struct Node *equation);
+void			  math_partial_sub (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			  math_series_sub   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_sub(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		 *math_diff_mult    (const struct Node *equation, size_t var,
-					 		 		 enum EquationError *err);
+struct Node		 *math_diff_mult    (const struct Node *equation,
+					 		 		 struct Node *diff_left, struct Node *diff_right,
+					 		 		 struct NodeArena *arena, enum EquationError *err);
 double			  math_eval_mult    (double l, double r,
 									 enum EquationError *err);
-enum EquationError math_simplify_mult(struct Node *equation);
+void			  math_partial_mult (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			  math_series_mult   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_mult(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		 *math_diff_div	   (const struct Node *equation, size_t var,
-							 		enum EquationError *err);
+struct Node		 *math_diff_div	   (const struct Node *equation,
+							 		struct Node *diff_left, struct Node *diff_right,
+							 		struct NodeArena *arena, enum EquationError *err);
 double 			  math_eval_div	   (double l, double r,
 									enum EquationError *err);
-enum EquationError math_simplify_div(struct Node *equation);
+void			  math_partial_div (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			  math_series_div   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_div(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		 *math_diff_pow	   (const struct Node *equation, size_t var,
-									enum EquationError *err);
+struct Node		 *math_diff_pow	   (const struct Node *equation,
+									struct Node *diff_left, struct Node *diff_right,
+									struct NodeArena *arena, enum EquationError *err);
 double			  math_eval_pow	   (double l, double r,
 									enum EquationError *err);
-enum EquationError math_simplify_pow(struct Node *equation);
-
-struct Node		  *math_diff_ln	    (const struct Node *equation, size_t var,
+void			  math_partial_pow (double l, double r, double res,
+									 double *d_left, double *d_right,
 									 enum EquationError *err);
-double			   math_eval_ln	    (double l, double r,
+void			  math_series_pow   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
 									 enum EquationError *err);
-enum EquationError math_simplify_ln (struct Node *equation);
+enum EquationError math_simplify_pow(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_cos    (const struct Node *equation, size_t var,
+struct Node		  *math_diff_ln	    (const struct Node *equation,
+									 struct Node *diff_left, struct Node *diff_right,
+									 struct NodeArena *arena, enum EquationError *err);
+double			   math_eval_ln	    (double l, double r,
 									 enum EquationError *err);
-double			   math_eval_cos    (double l, double r,
+void			   math_partial_ln (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_ln   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
 									 enum EquationError *err);
-enum EquationError math_simplify_cos(struct Node *equation);
+enum EquationError math_simplify_ln (struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_sin    (const struct Node *equation, size_t var,
+struct Node		  *math_diff_cos    (const struct Node *equation,
+									 struct Node *diff_left, struct Node *diff_right,
+									 struct NodeArena *arena, enum EquationError *err);
+double			   math_eval_cos    (double l, double r,
 									 enum EquationError *err);
-double			   math_eval_sin    (double l, double r,
+void			   math_partial_cos (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_cos   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
 									 enum EquationError *err);
-enum EquationError math_simplify_sin(struct Node *equation);
+enum EquationError math_simplify_cos(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_sqrt    (const struct Node *equation, size_t var,
+struct Node		  *math_diff_sin    (const struct Node *equation,
+									 struct Node *diff_left, struct Node *diff_right,
+									 struct NodeArena *arena, enum EquationError *err);
+double			   math_eval_sin    (double l, double r,
 									 enum EquationError *err);
-double			   math_eval_sqrt    (double l, double r,
+void			   math_partial_sin (double l, double r, double res,
+									 double *d_left, double *d_right,
 									 enum EquationError *err);
-enum EquationError math_simplify_sqrt(struct Node *equation);
+void			   math_series_sin   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_sin(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_tg    (const struct Node *equation, size_t var,
+struct Node		  *math_diff_sqrt    (const struct Node *equation,
+									 struct Node *diff_left, struct Node *diff_right,
+									 struct NodeArena *arena, enum EquationError *err);
+double			   math_eval_sqrt    (double l, double r,
 									 enum EquationError *err);
-double			   math_eval_tg    (double l, double r,
+void			   math_partial_sqrt (double l, double r, double res,
+									 double *d_left, double *d_right,
 									 enum EquationError *err);
-enum EquationError math_simplify_tg(struct Node *equation);
+void			   math_series_sqrt   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_sqrt(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_ctg    (const struct Node *equation, size_t var,
+struct Node		  *math_diff_tg    (const struct Node *equation,
+									 struct Node *diff_left, struct Node *diff_right,
+									 struct NodeArena *arena, enum EquationError *err);
+double			   math_eval_tg    (double l, double r,
+									 enum EquationError *err);
+void			   math_partial_tg (double l, double r, double res,
+									 double *d_left, double *d_right,
 									 enum EquationError *err);
+void			   math_series_tg   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_tg(struct Node *equation,
+										 struct NodeArena *arena);
+
+struct Node		  *math_diff_ctg    (const struct Node *equation,
+									 struct Node *diff_left, struct Node *diff_right,
+									 struct NodeArena *arena, enum EquationError *err);
 double			   math_eval_ctg    (double l, double r,
 									 enum EquationError *err);
-enum EquationError math_simplify_ctg(struct Node *equation);
+void			   math_partial_ctg (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_ctg   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_ctg(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_arcsin    (const struct Node *equation, size_t var,
-									 	enum EquationError *err);
+struct Node		  *math_diff_arcsin    (const struct Node *equation,
+									 	struct Node *diff_left, struct Node *diff_right,
+									 	struct NodeArena *arena, enum EquationError *err);
 double			   math_eval_arcsin    (double l, double r,
 									 	enum EquationError *err);
-enum EquationError math_simplify_arcsin(struct Node *equation);
+void			   math_partial_arcsin (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_arcsin   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_arcsin(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_arccos    (const struct Node *equation, size_t var,
-										enum EquationError *err);
+struct Node		  *math_diff_arccos    (const struct Node *equation,
+										struct Node *diff_left, struct Node *diff_right,
+										struct NodeArena *arena, enum EquationError *err);
 double			   math_eval_arccos    (double l, double r,
 									 	enum EquationError *err);
-enum EquationError math_simplify_arccos(struct Node *equation);
+void			   math_partial_arccos (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_arccos   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_arccos(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_arctg     (const struct Node *equation, size_t var,
-									 	enum EquationError *err);
+struct Node		  *math_diff_arctg     (const struct Node *equation,
+									 	struct Node *diff_left, struct Node *diff_right,
+									 	struct NodeArena *arena, enum EquationError *err);
 double			   math_eval_arctg    (double l, double r,
 									 	enum EquationError *err);
-enum EquationError math_simplify_arctg(struct Node *equation);
+void			   math_partial_arctg (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_arctg   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_arctg(struct Node *equation,
+										 struct NodeArena *arena);
 
-struct Node		  *math_diff_arcctg     (const struct Node *equation, size_t var,
-									 	enum EquationError *err);
+struct Node		  *math_diff_arcctg     (const struct Node *equation,
+									 	struct Node *diff_left, struct Node *diff_right,
+									 	struct NodeArena *arena, enum EquationError *err);
 double			   math_eval_arcctg    (double l, double r,
 									 	enum EquationError *err);
-enum EquationError math_simplify_arcctg(struct Node *equation);
+void			   math_partial_arcctg (double l, double r, double res,
+									 double *d_left, double *d_right,
+									 enum EquationError *err);
+void			   math_series_arcctg   (const double *l, const double *r,
+									 double *res, size_t n, double *tmp,
+									 enum EquationError *err);
+enum EquationError math_simplify_arcctg(struct Node *equation,
+										 struct NodeArena *arena);
 
+/*
+ * cost is about the evaluation time of an operator in nanoseconds, numbers
+ * and variables cost nothing.
+ */
 struct MathOpDefinition {
 	const char  *name;
 	int priority;
+	double cost;
 	op_diff 	diff;
 	op_eval 	eval;
+	op_partial	partial;
+	op_series	series;
 	op_simplify simplify;
 };
 	
 const struct MathOpDefinition MATH_OP_DEFS[] = { 
-	{ "+",      3, math_diff_add,    math_eval_add,      math_simplify_add    },
-	{ "*",      2, math_diff_mult,   math_eval_mult,     math_simplify_mult   },
-	{ "-",      3, math_diff_sub,    math_eval_sub,      math_simplify_sub    },
-	{ "/",      2, math_diff_div,    math_eval_div,      math_simplify_div    },
-	{ "^",	    1, math_diff_pow,    math_eval_pow,      math_simplify_pow    },
-	{ "ln",     1, math_diff_ln,     math_eval_ln,       math_simplify_ln     },
-	{ "sqrt",   2, math_diff_sqrt,   math_eval_sqrt,     math_simplify_sqrt   },
-	{ "cos",    1, math_diff_cos,    math_eval_cos,      math_simplify_cos    },
-	{ "sin",    1, math_diff_sin,    math_eval_sin,      math_simplify_sin    },
-	{ "tg",     1, math_diff_tg,     math_eval_tg,       math_simplify_tg     },
-	{ "ctg",    1, math_diff_ctg,    math_eval_ctg,      math_simplify_ctg    },
-	{ "arcsin", 1, math_diff_arcsin, math_eval_arcsin,   math_simplify_arcsin },
-	{ "arccos", 1, math_diff_arccos, math_eval_arccos,   math_simplify_arccos },
-	{ "arctg", 	1, math_diff_arctg,  math_eval_arctg,    math_simplify_arctg  },
-	{ "arcctg", 1, math_diff_arcctg, math_eval_arcctg,   math_simplify_arcctg },
+	{ "+",      3,  1, math_diff_add,    math_eval_add,      math_partial_add,     math_series_add,     math_simplify_add    },
+	{ "*",      2,  1, math_diff_mult,   math_eval_mult,     math_partial_mult,    math_series_mult,    math_simplify_mult   },
+	{ "-",      3,  1, math_diff_sub,    math_eval_sub,      math_partial_sub,     math_series_sub,     math_simplify_sub    },
+	{ "/",      2,  4, math_diff_div,    math_eval_div,      math_partial_div,     math_series_div,     math_simplify_div    },
+	{ "^",	    1, 24, math_diff_pow,    math_eval_pow,      math_partial_pow,     math_series_pow,     math_simplify_pow    },
+	{ "ln",     1,  9, math_diff_ln,     math_eval_ln,       math_partial_ln,      math_series_ln,      math_simplify_ln     },
+	{ "sqrt",   2,  3, math_diff_sqrt,   math_eval_sqrt,     math_partial_sqrt,    math_series_sqrt,    math_simplify_sqrt   },
+	{ "cos",    1, 11, math_diff_cos,    math_eval_cos,      math_partial_cos,     math_series_cos,     math_simplify_cos    },
+	{ "sin",    1, 11, math_diff_sin,    math_eval_sin,      math_partial_sin,     math_series_sin,     math_simplify_sin    },
+	{ "tg",     1, 13, math_diff_tg,     math_eval_tg,       math_partial_tg,      math_series_tg,      math_simplify_tg     },
+	{ "ctg",    1, 15, math_diff_ctg,    math_eval_ctg,      math_partial_ctg,     math_series_ctg,     math_simplify_ctg    },
+	{ "arcsin", 1, 11, math_diff_arcsin, math_eval_arcsin,   math_partial_arcsin,  math_series_arcsin,  math_simplify_arcsin },
+	{ "arccos", 1, 11, math_diff_arccos, math_eval_arccos,   math_partial_arccos,  math_series_arccos,  math_simplify_arccos },
+	{ "arctg", 	1, 11, math_diff_arctg,  math_eval_arctg,    math_partial_arctg,   math_series_arctg,   math_simplify_arctg  },
+	{ "arcctg", 1, 11, math_diff_arcctg, math_eval_arcctg,   math_partial_arcctg,  math_series_arcctg,  math_simplify_arcctg },
 };
 const size_t MATH_OP_DEFS_SIZE = sizeof(MATH_OP_DEFS) / 
 								 sizeof(MATH_OP_DEFS[0]);
@@ -0,0 +1,1034 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "polynomial.h"
+#include "equation_manipulation.h"
+
+/*
+ * What a subtree is as a polynomial: a subtree that is not one keeps only
+ * its size, so that its polynomial operands can still be rewritten.
+ */
+struct PolyFrame {
+	struct Polynomial poly;
+	size_t tree_size;
+	bool is_poly;
+};
+
+/*
+ * A walk that takes the largest polynomial subtrees either rewrites them
+ * (found is NULL) or collects them into found.
+ */
+struct PolyWalk {
+	struct PolyFrame *frames;
+	size_t size;
+	size_t cap;
+
+	uint32_t *exps;
+	size_t num_vars;
+	struct NodeArena *arena;
+	bool is_taking;
+	struct PolySubtrees *found;
+	// Operators of a sharing arena that are already walked
+	struct NodeMap seen;
+};
+
+static size_t poly_hash(const uint32_t *exps, size_t num_vars);
+static uint32_t *poly_table_find(const struct Polynomial *poly,
+								 const uint32_t *exps);
+static enum EquationError poly_grow(struct Polynomial *poly);
+static size_t poly_sort_terms(const struct Polynomial *poly, uint32_t *order,
+							  uint32_t *tmp);
+static bool poly_term_less(const struct Polynomial *poly, uint32_t a,
+						   uint32_t b);
+static struct Node *poly_term_to_tree(const struct Polynomial *poly,
+									  uint32_t ind, double coef,
+									  struct NodeArena *arena,
+									  enum EquationError *err);
+static size_t poly_term_tree_size(const struct Polynomial *poly,
+								  uint32_t ind, double coef);
+static double poly_max_terms(const struct Polynomial *a, uint32_t n);
+
+static enum EquationError subeq_polynomial(struct Node **root,
+										   struct PolyWalk *pw);
+static enum EquationError poly_walk_push(struct PolyWalk *pw,
+										 struct PolyFrame **frame);
+static enum EquationError poly_walk_visit(struct PolyWalk *pw,
+										  struct Node *node);
+static enum EquationError poly_combine(enum MathOp op, struct PolyFrame *left,
+									   struct PolyFrame *right,
+									   const uint32_t *zero_exps,
+									   struct Polynomial *res, bool *is_poly);
+static enum EquationError poly_take(struct PolyWalk *pw, struct Node *node,
+									struct Node **child,
+									struct PolyFrame *frame);
+static enum EquationError poly_subtrees_add(struct PolySubtrees *subtrees,
+											const struct Node *root,
+											struct Polynomial *poly);
+static void poly_walk_dtor(struct PolyWalk *pw);
+static bool is_integer(double a);
+static bool is_zero(double a);
+static bool is_equal(double a, double b);
+
+enum EquationError poly_ctor(struct Polynomial *poly, size_t num_vars)
+{
+	assert(poly);
+
+	poly->exps = (uint32_t*) calloc(POLY_INIT_CAPACITY * num_vars + 1,
+									sizeof(uint32_t));
+	poly->coefs = (double*) calloc(POLY_INIT_CAPACITY, sizeof(double));
+	poly->table = (uint32_t*) malloc(2 * POLY_INIT_CAPACITY *
+									 sizeof(uint32_t));
+	poly->size = 0;
+	poly->cap = POLY_INIT_CAPACITY;
+	poly->num_vars = num_vars;
+	poly->table_cap = 2 * POLY_INIT_CAPACITY;
+	if (!poly->exps || !poly->coefs || !poly->table) {
+		poly_dtor(poly);
+		return EQ_NO_MEM_ERR;
+	}
+	memset(poly->table, 0xff, poly->table_cap * sizeof(uint32_t));
+	return EQ_NO_ERR;
+}
+
+void poly_dtor(struct Polynomial *poly)
+{
+	assert(poly);
+
+	free(poly->exps);
+	free(poly->coefs);
+	free(poly->table);
+	poly->exps = NULL;
+	poly->coefs = NULL;
+	poly->table = NULL;
+	poly->size = 0;
+	poly->cap = 0;
+	poly->table_cap = 0;
+}
+
+void poly_clear(struct Polynomial *poly)
+{
+	assert(poly);
+
+	poly->size = 0;
+	memset(poly->table, 0xff, poly->table_cap * sizeof(uint32_t));
+}
+
+static size_t poly_hash(const uint32_t *exps, size_t num_vars)
+{
+	size_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < num_vars; i++)
+		hash = (hash ^ exps[i]) * 0x100000001b3;
+	return hash ^ (hash >> 29);
+}
+
+// The slot of the term with these exponents or the empty slot for it
+static uint32_t *poly_table_find(const struct Polynomial *poly,
+								 const uint32_t *exps)
+{
+	assert(poly);
+	assert(exps);
+
+	size_t mask = poly->table_cap - 1;
+	size_t i = poly_hash(exps, poly->num_vars) & mask;
+	while (poly->table[i] != POLY_NONE &&
+		   memcmp(poly->exps + poly->table[i] * poly->num_vars, exps,
+				  poly->num_vars * sizeof(uint32_t)) != 0)
+		i = (i + 1) & mask;
+	return poly->table + i;
+}
+
+static enum EquationError poly_grow(struct Polynomial *poly)
+{
+	assert(poly);
+
+	size_t cap = 2 * poly->cap;
+	uint32_t *exps = (uint32_t*) realloc(poly->exps,
+							(cap * poly->num_vars + 1) * sizeof(uint32_t));
+	if (!exps)
+		return EQ_NO_MEM_ERR;
+	poly->exps = exps;
+	double *coefs = (double*) realloc(poly->coefs, cap * sizeof(double));
+	if (!coefs)
+		return EQ_NO_MEM_ERR;
+	poly->coefs = coefs;
+	uint32_t *table = (uint32_t*) realloc(poly->table,
+										  2 * cap * sizeof(uint32_t));
+	if (!table)
+		return EQ_NO_MEM_ERR;
+	poly->table = table;
+	poly->cap = cap;
+	poly->table_cap = 2 * cap;
+
+	memset(poly->table, 0xff, poly->table_cap * sizeof(uint32_t));
+	for (uint32_t i = 0; i < poly->size; i++)
+		*poly_table_find(poly, poly->exps + i * poly->num_vars) = i;
+	return EQ_NO_ERR;
+}
+
+enum EquationError poly_add_term(struct Polynomial *poly, const uint32_t *exps,
+								 double coef)
+{
+	assert(poly);
+	assert(exps);
+
+	uint32_t *slot = poly_table_find(poly, exps);
+	if (*slot != POLY_NONE) {
+		poly->coefs[*slot] += coef;
+		return EQ_NO_ERR;
+	}
+
+	if (poly->size >= POLY_NONE - 1)
+		return EQ_NO_MEM_ERR;
+	if (poly->size >= poly->cap) {
+		enum EquationError err = poly_grow(poly);
+		if (err < 0)
+			return err;
+		slot = poly_table_find(poly, exps);
+	}
+	*slot = (uint32_t) poly->size;
+	memcpy(poly->exps + poly->size * poly->num_vars, exps,
+		   poly->num_vars * sizeof(uint32_t));
+	poly->coefs[poly->size++] = coef;
+	return EQ_NO_ERR;
+}
+
+enum EquationError poly_add(struct Polynomial *poly,
+							const struct Polynomial *a, double factor)
+{
+	assert(poly);
+	assert(a);
+	assert(poly != a);
+	assert(poly->num_vars == a->num_vars);
+
+	for (size_t i = 0; i < a->size; i++) {
+		enum EquationError err = poly_add_term(poly,
+									a->exps + i * a->num_vars,
+									factor * a->coefs[i]);
+		if (err < 0)
+			return err;
+	}
+	return EQ_NO_ERR;
+}
+
+void poly_scale(struct Polynomial *poly, double factor)
+{
+	assert(poly);
+
+	for (size_t i = 0; i < poly->size; i++)
+		poly->coefs[i] *= factor;
+}
+
+enum EquationError poly_mult(struct Polynomial *res,
+							 const struct Polynomial *a,
+							 const struct Polynomial *b)
+{
+	assert(res);
+	assert(a);
+	assert(b);
+	assert(res != a && res != b);
+	assert(a->num_vars == b->num_vars && res->num_vars == a->num_vars);
+
+	size_t num_vars = a->num_vars;
+	uint32_t *exps = (uint32_t*) calloc(num_vars + 1, sizeof(uint32_t));
+	if (!exps)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = EQ_NO_ERR;
+	poly_clear(res);
+	for (size_t i = 0; i < a->size && err == EQ_NO_ERR; i++) {
+		if (is_zero(a->coefs[i]))
+			continue;
+		for (size_t j = 0; j < b->size && err == EQ_NO_ERR; j++) {
+			if (is_zero(b->coefs[j]))
+				continue;
+			for (size_t k = 0; k < num_vars; k++)
+				exps[k] = a->exps[i * num_vars + k] +
+						  b->exps[j * num_vars + k];
+			err = poly_add_term(res, exps, a->coefs[i] * b->coefs[j]);
+		}
+	}
+
+	free(exps);
+	return err;
+}
+
+// Squaring and multiplying by the bits of n from the highest one
+enum EquationError poly_pow(struct Polynomial *res,
+							const struct Polynomial *a, uint32_t n)
+{
+	assert(res);
+	assert(a);
+	assert(res != a);
+
+	struct Polynomial tmp = {};
+	enum EquationError err = poly_ctor(&tmp, a->num_vars);
+	if (err < 0)
+		return err;
+
+	poly_clear(res);
+	err = poly_add_term(res, tmp.exps, 1);
+
+	uint32_t bit = 1;
+	while (bit <= n / 2)
+		bit *= 2;
+	for (; n > 0 && bit > 0 && err == EQ_NO_ERR; bit /= 2) {
+		err = poly_mult(&tmp, res, res);
+		poly_swap(res, &tmp);
+		if (err == EQ_NO_ERR && (n & bit)) {
+			err = poly_mult(&tmp, res, a);
+			poly_swap(res, &tmp);
+		}
+	}
+
+	poly_dtor(&tmp);
+	return err;
+}
+
+enum EquationError poly_differentiate(struct Polynomial *res,
+									  const struct Polynomial *a,
+									  size_t diff_var_ind)
+{
+	assert(res);
+	assert(a);
+	assert(res != a);
+	assert(res->num_vars == a->num_vars);
+
+	size_t num_vars = a->num_vars;
+	uint32_t *exps = (uint32_t*) calloc(num_vars + 1, sizeof(uint32_t));
+	if (!exps)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = EQ_NO_ERR;
+	poly_clear(res);
+	for (size_t i = 0; i < a->size && err == EQ_NO_ERR; i++) {
+		const uint32_t *term = a->exps + i * num_vars;
+		if (diff_var_ind >= num_vars || term[diff_var_ind] == 0)
+			continue;
+		memcpy(exps, term, num_vars * sizeof(uint32_t));
+		exps[diff_var_ind]--;
+		err = poly_add_term(res, exps,
+							a->coefs[i] * (double) term[diff_var_ind]);
+	}
+
+	free(exps);
+	return err;
+}
+
+void poly_swap(struct Polynomial *a, struct Polynomial *b)
+{
+	assert(a);
+	assert(b);
+
+	struct Polynomial tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+uint32_t poly_degree(const struct Polynomial *poly)
+{
+	assert(poly);
+
+	uint32_t degree = 0;
+	for (size_t i = 0; i < poly->size; i++) {
+		if (is_zero(poly->coefs[i]))
+			continue;
+		uint32_t term_degree = 0;
+		for (size_t k = 0; k < poly->num_vars; k++)
+			term_degree += poly->exps[i * poly->num_vars + k];
+		if (term_degree > degree)
+			degree = term_degree;
+	}
+	return degree;
+}
+
+bool poly_is_const(const struct Polynomial *poly, double *val)
+{
+	assert(poly);
+
+	double constant = 0;
+	for (size_t i = 0; i < poly->size; i++) {
+		bool is_const_term = true;
+		for (size_t k = 0; k < poly->num_vars; k++)
+			is_const_term &= poly->exps[i * poly->num_vars + k] == 0;
+		if (is_const_term)
+			constant += poly->coefs[i];
+		else if (!is_zero(poly->coefs[i]))
+			return false;
+	}
+	if (val)
+		*val = constant;
+	return true;
+}
+
+/*
+ * A bound on the number of terms of a^n: the number of multisets of n terms
+ * of a and the number of monomials of the variables of a up to the degree.
+ */
+static double poly_max_terms(const struct Polynomial *a, uint32_t n)
+{
+	assert(a);
+
+	size_t num_terms = 0;
+	size_t num_used_vars = 0;
+	for (size_t i = 0; i < a->size; i++)
+		num_terms += !is_zero(a->coefs[i]);
+	for (size_t k = 0; k < a->num_vars; k++) {
+		bool is_used = false;
+		for (size_t i = 0; i < a->size && !is_used; i++)
+			is_used = a->exps[i * a->num_vars + k] > 0 &&
+					  !is_zero(a->coefs[i]);
+		num_used_vars += is_used;
+	}
+
+	double by_terms = 1;
+	for (uint32_t i = 1; i <= n && num_terms > 0; i++)
+		by_terms = by_terms * (double) (num_terms - 1 + i) / (double) i;
+	double degree = (double) poly_degree(a) * (double) n;
+	double by_degree = 1;
+	for (size_t i = 1; i <= num_used_vars; i++)
+		by_degree = by_degree * (degree + (double) i) / (double) i;
+	return by_terms < by_degree ? by_terms : by_degree;
+}
+
+enum EquationError poly_to_tree(const struct Polynomial *poly,
+								struct NodeArena *arena, struct Node **tree)
+{
+	assert(poly);
+	assert(tree);
+
+	uint32_t *order = (uint32_t*) calloc(2 * poly->size + 1,
+										 sizeof(uint32_t));
+	if (!order)
+		return EQ_NO_MEM_ERR;
+	size_t num_terms = poly_sort_terms(poly, order, order + poly->size);
+
+	enum EquationError eq_err = EQ_NO_ERR;
+	enum EquationError *err = &eq_err;
+	struct Node *res = num_terms == 0 ? new_num(0) : NULL;
+	for (size_t i = 0; i < num_terms && eq_err == EQ_NO_ERR; i++) {
+		double coef = poly->coefs[order[i]];
+		bool is_neg = i > 0 && coef < 0;
+		struct Node *term = poly_term_to_tree(poly, order[i],
+											  is_neg ? -coef : coef,
+											  arena, err);
+		if (i == 0)
+			res = term;
+		else
+			res = new_op(is_neg ? MATH_SUB : MATH_ADD, res, term);
+	}
+	free(order);
+
+	if (eq_err < 0) {
+		node_op_delete(arena, res);
+		return eq_err;
+	}
+	*tree = res;
+	return EQ_NO_ERR;
+}
+
+size_t poly_tree_size(const struct Polynomial *poly)
+{
+	assert(poly);
+
+	size_t size = 0;
+	size_t num_terms = 0;
+	for (uint32_t i = 0; i < poly->size; i++) {
+		if (is_equal(poly->coefs[i], 0))
+			continue;
+		size += poly_term_tree_size(poly, i, num_terms == 0 ?
+									poly->coefs[i] : fabs(poly->coefs[i]));
+		num_terms++;
+	}
+	return num_terms == 0 ? 1 : size + num_terms - 1;
+}
+
+static struct Node *poly_term_to_tree(const struct Polynomial *poly,
+									  uint32_t ind, double coef,
+									  struct NodeArena *arena,
+									  enum EquationError *err)
+{
+	assert(poly);
+	assert(err);
+
+	struct Node *monomial = NULL;
+	for (size_t k = 0; k < poly->num_vars; k++) {
+		uint32_t exp = poly->exps[ind * poly->num_vars + k];
+		if (exp == 0)
+			continue;
+		struct Node *factor = new_var(k);
+		if (exp > 1)
+			factor = new_op(MATH_POW, factor, new_num((double) exp));
+		monomial = monomial ? new_op(MATH_MULT, monomial, factor) : factor;
+	}
+
+	if (!monomial)
+		return new_num(coef);
+	if (is_equal(coef, 1))
+		return monomial;
+	return new_op(MATH_MULT, new_num(coef), monomial);
+}
+
+static size_t poly_term_tree_size(const struct Polynomial *poly,
+								  uint32_t ind, double coef)
+{
+	assert(poly);
+
+	size_t size = 0;
+	size_t num_factors = 0;
+	for (size_t k = 0; k < poly->num_vars; k++) {
+		uint32_t exp = poly->exps[ind * poly->num_vars + k];
+		if (exp == 0)
+			continue;
+		size += exp > 1 ? 3 : 1;
+		num_factors++;
+	}
+
+	if (num_factors == 0)
+		return 1;
+	size += num_factors - 1;
+	return is_equal(coef, 1) ? size : size + 2;
+}
+
+/*
+ * Puts the indices of the non-zero terms into order by descending degree,
+ * terms of one degree by descending exponents of the first variables.
+ * Bottom-up merge sort, tmp is the buffer.
+ */
+static size_t poly_sort_terms(const struct Polynomial *poly, uint32_t *order,
+							  uint32_t *tmp)
+{
+	assert(poly);
+	assert(order);
+	assert(tmp);
+
+	size_t size = 0;
+	for (uint32_t i = 0; i < poly->size; i++)
+		if (!is_equal(poly->coefs[i], 0))
+			order[size++] = i;
+
+	uint32_t *src = order;
+	uint32_t *dst = tmp;
+	for (size_t width = 1; width < size; width *= 2) {
+		for (size_t lo = 0; lo < size; lo += 2 * width) {
+			size_t mid = lo + width < size ? lo + width : size;
+			size_t hi = lo + 2 * width < size ? lo + 2 * width : size;
+			size_t i = lo;
+			size_t j = mid;
+			size_t k = lo;
+			while (i < mid && j < hi) {
+				if (poly_term_less(poly, src[i], src[j]))
+					dst[k++] = src[j++];
+				else
+					dst[k++] = src[i++];
+			}
+			while (i < mid)
+				dst[k++] = src[i++];
+			while (j < hi)
+				dst[k++] = src[j++];
+		}
+		uint32_t *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != order)
+		memcpy(order, src, size * sizeof(uint32_t));
+	return size;
+}
+
+static bool poly_term_less(const struct Polynomial *poly, uint32_t a,
+						   uint32_t b)
+{
+	assert(poly);
+
+	const uint32_t *exps_a = poly->exps + a * poly->num_vars;
+	const uint32_t *exps_b = poly->exps + b * poly->num_vars;
+	uint32_t degree_a = 0;
+	uint32_t degree_b = 0;
+	for (size_t k = 0; k < poly->num_vars; k++) {
+		degree_a += exps_a[k];
+		degree_b += exps_b[k];
+	}
+	if (degree_a != degree_b)
+		return degree_a < degree_b;
+	for (size_t k = 0; k < poly->num_vars; k++)
+		if (exps_a[k] != exps_b[k])
+			return exps_a[k] < exps_b[k];
+	return false;
+}
+
+enum EquationError poly_from_tree(struct Polynomial *poly, struct Node *tree,
+								  bool *is_poly)
+{
+	assert(poly);
+	assert(tree);
+	assert(is_poly);
+
+	struct PolyWalk pw = {};
+	pw.num_vars = poly->num_vars;
+	pw.exps = (uint32_t*) calloc(pw.num_vars + 1, sizeof(uint32_t));
+	if (!pw.exps)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = subeq_polynomial(&tree, &pw);
+	*is_poly = err == EQ_NO_ERR && pw.size == 1 && pw.frames[0].is_poly;
+	if (*is_poly)
+		poly_swap(poly, &pw.frames[0].poly);
+	poly_walk_dtor(&pw);
+	return err;
+}
+
+enum EquationError eq_simplify_polynomials(struct Equation *eq)
+{
+	assert(eq);
+
+	if (!eq->tree)
+		return EQ_NO_ERR;
+
+	struct PolyWalk pw = {};
+	pw.num_vars = eq->num_vars;
+	pw.arena = eq->arena;
+	pw.is_taking = true;
+	pw.exps = (uint32_t*) calloc(pw.num_vars + 1, sizeof(uint32_t));
+	if (!pw.exps)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = EQ_NO_ERR;
+	if (eq->arena && eq->arena->is_shared && node_map_ctor(&pw.seen) < 0)
+		err = EQ_NO_MEM_ERR;
+	if (err == EQ_NO_ERR)
+		err = subeq_polynomial(&eq->tree, &pw);
+	poly_walk_dtor(&pw);
+	return err;
+}
+
+enum EquationError eq_differentiate_polynomial(struct Equation eq,
+											   size_t diff_var_ind,
+											   struct Equation *diff,
+											   bool *is_poly)
+{
+	assert(diff);
+	assert(is_poly);
+
+	*is_poly = false;
+	if (!eq.tree)
+		return EQ_NO_ERR;
+
+	struct Polynomial poly = {};
+	struct Polynomial poly_diff = {};
+	size_t tree_size = 0;
+	enum EquationError err = poly_ctor(&poly, eq.num_vars);
+	if (err == EQ_NO_ERR)
+		err = poly_ctor(&poly_diff, eq.num_vars);
+	if (err == EQ_NO_ERR)
+		err = poly_from_tree(&poly, eq.tree, is_poly);
+	if (err == EQ_NO_ERR && *is_poly)
+		err = eq_count_nodes(eq, &tree_size);
+	if (err == EQ_NO_ERR && *is_poly && poly_tree_size(&poly) <= tree_size)
+		err = poly_differentiate(&poly_diff, &poly, diff_var_ind);
+	else
+		*is_poly = false;
+	if (err == EQ_NO_ERR && *is_poly)
+		err = poly_to_tree(&poly_diff, diff->arena, &diff->tree);
+
+	poly_dtor(&poly);
+	poly_dtor(&poly_diff);
+	return err;
+}
+
+enum EquationError eq_find_polynomials(struct Equation eq,
+									   struct PolySubtrees *found)
+{
+	assert(found);
+
+	if (!eq.tree)
+		return EQ_NO_ERR;
+
+	struct PolyWalk pw = {};
+	pw.num_vars = eq.num_vars;
+	pw.arena = eq.arena;
+	pw.is_taking = true;
+	pw.found = found;
+	pw.exps = (uint32_t*) calloc(pw.num_vars + 1, sizeof(uint32_t));
+	if (!pw.exps)
+		return EQ_NO_MEM_ERR;
+
+	enum EquationError err = EQ_NO_ERR;
+	if (eq.arena && eq.arena->is_shared && node_map_ctor(&pw.seen) < 0)
+		err = EQ_NO_MEM_ERR;
+	if (err == EQ_NO_ERR)
+		err = subeq_polynomial(&eq.tree, &pw);
+	poly_walk_dtor(&pw);
+	return err;
+}
+
+enum EquationError poly_subtrees_ctor(struct PolySubtrees *subtrees)
+{
+	assert(subtrees);
+
+	subtrees->polys = NULL;
+	subtrees->size = 0;
+	subtrees->cap = 0;
+	if (node_map_ctor(&subtrees->roots) < 0)
+		return EQ_NO_MEM_ERR;
+	return EQ_NO_ERR;
+}
+
+void poly_subtrees_dtor(struct PolySubtrees *subtrees)
+{
+	assert(subtrees);
+
+	for (size_t i = 0; i < subtrees->size; i++)
+		poly_dtor(&subtrees->polys[i]);
+	free(subtrees->polys);
+	node_map_dtor(&subtrees->roots);
+	subtrees->polys = NULL;
+	subtrees->size = 0;
+	subtrees->cap = 0;
+}
+
+// Moves poly out, leaving it empty
+static enum EquationError poly_subtrees_add(struct PolySubtrees *subtrees,
+											const struct Node *root,
+											struct Polynomial *poly)
+{
+	assert(subtrees);
+	assert(root);
+	assert(poly);
+
+	if (subtrees->size >= subtrees->cap) {
+		size_t cap = subtrees->cap ? 2 * subtrees->cap : POLY_INIT_CAPACITY;
+		struct Polynomial *tmp = (struct Polynomial*) realloc(subtrees->polys,
+										cap * sizeof(struct Polynomial));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		subtrees->polys = tmp;
+		subtrees->cap = cap;
+	}
+
+	union NodeMapValue ind = {};
+	ind.ind = subtrees->size;
+	if (node_map_insert(&subtrees->roots, root, ind) < 0)
+		return EQ_NO_MEM_ERR;
+	subtrees->polys[subtrees->size] = {};
+	poly_swap(&subtrees->polys[subtrees->size++], poly);
+	return EQ_NO_ERR;
+}
+
+/*
+ * Every node gets a frame in post order, made of the frames of its operands.
+ * A polynomial operand of a node that is not a polynomial is the root of a
+ * largest polynomial subtree, so that is where the rewriting walk rewrites.
+ * In a sharing arena a node met again is taken for a non-polynomial leaf:
+ * it has been rewritten (or left as it is) at the first meeting.
+ */
+static enum EquationError subeq_polynomial(struct Node **root,
+										   struct PolyWalk *pw)
+{
+	assert(root);
+	assert(pw);
+
+	bool is_shared = pw->arena && pw->arena->is_shared;
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	if (tree_walk_start(&walk, *root) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		if (frame.step == NODE_VISIT_PRE && is_shared &&
+			type(frame.node) == MATH_OP) {
+			struct PolyFrame *seen = NULL;
+			if (!node_map_find(&pw->seen, frame.node)) {
+				if (node_map_insert(&pw->seen, frame.node, {}) < 0)
+					err = EQ_NO_MEM_ERR;
+			} else if ((err = poly_walk_push(pw, &seen)) == EQ_NO_ERR) {
+				tree_walk_skip(&walk, frame.node);
+				seen->tree_size = 1;
+			}
+		} else if (frame.step == NODE_VISIT_POST) {
+			err = poly_walk_visit(pw, frame.node);
+		}
+	}
+	node_stack_dtor(&walk);
+	if (err < 0)
+		return err;
+
+	assert(pw->size == 1);
+	struct PolyFrame *top = pw->frames;
+	if (pw->is_taking && top->is_poly)
+		err = poly_take(pw, NULL, root, top);
+	return err;
+}
+
+static enum EquationError poly_walk_push(struct PolyWalk *pw,
+										 struct PolyFrame **frame)
+{
+	assert(pw);
+	assert(frame);
+
+	if (pw->size >= pw->cap) {
+		size_t cap = pw->cap ? 2 * pw->cap : NODE_STACK_INIT_CAPACITY;
+		struct PolyFrame *tmp = (struct PolyFrame*) realloc(pw->frames,
+										cap * sizeof(struct PolyFrame));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		pw->frames = tmp;
+		pw->cap = cap;
+	}
+	*frame = pw->frames + pw->size++;
+	**frame = {};
+	return EQ_NO_ERR;
+}
+
+static enum EquationError poly_walk_visit(struct PolyWalk *pw,
+										  struct Node *node)
+{
+	assert(pw);
+	assert(node);
+
+	struct PolyFrame *frame = NULL;
+	enum EquationError err = EQ_NO_ERR;
+	switch (type(node)) {
+		case MATH_NUM:
+			err = poly_walk_push(pw, &frame);
+			if (err == EQ_NO_ERR)
+				err = poly_ctor(&frame->poly, pw->num_vars);
+			if (err == EQ_NO_ERR)
+				err = poly_add_term(&frame->poly, pw->exps, num(node));
+			if (err == EQ_NO_ERR) {
+				frame->tree_size = 1;
+				frame->is_poly = true;
+			}
+			return err;
+		case MATH_VAR:
+			err = poly_walk_push(pw, &frame);
+			if (err < 0)
+				return err;
+			frame->tree_size = 1;
+			if (var(node) >= pw->num_vars)
+				return EQ_NO_ERR;
+			err = poly_ctor(&frame->poly, pw->num_vars);
+			pw->exps[var(node)] = 1;
+			if (err == EQ_NO_ERR)
+				err = poly_add_term(&frame->poly, pw->exps, 1);
+			pw->exps[var(node)] = 0;
+			frame->is_poly = err == EQ_NO_ERR;
+			return err;
+		case MATH_OP:
+			break;
+		default:
+			return EQ_TREE_ERR;
+	}
+
+	size_t num_operands = (size_t) (node->left != NULL) +
+						  (size_t) (node->right != NULL);
+	assert(pw->size >= num_operands);
+	struct PolyFrame *operands = pw->frames + pw->size - num_operands;
+	struct PolyFrame *left = node->left ? operands : NULL;
+	struct PolyFrame *right = node->right ? operands + num_operands - 1 :
+											NULL;
+
+	struct Polynomial res = {};
+	bool is_poly = (!left || left->is_poly) && (!right || right->is_poly);
+	size_t tree_size = 1 + (left ? left->tree_size : 0) +
+					   (right ? right->tree_size : 0);
+	if (is_poly)
+		err = poly_combine(op(node), left, right, pw->exps, &res, &is_poly);
+
+	if (err == EQ_NO_ERR && !is_poly && pw->is_taking) {
+		if (left && left->is_poly)
+			err = poly_take(pw, node, &node->left, left);
+		if (err == EQ_NO_ERR && right && right->is_poly)
+			err = poly_take(pw, node, &node->right, right);
+	}
+
+	for (size_t i = 0; i < num_operands; i++)
+		poly_dtor(&operands[i].poly);
+	pw->size -= num_operands;
+	if (err == EQ_NO_ERR)
+		err = poly_walk_push(pw, &frame);
+	if (err < 0) {
+		poly_dtor(&res);
+		return err;
+	}
+	frame->poly = res;
+	frame->tree_size = tree_size;
+	frame->is_poly = is_poly;
+	return EQ_NO_ERR;
+}
+
+/*
+ * Takes the polynomials of the operands: the result is made in the place of
+ * the larger one where it can be. *is_poly is false if the operator does
+ * not keep the polynomial a polynomial or makes it too large.
+ */
+static enum EquationError poly_combine(enum MathOp op, struct PolyFrame *left,
+									   struct PolyFrame *right,
+									   const uint32_t *zero_exps,
+									   struct Polynomial *res, bool *is_poly)
+{
+	assert(right);
+	assert(zero_exps);
+	assert(res);
+	assert(is_poly);
+
+	*is_poly = false;
+	double left_val = NAN;
+	double right_val = NAN;
+	bool is_left_const = !left || poly_is_const(&left->poly, &left_val);
+	bool is_right_const = poly_is_const(&right->poly, &right_val);
+
+	if (is_left_const && is_right_const) {
+		enum EquationError eval_err = EQ_NO_ERR;
+		double val = (*MATH_OP_DEFS[op].eval)(left_val, right_val, &eval_err);
+		if (eval_err < 0 || !isfinite(val))
+			return EQ_NO_ERR;
+		poly_swap(res, &right->poly);
+		poly_clear(res);
+		*is_poly = true;
+		return poly_add_term(res, zero_exps, val);
+	}
+	if (!left)
+		return EQ_NO_ERR;
+
+	struct PolyFrame *big = left->poly.size >= right->poly.size ? left :
+																 right;
+	struct PolyFrame *small = big == left ? right : left;
+	enum EquationError err = EQ_NO_ERR;
+	switch (op) {
+		case MATH_ADD:
+			poly_swap(res, &big->poly);
+			err = poly_add(res, &small->poly, 1);
+			break;
+		case MATH_SUB:
+			poly_swap(res, &big->poly);
+			if (big == right)
+				poly_scale(res, -1);
+			err = poly_add(res, &small->poly, big == right ? 1 : -1);
+			break;
+		case MATH_MULT:
+			if (is_left_const || is_right_const) {
+				poly_swap(res, is_left_const ? &right->poly : &left->poly);
+				poly_scale(res, is_left_const ? left_val : right_val);
+				break;
+			}
+			if ((double) left->poly.size * (double) right->poly.size >
+				(double) POLY_MAX_TERMS ||
+				poly_degree(&left->poly) + poly_degree(&right->poly) >
+				POLY_MAX_DEGREE)
+				return EQ_NO_ERR;
+			err = poly_ctor(res, left->poly.num_vars);
+			if (err == EQ_NO_ERR)
+				err = poly_mult(res, &left->poly, &right->poly);
+			break;
+		case MATH_DIV:
+			if (!is_right_const || is_equal(right_val, 0))
+				return EQ_NO_ERR;
+			poly_swap(res, &left->poly);
+			poly_scale(res, 1 / right_val);
+			break;
+		case MATH_POW:
+			if (!is_right_const || !is_integer(right_val) || right_val < 0 ||
+				right_val > POLY_MAX_DEGREE ||
+				(double) poly_degree(&left->poly) * right_val >
+				POLY_MAX_DEGREE ||
+				poly_max_terms(&left->poly, (uint32_t) right_val) >
+				(double) POLY_MAX_TERMS)
+				return EQ_NO_ERR;
+			err = poly_ctor(res, left->poly.num_vars);
+			if (err == EQ_NO_ERR)
+				err = poly_pow(res, &left->poly, (uint32_t) right_val);
+			break;
+		case MATH_LN:
+		case MATH_SQRT:
+		case MATH_COS:
+		case MATH_SIN:
+		case MATH_TG:
+		case MATH_CTG:
+		case MATH_ARCSIN:
+		case MATH_ARCCOS:
+		case MATH_ARCTG:
+		case MATH_ARCCTG:
+			return EQ_NO_ERR;
+		default:
+			return EQ_UNKNOWN_OP_ERR;
+	}
+	if (err < 0)
+		return err;
+	*is_poly = res->size <= POLY_MAX_TERMS;
+	return EQ_NO_ERR;
+}
+
+/*
+ * Takes the polynomial of *child (an operand of node, or the root if node is
+ * NULL): puts its expanded form in place of the subtree if it has fewer
+ * nodes, or moves it to found if it has no more nodes than the subtree.
+ */
+static enum EquationError poly_take(struct PolyWalk *pw, struct Node *node,
+									struct Node **child,
+									struct PolyFrame *frame)
+{
+	assert(pw);
+	assert(child);
+	assert(frame);
+
+	if (type(*child) != MATH_OP)
+		return EQ_NO_ERR;
+	size_t size = poly_tree_size(&frame->poly);
+
+	if (pw->found) {
+		if (size > frame->tree_size)
+			return EQ_NO_ERR;
+		return poly_subtrees_add(pw->found, *child, &frame->poly);
+	}
+	if (size >= frame->tree_size)
+		return EQ_NO_ERR;
+
+	struct Node *tree = NULL;
+	enum EquationError err = poly_to_tree(&frame->poly, pw->arena, &tree);
+	if (err < 0)
+		return err;
+	if (node)
+		node_op_unshare(pw->arena, node);
+	node_op_delete(pw->arena, *child);
+	*child = tree;
+	return EQ_NO_ERR;
+}
+
+static void poly_walk_dtor(struct PolyWalk *pw)
+{
+	assert(pw);
+
+	for (size_t i = 0; i < pw->size; i++)
+		poly_dtor(&pw->frames[i].poly);
+	free(pw->frames);
+	free(pw->exps);
+	node_map_dtor(&pw->seen);
+	pw->frames = NULL;
+	pw->exps = NULL;
+	pw->size = 0;
+	pw->cap = 0;
+}
+
+static bool is_integer(double a)
+{
+	return is_zero(a - round(a));
+}
+
+// Exact, for arithmetic: only the output drops coefficients under EQ_EPSILON
+static bool is_zero(double a)
+{
+	return !(fabs(a) > 0);
+}
+
+static bool is_equal(double a, double b)
+{
+	return fabs(a - b) < EQ_EPSILON;
+}
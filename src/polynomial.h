@@ -0,0 +1,109 @@
+#ifndef _POLYNOMIAL_H
+#define _POLYNOMIAL_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "math_funcs.h"
+#include "equation_utils.h"
+
+/*
+ * Sparse multivariate polynomial: every term is a monomial, a vector of
+ * num_vars exponents, with a coefficient. Terms are kept in insertion order
+ * and are found by their exponents through an open-addressing hash table,
+ * so adding a term with a known monomial adds up the coefficients in O(1).
+ * Terms whose coefficients have cancelled out stay in place with 0 and are
+ * skipped when the polynomial is turned back into a tree.
+ */
+struct Polynomial {
+	uint32_t *exps;
+	double *coefs;
+	size_t size;
+	size_t cap;
+	size_t num_vars;
+
+	uint32_t *table;
+	size_t table_cap;
+};
+
+const size_t POLY_INIT_CAPACITY = 8;
+const uint32_t POLY_NONE = UINT32_MAX;
+
+/*
+ * Subtrees are treated as polynomials only while they stay this small, so
+ * (x + y)^64 * (x - y)^64 is left to the rules rather than expanded.
+ */
+const size_t POLY_MAX_TERMS = 4096;
+const uint32_t POLY_MAX_DEGREE = 1024;
+
+enum EquationError poly_ctor(struct Polynomial *poly, size_t num_vars);
+void poly_dtor(struct Polynomial *poly);
+void poly_clear(struct Polynomial *poly);
+
+enum EquationError poly_add_term(struct Polynomial *poly, const uint32_t *exps,
+								 double coef);
+// poly += factor * a
+enum EquationError poly_add(struct Polynomial *poly,
+							const struct Polynomial *a, double factor);
+void poly_scale(struct Polynomial *poly, double factor);
+void poly_swap(struct Polynomial *a, struct Polynomial *b);
+// res must be distinct from a and b
+enum EquationError poly_mult(struct Polynomial *res,
+							 const struct Polynomial *a,
+							 const struct Polynomial *b);
+enum EquationError poly_pow(struct Polynomial *res,
+							const struct Polynomial *a, uint32_t n);
+enum EquationError poly_differentiate(struct Polynomial *res,
+									  const struct Polynomial *a,
+									  size_t diff_var_ind);
+
+uint32_t poly_degree(const struct Polynomial *poly);
+bool poly_is_const(const struct Polynomial *poly, double *val);
+
+/*
+ * *is_poly is false if the tree has operators other than +, -, *, division
+ * by a constant and constant non-negative integer powers (operators over
+ * constants are folded), or if it expands over the limits above.
+ */
+enum EquationError poly_from_tree(struct Polynomial *poly, struct Node *tree,
+								  bool *is_poly);
+/*
+ * Builds the sum of the terms by descending degree. poly_tree_size is the
+ * number of nodes it makes.
+ */
+enum EquationError poly_to_tree(const struct Polynomial *poly,
+								struct NodeArena *arena, struct Node **tree);
+size_t poly_tree_size(const struct Polynomial *poly);
+
+/*
+ * Replaces every largest polynomial subtree with its expanded form when that
+ * has fewer nodes, so like terms are collected across the whole subtree.
+ */
+enum EquationError eq_simplify_polynomials(struct Equation *eq);
+/*
+ * Differentiates the equation term by term, in time linear in the number of
+ * terms, if it is a polynomial that is not larger expanded than as it is
+ * written; otherwise *is_poly is false and diff is left as it is.
+ */
+enum EquationError eq_differentiate_polynomial(struct Equation eq,
+											   size_t diff_var_ind,
+											   struct Equation *diff,
+											   bool *is_poly);
+
+/*
+ * The largest polynomial subtrees that have no more nodes than their
+ * expanded forms, roots maps their roots to indices in polys.
+ */
+struct PolySubtrees {
+	struct NodeMap roots;
+	struct Polynomial *polys;
+	size_t size;
+	size_t cap;
+};
+
+enum EquationError poly_subtrees_ctor(struct PolySubtrees *subtrees);
+void poly_subtrees_dtor(struct PolySubtrees *subtrees);
+enum EquationError eq_find_polynomials(struct Equation eq,
+									   struct PolySubtrees *found);
+
+#endif /*_POLYNOMIAL_H*/
@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "scalar_evaluate.h"
+#include "equation_manipulation.h"
+
+template <class T>
+static T scalar_eval_op(enum MathOp math_op, T left, T right,
+						enum EquationError *err);
+template <class T>
+static enum EquationError scalar_push(T **arr, size_t *size, size_t *cap,
+									  T val);
+
+/*
+ * Post-order walk with a stack of T. Over a sharing arena a memo of this
+ * call keeps indices of computed values in cache, since a NodeMapValue fits
+ * only one number. The arena's own memo is left alone, so equations can be
+ * evaluated from several threads at once.
+ */
+template <class T>
+enum EquationError eq_evaluate_as(struct Equation eq, const T *vals, T *res)
+{
+	assert(vals);
+	assert(res);
+
+	if (!eq.tree) {
+		*res = ScalarOps<T>::from_num(NAN);
+		return EQ_NO_ERR;
+	}
+
+	bool is_shared = eq.arena && eq.arena->is_shared;
+	struct NodeMap memo = {};
+	struct NodeStack walk = {};
+	struct NodeFrame frame = {};
+	enum EquationError err = EQ_NO_ERR;
+
+	T *stack = NULL;
+	size_t stack_size = 0;
+	size_t stack_cap = 0;
+	T *cache = NULL;
+	size_t cache_size = 0;
+	size_t cache_cap = 0;
+	T val = {};
+
+	if ((is_shared && node_map_ctor(&memo) < 0) ||
+		tree_walk_start(&walk, eq.tree) < 0)
+		err = EQ_NO_MEM_ERR;
+	while (err == EQ_NO_ERR && walk.size > 0) {
+		if (tree_walk_next(&walk, &frame) < 0) {
+			err = EQ_NO_MEM_ERR;
+			break;
+		}
+
+		union NodeMapValue *found = NULL;
+		if (frame.step == NODE_VISIT_PRE && is_shared &&
+			type(frame.node) == MATH_OP &&
+			(found = node_map_find(&memo, frame.node))) {
+			tree_walk_skip(&walk, frame.node);
+			val = cache[found->ind];
+		} else if (frame.step != NODE_VISIT_POST) {
+			continue;
+		} else if (type(frame.node) == MATH_NUM) {
+			val = ScalarOps<T>::from_num(num(frame.node));
+		} else if (type(frame.node) == MATH_VAR) {
+			val = vals[var(frame.node)];
+		} else {
+			T right = ScalarOps<T>::from_num(NAN);
+			T left = ScalarOps<T>::from_num(NAN);
+			if (frame.node->right)
+				right = stack[--stack_size];
+			if (frame.node->left)
+				left = stack[--stack_size];
+
+			val = scalar_eval_op(op(frame.node), left, right, &err);
+			if (err < 0)
+				break;
+
+			if (is_shared) {
+				union NodeMapValue ind = {};
+				ind.ind = cache_size;
+				err = scalar_push(&cache, &cache_size, &cache_cap, val);
+				if (err == EQ_NO_ERR &&
+					node_map_insert(&memo, frame.node, ind) < 0)
+					err = EQ_NO_MEM_ERR;
+				if (err < 0)
+					break;
+			}
+		}
+
+		err = scalar_push(&stack, &stack_size, &stack_cap, val);
+	}
+
+	if (err == EQ_NO_ERR)
+		*res = stack[0];
+	free(stack);
+	free(cache);
+	node_map_dtor(&memo);
+	node_stack_dtor(&walk);
+	return err;
+}
+
+template enum EquationError eq_evaluate_as<float>(struct Equation eq,
+												  const float *vals,
+												  float *res);
+template enum EquationError eq_evaluate_as<double>(struct Equation eq,
+												   const double *vals,
+												   double *res);
+template enum EquationError eq_evaluate_as<long double>(
+												struct Equation eq,
+												const long double *vals,
+												long double *res);
+template enum EquationError eq_evaluate_as<DualValue>(
+												struct Equation eq,
+												const struct DualValue *vals,
+												struct DualValue *res);
+template enum EquationError eq_evaluate_as<Interval>(
+												struct Equation eq,
+												const struct Interval *vals,
+												struct Interval *res);
+
+// The kernel of every operator is compiled in for T
+template <class T>
+static T scalar_eval_op(enum MathOp math_op, T left, T right,
+						enum EquationError *err)
+{
+	switch (math_op) {
+		case MATH_ADD:
+			return ScalarOps<T>::template eval<MATH_ADD>(left, right, err);
+		case MATH_MULT:
+			return ScalarOps<T>::template eval<MATH_MULT>(left, right, err);
+		case MATH_SUB:
+			return ScalarOps<T>::template eval<MATH_SUB>(left, right, err);
+		case MATH_DIV:
+			return ScalarOps<T>::template eval<MATH_DIV>(left, right, err);
+		case MATH_POW:
+			return ScalarOps<T>::template eval<MATH_POW>(left, right, err);
+		case MATH_LN:
+			return ScalarOps<T>::template eval<MATH_LN>(left, right, err);
+		case MATH_SQRT:
+			return ScalarOps<T>::template eval<MATH_SQRT>(left, right, err);
+		case MATH_COS:
+			return ScalarOps<T>::template eval<MATH_COS>(left, right, err);
+		case MATH_SIN:
+			return ScalarOps<T>::template eval<MATH_SIN>(left, right, err);
+		case MATH_TG:
+			return ScalarOps<T>::template eval<MATH_TG>(left, right, err);
+		case MATH_CTG:
+			return ScalarOps<T>::template eval<MATH_CTG>(left, right, err);
+		case MATH_ARCSIN:
+			return ScalarOps<T>::template eval<MATH_ARCSIN>(left, right, err);
+		case MATH_ARCCOS:
+			return ScalarOps<T>::template eval<MATH_ARCCOS>(left, right, err);
+		case MATH_ARCTG:
+			return ScalarOps<T>::template eval<MATH_ARCTG>(left, right, err);
+		case MATH_ARCCTG:
+			return ScalarOps<T>::template eval<MATH_ARCCTG>(left, right, err);
+		default:
+			*err = EQ_UNKNOWN_OP_ERR;
+			return ScalarOps<T>::from_num(NAN);
+	}
+}
+
+template <class T>
+static enum EquationError scalar_push(T **arr, size_t *size, size_t *cap,
+									  T val)
+{
+	assert(arr);
+	assert(size);
+	assert(cap);
+
+	if (*size >= *cap) {
+		size_t new_cap = *cap ? 2 * *cap : NODE_STACK_INIT_CAPACITY;
+		T *tmp = (T*) realloc(*arr, new_cap * sizeof(T));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		*arr = tmp;
+		*cap = new_cap;
+	}
+	(*arr)[(*size)++] = val;
+	return EQ_NO_ERR;
+}
@@ -0,0 +1,287 @@
+#ifndef _SCALAR_EVALUATE_H
+#define _SCALAR_EVALUATE_H
+
+#include <math.h>
+#include <cmath>
+
+#include "equation_utils.h"
+
+/*
+ * Evaluation of equations over any scalar type. ScalarOps<T> holds the
+ * operator kernels of T, picked at compile time by the MathOp template
+ * argument; the primary template serves float, double and long double with
+ * the same domain checks as math_eval_* (which are ScalarOps<double>).
+ * Unary operators take their operand in r, like MATH_OP_DEFS.
+ */
+template <class T>
+struct ScalarOps {
+	static T from_num(double num)
+	{
+		return (T) num;
+	}
+
+	template <enum MathOp OP>
+	static T eval(T l, T r, enum EquationError *err);
+};
+
+/*
+ * A value with its derivative. An inactive value does not depend on the
+ * variable, its derivative is 0 and is never multiplied by partials that may
+ * be undefined there (ln of the negative base of (-2)^3, ...).
+ */
+struct DualValue {
+	double val;
+	double diff;
+	bool is_active;
+};
+
+/*
+ * Closed interval [lo, hi] of doubles. Results of interval kernels enclose
+ * the values at all points of the operands where the operator is defined,
+ * with bounds rounded outward. A domain error means that the check fails for
+ * some point of the operands, not necessarily for all of them.
+ */
+struct Interval {
+	double lo;
+	double hi;
+};
+
+/*
+ * Evaluates the equation with variables set to vals. Instantiated for
+ * float, double, long double, DualValue and Interval.
+ */
+template <class T>
+enum EquationError eq_evaluate_as(struct Equation eq, const T *vals, T *res);
+
+template <class T>
+static inline T scalar_fail(enum EquationError *err, enum EquationError code)
+{
+	*err = code;
+	return ScalarOps<T>::from_num(NAN);
+}
+
+template <class T>
+template <enum MathOp OP>
+inline T ScalarOps<T>::eval(T l, T r, enum EquationError *err)
+{
+	if constexpr (OP == MATH_ADD) {
+		return l + r;
+	} else if constexpr (OP == MATH_SUB) {
+		return l - r;
+	} else if constexpr (OP == MATH_MULT) {
+		return l * r;
+	} else if constexpr (OP == MATH_DIV) {
+		if (std::fabs(r) < (T) EQ_EPSILON)
+			return scalar_fail<T>(err, EQ_ZERO_DIV_ERR);
+		return l / r;
+	} else if constexpr (OP == MATH_POW) {
+		return std::pow(l, r);
+	} else if constexpr (OP == MATH_LN) {
+		if (r <= 0)
+			return scalar_fail<T>(err, EQ_LN_NEGATIVE_ARG_ERR);
+		return std::log(r);
+	} else if constexpr (OP == MATH_SQRT) {
+		return std::sqrt(r);
+	} else if constexpr (OP == MATH_COS) {
+		return std::cos(r);
+	} else if constexpr (OP == MATH_SIN) {
+		return std::sin(r);
+	} else if constexpr (OP == MATH_TG) {
+		return std::tan(r);
+	} else if constexpr (OP == MATH_CTG) {
+		if (std::fabs(std::tan(r)) < (T) EQ_EPSILON)
+			return scalar_fail<T>(err, EQ_WRONG_CTG_ARG_ERR);
+		return 1 / std::tan(r);
+	} else if constexpr (OP == MATH_ARCSIN) {
+		if (std::fabs(r) > 1)
+			return scalar_fail<T>(err, EQ_WRONG_ARCSIN_ARG_ERR);
+		return std::asin(r);
+	} else if constexpr (OP == MATH_ARCCOS) {
+		if (std::fabs(r) > 1)
+			return scalar_fail<T>(err, EQ_WRONG_ARCCOS_ARG_ERR);
+		return std::acos(r);
+	} else if constexpr (OP == MATH_ARCTG) {
+		return std::atan(r);
+	} else {
+		static_assert(OP == MATH_ARCCTG, "Unknown operator");
+		return (T) M_PI_2l - std::atan(r);
+	}
+}
+
+// The value by ScalarOps<double>, the derivative by the chain rule with the
+// errors of the partials
+template <>
+struct ScalarOps<DualValue> {
+	static DualValue from_num(double num)
+	{
+		return {num, 0, false};
+	}
+
+	template <enum MathOp OP>
+	static DualValue eval(DualValue l, DualValue r, enum EquationError *err)
+	{
+		struct DualValue res = {};
+		res.val = ScalarOps<double>::eval<OP>(l.val, r.val, err);
+		res.is_active = l.is_active || r.is_active;
+		if (*err < 0 || !res.is_active)
+			return res;
+
+		double d_left = 0;
+		double d_right = 0;
+		(*MATH_OP_DEFS[OP].partial)(l.val, r.val, res.val, &d_left, &d_right,
+									err);
+		if (*err < 0)
+			return scalar_fail<DualValue>(err, *err);
+		if (l.is_active)
+			res.diff += d_left * l.diff;
+		if (r.is_active)
+			res.diff += d_right * r.diff;
+		return res;
+	}
+};
+
+static inline double interval_down(double x)
+{
+	return std::nextafter(x, -INFINITY);
+}
+
+static inline double interval_up(double x)
+{
+	return std::nextafter(x, INFINITY);
+}
+
+// Outward rounded hull of a and b, a NAN of 0 * inf is taken for 0
+static inline struct Interval interval_hull(double a, double b)
+{
+	a = std::isnan(a) ? 0 : a;
+	b = std::isnan(b) ? 0 : b;
+	return {interval_down(std::fmin(a, b)), interval_up(std::fmax(a, b))};
+}
+
+static inline struct Interval interval_hull(double a, double b, double c,
+											double d)
+{
+	struct Interval ab = interval_hull(a, b);
+	struct Interval cd = interval_hull(c, d);
+	return {std::fmin(ab.lo, cd.lo), std::fmax(ab.hi, cd.hi)};
+}
+
+/*
+ * Whether [lo, hi] may hold offset + k period for an integer k. Borderline
+ * cases count as hits, so the answer is never a wrong "no".
+ */
+static inline bool interval_hits_period(struct Interval x, double offset,
+										double period)
+{
+	double tol = 1e-12 * (1 + std::fabs(x.lo) + std::fabs(x.hi));
+	double k = std::ceil((x.lo - tol - offset) / period);
+	return offset + k * period <= x.hi + tol;
+}
+
+// Exact, like is_zero of polynomial.cpp
+static inline bool interval_is_zero(double a)
+{
+	return !(std::fabs(a) > 0);
+}
+
+static inline struct Interval interval_powi(struct Interval x, double n)
+{
+	if (interval_is_zero(n))
+		return {1, 1};
+
+	double abs_n = std::fabs(n);
+	double at_lo = std::pow(x.lo, abs_n);
+	double at_hi = std::pow(x.hi, abs_n);
+	struct Interval res = interval_hull(at_lo, at_hi);
+	if (interval_is_zero(std::fmod(abs_n, 2)) && x.lo < 0 && x.hi > 0)
+		res.lo = 0;
+	if (n > 0)
+		return res;
+	if (res.lo > 0 || res.hi < 0)
+		return interval_hull(1 / res.lo, 1 / res.hi);
+	if (interval_is_zero(res.lo) && res.hi > 0)
+		return {interval_down(1 / res.hi), INFINITY};
+	return {-INFINITY, INFINITY};
+}
+
+template <>
+struct ScalarOps<Interval> {
+	static struct Interval from_num(double num)
+	{
+		return {num, num};
+	}
+
+	template <enum MathOp OP>
+	static struct Interval eval(struct Interval l, struct Interval r,
+								enum EquationError *err)
+	{
+		if constexpr (OP == MATH_ADD) {
+			return {interval_down(l.lo + r.lo), interval_up(l.hi + r.hi)};
+		} else if constexpr (OP == MATH_SUB) {
+			return {interval_down(l.lo - r.hi), interval_up(l.hi - r.lo)};
+		} else if constexpr (OP == MATH_MULT) {
+			return interval_hull(l.lo * r.lo, l.lo * r.hi,
+								 l.hi * r.lo, l.hi * r.hi);
+		} else if constexpr (OP == MATH_DIV) {
+			if (r.lo < EQ_EPSILON && r.hi > -EQ_EPSILON)
+				return scalar_fail<Interval>(err, EQ_ZERO_DIV_ERR);
+			return interval_hull(l.lo / r.lo, l.lo / r.hi,
+								 l.hi / r.lo, l.hi / r.hi);
+		} else if constexpr (OP == MATH_POW) {
+			// x^y is monotone in both x >= 0 and y, so corners bound it
+			if (interval_is_zero(r.hi - r.lo) &&
+				interval_is_zero(r.lo - std::trunc(r.lo)))
+				return interval_powi(l, r.lo);
+			if (l.lo < 0)
+				return {-INFINITY, INFINITY};
+			return interval_hull(std::pow(l.lo, r.lo), std::pow(l.lo, r.hi),
+								 std::pow(l.hi, r.lo), std::pow(l.hi, r.hi));
+		} else if constexpr (OP == MATH_LN) {
+			if (r.lo <= 0)
+				return scalar_fail<Interval>(err, EQ_LN_NEGATIVE_ARG_ERR);
+			return interval_hull(std::log(r.lo), std::log(r.hi));
+		} else if constexpr (OP == MATH_SQRT) {
+			if (r.hi < 0)
+				return {NAN, NAN};
+			return interval_hull(std::sqrt(std::fmax(r.lo, 0)),
+								 std::sqrt(r.hi));
+		} else if constexpr (OP == MATH_COS || OP == MATH_SIN) {
+			double max_at = OP == MATH_COS ? 0 : M_PI_2;
+			if (r.hi - r.lo >= 2 * M_PI)
+				return {-1, 1};
+			struct Interval res = OP == MATH_COS ?
+								  interval_hull(std::cos(r.lo), std::cos(r.hi)) :
+								  interval_hull(std::sin(r.lo), std::sin(r.hi));
+			if (interval_hits_period(r, max_at, 2 * M_PI))
+				res.hi = 1;
+			if (interval_hits_period(r, max_at + M_PI, 2 * M_PI))
+				res.lo = -1;
+			return {std::fmax(res.lo, -1), std::fmin(res.hi, 1)};
+		} else if constexpr (OP == MATH_TG) {
+			if (r.hi - r.lo >= M_PI || interval_hits_period(r, M_PI_2, M_PI))
+				return {-INFINITY, INFINITY};
+			return interval_hull(std::tan(r.lo), std::tan(r.hi));
+		} else if constexpr (OP == MATH_CTG) {
+			struct Interval wide = {r.lo - EQ_EPSILON, r.hi + EQ_EPSILON};
+			if (r.hi - r.lo >= M_PI || interval_hits_period(wide, 0, M_PI))
+				return scalar_fail<Interval>(err, EQ_WRONG_CTG_ARG_ERR);
+			return interval_hull(1 / std::tan(r.lo), 1 / std::tan(r.hi));
+		} else if constexpr (OP == MATH_ARCSIN) {
+			if (r.lo < -1 || r.hi > 1)
+				return scalar_fail<Interval>(err, EQ_WRONG_ARCSIN_ARG_ERR);
+			return interval_hull(std::asin(r.lo), std::asin(r.hi));
+		} else if constexpr (OP == MATH_ARCCOS) {
+			if (r.lo < -1 || r.hi > 1)
+				return scalar_fail<Interval>(err, EQ_WRONG_ARCCOS_ARG_ERR);
+			return interval_hull(std::acos(r.lo), std::acos(r.hi));
+		} else if constexpr (OP == MATH_ARCTG) {
+			return interval_hull(std::atan(r.lo), std::atan(r.hi));
+		} else {
+			static_assert(OP == MATH_ARCCTG, "Unknown operator");
+			return interval_hull(M_PI_2 - std::atan(r.lo),
+								 M_PI_2 - std::atan(r.hi));
+		}
+	}
+};
+
+#endif /*_SCALAR_EVALUATE_H*/
@@ -0,0 +1,223 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <utility>
+
+#include "static_check.h"
+#include "static_equation.h"
+#include "equation_utils.h"
+#include "equation_io.h"
+
+// x sin x + ln x / (x - 1) + x^5
+typedef Add<Add<Mult<Var<0>, Sin<Var<0>>>,
+				Div<Ln<Var<0>>, Sub<Var<0>, Num<1>>>>,
+			Pow<Var<0>, Num<5>>> StaticFormula1;
+// sqrt(x0^2 + x1^2) arctg(x1 / x0)
+typedef Mult<Sqrt<Add<Mult<Var<0>, Var<0>>, Mult<Var<1>, Var<1>>>>,
+			 Arctg<Div<Var<1>, Var<0>>>> StaticFormula2;
+// arcsin(x0 / 4) arccos(x1 / 4) + ctg x0 - tg x1 arcctg(x0 x1)
+typedef Sub<Add<Mult<Arcsin<Div<Var<0>, Num<4>>>, Arccos<Div<Var<1>, Num<4>>>>,
+				Ctg<Var<0>>>,
+			Mult<Tg<Var<1>>, Arcctg<Mult<Var<0>, Var<1>>>>> StaticFormula3;
+// (x0^2 + 1)^x1 / cos x2 + 2^x0 + e^(x1 x2) + sqrt(x2^2 + 1)^3
+typedef Add<Add<Add<Div<Pow<Add<Pow<Var<0>, Num<2>>, Num<1>>, Var<1>>,
+						Cos<Var<2>>>,
+					Pow<Num<2>, Var<0>>>,
+				Pow<NumE, Mult<Var<1>, Var<2>>>>,
+			Pow<Sqrt<Add<Pow<Var<2>, Num<2>>, Num<1>>>, Num<3>>> StaticFormula4;
+// ln(x0^2 + 1) (x1 + 3)^2 + cos(x2^2 + 1) (x0 + 1)^2 + sin(x1^2 + 1) (x2 + 7)^2
+typedef Add<Add<Mult<Ln<Add<Mult<Var<0>, Var<0>>, Num<1>>>,
+					 Pow<Add<Var<1>, Num<3>>, Num<2>>>,
+				Mult<Cos<Add<Mult<Var<2>, Var<2>>, Num<1>>>,
+					 Pow<Add<Var<0>, Num<1>>, Num<2>>>>,
+			Mult<Sin<Add<Mult<Var<1>, Var<1>>, Num<1>>>,
+				 Pow<Add<Var<2>, Num<7>>, Num<2>>>> StaticFormula5;
+
+static double elapsed_secs(struct timespec start, struct timespec end);
+
+template <class E>
+static enum EquationError check_eval(struct Equation eq, const char *label,
+									 double *points, size_t num_points,
+									 bool *is_conformant);
+template <class E, size_t V>
+static enum EquationError check_partial(struct Equation eq, double *points,
+										size_t num_points,
+										bool *is_conformant);
+template <class E, size_t... V>
+static enum EquationError check_formula(size_t num_points,
+										std::index_sequence<V...>,
+										bool *is_conformant);
+template <class E>
+static enum EquationError check_formula(size_t num_points,
+										bool *is_conformant);
+
+enum EquationError static_eq_check(size_t num_points, bool *is_conformant)
+{
+	assert(is_conformant);
+
+	*is_conformant = true;
+	enum EquationError err = check_formula<StaticFormula1>(num_points,
+														   is_conformant);
+	if (err == EQ_NO_ERR)
+		err = check_formula<StaticFormula2>(num_points, is_conformant);
+	if (err == EQ_NO_ERR)
+		err = check_formula<StaticFormula3>(num_points, is_conformant);
+	if (err == EQ_NO_ERR)
+		err = check_formula<StaticFormula4>(num_points, is_conformant);
+	if (err == EQ_NO_ERR)
+		err = check_formula<StaticFormula5>(num_points, is_conformant);
+	return err;
+}
+
+template <class E>
+static enum EquationError check_formula(size_t num_points,
+										bool *is_conformant)
+{
+	return check_formula<E>(num_points,
+							std::make_index_sequence<E::num_vars>{},
+							is_conformant);
+}
+
+// Variable v runs over the grid with its own stride, so points are scattered
+template <class E, size_t... V>
+static enum EquationError check_formula(size_t num_points,
+										std::index_sequence<V...>,
+										bool *is_conformant)
+{
+	const double SWEEP_FROM = -4;
+	const double SWEEP_TO = 4;
+	const size_t num_vars = E::num_vars > 0 ? E::num_vars : 1;
+
+	struct Equation eq = {};
+	enum EquationError err = eq_ctor(&eq);
+	if (err == EQ_NO_ERR)
+		err = static_eq_to_equation<E>(&eq);
+	double *points = (double*) calloc(num_points * num_vars, sizeof(double));
+	if (!points && err == EQ_NO_ERR)
+		err = EQ_NO_MEM_ERR;
+	if (err < 0) {
+		free(points);
+		eq_dtor(&eq);
+		return err;
+	}
+
+	for (size_t i = 0; i < num_points; i++) {
+		for (size_t v = 0; v < num_vars; v++) {
+			size_t step = (i * (2 * v + 1) + v) % num_points;
+			points[i * num_vars + v] = SWEEP_FROM + (SWEEP_TO - SWEEP_FROM) *
+									   (double) step / (double) num_points;
+		}
+	}
+
+	eq_print(eq, stdout);
+	err = check_eval<E>(eq, "f", points, num_points, is_conformant);
+	((err = err < 0 ? err : check_partial<E, V>(eq, points, num_points,
+												is_conformant)), ...);
+
+	free(points);
+	eq_dtor(&eq);
+	return err;
+}
+
+template <class E, size_t V>
+static enum EquationError check_partial(struct Equation eq, double *points,
+										size_t num_points,
+										bool *is_conformant)
+{
+	const size_t MAX_LABEL_LEN = 64;
+
+	struct Equation diff = {};
+	enum EquationError err = eq_ctor(&diff);
+	if (err == EQ_NO_ERR)
+		err = eq_differentiate(eq, V, &diff);
+
+	char label[MAX_LABEL_LEN] = {};
+	snprintf(label, MAX_LABEL_LEN, "d/d%s", eq.var_names[V]);
+	if (err == EQ_NO_ERR)
+		err = check_eval<Diff<E, V>>(diff, label, points, num_points,
+									 is_conformant);
+	eq_dtor(&diff);
+	return err;
+}
+
+template <class E>
+static enum EquationError check_eval(struct Equation eq, const char *label,
+									 double *points, size_t num_points,
+									 bool *is_conformant)
+{
+	const size_t num_vars = E::num_vars > 0 ? E::num_vars : 1;
+
+	double *tree_res = (double*) calloc(num_points, sizeof(double));
+	double *static_res = (double*) calloc(num_points, sizeof(double));
+	struct Equation static_eq = {};
+	enum EquationError err = eq_ctor(&static_eq);
+	if (err == EQ_NO_ERR)
+		err = static_eq_to_equation<E>(&static_eq);
+	struct NodeStack stack = {};
+	bool is_same = err == EQ_NO_ERR &&
+				   tree_is_same(eq.tree, static_eq.tree, &stack);
+	node_stack_dtor(&stack);
+	eq_dtor(&static_eq);
+	if (!tree_res || !static_res) {
+		free(tree_res);
+		free(static_res);
+		return EQ_NO_MEM_ERR;
+	}
+	if (err < 0) {
+		free(tree_res);
+		free(static_res);
+		return err;
+	}
+
+	struct timespec start = {};
+	struct timespec end = {};
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num_points && err != EQ_NO_MEM_ERR; i++) {
+		err = eq_evaluate(eq, points + i * num_vars, tree_res + i);
+		if (err < 0)
+			tree_res[i] = NAN;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double tree_secs = elapsed_secs(start, end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num_points; i++) {
+		enum EquationError point_err = EQ_NO_ERR;
+		static_res[i] = E::eval(points + i * num_vars, &point_err);
+		if (point_err < 0)
+			static_res[i] = NAN;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double static_secs = elapsed_secs(start, end);
+
+	double max_diff = 0;
+	size_t num_mismatches = 0;
+	for (size_t i = 0; i < num_points; i++) {
+		if (isnan(tree_res[i]) != isnan(static_res[i]))
+			num_mismatches++;
+		else if (isfinite(tree_res[i]) && isfinite(static_res[i]))
+			max_diff = fmax(max_diff, fabs(tree_res[i] - static_res[i]) /
+									  (1 + fabs(tree_res[i])));
+	}
+	if (max_diff > STATIC_CHECK_TOLERANCE || num_mismatches > 0)
+		*is_conformant = false;
+
+	printf("%-6s %s, отклонение %.3le, расхождений в области определения %zu,"
+		   " дерево %.1lf нс, шаблон %.1lf нс на точку\n", label,
+		   is_same ? "то же дерево" : "другое дерево", max_diff,
+		   num_mismatches,
+		   tree_secs / (double) num_points * 1e9,
+		   static_secs / (double) num_points * 1e9);
+
+	free(tree_res);
+	free(static_res);
+	return err == EQ_NO_MEM_ERR ? err : EQ_NO_ERR;
+}
+
+static double elapsed_secs(struct timespec start, struct timespec end)
+{
+	return (double) (end.tv_sec - start.tv_sec) +
+		   (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
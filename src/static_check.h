@@ -0,0 +1,23 @@
+#ifndef _STATIC_CHECK_H
+#define _STATIC_CHECK_H
+
+#include <stddef.h>
+
+#include "math_funcs.h"
+
+/*
+ * Conformance check of static_equation.h on a set of built-in formulas:
+ * every formula and its partial derivatives made at compile time are
+ * evaluated at num_points points of [-4, 4] and compared with the tree made
+ * by eq_differentiate, evaluated by eq_evaluate. Prints whether the trees
+ * are the same, the largest relative deviation, the number of points where
+ * only one of them fails a domain check and the time per point of both. *is_conformant is
+ * false if any deviation is over STATIC_CHECK_TOLERANCE or any point fails
+ * in only one of them.
+ */
+const double STATIC_CHECK_TOLERANCE = 1e-9;
+const size_t STATIC_CHECK_DEFAULT_POINTS = 100000;
+
+enum EquationError static_eq_check(size_t num_points, bool *is_conformant);
+
+#endif /*_STATIC_CHECK_H*/
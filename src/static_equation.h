@@ -0,0 +1,470 @@
+#ifndef _STATIC_EQUATION_H
+#define _STATIC_EQUATION_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <numeric>
+#include <type_traits>
+
+#include "tree.h"
+#include "math_funcs.h"
+#include "equation_utils.h"
+#include "compiled_equation.h"
+
+/*
+ * Equations known at build time, written as types: Var<0>, Num<3>,
+ * Num<1, 2>, NumE, Add<A, B>, Sin<E>, ... A formula is an empty type and
+ * E::eval(vals, err) evaluates it with no dispatch at run time: every
+ * operator is inlined into the caller. Domain checks and errors are those
+ * of eq_evaluate, the first failing operator in post-order sets *err.
+ *
+ * Diff<E, I> is the derivative by variable I, made by the rules of the
+ * math_diff_* functions. The operator aliases fold as eq_make_operator
+ * does, so derivatives come out as eq_differentiate makes them: numbers are
+ * exact fractions, operators over them (and their integer powers) are
+ * computed by the compiler and identities (u + 0, 0 * u, 1 * u, u / 1,
+ * u^0, u^1, ...) are dropped. Functions of numbers (ln 2 made by
+ * math_diff_pow) stay operators until they are made into a tree, where they
+ * become numbers, and are left to the optimizer in eval.
+ *
+ * Integer powers are multiplied out by squaring and e^u is exp, as in
+ * CompiledEquation. static_eq_to_equation builds the same formula as a tree,
+ * so it can be checked against the symbolic differentiator.
+ */
+
+struct NoOperand;
+template <int64_t N, int64_t D = 1> struct Num;
+template <size_t I> struct Var;
+struct NumE;
+template <enum MathOp OP, class L, class R> struct StaticOp;
+
+template <class E, size_t I> struct StaticDiff;
+template <class E, size_t I> using Diff = typename StaticDiff<E, I>::type;
+
+inline struct Node *static_eq_new_node(struct NodeArena *arena,
+									   struct MathToken data,
+									   struct Node *left, struct Node *right,
+									   enum EquationError *err)
+{
+	struct Node *node = NULL;
+	if (*err == EQ_NO_ERR && node_op_make(arena, &node, data, left,
+										  right) < 0)
+		*err = EQ_NO_MEM_ERR;
+	return node;
+}
+
+// Keeps the first error, the NAN returned goes on up as eq_evaluate stops
+inline double static_eq_fail(enum EquationError *err, enum EquationError code)
+{
+	if (*err == EQ_NO_ERR)
+		*err = code;
+	return NAN;
+}
+
+// Integer powers of numbers up to this one are computed by the compiler
+const int64_t STATIC_EQ_MAX_FOLDED_EXP = 16;
+
+constexpr int64_t static_eq_ipow(int64_t base, int64_t exp)
+{
+	int64_t res = 1;
+	for (int64_t i = 0; i < exp; i++)
+		res *= base;
+	return res;
+}
+
+template <int64_t N>
+inline double static_eq_powi(double x)
+{
+	uint64_t n = N < 0 ? 0 - (uint64_t) N : (uint64_t) N;
+	double res = 1;
+	for (; n > 0; n >>= 1) {
+		if (n & 1)
+			res *= x;
+		x *= x;
+	}
+	return N < 0 ? 1 / res : res;
+}
+
+// Num<N, D> with the fraction reduced and D > 0
+template <int64_t N, int64_t D>
+using NumOf = Num<(D < 0 ? -N : N) / std::gcd(N, D),
+				  (D < 0 ? -D : D) / std::gcd(N, D)>;
+
+struct NoOperand {
+	static constexpr bool is_num = false;
+	static constexpr bool is_const = true;
+	static constexpr size_t size = 0;
+	static constexpr size_t num_vars = 0;
+
+	static double eval(const double */*vals*/, enum EquationError */*err*/)
+	{
+		return NAN;
+	}
+	static struct Node *make(struct NodeArena */*arena*/,
+							 enum EquationError */*err*/)
+	{
+		return NULL;
+	}
+};
+
+template <int64_t N, int64_t D>
+struct Num {
+	static_assert(D > 0 && std::gcd(N, D) == 1, "Use NumOf<N, D>");
+
+	static constexpr bool is_num = true;
+	static constexpr bool is_const = true;
+	static constexpr int64_t numer = N;
+	static constexpr int64_t denom = D;
+	static constexpr double value = (double) N / (double) D;
+	static constexpr size_t size = 1;
+	static constexpr size_t num_vars = 0;
+
+	static double eval(const double */*vals*/, enum EquationError */*err*/)
+	{
+		return value;
+	}
+	static struct Node *make(struct NodeArena *arena, enum EquationError *err)
+	{
+		struct MathToken tok = {};
+		tok.type = MATH_NUM;
+		tok.value.num = value;
+		return static_eq_new_node(arena, tok, NULL, NULL, err);
+	}
+};
+
+struct NumE {
+	static constexpr bool is_num = false;
+	static constexpr bool is_const = true;
+	static constexpr size_t size = 1;
+	static constexpr size_t num_vars = 0;
+
+	static double eval(const double */*vals*/, enum EquationError */*err*/)
+	{
+		return M_E;
+	}
+	static struct Node *make(struct NodeArena *arena, enum EquationError *err)
+	{
+		struct MathToken tok = {};
+		tok.type = MATH_NUM;
+		tok.value.num = M_E;
+		return static_eq_new_node(arena, tok, NULL, NULL, err);
+	}
+};
+
+template <size_t I>
+struct Var {
+	static constexpr bool is_num = false;
+	static constexpr bool is_const = false;
+	static constexpr size_t size = 1;
+	static constexpr size_t num_vars = I + 1;
+
+	static double eval(const double *vals, enum EquationError */*err*/)
+	{
+		return vals[I];
+	}
+	static struct Node *make(struct NodeArena *arena, enum EquationError *err)
+	{
+		struct MathToken tok = {};
+		tok.type = MATH_VAR;
+		tok.value.var_ind = I;
+		return static_eq_new_node(arena, tok, NULL, NULL, err);
+	}
+};
+
+template <class T, int64_t N, int64_t D = 1>
+constexpr bool static_is_num(void)
+{
+	if constexpr (T::is_num)
+		return T::numer == N && T::denom == D;
+	else
+		return false;
+}
+
+template <class T, int64_t FROM, int64_t TO>
+constexpr bool static_is_int_in(void)
+{
+	if constexpr (T::is_num)
+		return T::denom == 1 && FROM <= T::numer && T::numer <= TO;
+	else
+		return false;
+}
+
+template <enum MathOp OP, class L, class R>
+struct StaticOp {
+	static constexpr bool is_num = false;
+	static constexpr bool is_const = L::is_const && R::is_const;
+	static constexpr size_t size = 1 + L::size + R::size;
+	static constexpr size_t num_vars = L::num_vars > R::num_vars ?
+									   L::num_vars : R::num_vars;
+
+	static double eval(const double *vals, enum EquationError *err)
+	{
+		double l = L::eval(vals, err);
+		double r = R::eval(vals, err);
+
+		if constexpr (OP == MATH_ADD) {
+			return l + r;
+		} else if constexpr (OP == MATH_SUB) {
+			return l - r;
+		} else if constexpr (OP == MATH_MULT) {
+			return l * r;
+		} else if constexpr (OP == MATH_DIV) {
+			if (fabs(r) < EQ_EPSILON)
+				return static_eq_fail(err, EQ_ZERO_DIV_ERR);
+			return l / r;
+		} else if constexpr (OP == MATH_POW) {
+			if constexpr (static_is_int_in<R, -CEQ_POWI_MAX_EXP,
+										   CEQ_POWI_MAX_EXP>())
+				return static_eq_powi<R::numer>(l);
+			else if constexpr (static_is_num<R, 1, 2>())
+				return sqrt(l);
+			else if constexpr (std::is_same<L, NumE>::value)
+				return exp(r);
+			else
+				return pow(l, r);
+		} else if constexpr (OP == MATH_LN) {
+			if (r <= 0)
+				return static_eq_fail(err, EQ_LN_NEGATIVE_ARG_ERR);
+			return log(r);
+		} else if constexpr (OP == MATH_SQRT) {
+			return sqrt(r);
+		} else if constexpr (OP == MATH_COS) {
+			return cos(r);
+		} else if constexpr (OP == MATH_SIN) {
+			return sin(r);
+		} else if constexpr (OP == MATH_TG) {
+			return tan(r);
+		} else if constexpr (OP == MATH_CTG) {
+			double tg = tan(r);
+			if (fabs(tg) < EQ_EPSILON)
+				return static_eq_fail(err, EQ_WRONG_CTG_ARG_ERR);
+			return 1 / tg;
+		} else if constexpr (OP == MATH_ARCSIN) {
+			if (fabs(r) > 1)
+				return static_eq_fail(err, EQ_WRONG_ARCSIN_ARG_ERR);
+			return asin(r);
+		} else if constexpr (OP == MATH_ARCCOS) {
+			if (fabs(r) > 1)
+				return static_eq_fail(err, EQ_WRONG_ARCCOS_ARG_ERR);
+			return acos(r);
+		} else if constexpr (OP == MATH_ARCTG) {
+			return atan(r);
+		} else {
+			static_assert(OP == MATH_ARCCTG, "Unknown operator");
+			return M_PI_2 - atan(r);
+		}
+	}
+
+	static struct Node *make(struct NodeArena *arena, enum EquationError *err)
+	{
+		struct MathToken tok = {};
+		if constexpr (is_const) {
+			enum EquationError eval_err = EQ_NO_ERR;
+			tok.type = MATH_NUM;
+			tok.value.num = eval(NULL, &eval_err);
+			if (eval_err == EQ_NO_ERR)
+				return static_eq_new_node(arena, tok, NULL, NULL, err);
+		}
+
+		struct Node *left = L::make(arena, err);
+		struct Node *right = R::make(arena, err);
+		tok.type = MATH_OP;
+		tok.value.op = OP;
+		return static_eq_new_node(arena, tok, left, right, err);
+	}
+};
+
+/*
+ * The type of static_make<OP, L, R>() is the operator folded as
+ * eq_make_operator folds it, the function itself is never called.
+ * Operators over numbers that are not exact fractions stay operators, make
+ * turns them into numbers.
+ */
+template <enum MathOp OP, class L, class R>
+auto static_make(void)
+{
+	if constexpr (OP == MATH_ADD) {
+		if constexpr (L::is_num && R::is_num)
+			return NumOf<L::numer * R::denom + R::numer * L::denom,
+						 L::denom * R::denom>{};
+		else if constexpr (static_is_num<L, 0>())
+			return R{};
+		else if constexpr (static_is_num<R, 0>())
+			return L{};
+		else
+			return StaticOp<OP, L, R>{};
+	} else if constexpr (OP == MATH_SUB) {
+		if constexpr (L::is_num && R::is_num)
+			return NumOf<L::numer * R::denom - R::numer * L::denom,
+						 L::denom * R::denom>{};
+		else if constexpr (static_is_num<R, 0>())
+			return L{};
+		else
+			return StaticOp<OP, L, R>{};
+	} else if constexpr (OP == MATH_MULT) {
+		if constexpr (L::is_num && R::is_num)
+			return NumOf<L::numer * R::numer, L::denom * R::denom>{};
+		else if constexpr (static_is_num<L, 0>() || static_is_num<R, 1>())
+			return L{};
+		else if constexpr (static_is_num<R, 0>() || static_is_num<L, 1>())
+			return R{};
+		else
+			return StaticOp<OP, L, R>{};
+	} else if constexpr (OP == MATH_DIV) {
+		// Division by 0 is kept, eval reports it as eq_evaluate does
+		if constexpr (static_is_num<R, 0>())
+			return StaticOp<OP, L, R>{};
+		else if constexpr (L::is_num && R::is_num)
+			return NumOf<L::numer * R::denom, L::denom * R::numer>{};
+		else if constexpr (static_is_num<L, 0>() || static_is_num<R, 1>())
+			return L{};
+		else
+			return StaticOp<OP, L, R>{};
+	} else if constexpr (OP == MATH_POW) {
+		if constexpr (L::is_num && R::is_num) {
+			if constexpr (static_is_int_in<R, 0, STATIC_EQ_MAX_FOLDED_EXP>() &&
+						  (L::numer != 0 || R::numer > 0))
+				return Num<static_eq_ipow(L::numer, R::numer),
+						   static_eq_ipow(L::denom, R::numer)>{};
+			else
+				return StaticOp<OP, L, R>{};
+		} else if constexpr (static_is_num<R, 1>() || static_is_num<L, 0>() ||
+							 static_is_num<L, 1>()) {
+			return L{};
+		} else if constexpr (static_is_num<R, 0>()) {
+			return Num<1>{};
+		} else {
+			return StaticOp<OP, L, R>{};
+		}
+	} else {
+		static_assert(std::is_same<L, NoOperand>::value,
+					  "Unary operators keep their operand in R");
+		return StaticOp<OP, L, R>{};
+	}
+}
+
+template <class L, class R>
+using Add = decltype(static_make<MATH_ADD, L, R>());
+template <class L, class R>
+using Sub = decltype(static_make<MATH_SUB, L, R>());
+template <class L, class R>
+using Mult = decltype(static_make<MATH_MULT, L, R>());
+template <class L, class R>
+using Div = decltype(static_make<MATH_DIV, L, R>());
+template <class L, class R>
+using Pow = decltype(static_make<MATH_POW, L, R>());
+template <class E> using Ln = StaticOp<MATH_LN, NoOperand, E>;
+template <class E> using Sqrt = StaticOp<MATH_SQRT, NoOperand, E>;
+template <class E> using Cos = StaticOp<MATH_COS, NoOperand, E>;
+template <class E> using Sin = StaticOp<MATH_SIN, NoOperand, E>;
+template <class E> using Tg = StaticOp<MATH_TG, NoOperand, E>;
+template <class E> using Ctg = StaticOp<MATH_CTG, NoOperand, E>;
+template <class E> using Arcsin = StaticOp<MATH_ARCSIN, NoOperand, E>;
+template <class E> using Arccos = StaticOp<MATH_ARCCOS, NoOperand, E>;
+template <class E> using Arctg = StaticOp<MATH_ARCTG, NoOperand, E>;
+template <class E> using Arcctg = StaticOp<MATH_ARCCTG, NoOperand, E>;
+
+template <int64_t N, int64_t D, size_t I>
+struct StaticDiff<Num<N, D>, I> {
+	using type = Num<0>;
+};
+
+template <size_t I>
+struct StaticDiff<NumE, I> {
+	using type = Num<0>;
+};
+
+template <size_t J, size_t I>
+struct StaticDiff<Var<J>, I> {
+	using type = Num<J == I ? 1 : 0>;
+};
+
+// The rules of math_diff_* with dl, dr for diff_left, diff_right
+template <enum MathOp OP, class L, class R, size_t I>
+auto static_diff_op(void)
+{
+	if constexpr (OP == MATH_ADD) {
+		return Add<Diff<L, I>, Diff<R, I>>{};
+	} else if constexpr (OP == MATH_SUB) {
+		return Sub<Diff<L, I>, Diff<R, I>>{};
+	} else if constexpr (OP == MATH_MULT) {
+		return Add<Mult<Diff<L, I>, R>, Mult<L, Diff<R, I>>>{};
+	} else if constexpr (OP == MATH_DIV) {
+		return Div<Sub<Mult<Diff<L, I>, R>, Mult<L, Diff<R, I>>>,
+				   Pow<R, Num<2>>>{};
+	} else if constexpr (OP == MATH_POW) {
+		if constexpr (R::is_const)
+			return Mult<Mult<R, Pow<L, Sub<R, Num<1>>>>, Diff<L, I>>{};
+		else if constexpr (std::is_same<L, NumE>::value)
+			return Mult<Pow<L, R>, Diff<R, I>>{};
+		else if constexpr (L::is_const)
+			return Mult<Mult<Pow<L, R>, Ln<L>>, Diff<R, I>>{};
+		else
+			return Mult<Pow<NumE, Mult<Ln<L>, R>>,
+						Add<Div<Mult<Diff<L, I>, R>, L>,
+							Mult<Ln<L>, Diff<R, I>>>>{};
+	} else if constexpr (OP == MATH_LN) {
+		return Mult<Div<Num<1>, R>, Diff<R, I>>{};
+	} else if constexpr (OP == MATH_SQRT) {
+		return Div<Diff<R, I>, Mult<Num<2>, Sqrt<R>>>{};
+	} else if constexpr (OP == MATH_COS) {
+		return Mult<Mult<Num<-1>, Sin<R>>, Diff<R, I>>{};
+	} else if constexpr (OP == MATH_SIN) {
+		return Mult<Cos<R>, Diff<R, I>>{};
+	} else if constexpr (OP == MATH_TG) {
+		return Div<Diff<R, I>, Pow<Cos<R>, Num<2>>>{};
+	} else if constexpr (OP == MATH_CTG) {
+		return Mult<Num<-1>, Div<Diff<R, I>, Pow<Sin<R>, Num<2>>>>{};
+	} else if constexpr (OP == MATH_ARCSIN) {
+		return Div<Diff<R, I>, Sqrt<Sub<Num<1>, Pow<R, Num<2>>>>>{};
+	} else if constexpr (OP == MATH_ARCCOS) {
+		return Mult<Num<-1>, Div<Diff<R, I>,
+								 Sqrt<Sub<Num<1>, Pow<R, Num<2>>>>>>{};
+	} else if constexpr (OP == MATH_ARCTG) {
+		return Div<Diff<R, I>, Add<Num<1>, Pow<R, Num<2>>>>{};
+	} else {
+		static_assert(OP == MATH_ARCCTG, "Unknown operator");
+		return Mult<Num<-1>, Div<Diff<R, I>,
+								 Add<Num<1>, Pow<R, Num<2>>>>>{};
+	}
+}
+
+template <enum MathOp OP, class L, class R, size_t I>
+struct StaticDiff<StaticOp<OP, L, R>, I> {
+	using type = decltype(static_diff_op<OP, L, R, I>());
+};
+
+/*
+ * Fills eq (already constructed) with the tree of E, its variables are
+ * named x0, x1, ...
+ */
+template <class E>
+enum EquationError static_eq_to_equation(struct Equation *eq)
+{
+	const size_t MAX_NAME_LEN = 32;
+
+	if (eq->cap_vars < E::num_vars) {
+		char **tmp = (char**) realloc(eq->var_names,
+									  E::num_vars * sizeof(char*));
+		if (!tmp)
+			return EQ_NO_MEM_ERR;
+		eq->var_names = tmp;
+		eq->cap_vars = E::num_vars;
+	}
+	for (; eq->num_vars < E::num_vars; eq->num_vars++) {
+		char name[MAX_NAME_LEN] = {};
+		snprintf(name, MAX_NAME_LEN, "x%zu", eq->num_vars);
+		eq->var_names[eq->num_vars] = strdup(name);
+		if (!eq->var_names[eq->num_vars])
+			return EQ_NO_MEM_ERR;
+	}
+
+	enum EquationError err = EQ_NO_ERR;
+	eq->tree = E::make(eq->arena, &err);
+	return err;
+}
+
+#endif /*_STATIC_EQUATION_H*/
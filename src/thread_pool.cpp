@@ -0,0 +1,194 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_pool.h"
+
+static void *thread_pool_thread(void *worker_ptr);
+static void thread_pool_work(struct ThreadPool *pool, size_t id);
+static bool thread_pool_next_chunk(struct ThreadPool *pool, size_t id,
+								   size_t *chunk);
+static void thread_pool_stop(struct ThreadPool *pool, size_t num_started);
+
+enum ThreadPoolError thread_pool_ctor(struct ThreadPool *pool,
+									  size_t num_threads)
+{
+	assert(pool);
+
+	if (num_threads == 0)
+		num_threads = 1;
+
+	pool->workers = (struct ThreadPoolWorker*) aligned_alloc(
+						alignof(struct ThreadPoolWorker),
+						num_threads * sizeof(struct ThreadPoolWorker));
+	if (!pool->workers)
+		return THREAD_POOL_NO_MEM_ERR;
+	memset((void*) pool->workers, 0,
+		   num_threads * sizeof(struct ThreadPoolWorker));
+
+	pool->num_threads = num_threads;
+	pool->generation = 0;
+	pool->num_busy = 0;
+	pool->is_stopping = false;
+	pool->task = NULL;
+	pool->arg = NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->job_ready, NULL);
+	pthread_cond_init(&pool->job_done, NULL);
+
+	for (size_t i = 0; i < num_threads; i++) {
+		pthread_mutex_init(&pool->workers[i].lock, NULL);
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+	}
+	for (size_t i = 1; i < num_threads; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL, thread_pool_thread,
+						   pool->workers + i) != 0) {
+			thread_pool_stop(pool, i);
+			return THREAD_POOL_THREAD_ERR;
+		}
+	}
+
+	return THREAD_POOL_NO_ERR;
+}
+
+void thread_pool_dtor(struct ThreadPool *pool)
+{
+	assert(pool);
+
+	if (pool->workers)
+		thread_pool_stop(pool, pool->num_threads);
+}
+
+static void thread_pool_stop(struct ThreadPool *pool, size_t num_started)
+{
+	assert(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->is_stopping = true;
+	pthread_cond_broadcast(&pool->job_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 1; i < num_started; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->job_ready);
+	pthread_cond_destroy(&pool->job_done);
+
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->num_threads = 0;
+}
+
+void thread_pool_run(struct ThreadPool *pool, size_t num_chunks,
+					 thread_pool_task task, void *arg)
+{
+	assert(pool);
+	assert(task);
+
+	size_t num_threads = pool->num_threads;
+	for (size_t i = 0; i < num_threads; i++) {
+		struct ThreadPoolWorker *worker = pool->workers + i;
+		pthread_mutex_lock(&worker->lock);
+		worker->begin = i * num_chunks / num_threads;
+		worker->end = (i + 1) * num_chunks / num_threads;
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->num_busy = num_threads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->job_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	thread_pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->num_busy > 0)
+		pthread_cond_wait(&pool->job_done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void *thread_pool_thread(void *worker_ptr)
+{
+	struct ThreadPoolWorker *worker = (struct ThreadPoolWorker*) worker_ptr;
+	struct ThreadPool *pool = worker->pool;
+	size_t seen_generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->is_stopping && pool->generation == seen_generation)
+			pthread_cond_wait(&pool->job_ready, &pool->lock);
+		if (pool->is_stopping)
+			break;
+		seen_generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		thread_pool_work(pool, worker->id);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->num_busy == 0)
+			pthread_cond_signal(&pool->job_done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void thread_pool_work(struct ThreadPool *pool, size_t id)
+{
+	assert(pool);
+
+	size_t chunk = 0;
+	while (thread_pool_next_chunk(pool, id, &chunk))
+		(*pool->task)(pool->arg, id, chunk);
+}
+
+/*
+ * Takes the next chunk of the worker's own range or, when it is empty,
+ * steals the back half of the first non-empty range of the other workers.
+ * At most one lock is held at a time.
+ */
+static bool thread_pool_next_chunk(struct ThreadPool *pool, size_t id,
+								   size_t *chunk)
+{
+	assert(pool);
+	assert(chunk);
+
+	struct ThreadPoolWorker *self = pool->workers + id;
+	pthread_mutex_lock(&self->lock);
+	if (self->begin < self->end) {
+		*chunk = self->begin++;
+		pthread_mutex_unlock(&self->lock);
+		return true;
+	}
+	pthread_mutex_unlock(&self->lock);
+
+	for (size_t i = 1; i < pool->num_threads; i++) {
+		struct ThreadPoolWorker *victim = pool->workers +
+										  (id + i) % pool->num_threads;
+		pthread_mutex_lock(&victim->lock);
+		size_t left = victim->end - victim->begin;
+		if (left == 0) {
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		size_t stolen_begin = victim->end - (left + 1) / 2;
+		size_t stolen_end = victim->end;
+		victim->end = stolen_begin;
+		pthread_mutex_unlock(&victim->lock);
+
+		pthread_mutex_lock(&self->lock);
+		self->begin = stolen_begin + 1;
+		self->end = stolen_end;
+		pthread_mutex_unlock(&self->lock);
+		*chunk = stolen_begin;
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,58 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Fixed set of threads running parallel loops over chunks [0, num_chunks).
+ * Every worker starts with a contiguous range of chunks and takes them from
+ * its front; a worker that runs out steals the back half of the range of
+ * another one. The thread calling thread_pool_run works as worker 0, so a
+ * pool of one thread runs everything in the caller.
+ */
+
+enum ThreadPoolError {
+	THREAD_POOL_THREAD_ERR	= -2,
+	THREAD_POOL_NO_MEM_ERR	= -1,
+	THREAD_POOL_NO_ERR		=  0,
+};
+
+/*
+ * Runs one chunk. worker is in [0, num_threads) and can index per-thread
+ * data: no two chunks run on the same worker at the same time.
+ */
+typedef void (*thread_pool_task)(void *arg, size_t worker, size_t chunk);
+
+struct alignas(64) ThreadPoolWorker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	size_t begin;
+	size_t end;
+	struct ThreadPool *pool;
+	size_t id;
+};
+
+struct ThreadPool {
+	struct ThreadPoolWorker *workers;
+	size_t num_threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t job_ready;
+	pthread_cond_t job_done;
+	size_t generation;
+	size_t num_busy;
+	bool is_stopping;
+
+	thread_pool_task task;
+	void *arg;
+};
+
+enum ThreadPoolError thread_pool_ctor(struct ThreadPool *pool,
+									  size_t num_threads);
+void thread_pool_dtor(struct ThreadPool *pool);
+
+void thread_pool_run(struct ThreadPool *pool, size_t num_chunks,
+					 thread_pool_task task, void *arg);
+
+#endif /*_THREAD_POOL_H*/
@@ -1,20 +1,349 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include "tree.h"
 
-enum TreeError node_op_new(struct Node **node, elem_t data)
+static struct Node SHARED_TOMBSTONE = {};
+
+static enum TreeError node_arena_add_slab(struct NodeArena *arena);
+static enum TreeError node_arena_resize_shared(struct NodeArena *arena,
+											   size_t new_cap);
+static struct Node **node_arena_find_shared(const struct NodeArena *arena,
+											elem_t data,
+											const struct Node *left,
+											const struct Node *right);
+static size_t node_content_hash(elem_t data, const struct Node *left,
+								const struct Node *right);
+static bool node_content_equal(const struct Node *node, elem_t data,
+							   const struct Node *left,
+							   const struct Node *right);
+static size_t node_token_hash(elem_t data);
+static bool node_token_same(elem_t a, elem_t b);
+static size_t hash_mix(size_t hash, size_t val);
+static enum TreeError node_map_resize(struct NodeMap *map, size_t new_cap);
+
+enum TreeError node_arena_ctor(struct NodeArena *arena)
 {
-	assert(node);
+	assert(arena);
 
-	*node = (struct Node*) calloc(1, sizeof(struct Node));
-	if (!(*node))
+	arena->slabs = (struct Node**) calloc(NODE_ARENA_INIT_SLABS_CAPACITY,
+										  sizeof(struct Node*));
+	if (!arena->slabs)
 		return TREE_NO_MEM_ERR;
+	arena->num_slabs = 0;
+	arena->cap_slabs = NODE_ARENA_INIT_SLABS_CAPACITY;
+	arena->slab_size = 0;
+	arena->slab_used = 0;
+	arena->free_list = NULL;
+	arena->num_live = 0;
+	arena->peak_live = 0;
+	arena->num_made = 0;
+	arena->is_shared = false;
+	arena->shared = NULL;
+	arena->num_shared = 0;
+	arena->cap_shared = 0;
+	arena->copy_walk = {};
+	arena->copy_res = {};
+	return TREE_NO_ERR;
+}
+
+enum TreeError node_arena_enable_sharing(struct NodeArena *arena)
+{
+	assert(arena);
+	assert(arena->num_live == 0);
+
+	if (arena->is_shared)
+		return TREE_NO_ERR;
+
+	enum TreeError err = node_arena_resize_shared(arena,
+										NODE_ARENA_INIT_SHARED_CAPACITY);
+	if (err < 0)
+		return err;
+	arena->is_shared = true;
+	return TREE_NO_ERR;
+}
+
+void node_arena_dtor(struct NodeArena *arena)
+{
+	assert(arena);
+
+	for (size_t i = 0; i < arena->num_slabs; i++)
+		free(arena->slabs[i]);
+	free(arena->slabs);
+	arena->slabs = NULL;
+	arena->num_slabs = 0;
+	arena->cap_slabs = 0;
+	arena->slab_size = 0;
+	arena->slab_used = 0;
+	arena->free_list = NULL;
+	arena->num_live = 0;
+
+	free(arena->shared);
+	arena->shared = NULL;
+	arena->num_shared = 0;
+	arena->cap_shared = 0;
+	arena->is_shared = false;
+	node_stack_dtor(&arena->copy_walk);
+	node_stack_dtor(&arena->copy_res);
+}
+
+static enum TreeError node_arena_add_slab(struct NodeArena *arena)
+{
+	assert(arena);
+
+	if (arena->num_slabs >= arena->cap_slabs) {
+		struct Node **tmp = (struct Node**) realloc(arena->slabs,
+									2 * arena->cap_slabs * sizeof(struct Node*));
+		if (!tmp)
+			return TREE_NO_MEM_ERR;
+		arena->slabs = tmp;
+		arena->cap_slabs *= 2;
+	}
+
+	size_t new_size = arena->slab_size ? 2 * arena->slab_size :
+										 NODE_ARENA_INIT_SLAB_SIZE;
+	if (new_size > NODE_ARENA_MAX_SLAB_SIZE)
+		new_size = NODE_ARENA_MAX_SLAB_SIZE;
+
+	struct Node *slab = (struct Node*) malloc(new_size * sizeof(struct Node));
+	if (!slab)
+		return TREE_NO_MEM_ERR;
+	arena->slabs[arena->num_slabs++] = slab;
+	arena->slab_size = new_size;
+	arena->slab_used = 0;
+	return TREE_NO_ERR;
+}
+
+enum TreeError node_op_new(struct NodeArena *arena, struct Node **node,
+						   elem_t data)
+{
+	assert(node);
+
+	if (!arena) {
+		*node = (struct Node*) calloc(1, sizeof(struct Node));
+		if (!(*node))
+			return TREE_NO_MEM_ERR;
+		node_ctor(*node, data);
+		return TREE_NO_ERR;
+	}
+
+	if (arena->free_list) {
+		*node = arena->free_list;
+		arena->free_list = arena->free_list->left;
+	} else {
+		if (arena->slab_used >= arena->slab_size) {
+			enum TreeError err = node_arena_add_slab(arena);
+			if (err < 0)
+				return err;
+		}
+		*node = arena->slabs[arena->num_slabs - 1] + arena->slab_used++;
+	}
+
+	arena->num_live++;
+	arena->num_made++;
+	if (arena->num_live > arena->peak_live)
+		arena->peak_live = arena->num_live;
 
 	node_ctor(*node, data);
 	return TREE_NO_ERR;
 }
 
+enum TreeError node_op_make(struct NodeArena *arena, struct Node **node,
+							elem_t data, struct Node *left, struct Node *right)
+{
+	assert(node);
+
+	if (!arena || !arena->is_shared) {
+		enum TreeError err = node_op_new(arena, node, data);
+		if (err < 0)
+			return err;
+		(*node)->left = left;
+		(*node)->right = right;
+		node_rehash(*node);
+		return TREE_NO_ERR;
+	}
+
+	struct Node **slot = node_arena_find_shared(arena, data, left, right);
+	if (*slot && *slot != &SHARED_TOMBSTONE) {
+		*node = *slot;
+		return TREE_NO_ERR;
+	}
+
+	if (2 * (arena->num_shared + 1) > arena->cap_shared) {
+		enum TreeError err = node_arena_resize_shared(arena,
+													  2 * arena->cap_shared);
+		if (err < 0)
+			return err;
+		slot = node_arena_find_shared(arena, data, left, right);
+	}
+
+	enum TreeError err = node_op_new(arena, node, data);
+	if (err < 0)
+		return err;
+	(*node)->left = left;
+	(*node)->right = right;
+	node_rehash(*node);
+
+	if (!*slot)
+		arena->num_shared++;
+	*slot = *node;
+	return TREE_NO_ERR;
+}
+
+bool node_is_shared(const struct NodeArena *arena, const struct Node *node)
+{
+	if (!arena || !arena->is_shared || !node)
+		return false;
+
+	struct Node **slot = node_arena_find_shared(arena, node->data,
+												node->left, node->right);
+	return *slot == node;
+}
+
+void node_op_unshare(struct NodeArena *arena, struct Node *node)
+{
+	if (!node_is_shared(arena, node))
+		return;
+
+	struct Node **slot = node_arena_find_shared(arena, node->data,
+												node->left, node->right);
+	*slot = &SHARED_TOMBSTONE;
+}
+
+static struct Node **node_arena_find_shared(const struct NodeArena *arena,
+											elem_t data,
+											const struct Node *left,
+											const struct Node *right)
+{
+	assert(arena);
+	assert(arena->shared);
+
+	size_t mask = arena->cap_shared - 1;
+	size_t i = node_content_hash(data, left, right) & mask;
+	struct Node **tombstone = NULL;
+	while (arena->shared[i]) {
+		if (arena->shared[i] == &SHARED_TOMBSTONE) {
+			if (!tombstone)
+				tombstone = arena->shared + i;
+		} else if (node_content_equal(arena->shared[i], data, left, right)) {
+			return arena->shared + i;
+		}
+		i = (i + 1) & mask;
+	}
+	return tombstone ? tombstone : arena->shared + i;
+}
+
+static enum TreeError node_arena_resize_shared(struct NodeArena *arena,
+											   size_t new_cap)
+{
+	assert(arena);
+
+	struct Node **old = arena->shared;
+	size_t old_cap = arena->cap_shared;
+
+	arena->shared = (struct Node**) calloc(new_cap, sizeof(struct Node*));
+	if (!arena->shared) {
+		arena->shared = old;
+		return TREE_NO_MEM_ERR;
+	}
+	arena->cap_shared = new_cap;
+	arena->num_shared = 0;
+
+	for (size_t i = 0; i < old_cap; i++) {
+		if (!old[i] || old[i] == &SHARED_TOMBSTONE)
+			continue;
+		struct Node **slot = node_arena_find_shared(arena, old[i]->data,
+													old[i]->left,
+													old[i]->right);
+		*slot = old[i];
+		arena->num_shared++;
+	}
+	free(old);
+	return TREE_NO_ERR;
+}
+
+static size_t node_content_hash(elem_t data, const struct Node *left,
+								const struct Node *right)
+{
+	size_t hash = node_token_hash(data);
+	hash = hash_mix(hash, (uintptr_t) left);
+	hash = hash_mix(hash, (uintptr_t) right);
+	return hash;
+}
+
+static size_t node_token_hash(elem_t data)
+{
+	size_t hash = (size_t) data.type;
+	uint64_t bits = 0;
+	switch (data.type) {
+		case MATH_NUM:
+			memcpy(&bits, &data.value.num, sizeof(bits));
+			hash = hash_mix(hash, bits);
+			break;
+		case MATH_OP:
+			hash = hash_mix(hash, (size_t) data.value.op);
+			break;
+		case MATH_VAR:
+			hash = hash_mix(hash, data.value.var_ind);
+			break;
+		default:
+			break;
+	}
+	return hash;
+}
+
+static bool node_content_equal(const struct Node *node, elem_t data,
+							   const struct Node *left,
+							   const struct Node *right)
+{
+	assert(node);
+
+	if (node->data.type != data.type || node->left != left ||
+		node->right != right)
+		return false;
+
+	switch (data.type) {
+		case MATH_NUM:
+			return memcmp(&node->data.value.num, &data.value.num,
+						  sizeof(data.value.num)) == 0;
+		case MATH_OP:
+			return node->data.value.op == data.value.op;
+		case MATH_VAR:
+			return node->data.value.var_ind == data.value.var_ind;
+		default:
+			return false;
+	}
+}
+
+// Numbers are the same if neither is less, as in the order of terms
+static bool node_token_same(elem_t a, elem_t b)
+{
+	if (a.type != b.type)
+		return false;
+
+	switch (a.type) {
+		case MATH_NUM:
+			return !(a.value.num < b.value.num) && !(b.value.num < a.value.num);
+		case MATH_OP:
+			return a.value.op == b.value.op;
+		case MATH_VAR:
+			return a.value.var_ind == b.value.var_ind;
+		default:
+			return false;
+	}
+}
+
+static size_t hash_mix(size_t hash, size_t val)
+{
+	hash ^= val + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+	hash ^= hash >> 31;
+	hash *= 0xbf58476d1ce4e5b9;
+	hash ^= hash >> 29;
+	return hash;
+}
+
 void node_ctor(struct Node *node, elem_t data)
 {
 	assert(node);
@@ -22,16 +351,98 @@ void node_ctor(struct Node *node, elem_t data)
 	node->data = data;
 	node->left = NULL;
 	node->right = NULL;
+	node_rehash(node);
+}
+
+void node_rehash(struct Node *node)
+{
+	assert(node);
+
+	elem_t data = node->data;
+	// -0 is the same number as 0
+	if (data.type == MATH_NUM && !(data.value.num < 0) &&
+		!(data.value.num > 0))
+		data.value.num = 0;
+
+	size_t hash = node_token_hash(data);
+	if (node->left || node->right)
+		hash = hash_mix(hash, (node->left ? node->left->hash : 0) *
+							  0x9e3779b97f4a7c15 ^
+							  (node->right ? node->right->hash : 0));
+	node->hash = hash;
+}
+
+bool tree_is_same(struct Node *a, struct Node *b, struct NodeStack *stack)
+{
+	assert(a);
+	assert(b);
+	assert(stack);
+
+	if (a == b)
+		return true;
+	if (a->hash != b->hash)
+		return false;
+
+	stack->size = 0;
+	if (node_stack_push(stack, a, NODE_VISIT_PRE) < 0 ||
+		node_stack_push(stack, b, NODE_VISIT_PRE) < 0)
+		return false;
+	while (stack->size > 0) {
+		b = node_stack_pop(stack);
+		a = node_stack_pop(stack);
+		if (a == b)
+			continue;
+		if (a->hash != b->hash || !node_token_same(a->data, b->data) ||
+			!a->left != !b->left || !a->right != !b->right)
+			return false;
+
+		if ((a->right &&
+			 (node_stack_push(stack, a->right, NODE_VISIT_PRE) < 0 ||
+			  node_stack_push(stack, b->right, NODE_VISIT_PRE) < 0)) ||
+			(a->left &&
+			 (node_stack_push(stack, a->left, NODE_VISIT_PRE) < 0 ||
+			  node_stack_push(stack, b->left, NODE_VISIT_PRE) < 0)))
+			return false;
+	}
+	return true;
 }
 
-void node_op_delete(struct Node *node)
+void node_op_free(struct NodeArena *arena, struct Node *node)
 {
 	if (!node)
 		return;
-	
-	node_op_delete(node->left);
-	node_op_delete(node->right);
-	free(node);
+
+	if (!arena) {
+		free(node);
+		return;
+	}
+	if (arena->is_shared)
+		return;
+
+	node->right = NULL;
+	node->left = arena->free_list;
+	arena->free_list = node;
+	arena->num_live--;
+}
+
+void node_op_delete(struct NodeArena *arena, struct Node *node)
+{
+	if (arena && arena->is_shared)
+		return;
+
+	/* rotating left children up turns the tree into a list without a stack */
+	while (node) {
+		struct Node *left = node->left;
+		if (left) {
+			node->left = left->right;
+			left->right = node;
+			node = left;
+		} else {
+			struct Node *right = node->right;
+			node_op_free(arena, node);
+			node = right;
+		}
+	}
 }
 
 const char *tree_err_to_str(enum TreeError err)
@@ -44,4 +455,190 @@ const char *tree_err_to_str(enum TreeError err)
 		default:
 			return "An unknown error occured\n";
 	}
-}
\ No newline at end of file
+}
+
+enum TreeError node_stack_push(struct NodeStack *stack, struct Node *node,
+							   enum NodeVisitStep step)
+{
+	assert(stack);
+
+	if (stack->size >= stack->cap) {
+		size_t new_cap = stack->cap ? 2 * stack->cap : NODE_STACK_INIT_CAPACITY;
+		struct NodeFrame *tmp = (struct NodeFrame*) realloc(stack->frames,
+											new_cap * sizeof(struct NodeFrame));
+		if (!tmp)
+			return TREE_NO_MEM_ERR;
+		stack->frames = tmp;
+		stack->cap = new_cap;
+	}
+
+	stack->frames[stack->size].node = node;
+	stack->frames[stack->size].step = step;
+	stack->size++;
+	return TREE_NO_ERR;
+}
+
+struct Node *node_stack_pop(struct NodeStack *stack)
+{
+	assert(stack);
+	assert(stack->size > 0);
+
+	return stack->frames[--stack->size].node;
+}
+
+void node_stack_dtor(struct NodeStack *stack)
+{
+	assert(stack);
+
+	free(stack->frames);
+	stack->frames = NULL;
+	stack->size = 0;
+	stack->cap = 0;
+}
+
+enum TreeError tree_walk_start(struct NodeStack *stack, struct Node *root)
+{
+	assert(stack);
+
+	stack->size = 0;
+	if (!root)
+		return TREE_NO_ERR;
+	return node_stack_push(stack, root, NODE_VISIT_PRE);
+}
+
+enum TreeError tree_walk_next(struct NodeStack *stack, struct NodeFrame *frame)
+{
+	assert(stack);
+	assert(frame);
+	assert(stack->size > 0);
+
+	*frame = stack->frames[--stack->size];
+	if (frame->step != NODE_VISIT_PRE)
+		return TREE_NO_ERR;
+
+	struct Node *node = frame->node;
+	if (node_stack_push(stack, node, NODE_VISIT_POST) < 0 ||
+		(node->right && node_stack_push(stack, node->right,
+										NODE_VISIT_PRE) < 0) ||
+		node_stack_push(stack, node, NODE_VISIT_IN) < 0 ||
+		(node->left && node_stack_push(stack, node->left,
+									   NODE_VISIT_PRE) < 0))
+		return TREE_NO_MEM_ERR;
+	return TREE_NO_ERR;
+}
+
+void tree_walk_skip(struct NodeStack *stack, const struct Node *node)
+{
+	assert(stack);
+
+	while (stack->size > 0) {
+		struct NodeFrame top = stack->frames[--stack->size];
+		if (top.node == node && top.step == NODE_VISIT_POST)
+			return;
+	}
+}
+
+enum TreeError node_map_ctor(struct NodeMap *map)
+{
+	assert(map);
+
+	map->keys = NULL;
+	map->vals = NULL;
+	map->size = 0;
+	map->cap = 0;
+	return node_map_resize(map, NODE_MAP_INIT_CAPACITY);
+}
+
+void node_map_dtor(struct NodeMap *map)
+{
+	assert(map);
+
+	free(map->keys);
+	free(map->vals);
+	map->keys = NULL;
+	map->vals = NULL;
+	map->size = 0;
+	map->cap = 0;
+}
+
+void node_map_clear(struct NodeMap *map)
+{
+	assert(map);
+
+	if (map->size == 0)
+		return;
+	memset(map->keys, 0, map->cap * sizeof(*map->keys));
+	map->size = 0;
+}
+
+union NodeMapValue *node_map_find(const struct NodeMap *map,
+								  const struct Node *key)
+{
+	assert(map);
+	assert(key);
+
+	size_t mask = map->cap - 1;
+	size_t i = hash_mix(0, (uintptr_t) key) & mask;
+	while (map->keys[i]) {
+		if (map->keys[i] == key)
+			return map->vals + i;
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+enum TreeError node_map_insert(struct NodeMap *map, const struct Node *key,
+							   union NodeMapValue val)
+{
+	assert(map);
+	assert(key);
+
+	if (2 * (map->size + 1) > map->cap) {
+		enum TreeError err = node_map_resize(map, 2 * map->cap);
+		if (err < 0)
+			return err;
+	}
+
+	size_t mask = map->cap - 1;
+	size_t i = hash_mix(0, (uintptr_t) key) & mask;
+	while (map->keys[i] && map->keys[i] != key)
+		i = (i + 1) & mask;
+	if (!map->keys[i])
+		map->size++;
+	map->keys[i] = key;
+	map->vals[i] = val;
+	return TREE_NO_ERR;
+}
+
+static enum TreeError node_map_resize(struct NodeMap *map, size_t new_cap)
+{
+	assert(map);
+
+	const struct Node **keys = (const struct Node**) calloc(new_cap,
+													sizeof(struct Node*));
+	union NodeMapValue *vals = (union NodeMapValue*) calloc(new_cap,
+													sizeof(union NodeMapValue));
+	if (!keys || !vals) {
+		free(keys);
+		free(vals);
+		return TREE_NO_MEM_ERR;
+	}
+
+	size_t mask = new_cap - 1;
+	for (size_t i = 0; i < map->cap; i++) {
+		if (!map->keys[i])
+			continue;
+		size_t j = hash_mix(0, (uintptr_t) map->keys[i]) & mask;
+		while (keys[j])
+			j = (j + 1) & mask;
+		keys[j] = map->keys[i];
+		vals[j] = map->vals[i];
+	}
+
+	free(map->keys);
+	free(map->vals);
+	map->keys = keys;
+	map->vals = vals;
+	map->cap = new_cap;
+	return TREE_NO_ERR;
+}
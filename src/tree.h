@@ -1,6 +1,8 @@
 #ifndef _TREE_H
 #define _TREE_H
 
+#include <stddef.h>
+
 enum MathOp {
 	MATH_ADD,
 	MATH_MULT,
@@ -38,20 +40,145 @@ struct MathToken {
 
 typedef MathToken elem_t;
 
+/*
+ * hash is a Merkle hash of the subtree, made from the token and the hashes of
+ * the children, so equal subtrees hash the same and subtrees with different
+ * hashes differ. Nodes are hashed when they are made; a node changed in place
+ * is rehashed by the change, its ancestors by whoever walks them next.
+ */
 struct Node {
 	elem_t data;
 	struct Node *left;
 	struct Node *right;
+	size_t hash;
+};
+
+union NodeMapValue {
+	double num;
+	size_t ind;
+	struct Node *node;
+};
+
+/*
+ * Open-addressing hash map keyed by node addresses, used as a scratch
+ * memo table by operations that have to visit every node of a DAG once.
+ */
+struct NodeMap {
+	const struct Node **keys;
+	union NodeMapValue *vals;
+	size_t size;
+	size_t cap;
 };
 
+const size_t NODE_MAP_INIT_CAPACITY = 64;
+
+/*
+ * Explicit-stack traversal: tree_walk_next pops the next visit off the stack,
+ * so walking a tree takes heap memory proportional to its depth instead of
+ * call stack. Every node is visited before its children (PRE), between the
+ * left and the right child (IN) and after both children (POST). After a PRE
+ * visit tree_walk_skip drops the rest of the node's visits. A zeroed
+ * NodeStack is empty and valid, and the stack keeps its memory between
+ * walks so it can be reused.
+ */
+enum NodeVisitStep {
+	NODE_VISIT_PRE,
+	NODE_VISIT_IN,
+	NODE_VISIT_POST,
+};
+
+struct NodeFrame {
+	struct Node *node;
+	enum NodeVisitStep step;
+};
+
+struct NodeStack {
+	struct NodeFrame *frames;
+	size_t size;
+	size_t cap;
+};
+
+const size_t NODE_STACK_INIT_CAPACITY = 32;
+
+/*
+ * Bump allocator for nodes: nodes are cut from geometrically growing slabs,
+ * nodes released one by one go to a free list and are reused, and the whole
+ * arena (with every tree allocated in it) is released at once by the dtor.
+ * A NULL arena means that nodes are calloc'ed and free'd one by one, so
+ * num_made, the count of nodes ever handed out, is what it would calloc.
+ *
+ * A sharing arena hash-conses nodes: making a node with the same token and
+ * the same children as an existing one returns the existing node, so equal
+ * subtrees are stored once and the trees become DAGs. Nodes of such an arena
+ * are never freed one by one, they live as long as the arena does.
+ */
+struct NodeArena {
+	struct Node **slabs;
+	size_t num_slabs;
+	size_t cap_slabs;
+	size_t slab_size;
+	size_t slab_used;
+	struct Node *free_list;
+	size_t num_live;
+	size_t peak_live;
+	size_t num_made;
+
+	bool is_shared;
+	struct Node **shared;
+	size_t num_shared;
+	size_t cap_shared;
+
+	struct NodeStack copy_walk;
+	struct NodeStack copy_res;
+};
+
+const size_t NODE_ARENA_INIT_SLAB_SIZE = 64;
+const size_t NODE_ARENA_MAX_SLAB_SIZE = 65536;
+const size_t NODE_ARENA_INIT_SLABS_CAPACITY = 8;
+const size_t NODE_ARENA_INIT_SHARED_CAPACITY = 256;
+
 enum TreeError {
 	TREE_NO_MEM_ERR = -1,
 	TREE_NO_ERR 	= 0,
 };
 
-enum TreeError node_op_new(struct Node **node, elem_t data);
+enum TreeError node_arena_ctor(struct NodeArena *arena);
+enum TreeError node_arena_enable_sharing(struct NodeArena *arena);
+void node_arena_dtor(struct NodeArena *arena);
+
+enum TreeError node_op_new(struct NodeArena *arena, struct Node **node,
+						   elem_t data);
+enum TreeError node_op_make(struct NodeArena *arena, struct Node **node,
+							elem_t data, struct Node *left, struct Node *right);
+bool node_is_shared(const struct NodeArena *arena, const struct Node *node);
+void node_op_unshare(struct NodeArena *arena, struct Node *node);
 void node_ctor(struct Node *node, elem_t data);
-void node_op_delete(struct Node *node);
+void node_rehash(struct Node *node);
+/*
+ * Structural equality: subtrees with different hashes are told apart in O(1),
+ * equal ones are confirmed node by node, with stack as scratch memory. Runs
+ * out of memory as unequal.
+ */
+bool tree_is_same(struct Node *a, struct Node *b, struct NodeStack *stack);
+void node_op_free(struct NodeArena *arena, struct Node *node);
+void node_op_delete(struct NodeArena *arena, struct Node *node);
 const char *tree_err_to_str(enum TreeError err);
 
-#endif /*_TREE_H*/
\ No newline at end of file
+enum TreeError node_stack_push(struct NodeStack *stack, struct Node *node,
+							   enum NodeVisitStep step);
+struct Node *node_stack_pop(struct NodeStack *stack);
+void node_stack_dtor(struct NodeStack *stack);
+
+enum TreeError tree_walk_start(struct NodeStack *stack, struct Node *root);
+enum TreeError tree_walk_next(struct NodeStack *stack, struct NodeFrame *frame);
+void tree_walk_skip(struct NodeStack *stack, const struct Node *node);
+
+enum TreeError node_map_ctor(struct NodeMap *map);
+void node_map_dtor(struct NodeMap *map);
+void node_map_clear(struct NodeMap *map);
+union NodeMapValue *node_map_find(const struct NodeMap *map,
+								  const struct Node *key);
+enum TreeError node_map_insert(struct NodeMap *map, const struct Node *key,
+							   union NodeMapValue val);
+
+#endif /*_TREE_H*/
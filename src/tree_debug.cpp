@@ -13,7 +13,8 @@ const int ELEM_BUF_SIZE = 1024;
 static void _subtree_dump_log(const struct Node *node, struct Equation eq,
 							  print_func print_el, size_t level);
 static void _subtree_dump_gui(const struct Node *node, struct Equation eq,
-							  print_func print_el, FILE *dump, size_t node_id);
+							  print_func print_el, FILE *dump,
+							  struct NodeMap *visited);
 
 void tree_dump_log(struct Equation eq, print_func print_el,
 				   const char *filename, const char* funcname, int line,
@@ -137,9 +138,16 @@ void tree_dump_gui(struct Equation eq, print_func print_el, FILE *dump_html,
 	"graph [dpi = 200, splines=ortho];\n"
 	"node [shape = \"rectangle\", style=\"rounded\"];\n";
 
+	struct NodeMap visited = {};
+	if (node_map_ctor(&visited) < 0) {
+		log_message(ERROR, "No memory for dumping\n");
+		fclose(dot_file);
+		return;
+	}
 	fputs(BEGIN, dot_file);
-	_subtree_dump_gui(eq.tree, eq, print_el, dot_file, 0);
+	_subtree_dump_gui(eq.tree, eq, print_el, dot_file, &visited);
 	fputs("}\n", dot_file);
+	node_map_dtor(&visited);
 	fclose(dot_file);
 
 	char image_name[FILENAME_SIZE] = {};
@@ -163,23 +171,23 @@ void tree_dump_gui(struct Equation eq, print_func print_el, FILE *dump_html,
 }
 
 static void _subtree_dump_gui(const struct Node *node, struct Equation eq,
-							  print_func print_el, FILE *dump, size_t node_id)
+							  print_func print_el, FILE *dump,
+							  struct NodeMap *visited)
 {
-	if (!node)
+	if (!node || node_map_find(visited, node))
 		return;
+	node_map_insert(visited, node, {});
 
 	static char buf[ELEM_BUF_SIZE] = {};
 	buf[0] = '\0';
 	print_el(buf, node->data, eq, ELEM_BUF_SIZE - 1);
-	fprintf(dump, "node%lu [label=\"%s (%p)\"]\n", node_id, buf, node);
+	fprintf(dump, "node%p [label=\"%s (%p)\"]\n", node, buf, node);
 	
-	_subtree_dump_gui(node->left, eq, print_el, dump, 2 * node_id + 1);
-	_subtree_dump_gui(node->right, eq, print_el, dump, 2 * node_id + 2);
+	_subtree_dump_gui(node->left, eq, print_el, dump, visited);
+	_subtree_dump_gui(node->right, eq, print_el, dump, visited);
 
 	if (node->left)
-		fprintf(dump, "node%lu -> node%lu\n", node_id, 
-				2 * node_id + 1);
+		fprintf(dump, "node%p -> node%p\n", node, node->left);
 	if (node->right)
-		fprintf(dump, "node%lu -> node%lu\n", node_id,
-				2 * node_id + 2);
+		fprintf(dump, "node%p -> node%p\n", node, node->right);
 }